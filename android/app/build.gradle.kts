@@ -43,10 +43,16 @@ android {
                 cppFlags += "-std=c++17"
                 arguments += listOf(
                     "-DANDROID_STL=c++_shared",
-                    "-DCMAKE_BUILD_TYPE=Release"
+                    "-DCMAKE_BUILD_TYPE=Release",
+                    // GPU offload build: -PcortexGpuBackend=vulkan or opencl
+                    "-DCORTEX_GPU_BACKEND=${project.findProperty("cortexGpuBackend") ?: "none"}",
+                    // One static armv8.0 CPU backend instead of the runtime
+                    // picked variants: -PcortexCpuVariants=false
+                    "-DCORTEX_CPU_VARIANTS=${if (project.findProperty("cortexCpuVariants") == "false") "OFF" else "ON"}"
                 )
-                // Target only arm64-v8a - must match ndk.abiFilters
-                targets += "llama_jni"
+                // No targets filter: on arm64 the ggml-cpu variants are
+                // modules loaded at runtime, which nothing links, and only
+                // a full build packages them next to libllama_jni.so
             }
         }
         
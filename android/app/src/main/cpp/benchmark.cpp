@@ -0,0 +1,374 @@
+#include "benchmark.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <ctime>
+#include <random>
+#include <thread>
+
+#include "thread_scheduler.h"
+
+#ifdef __ANDROID__
+    #include <android/log.h>
+    #define LOG_TAG "CortexBenchmark"
+    #define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+    #define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+#else
+    #include <iostream>
+    #define LOG_TAG "CortexBenchmark"
+    #define LOGI(...) printf("[INFO] " __VA_ARGS__); printf("\n")
+    #define LOGE(...) printf("[ERROR] " __VA_ARGS__); printf("\n")
+#endif
+
+namespace cortex {
+
+namespace {
+
+// Fixed seed so every run feeds the model the same tokens
+constexpr uint32_t TOKEN_SEED = 1234;
+
+double nowMs() {
+    using namespace std::chrono;
+    return duration<double, std::milli>(steady_clock::now().time_since_epoch()).count();
+}
+
+void appendf(std::string& out, const char* fmt, ...) {
+    char buf[256];
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    if (n > 0) {
+        out.append(buf, std::min<size_t>(n, sizeof(buf) - 1));
+    }
+}
+
+void appendString(std::string& out, const std::string& value) {
+    out += '"';
+    for (char c : value) {
+        switch (c) {
+            case '"':  out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) >= 0x20) out += c;
+        }
+    }
+    out += '"';
+}
+
+// Median/p90/min/max over the repetitions
+void appendSummary(std::string& out, std::vector<double> samples) {
+    if (samples.empty()) {
+        out += "null";
+        return;
+    }
+    
+    std::sort(samples.begin(), samples.end());
+    size_t n = samples.size();
+    double median = (n % 2) ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+    double p90 = samples[std::min(n - 1, static_cast<size_t>(std::ceil(0.9 * n)) - 1)];
+    
+    appendf(out, "{\"median\":%.2f,\"p90\":%.2f,\"min\":%.2f,\"max\":%.2f,\"n\":%zu}",
+            median, p90, samples.front(), samples.back(), n);
+}
+
+// Thermal and clock state; throttling is the main source of run-to-run noise
+struct DeviceSnapshot {
+    double max_temp_c = -1;
+    std::vector<long> cpu_freq_khz;
+};
+
+bool readLong(const char* path, long& value) {
+    FILE* f = fopen(path, "r");
+    if (f == nullptr) return false;
+    bool ok = fscanf(f, "%ld", &value) == 1;
+    fclose(f);
+    return ok;
+}
+
+DeviceSnapshot captureDevice() {
+    DeviceSnapshot snap;
+    char path[128];
+    
+    for (int zone = 0; zone < 64; zone++) {
+        long temp;
+        snprintf(path, sizeof(path), "/sys/class/thermal/thermal_zone%d/temp", zone);
+        if (!readLong(path, temp)) continue;
+        
+        // Most zones report millidegrees, a few whole degrees
+        double celsius = temp > 1000 ? temp / 1000.0 : static_cast<double>(temp);
+        snap.max_temp_c = std::max(snap.max_temp_c, celsius);
+    }
+    
+    int n_cpus = std::thread::hardware_concurrency();
+    for (int cpu = 0; cpu < n_cpus; cpu++) {
+        long freq = 0;
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_cur_freq", cpu);
+        readLong(path, freq);
+        snap.cpu_freq_khz.push_back(freq);
+    }
+    
+    return snap;
+}
+
+void appendDevice(std::string& out, const DeviceSnapshot& snap) {
+    appendf(out, "{\"max_temp_c\":%.1f,\"cpu_freq_khz\":[", snap.max_temp_c);
+    for (size_t i = 0; i < snap.cpu_freq_khz.size(); i++) {
+        appendf(out, "%s%ld", i ? "," : "", snap.cpu_freq_khz[i]);
+    }
+    out += "]}";
+}
+
+// Decode tokens[0..n) at positions start..start+n in batches of n_batch,
+// with logits only for the last token
+bool decodeRange(llama_context* ctx, llama_batch& batch, const std::vector<llama_token>& tokens,
+                 int n, int start, int n_batch) {
+    for (int i = 0; i < n; i += n_batch) {
+        int n_eval = std::min(n_batch, n - i);
+        batch.n_tokens = 0;
+        for (int j = 0; j < n_eval; j++) {
+            int k = batch.n_tokens++;
+            batch.token[k] = tokens[i + j];
+            batch.pos[k] = start + i + j;
+            batch.n_seq_id[k] = 1;
+            batch.seq_id[k][0] = 0;
+            batch.logits[k] = (i + j == n - 1);
+        }
+        if (llama_decode(ctx, batch) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool decodeOne(llama_context* ctx, llama_batch& batch, llama_token token, int pos) {
+    batch.n_tokens = 1;
+    batch.token[0] = token;
+    batch.pos[0] = pos;
+    batch.n_seq_id[0] = 1;
+    batch.seq_id[0][0] = 0;
+    batch.logits[0] = true;
+    return llama_decode(ctx, batch) == 0;
+}
+
+llama_token greedy(llama_context* ctx, int n_vocab) {
+    const float* logits = llama_get_logits_ith(ctx, -1);
+    return static_cast<llama_token>(std::max_element(logits, logits + n_vocab) - logits);
+}
+
+// One context: warmup, prefill/TTFT per prompt length, decode per depth
+// defaults: thread counts from the scheduler (pools attached) or topology
+bool runContext(llama_model* model, const BenchmarkConfig& config, int n_threads, int n_ubatch,
+                bool defaults, const std::vector<llama_token>& tokens, std::string& out) {
+    int max_prompt = *std::max_element(config.prompt_lengths.begin(), config.prompt_lengths.end());
+    int max_depth = *std::max_element(config.decode_depths.begin(), config.decode_depths.end());
+    int n_batch = std::max(max_prompt, n_ubatch);
+    
+    const CpuTopology& topology = CpuTopology::get();
+    const ThreadScheduler* pools = defaults ? config.scheduler : nullptr;
+    int n_threads_batch = n_threads;
+    if (defaults) {
+        n_threads = pools != nullptr && pools->decodeThreads() > 0 ? pools->decodeThreads()
+                                                                  : topology.defaultDecodeThreads();
+        n_threads_batch = pools != nullptr && pools->prefillThreads() > 0 ? pools->prefillThreads()
+                                                                         : topology.defaultPrefillThreads();
+    }
+    
+    // Same attention, KV type and threads as the engine, but perf timings enabled
+    llama_context_params params = llama_context_default_params();
+    params.n_ctx = std::max(max_prompt, max_depth + config.decode_tokens) + 16;
+    params.n_batch = n_batch;
+    params.n_ubatch = n_ubatch;
+    params.n_seq_max = 1;
+    params.n_threads = n_threads;
+    params.n_threads_batch = n_threads_batch;
+    params.flash_attn_type = LLAMA_FLASH_ATTN_TYPE_ENABLED;
+    params.type_k = config.kv_type;
+    params.type_v = config.kv_type;
+    params.no_perf = false;
+    
+    llama_context* ctx = llama_init_from_model(model, params);
+    if (ctx == nullptr) {
+        LOGE("failed to create context: threads=%d/%d ubatch=%d", n_threads, n_threads_batch, n_ubatch);
+        appendf(out, "{\"threads\":%d,\"threads_batch\":%d,\"ubatch\":%d,\"ok\":false}",
+                n_threads, n_threads_batch, n_ubatch);
+        return false;
+    }
+    if (pools != nullptr) {
+        pools->attach(ctx);
+    }
+    
+    llama_memory_t mem = llama_get_memory(ctx);
+    llama_batch batch = llama_batch_init(n_batch, 0, 1);
+    int n_vocab = llama_vocab_n_tokens(llama_model_get_vocab(model));
+    bool ok = true;
+    
+    // Warm caches, page in mmapped weights and let the governor ramp up
+    for (int i = 0; ok && i < config.warmup; i++) {
+        int n_warm = std::min(max_prompt, 32);
+        llama_memory_clear(mem, true);
+        ok = decodeRange(ctx, batch, tokens, n_warm, 0, n_batch);
+        for (int j = 0; ok && j < 4; j++) {
+            ok = decodeOne(ctx, batch, tokens[j], n_warm + j);
+        }
+        llama_synchronize(ctx);
+    }
+    
+    appendf(out, "{\"threads\":%d,\"threads_batch\":%d,\"pinned\":%s,\"ubatch\":%d,\"prefill\":[",
+            n_threads, n_threads_batch, pools != nullptr ? "true" : "false", n_ubatch);
+    for (size_t p = 0; ok && p < config.prompt_lengths.size(); p++) {
+        int n_prompt = config.prompt_lengths[p];
+        std::vector<double> tps, ttft;
+        
+        for (int rep = 0; ok && rep < config.repetitions; rep++) {
+            llama_memory_clear(mem, true);
+            
+            double start = nowMs();
+            ok = decodeRange(ctx, batch, tokens, n_prompt, 0, n_batch);
+            llama_synchronize(ctx);
+            double prefilled = nowMs();
+            if (!ok) break;
+            
+            greedy(ctx, n_vocab);
+            double first = nowMs();
+            
+            tps.push_back(n_prompt * 1000.0 / std::max(prefilled - start, 1e-3));
+            ttft.push_back(first - start);
+        }
+        
+        appendf(out, "%s{\"n_prompt\":%d,\"tokens_per_second\":", p ? "," : "", n_prompt);
+        appendSummary(out, tps);
+        out += ",\"ttft_ms\":";
+        appendSummary(out, ttft);
+        out += "}";
+    }
+    
+    out += "],\"decode\":[";
+    for (size_t d = 0; ok && d < config.decode_depths.size(); d++) {
+        int depth = config.decode_depths[d];
+        std::vector<double> tps;
+        
+        for (int rep = 0; ok && rep < config.repetitions; rep++) {
+            llama_memory_clear(mem, true);
+            if (depth > 0) {
+                ok = decodeRange(ctx, batch, tokens, depth, 0, n_batch);
+                llama_synchronize(ctx);
+            }
+            
+            // Steady state: one token per decode, fed back greedily
+            llama_token token = tokens[depth % tokens.size()];
+            double start = nowMs();
+            for (int i = 0; ok && i < config.decode_tokens; i++) {
+                ok = decodeOne(ctx, batch, token, depth + i);
+                if (ok) token = greedy(ctx, n_vocab);
+            }
+            llama_synchronize(ctx);
+            double elapsed = nowMs() - start;
+            
+            if (ok) {
+                tps.push_back(config.decode_tokens * 1000.0 / std::max(elapsed, 1e-3));
+            }
+        }
+        
+        appendf(out, "%s{\"depth\":%d,\"n_gen\":%d,\"tokens_per_second\":",
+                d ? "," : "", depth, config.decode_tokens);
+        appendSummary(out, tps);
+        out += "}";
+    }
+    
+    out += "],\"device\":";
+    appendDevice(out, captureDevice());
+    appendf(out, ",\"ok\":%s}", ok ? "true" : "false");
+    
+    llama_batch_free(batch);
+    if (pools != nullptr) {
+        pools->detach(ctx);
+    }
+    llama_free(ctx);
+    return ok;
+}
+
+} // namespace
+
+std::string runBenchmark(llama_model* model, const std::string& model_path,
+                         const BenchmarkConfig& config) {
+    if (model == nullptr) {
+        return "{\"error\":\"No model loaded\"}";
+    }
+    if (config.prompt_lengths.empty() || config.decode_depths.empty() ||
+        config.decode_tokens <= 0 || config.repetitions <= 0) {
+        return "{\"error\":\"Invalid benchmark config\"}";
+    }
+    
+    // 0 stands for the engine's own split
+    std::vector<int> thread_counts = config.thread_counts;
+    if (thread_counts.empty()) {
+        thread_counts.push_back(0);
+    }
+    std::vector<int> ubatch_sizes = config.ubatch_sizes;
+    if (ubatch_sizes.empty()) {
+        ubatch_sizes.push_back(32);
+    }
+    
+    // Random but reproducible token stream, long enough for any measurement
+    int max_prompt = *std::max_element(config.prompt_lengths.begin(), config.prompt_lengths.end());
+    int max_depth = *std::max_element(config.decode_depths.begin(), config.decode_depths.end());
+    int n_vocab = llama_vocab_n_tokens(llama_model_get_vocab(model));
+    std::mt19937 rng(TOKEN_SEED);
+    std::uniform_int_distribution<int> dist(0, n_vocab - 1);
+    std::vector<llama_token> tokens(std::max({max_prompt, max_depth, 32}) + 1);
+    for (auto& token : tokens) {
+        token = dist(rng);
+    }
+    
+    LOGI("benchmark: %zu thread counts x %zu ubatch sizes, %d reps",
+         thread_counts.size(), ubatch_sizes.size(), config.repetitions);
+    
+    char desc[128] = {0};
+    llama_model_desc(model, desc, sizeof(desc));
+    
+    std::string out;
+    out.reserve(4096);
+    out += "{\"model\":{\"path\":";
+    appendString(out, model_path);
+    out += ",\"desc\":";
+    appendString(out, desc);
+    appendf(out, ",\"size_bytes\":%llu,\"n_params\":%llu},",
+            static_cast<unsigned long long>(llama_model_size(model)),
+            static_cast<unsigned long long>(llama_model_n_params(model)));
+    
+    out += "\"system\":{\"info\":";
+    appendString(out, llama_print_system_info());
+    appendf(out, ",\"cores\":%u,\"timestamp\":%lld},",
+            std::thread::hardware_concurrency(), static_cast<long long>(time(nullptr)));
+    
+    appendf(out, "\"config\":{\"warmup\":%d,\"repetitions\":%d,\"decode_tokens\":%d,\"seed\":%u,\"kv_type\":",
+            config.warmup, config.repetitions, config.decode_tokens, TOKEN_SEED);
+    appendString(out, ggml_type_name(config.kv_type));
+    out += "},";
+    
+    out += "\"device_start\":";
+    appendDevice(out, captureDevice());
+    
+    out += ",\"runs\":[";
+    bool first = true;
+    for (int n_threads : thread_counts) {
+        for (int n_ubatch : ubatch_sizes) {
+            if (!first) out += ",";
+            first = false;
+            runContext(model, config, n_threads, n_ubatch, n_threads <= 0, tokens, out);
+        }
+    }
+    out += "],\"device_end\":";
+    appendDevice(out, captureDevice());
+    out += "}";
+    
+    LOGI("benchmark done");
+    return out;
+}
+
+} // namespace cortex
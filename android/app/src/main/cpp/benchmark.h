@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "llama.h"
+#include "ggml.h"
+
+namespace cortex {
+
+class ThreadScheduler;
+
+// Benchmark sweep. Every (threads, ubatch) pair gets its own context so the
+// engine's context and KV cache are left untouched.
+struct BenchmarkConfig {
+    std::vector<int> prompt_lengths = {64, 256};  // Prefill and time-to-first-token
+    std::vector<int> decode_depths = {0, 256};    // Tokens already in the cache when decoding
+    int decode_tokens = 32;                       // Generated per decode measurement
+    std::vector<int> thread_counts;               // Empty: the engine's decode/prefill split
+    std::vector<int> ubatch_sizes = {32};
+    ggml_type kv_type = GGML_TYPE_F16;            // The engine passes its own
+    const ThreadScheduler* scheduler = nullptr;   // Pinned pools for the default split
+    int warmup = 1;                               // Discarded runs per context
+    int repetitions = 5;
+};
+
+// Runs the sweep against an already loaded model and returns the results as
+// JSON (median/p90/min/max per measurement, plus model, build and device
+// state) so runs can be compared across builds and models.
+std::string runBenchmark(llama_model* model, const std::string& model_path,
+                         const BenchmarkConfig& config);
+
+} // namespace cortex
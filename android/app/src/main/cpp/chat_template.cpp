@@ -0,0 +1,108 @@
+#include "chat_template.h"
+
+#ifdef __ANDROID__
+    #include <android/log.h>
+    #define LOG_TAG "CortexChatTemplate"
+    #define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+    #define LOGW(...) __android_log_print(ANDROID_LOG_WARN, LOG_TAG, __VA_ARGS__)
+#else
+    #include <iostream>
+    #define LOG_TAG "CortexChatTemplate"
+    #define LOGI(...) printf("[INFO] " __VA_ARGS__); printf("\n")
+    #define LOGW(...) printf("[WARN] " __VA_ARGS__); printf("\n")
+#endif
+
+namespace cortex {
+
+static const char* FALLBACK_TEMPLATE = "chatml";
+
+void ChatTemplate::init(const llama_model* model) {
+    const char* tmpl = model != nullptr ? llama_model_chat_template(model, nullptr) : nullptr;
+    template_ = tmpl != nullptr ? tmpl : "";
+    name_ = "gguf";
+    
+    // llama.cpp matches the embedded template against its builtin formats;
+    // probe once so an unknown one fails at load rather than per message
+    std::string probe;
+    std::vector<ChatTurn> turns = {{"user", "hi"}};
+    if (template_.empty() || !apply(turns, turns.size(), true, probe)) {
+        if (!template_.empty()) {
+            LOGW("unsupported chat template in model, using %s", FALLBACK_TEMPLATE);
+        }
+        template_ = FALLBACK_TEMPLATE;
+        name_ = FALLBACK_TEMPLATE;
+    }
+    
+    LOGI("chat template: %s", name_.c_str());
+}
+
+void ChatTemplate::clear() {
+    template_.clear();
+    name_.clear();
+}
+
+bool ChatTemplate::render(const std::vector<ChatTurn>& turns, bool add_assistant, std::string& out) const {
+    return apply(turns, turns.size(), add_assistant, out);
+}
+
+bool ChatTemplate::renderContinuation(const std::vector<ChatTurn>& turns, std::string& past,
+                                      std::string& out) const {
+    size_t n = turns.size();
+    if (n < 2 || turns[n - 1].role != "user" || turns[n - 2].role != "assistant") {
+        return false;
+    }
+    
+    // What the cache holds: everything before the reply, the assistant
+    // prefix, then the reply itself
+    if (!apply(turns, n - 2, true, past)) {
+        return false;
+    }
+    past += turns[n - 2].content;
+    
+    std::string full;
+    if (!apply(turns, n, true, full)) {
+        return false;
+    }
+    
+    // Templates that rewrite earlier turns (e.g. strip reasoning) cannot be
+    // extended incrementally
+    if (full.compare(0, past.size(), past) != 0) {
+        return false;
+    }
+    
+    out = full.substr(past.size());
+    return true;
+}
+
+bool ChatTemplate::apply(const std::vector<ChatTurn>& turns, size_t n_turns, bool add_assistant,
+                         std::string& out) const {
+    if (template_.empty()) {
+        return false;
+    }
+    
+    std::vector<llama_chat_message> messages;
+    messages.reserve(n_turns);
+    size_t n_chars = 0;
+    for (size_t i = 0; i < n_turns; i++) {
+        messages.push_back({turns[i].role.c_str(), turns[i].content.c_str()});
+        n_chars += turns[i].role.size() + turns[i].content.size();
+    }
+    
+    // Recommended starting size is twice the message text
+    std::vector<char> buf(n_chars * 2 + 64);
+    int32_t n = llama_chat_apply_template(template_.c_str(), messages.data(), messages.size(),
+                                          add_assistant, buf.data(), buf.size());
+    if (n > static_cast<int32_t>(buf.size())) {
+        buf.resize(n);
+        n = llama_chat_apply_template(template_.c_str(), messages.data(), messages.size(),
+                                      add_assistant, buf.data(), buf.size());
+    }
+    if (n < 0) {
+        return false;
+    }
+    
+    out.assign(buf.data(), n);
+    return true;
+}
+
+} // namespace cortex
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "llama.h"
+
+namespace cortex {
+
+// One message of a conversation as sent over the bridge
+struct ChatTurn {
+    std::string role;     // "system", "user" or "assistant"
+    std::string content;
+};
+
+// Renders conversations with the chat template embedded in the GGUF
+// (tokenizer.chat_template), falling back to ChatML for models without one
+// or with a template llama.cpp does not recognise.
+class ChatTemplate {
+public:
+    void init(const llama_model* model);
+    void clear();
+    
+    const std::string& name() const { return name_; }
+    
+    // Whole conversation, optionally followed by the assistant prefix
+    bool render(const std::vector<ChatTurn>& turns, bool add_assistant, std::string& out) const;
+    
+    // Only the text after the previous assistant reply: its end-of-turn
+    // marker, the new user message and the assistant prefix. Needs
+    // [..., assistant, user]; the cache is expected to end in the reply as
+    // generated (unterminated, since EOG tokens are never decoded). past is
+    // what the cache has to hold for that: everything up to the reply.
+    bool renderContinuation(const std::vector<ChatTurn>& turns, std::string& past, std::string& out) const;
+
+private:
+    std::string template_;  // Template source from the GGUF, or a builtin name
+    std::string name_;      // For logging
+    
+    bool apply(const std::vector<ChatTurn>& turns, size_t n_turns, bool add_assistant,
+               std::string& out) const;
+};
+
+} // namespace cortex
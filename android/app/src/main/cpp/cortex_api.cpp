@@ -0,0 +1,246 @@
+#include "cortex_api.h"
+#include "ffi_stream.h"
+#include "platform_channel.h"
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+char* copyString(const std::string& str) {
+    char* out = static_cast<char*>(malloc(str.size() + 1));
+    if (out == nullptr) return nullptr;
+    memcpy(out, str.data(), str.size());
+    out[str.size()] = '\0';
+    return out;
+}
+
+std::string toString(const char* str) {
+    return str != nullptr ? std::string(str) : std::string();
+}
+
+std::vector<int> toVector(const int32_t* values, int32_t count) {
+    if (values == nullptr || count <= 0) return {};
+    return std::vector<int>(values, values + count);
+}
+
+// The FFI ring when it is wanted and open, otherwise the caller's callback
+cortex::SessionCallback sessionCallback(bool ffi_stream, CortexSessionCallback callback, void* user_data) {
+    if (ffi_stream) {
+        cortex::SessionCallback sink = cortex::streamSessionCallback();
+        if (sink) return sink;
+    }
+    if (callback == nullptr) return nullptr;
+    return [callback, user_data](int64_t session, int type, const std::string& data) {
+        callback(user_data, session, type, data.c_str());
+    };
+}
+
+} // namespace
+
+void cortex_string_free(char* str) {
+    free(str);
+}
+
+// Model loading
+
+bool cortex_load_model(const char* model_path) {
+    return cortex::loadModel(toString(model_path));
+}
+
+char* cortex_preflight_model(const char* model_path) {
+    return copyString(cortex::preflightModel(toString(model_path)));
+}
+
+char* cortex_get_load_error(void) {
+    return copyString(cortex::getLoadError());
+}
+
+bool cortex_start_model_load(const char* model_path) {
+    return cortex::startModelLoad(toString(model_path));
+}
+
+void cortex_cancel_model_load(void) {
+    cortex::cancelModelLoad();
+}
+
+char* cortex_get_load_progress(void) {
+    return copyString(cortex::getLoadProgress());
+}
+
+void cortex_unload_model(void) {
+    cortex::unloadModel();
+}
+
+bool cortex_is_model_loaded(void) {
+    return cortex::isModelLoaded();
+}
+
+void cortex_on_trim_memory(int32_t level) {
+    cortex::onTrimMemory(level);
+}
+
+char* cortex_get_model_info(void) {
+    return copyString(cortex::getModelInfo());
+}
+
+// GPU offload
+
+char* cortex_get_gpu_info(const char* model_path) {
+    return copyString(cortex::getGpuInfo(toString(model_path)));
+}
+
+char* cortex_tune_gpu_layers(const char* model_path) {
+    return copyString(cortex::tuneGpuLayers(toString(model_path)));
+}
+
+// Draft model
+
+bool cortex_load_draft_model(const char* model_path) {
+    return cortex::loadDraftModel(toString(model_path));
+}
+
+void cortex_unload_draft_model(void) {
+    cortex::unloadDraftModel();
+}
+
+bool cortex_has_draft_model(void) {
+    return cortex::hasDraftModel();
+}
+
+// Generation sessions
+
+int64_t cortex_start_chat_session(const char* const* roles, const char* const* contents,
+                                  int32_t count, float temperature, float top_p,
+                                  int32_t top_k, int32_t max_tokens, const char* grammar,
+                                  const char* json_schema, bool speculative,
+                                  bool ffi_stream, CortexSessionCallback callback,
+                                  void* user_data) {
+    cortex::SessionCallback sink = sessionCallback(ffi_stream, callback, user_data);
+    if (!sink) return -1;
+    
+    std::vector<std::string> role_list;
+    std::vector<std::string> content_list;
+    for (int32_t i = 0; i < count; i++) {
+        role_list.push_back(toString(roles[i]));
+        content_list.push_back(toString(contents[i]));
+    }
+    int64_t session = cortex::startChatSession(role_list, content_list, temperature, top_p, top_k,
+                                               max_tokens, toString(grammar), toString(json_schema),
+                                               speculative, sink);
+    if (session < 0 && ffi_stream) cortex::abandonStream();  // Nothing else would end the ring
+    return session;
+}
+
+int64_t cortex_start_prompt_session(const char* prompt, bool incremental, float temperature,
+                                    float top_p, int32_t top_k, int32_t max_tokens,
+                                    const char* grammar, const char* json_schema,
+                                    bool speculative, bool ffi_stream,
+                                    CortexSessionCallback callback, void* user_data) {
+    cortex::SessionCallback sink = sessionCallback(ffi_stream, callback, user_data);
+    if (!sink) return -1;
+    
+    int64_t session = cortex::startPromptSession(toString(prompt), incremental, temperature, top_p,
+                                                 top_k, max_tokens, toString(grammar),
+                                                 toString(json_schema), speculative, sink);
+    if (session < 0 && ffi_stream) cortex::abandonStream();  // Nothing else would end the ring
+    return session;
+}
+
+int64_t cortex_start_background_session(const char* const* roles, const char* const* contents,
+                                        int32_t count, const char* prompt, float temperature,
+                                        float top_p, int32_t top_k, int32_t max_tokens,
+                                        const char* grammar, const char* json_schema,
+                                        CortexSessionCallback callback, void* user_data) {
+    cortex::SessionCallback sink = sessionCallback(false, callback, user_data);
+    if (!sink) return -1;
+    
+    std::vector<std::string> role_list;
+    std::vector<std::string> content_list;
+    for (int32_t i = 0; i < count; i++) {
+        role_list.push_back(toString(roles[i]));
+        content_list.push_back(toString(contents[i]));
+    }
+    return cortex::startBackgroundSession(role_list, content_list, toString(prompt), temperature, top_p,
+                                          top_k, max_tokens, toString(grammar), toString(json_schema),
+                                          sink);
+}
+
+void cortex_cancel_session(int64_t session) {
+    cortex::cancelSession(session);
+}
+
+bool cortex_is_generating(void) {
+    return cortex::isGenerating();
+}
+
+void cortex_stop_generation(void) {
+    cortex::stopGeneration();
+}
+
+// Cache management and conversation slots
+
+void cortex_clear_cache(void) {
+    cortex::clearCache();
+}
+
+int32_t cortex_get_cached_token_count(void) {
+    return cortex::getCachedTokenCount();
+}
+
+int32_t cortex_select_conversation(int64_t conversation_id) {
+    return cortex::selectConversation(conversation_id);
+}
+
+bool cortex_fork_conversation(int64_t src_id, int64_t dst_id) {
+    return cortex::forkConversation(src_id, dst_id);
+}
+
+void cortex_release_conversation(int64_t conversation_id) {
+    cortex::releaseConversation(conversation_id);
+}
+
+// Benchmark
+
+char* cortex_run_benchmark(const int32_t* prompt_lengths, int32_t n_prompt_lengths,
+                           const int32_t* decode_depths, int32_t n_decode_depths,
+                           int32_t decode_tokens,
+                           const int32_t* thread_counts, int32_t n_thread_counts,
+                           const int32_t* ubatch_sizes, int32_t n_ubatch_sizes,
+                           int32_t warmup, int32_t repetitions) {
+    if (!cortex::isModelLoaded()) {
+        return copyString("{\"error\":\"No model loaded\"}");
+    }
+    return copyString(cortex::runBenchmark(
+        toVector(prompt_lengths, n_prompt_lengths),
+        toVector(decode_depths, n_decode_depths),
+        decode_tokens,
+        toVector(thread_counts, n_thread_counts),
+        toVector(ubatch_sizes, n_ubatch_sizes),
+        warmup,
+        repetitions
+    ));
+}
+
+// Statistics
+
+char* cortex_get_stats(void) {
+    return copyString(cortex::getStats());
+}
+
+void cortex_set_thermal_state(int32_t status, float headroom) {
+    cortex::setThermalState(status, headroom);
+}
+
+void cortex_reset_stats(void) {
+    cortex::resetStats();
+}
+
+char* cortex_get_memory_info(void) {
+    return copyString(cortex::getMemoryInfo());
+}
+
+int64_t cortex_get_memory_usage(void) {
+    return cortex::getMemoryUsage();
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// C ABI over platform_channel.h for hosts without JNI: the iOS plugin
+// (ios/Runner/InferenceEnginePlugin.swift) imports this header through the bridging
+// header. Functions block like their JNI counterparts, so call them off
+// the main thread. Returned strings are malloc'd UTF-8; release them with
+// cortex_string_free.
+
+#ifdef __cplusplus
+    #define CORTEX_API extern "C" __attribute__((visibility("default"))) __attribute__((used))
+#else
+    #define CORTEX_API __attribute__((visibility("default"))) __attribute__((used))
+#endif
+
+CORTEX_API void cortex_string_free(char* str);
+
+// Model loading
+CORTEX_API bool cortex_load_model(const char* model_path);
+CORTEX_API char* cortex_preflight_model(const char* model_path);  // Load plan JSON
+CORTEX_API char* cortex_get_load_error(void);
+CORTEX_API bool cortex_start_model_load(const char* model_path);  // Poll cortex_get_load_progress
+CORTEX_API void cortex_cancel_model_load(void);
+CORTEX_API char* cortex_get_load_progress(void);
+CORTEX_API void cortex_unload_model(void);
+CORTEX_API bool cortex_is_model_loaded(void);
+CORTEX_API void cortex_on_trim_memory(int32_t level);  // ComponentCallbacks2 level
+CORTEX_API char* cortex_get_model_info(void);
+
+// GPU offload
+CORTEX_API char* cortex_get_gpu_info(const char* model_path);
+CORTEX_API char* cortex_tune_gpu_layers(const char* model_path);
+
+// Draft model for speculative decoding
+CORTEX_API bool cortex_load_draft_model(const char* model_path);
+CORTEX_API void cortex_unload_draft_model(void);
+CORTEX_API bool cortex_has_draft_model(void);
+
+// Generation sessions. Events come from the engine's generation thread:
+// type 0 with UTF-8 text, then exactly one 1 (done) or 2 (error) with the
+// stats JSON. data is only valid during the call. With ffi_stream the
+// output goes to the ring opened by cortex_stream_open instead and the
+// callback may be null. Starting a session ends the running one.
+typedef void (*CortexSessionCallback)(void* user_data, int64_t session, int32_t type, const char* data);
+
+// Return the session handle, or -1 when it could not be started (also
+// when the grammar does not compile). grammar (GBNF) and json_schema
+// constrain the output; null or empty: unconstrained.
+CORTEX_API int64_t cortex_start_chat_session(const char* const* roles, const char* const* contents,
+                                             int32_t count, float temperature, float top_p,
+                                             int32_t top_k, int32_t max_tokens, const char* grammar,
+                                             const char* json_schema, bool speculative,
+                                             bool ffi_stream, CortexSessionCallback callback,
+                                             void* user_data);
+CORTEX_API int64_t cortex_start_prompt_session(const char* prompt, bool incremental, float temperature,
+                                               float top_p, int32_t top_k, int32_t max_tokens,
+                                               const char* grammar, const char* json_schema,
+                                               bool speculative, bool ffi_stream,
+                                               CortexSessionCallback callback, void* user_data);
+// Next to the running session, on chat turns (count > 0) or the prompt;
+// the callback is required. -1 when all background sequences are busy.
+CORTEX_API int64_t cortex_start_background_session(const char* const* roles, const char* const* contents,
+                                                   int32_t count, const char* prompt, float temperature,
+                                                   float top_p, int32_t top_k, int32_t max_tokens,
+                                                   const char* grammar, const char* json_schema,
+                                                   CortexSessionCallback callback, void* user_data);
+CORTEX_API void cortex_cancel_session(int64_t session);  // 0: whichever runs; waits for its final event
+CORTEX_API bool cortex_is_generating(void);
+CORTEX_API void cortex_stop_generation(void);
+
+// Cache management and conversation slots
+CORTEX_API void cortex_clear_cache(void);
+CORTEX_API int32_t cortex_get_cached_token_count(void);
+CORTEX_API int32_t cortex_select_conversation(int64_t conversation_id);
+CORTEX_API bool cortex_fork_conversation(int64_t src_id, int64_t dst_id);
+CORTEX_API void cortex_release_conversation(int64_t conversation_id);
+
+// Benchmark sweep; empty arrays fall back to the native defaults
+CORTEX_API char* cortex_run_benchmark(const int32_t* prompt_lengths, int32_t n_prompt_lengths,
+                                      const int32_t* decode_depths, int32_t n_decode_depths,
+                                      int32_t decode_tokens,
+                                      const int32_t* thread_counts, int32_t n_thread_counts,
+                                      const int32_t* ubatch_sizes, int32_t n_ubatch_sizes,
+                                      int32_t warmup, int32_t repetitions);
+
+// Statistics
+CORTEX_API char* cortex_get_stats(void);
+CORTEX_API void cortex_set_thermal_state(int32_t status, float headroom);  // PowerManager status scale
+CORTEX_API void cortex_reset_stats(void);
+CORTEX_API char* cortex_get_memory_info(void);
+CORTEX_API int64_t cortex_get_memory_usage(void);
@@ -0,0 +1,31 @@
+# Engine sources shared by every platform build: the Android JNI library
+# (CMakeLists.txt here) and the iOS static library (ios/cortex). Paths are
+# relative to this directory.
+set(CORTEX_CORE_SOURCES
+    inference_engine.cpp
+    generation_session.cpp
+    memory_manager.cpp
+    memory_telemetry.cpp
+    model_cache.cpp
+    model_loader.cpp
+    model_preflight.cpp
+    model_download.cpp
+    sha256.cpp
+    kv_cache.cpp
+    detokenizer.cpp
+    cpu_backend.cpp
+    token_sampler.cpp
+    latency_trace.cpp
+    json_schema.cpp
+    grammar_cache.cpp
+    chat_template.cpp
+    benchmark.cpp
+    gpu_offload.cpp
+    thread_scheduler.cpp
+    thermal_governor.cpp
+    prefix_cache.cpp
+    platform_channel.cpp
+    ffi_stream.cpp
+    cortex_api.cpp
+)
+list(TRANSFORM CORTEX_CORE_SOURCES PREPEND "${CMAKE_CURRENT_LIST_DIR}/")
@@ -0,0 +1,164 @@
+#include "cpu_backend.h"
+#include "ggml-backend.h"
+#include <mutex>
+
+#if defined(__linux__) && defined(__aarch64__)
+    #include <sys/auxv.h>
+#endif
+#ifdef CORTEX_CPU_VARIANTS
+    #include <dlfcn.h>
+#endif
+
+#ifdef __ANDROID__
+    #include <android/log.h>
+    #define LOG_TAG "CortexBackend"
+    #define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+    #define LOGW(...) __android_log_print(ANDROID_LOG_WARN, LOG_TAG, __VA_ARGS__)
+#else
+    #include <cstdio>
+    #define LOG_TAG "CortexBackend"
+    #define LOGI(...) printf("[INFO] " __VA_ARGS__); printf("\n")
+    #define LOGW(...) printf("[WARN] " __VA_ARGS__); printf("\n")
+#endif
+
+#ifndef CORTEX_GPU_BACKEND_NAME
+    #define CORTEX_GPU_BACKEND_NAME "none"
+#endif
+
+namespace cortex {
+
+// arm64 hwcap bits, spelled out since older NDK headers lack the newer ones
+static const unsigned long CAP_FPHP = 1UL << 9;
+static const unsigned long CAP_ASIMDHP = 1UL << 10;
+static const unsigned long CAP_ASIMDDP = 1UL << 20;
+static const unsigned long CAP_SVE = 1UL << 22;
+static const unsigned long CAP2_SVE2 = 1UL << 1;
+static const unsigned long CAP2_I8MM = 1UL << 13;
+static const unsigned long CAP2_SME = 1UL << 23;
+
+CpuFeatures detectCpuFeatures() {
+    CpuFeatures features;
+#if defined(__linux__) && defined(__aarch64__)
+    unsigned long hwcap = getauxval(AT_HWCAP);
+    unsigned long hwcap2 = getauxval(AT_HWCAP2);
+    features.fp16 = (hwcap & CAP_FPHP) && (hwcap & CAP_ASIMDHP);
+    features.dotprod = hwcap & CAP_ASIMDDP;
+    features.sve = hwcap & CAP_SVE;
+    features.i8mm = hwcap2 & CAP2_I8MM;
+    features.sve2 = hwcap2 & CAP2_SVE2;
+    features.sme = hwcap2 & CAP2_SME;
+#endif
+    return features;
+}
+
+std::string cpuFeaturesString(const CpuFeatures& features) {
+    std::string out;
+    auto add = [&out](bool present, const char* name) {
+        if (!present) return;
+        if (!out.empty()) out += " ";
+        out += name;
+    };
+    add(features.fp16, "fp16");
+    add(features.dotprod, "dotprod");
+    add(features.i8mm, "i8mm");
+    add(features.sve, "sve");
+    add(features.sve2, "sve2");
+    add(features.sme, "sme");
+    return out.empty() ? "none" : out;
+}
+
+static std::once_flag g_load_once;
+static const char* g_variant = "none";
+
+#ifdef CORTEX_CPU_VARIANTS
+// ggml's Android variants (GGML_CPU_ALL_VARIANTS), most capable first,
+// with the features each one was compiled for
+struct CpuVariant {
+    const char* name;
+    bool fp16, dotprod, i8mm, sve, sve2, sme;
+};
+
+static const CpuVariant CPU_VARIANTS[] = {
+    {"android_armv9.2_2", true, true, true, true, false, true},
+    {"android_armv9.2_1", true, true, true, false, false, true},
+    {"android_armv9.0_1", true, true, true, false, true, false},
+    {"android_armv8.6_1", true, true, true, false, false, false},
+    {"android_armv8.2_2", true, true, false, false, false, false},
+    {"android_armv8.2_1", false, true, false, false, false, false},
+    {"android_armv8.0_1", false, false, false, false, false, false},
+};
+
+static bool supports(const CpuFeatures& cpu, const CpuVariant& variant) {
+    return (!variant.fp16 || cpu.fp16) && (!variant.dotprod || cpu.dotprod) &&
+           (!variant.i8mm || cpu.i8mm) && (!variant.sve || cpu.sve) &&
+           (!variant.sve2 || cpu.sve2) && (!variant.sme || cpu.sme);
+}
+
+// Directory holding this library (extracted native libs), or empty when it
+// is mapped straight from the APK; bare names then go through the app's
+// linker namespace, which covers the APK's lib/ folder too
+static std::string libraryDir() {
+    Dl_info info;
+    if (dladdr(reinterpret_cast<void*>(&loadBackends), &info) == 0 || info.dli_fname == nullptr) {
+        return "";
+    }
+    std::string path = info.dli_fname;
+    size_t slash = path.rfind('/');
+    if (slash == std::string::npos || path.find("!/") != std::string::npos) {
+        return "";
+    }
+    return path.substr(0, slash);
+}
+
+static bool loadModule(const std::string& dir, const std::string& name) {
+    std::string file = "lib" + name + ".so";
+    std::string path = dir.empty() ? file : dir + "/" + file;
+    return ggml_backend_load(path.c_str()) != nullptr;
+}
+
+static void loadModules() {
+    CpuFeatures cpu = detectCpuFeatures();
+    std::string dir = libraryDir();
+    LOGI("cpu features: %s", cpuFeaturesString(cpu).c_str());
+    
+    for (const CpuVariant& variant : CPU_VARIANTS) {
+        if (supports(cpu, variant) && loadModule(dir, std::string("ggml-cpu-") + variant.name)) {
+            g_variant = variant.name;
+            break;
+        }
+    }
+    
+    if (std::string(g_variant) == "none") {
+        // Variant names follow the llama.cpp checkout; let ggml scan and
+        // score whatever was built. That picks up the GPU module as well.
+        LOGW("no known cpu variant loaded, scanning %s", dir.empty() ? "the default paths" : dir.c_str());
+        if (dir.empty()) {
+            ggml_backend_load_all();
+        } else {
+            ggml_backend_load_all_from_path(dir.c_str());
+        }
+        g_variant = ggml_backend_reg_count() > 0 ? "scanned" : "none";
+    } else if (std::string(CORTEX_GPU_BACKEND_NAME) != "none" &&
+               !loadModule(dir, std::string("ggml-") + CORTEX_GPU_BACKEND_NAME)) {
+        LOGW("gpu backend %s did not load", CORTEX_GPU_BACKEND_NAME);
+    }
+    LOGI("cpu backend: %s", g_variant);
+}
+#endif
+
+void loadBackends() {
+    std::call_once(g_load_once, [] {
+#ifdef CORTEX_CPU_VARIANTS
+        loadModules();
+#else
+        g_variant = "static";
+#endif
+    });
+}
+
+const char* cpuVariant() {
+    loadBackends();
+    return g_variant;
+}
+
+} // namespace cortex
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string>
+
+namespace cortex {
+
+// arm64 features the ggml CPU kernels are specialized for, from
+// getauxval(AT_HWCAP / AT_HWCAP2); all false elsewhere
+struct CpuFeatures {
+    bool fp16 = false;      // FPHP + ASIMDHP: half-precision vector arithmetic
+    bool dotprod = false;   // ASIMDDP: SDOT/UDOT, the q4/q8 dot products
+    bool i8mm = false;      // SMMLA/UMMLA int8 matrix multiply
+    bool sve = false;
+    bool sve2 = false;
+    bool sme = false;
+};
+
+CpuFeatures detectCpuFeatures();
+std::string cpuFeaturesString(const CpuFeatures& features);  // "fp16 dotprod i8mm", "none"
+
+// With CORTEX_CPU_VARIANTS the ggml CPU backend is built once per feature
+// level as its own module, and nothing links one: this loads the most
+// capable variant the core supports (ggml's own score check still vetoes
+// one the CPU cannot run), falling back to ggml's directory scan, then
+// the GPU backend module when one was built. In a static build the CPU
+// backend is linked in and this does nothing. Idempotent and thread-safe;
+// has to run before the first backend or device lookup.
+void loadBackends();
+
+// The loaded CPU variant, e.g. "android_armv8.6_1"; "static" when linked
+// in, "none" if nothing could be loaded
+const char* cpuVariant();
+
+} // namespace cortex
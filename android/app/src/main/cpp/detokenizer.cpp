@@ -0,0 +1,155 @@
+#include "detokenizer.h"
+#include <algorithm>
+#include <cstring>
+
+namespace cortex {
+
+// Template markers some models emit as plain text instead of one control
+// token. Control tokens themselves never render (special = false below).
+static const char* const TEMPLATE_MARKERS[] = {
+    "<|im_end|>",
+    "<|im_start|>",
+    "<|endoftext|>",
+    "<|eot_id|>",
+    "<end_of_turn>",
+    "<start_of_turn>",
+};
+
+static const char UTF8_REPLACEMENT[] = "\xEF\xBF\xBD";
+
+StreamingDetokenizer::StreamingDetokenizer() {
+    out_.reserve(1024);
+    pending_.reserve(64);
+    piece_.resize(256);
+}
+
+void StreamingDetokenizer::reset(const llama_vocab* vocab) {
+    vocab_ = vocab;
+    out_.clear();
+    pending_.clear();
+    altered_ = false;
+}
+
+size_t StreamingDetokenizer::push(llama_token token) {
+    if (vocab_ == nullptr) return out_.size();
+    
+    int n = llama_token_to_piece(vocab_, token, piece_.data(), piece_.size(), 0, false);
+    if (n < 0) {
+        // Grow the scratch buffer once and keep it for later tokens
+        piece_.resize(-n);
+        n = llama_token_to_piece(vocab_, token, piece_.data(), piece_.size(), 0, false);
+    }
+    if (n > 0) {
+        pending_.append(piece_.data(), n);
+        emitPending(false);
+    }
+    return out_.size();
+}
+
+size_t StreamingDetokenizer::flush() {
+    emitPending(true);
+    return out_.size();
+}
+
+std::string StreamingDetokenizer::take() {
+    std::string result = out_;
+    out_.clear();
+    return result;
+}
+
+void StreamingDetokenizer::emitPending(bool final) {
+    // Drop complete markers
+    for (const char* marker : TEMPLATE_MARKERS) {
+        size_t len = strlen(marker);
+        size_t pos;
+        while ((pos = pending_.find(marker)) != std::string::npos) {
+            pending_.erase(pos, len);
+            altered_ = true;
+        }
+    }
+    
+    size_t hold = 0;
+    if (!final) {
+        hold = incompleteTail(pending_);
+        
+        // Keep a tail that could still grow into a marker
+        for (const char* marker : TEMPLATE_MARKERS) {
+            size_t len = std::min(strlen(marker) - 1, pending_.size());
+            for (size_t k = len; k > hold; k--) {
+                if (pending_.compare(pending_.size() - k, k, marker, k) == 0) {
+                    hold = k;
+                    break;
+                }
+            }
+        }
+    }
+    
+    size_t ready = pending_.size() - hold;
+    if (ready > 0) {
+        if (!appendValidUtf8(out_, pending_.data(), ready)) {
+            altered_ = true;
+        }
+        pending_.erase(0, ready);
+    }
+}
+
+size_t StreamingDetokenizer::incompleteTail(const std::string& bytes) {
+    // A codepoint is at most 4 bytes, so only the last 3 can be incomplete
+    size_t len = bytes.size();
+    for (size_t k = 1; k <= std::min<size_t>(3, len); k++) {
+        unsigned char c = bytes[len - k];
+        if ((c & 0xC0) == 0x80) continue;  // Continuation byte
+        
+        size_t expected = (c >= 0xF8) ? 1 : (c >= 0xF0) ? 4 : (c >= 0xE0) ? 3 : (c >= 0xC0) ? 2 : 1;
+        return expected > k ? k : 0;
+    }
+    return 0;
+}
+
+bool StreamingDetokenizer::appendValidUtf8(std::string& out, const char* data, size_t n) {
+    const unsigned char* s = reinterpret_cast<const unsigned char*>(data);
+    size_t i = 0;
+    bool clean = true;
+    
+    while (i < n) {
+        unsigned char c = s[i];
+        if (c < 0x80) {
+            // ASCII fast path
+            size_t start = i;
+            while (i < n && s[i] < 0x80) i++;
+            out.append(data + start, i - start);
+            continue;
+        }
+        
+        size_t len = 0;
+        unsigned char lo = 0x80, hi = 0xBF;  // Valid range of the second byte
+        if (c >= 0xC2 && c <= 0xDF) {
+            len = 2;
+        } else if (c >= 0xE0 && c <= 0xEF) {
+            len = 3;
+            if (c == 0xE0) lo = 0xA0;  // Overlong
+            if (c == 0xED) hi = 0x9F;  // UTF-16 surrogates
+        } else if (c >= 0xF0 && c <= 0xF4) {
+            len = 4;
+            if (c == 0xF0) lo = 0x90;  // Overlong
+            if (c == 0xF4) hi = 0x8F;  // Above U+10FFFF
+        }
+        
+        bool valid = len > 0 && i + len <= n && s[i + 1] >= lo && s[i + 1] <= hi;
+        for (size_t k = 2; valid && k < len; k++) {
+            valid = (s[i + k] & 0xC0) == 0x80;
+        }
+        
+        if (valid) {
+            out.append(data + i, len);
+            i += len;
+        } else {
+            out.append(UTF8_REPLACEMENT, 3);
+            i++;
+            clean = false;
+        }
+    }
+    return clean;
+}
+
+} // namespace cortex
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "llama.h"
+
+namespace cortex {
+
+// Incremental token -> UTF-8 converter for streaming output.
+//
+// Pieces are appended to a reusable output arena. Bytes of a codepoint that
+// is split across tokens are held back until it completes, invalid bytes
+// become U+FFFD, and chat-template markers such as <|im_end|> are stripped
+// even when the model spells them out over several plain tokens.
+class StreamingDetokenizer {
+public:
+    StreamingDetokenizer();
+    
+    // Start a new response
+    void reset(const llama_vocab* vocab);
+    
+    // Append a token; returns the number of bytes now ready in text()
+    size_t push(llama_token token);
+    
+    // Release everything still held back (end of generation)
+    size_t flush();
+    
+    // Ready output, valid until the next push()/flush()/consume()
+    const std::string& text() const { return out_; }
+    void consume() { out_.clear(); }
+    
+    // Convenience for callers that need an owned string per token
+    std::string take();
+    
+    // Everything pushed so far came out byte for byte: no marker stripped,
+    // no invalid byte replaced, nothing held back
+    bool exact() const { return !altered_ && pending_.empty(); }
+
+private:
+    const llama_vocab* vocab_ = nullptr;
+    std::string out_;       // Complete, clean UTF-8 ready for the caller
+    std::string pending_;   // Tail that may still turn into a codepoint or marker
+    std::vector<char> piece_;
+    bool altered_ = false;
+    
+    void emitPending(bool final);
+    static size_t incompleteTail(const std::string& bytes);
+    static bool appendValidUtf8(std::string& out, const char* data, size_t n);  // false if any byte was replaced
+};
+
+} // namespace cortex
@@ -0,0 +1,229 @@
+#include "ffi_stream.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __ANDROID__
+#include <android/log.h>
+#define LOG_TAG "CortexStream"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGW(...) __android_log_print(ANDROID_LOG_WARN, LOG_TAG, __VA_ARGS__)
+#else
+#include <iostream>
+#define LOGI(...) printf(__VA_ARGS__); printf("\n")
+#define LOGW(...) fprintf(stderr, __VA_ARGS__); fprintf(stderr, "\n")
+#endif
+
+namespace {
+
+struct NativeStream {
+    std::vector<uint8_t> data;
+    uint32_t mask = 0;
+    std::atomic<int64_t> write_pos{0};   // Written by the generation thread
+    std::atomic<int64_t> read_pos{0};    // Written by Dart
+    std::atomic<bool> armed{false};
+    std::atomic<bool> stop{false};
+    std::atomic<bool> running{false};    // Open until the -1 notification
+    bool reading = false;                // Dart holds the ring until cortex_stream_release()
+    std::atomic<uint64_t> dropped{0};    // Output lost to a stalled reader
+    CortexStreamNotify notify = nullptr;
+    
+    // Guards the end of the stream, which the session or close() may reach
+    std::mutex end_mutex;
+    bool attached = false;               // A session writes here
+    std::atomic<uint64_t> epoch{0};      // Bumped per open; stale callbacks drop out
+    int32_t result_type = -1;
+    std::string result;
+};
+
+NativeStream g_stream;
+
+// A stalled reader must not wedge generation forever; past this the rest
+// of the output is dropped and the session ends as an error
+constexpr auto STALL_TIMEOUT = std::chrono::seconds(5);
+
+void writeBytes(const std::string& text) {
+    // Closed by Dart: nobody reads any more until the -1
+    if (g_stream.stop) return;
+    
+    // Once bytes are lost, later ones would only leave a hole in the text
+    if (g_stream.dropped > 0) {
+        g_stream.dropped += text.size();
+        return;
+    }
+    
+    const uint8_t* src = reinterpret_cast<const uint8_t*>(text.data());
+    size_t remaining = text.size();
+    uint32_t capacity = g_stream.mask + 1;
+    auto stall_start = std::chrono::steady_clock::now();
+    
+    while (remaining > 0) {
+        int64_t write = g_stream.write_pos.load(std::memory_order_relaxed);
+        int64_t read = g_stream.read_pos.load(std::memory_order_acquire);
+        size_t free = capacity - static_cast<size_t>(write - read);
+        
+        if (free == 0) {
+            if (g_stream.stop) return;
+            if (std::chrono::steady_clock::now() - stall_start > STALL_TIMEOUT) {
+                LOGW("stream reader stalled, dropping the rest of the output");
+                g_stream.dropped += remaining;
+                return;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+        
+        // Copy in at most two runs around the wrap point
+        size_t n = std::min(free, remaining);
+        size_t offset = static_cast<size_t>(write) & g_stream.mask;
+        size_t first = std::min(n, capacity - offset);
+        memcpy(g_stream.data.data() + offset, src, first);
+        memcpy(g_stream.data.data(), src + first, n - first);
+        
+        src += n;
+        remaining -= n;
+        write += n;
+        g_stream.write_pos.store(write, std::memory_order_release);
+        
+        if (g_stream.armed.exchange(false)) {
+            g_stream.notify(write);
+        }
+        stall_start = std::chrono::steady_clock::now();
+    }
+}
+
+// Runs once per open, from the session's final event or from close()
+void endStream(int32_t type, const std::string& data) {
+    std::lock_guard<std::mutex> lock(g_stream.end_mutex);
+    if (!g_stream.running) return;
+    
+    g_stream.result_type = type;
+    g_stream.result = data;
+    
+    // A reply that lost its tail is not a success; same JSON plus "error"
+    uint64_t dropped = g_stream.dropped;
+    if (dropped > 0 && type == cortex::SESSION_DONE) {
+        char error[96];
+        snprintf(error, sizeof(error), "{\"error\":\"stream reader stalled, %llu bytes dropped\"",
+                 static_cast<unsigned long long>(dropped));
+        g_stream.result_type = cortex::SESSION_ERROR;
+        g_stream.result = error;
+        g_stream.result += data.size() > 2 && data[0] == '{' ? "," + data.substr(1) : "}";
+    }
+    g_stream.attached = false;
+    g_stream.running = false;
+    g_stream.notify(-1);
+}
+
+} // namespace
+
+bool cortex_stream_open(uint32_t capacity, CortexStreamNotify notify) {
+    std::lock_guard<std::mutex> lock(g_stream.end_mutex);
+    if (g_stream.running || g_stream.reading || notify == nullptr) {
+        return false;
+    }
+    
+    uint32_t size = 1;
+    while (size < capacity) size <<= 1;
+    if (g_stream.data.size() != size) {
+        g_stream.data.assign(size, 0);
+    }
+    g_stream.mask = size - 1;
+    
+    g_stream.write_pos = 0;
+    g_stream.read_pos = 0;
+    g_stream.armed = true;
+    g_stream.stop = false;
+    g_stream.dropped = 0;
+    g_stream.notify = notify;
+    g_stream.epoch++;
+    g_stream.result_type = -1;
+    g_stream.result.clear();
+    g_stream.running = true;
+    g_stream.reading = true;
+    
+    LOGI("stream opened: %u bytes", size);
+    return true;
+}
+
+void cortex_stream_close() {
+    g_stream.stop = true;
+    
+    // Without a session nothing else would end the stream
+    bool attached;
+    {
+        std::lock_guard<std::mutex> lock(g_stream.end_mutex);
+        attached = g_stream.attached;
+    }
+    if (!attached) {
+        endStream(-1, "");
+    }
+}
+
+void cortex_stream_release() {
+    std::lock_guard<std::mutex> lock(g_stream.end_mutex);
+    if (!g_stream.running) {
+        g_stream.reading = false;
+    }
+}
+
+int32_t cortex_stream_result_type() {
+    return g_stream.result_type;
+}
+
+const char* cortex_stream_result() {
+    return g_stream.result.c_str();
+}
+
+uint8_t* cortex_stream_data() {
+    return g_stream.data.data();
+}
+
+uint32_t cortex_stream_capacity() {
+    return g_stream.mask + 1;
+}
+
+int64_t cortex_stream_write_pos() {
+    return g_stream.write_pos.load(std::memory_order_acquire);
+}
+
+void cortex_stream_set_read_pos(int64_t read_pos) {
+    g_stream.read_pos.store(read_pos, std::memory_order_release);
+}
+
+int64_t cortex_stream_arm() {
+    g_stream.armed = true;
+    return g_stream.write_pos.load(std::memory_order_acquire);
+}
+
+namespace cortex {
+
+SessionCallback streamSessionCallback() {
+    std::lock_guard<std::mutex> lock(g_stream.end_mutex);
+    if (!g_stream.running) return nullptr;
+    
+    g_stream.attached = true;
+    uint64_t epoch = g_stream.epoch;
+    return [epoch](int64_t, int type, const std::string& data) {
+        // open() only succeeds once the previous session ended, so the
+        // epoch changes only while no writer is running
+        if (epoch != g_stream.epoch) return;
+        if (type == SESSION_TOKEN) {
+            writeBytes(data);
+        } else {
+            endStream(type, data);
+        }
+    };
+}
+
+void abandonStream() {
+    endStream(-1, "");
+}
+
+} // namespace cortex
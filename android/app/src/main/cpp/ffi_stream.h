@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include "platform_channel.h"
+
+// C ABI token stream for dart:ffi (lib/services/native_stream.dart).
+//
+// A generation session's UTF-8 output goes into a native ring buffer that
+// Dart reads in place. Positions are monotonically increasing byte counts; the slot for
+// position p is data[p & (capacity - 1)]. The writer only notifies Dart
+// after Dart re-arms, so a burst of tokens costs a single isolate message.
+
+#define CORTEX_FFI_EXPORT extern "C" __attribute__((visibility("default"))) __attribute__((used))
+
+// Called from the generation thread with the new write position, or -1
+// once the session has ended. Dart passes a NativeCallable.listener here.
+typedef void (*CortexStreamNotify)(int64_t write_pos);
+
+// Open the stream, then start the session with its output routed here
+// (cortex::streamSessionCallback). Capacity is rounded up to a power of
+// two. Returns false until the previous session has ended and Dart has
+// released the ring.
+CORTEX_FFI_EXPORT bool cortex_stream_open(uint32_t capacity, CortexStreamNotify notify);
+
+// Stop writing; Dart gets -1 once the session has ended, or right away
+// when no session was started on the stream
+CORTEX_FFI_EXPORT void cortex_stream_close();
+
+// Dart is done with the ring and the result (after the -1 and its drain);
+// only then may the next open reuse them
+CORTEX_FFI_EXPORT void cortex_stream_release();
+
+// Final event, valid after -1 until cortex_stream_release(): SESSION_DONE
+// or SESSION_ERROR and its stats JSON, or -1 and "" if no session ran. A
+// reader that stalls for long turns SESSION_DONE into SESSION_ERROR: the
+// rest of the text was dropped.
+CORTEX_FFI_EXPORT int32_t cortex_stream_result_type();
+CORTEX_FFI_EXPORT const char* cortex_stream_result();
+
+// Ring access, valid from open until cortex_stream_release()
+CORTEX_FFI_EXPORT uint8_t* cortex_stream_data();
+CORTEX_FFI_EXPORT uint32_t cortex_stream_capacity();
+CORTEX_FFI_EXPORT int64_t cortex_stream_write_pos();  // Acquire load
+CORTEX_FFI_EXPORT void cortex_stream_set_read_pos(int64_t read_pos);  // Release store
+
+// Request a notification for the next write; returns the current write
+// position so the caller can catch data that raced with arming
+CORTEX_FFI_EXPORT int64_t cortex_stream_arm();
+
+namespace cortex {
+
+// Session callback writing into the open stream: text into the ring, the
+// final event into cortex_stream_result() followed by the -1 notification.
+// Null when no stream is open.
+SessionCallback streamSessionCallback();
+
+// Ends the open stream when the session it was handed to never started
+// (the start returned -1), so Dart gets its -1 and can open it again
+void abandonStream();
+
+} // namespace cortex
@@ -0,0 +1,227 @@
+#include "generation_session.h"
+
+#ifdef __ANDROID__
+    #include <android/log.h>
+    #define LOG_TAG "CortexSession"
+    #define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
+    #define LOGW(...) __android_log_print(ANDROID_LOG_WARN, LOG_TAG, __VA_ARGS__)
+#else
+    #include <cstdio>
+    #define LOG_TAG "CortexSession"
+    #define LOGD(...) printf("[DEBUG] " __VA_ARGS__); printf("\n")
+    #define LOGW(...) printf("[WARN] " __VA_ARGS__); printf("\n")
+#endif
+
+namespace cortex {
+
+GenerationSession::GenerationSession(InferenceEngine& engine) : engine_(engine) {
+    thread_ = std::thread(&GenerationSession::threadFunc, this);
+}
+
+GenerationSession::~GenerationSession() {
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        stopLocked(lock, 0);
+        shutdown_ = true;
+    }
+    cv_.notify_all();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+int64_t GenerationSession::start(SessionRequest request, SessionSink sink) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    
+    // One session at a time: the previous one has delivered its final
+    // event before this one is queued, so sinks never interleave
+    stopLocked(lock, 0);
+    
+    int64_t session = next_id_++;
+    request_ = std::move(request);
+    sink_ = std::move(sink);
+    queued_ = session;
+    queued_us_ = LatencyTrace::nowUs();
+    has_request_ = true;
+    cv_.notify_one();
+    return session;
+}
+
+int64_t GenerationSession::startBackground(SessionRequest request, SessionSink sink) {
+    int64_t session;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        session = next_id_++;
+    }
+    
+    // The engine takes its own lock; holding ours would stall cancel()
+    // behind a foreground prefill
+    if (!engine_.addBackground(session, request, std::move(sink))) {
+        return -1;
+    }
+    wake();
+    return session;
+}
+
+void GenerationSession::cancel(int64_t session) {
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        int64_t current = has_request_ ? queued_ : running_;
+        if (session == 0 || session == current) {
+            stopLocked(lock, session);
+            return;
+        }
+    }
+    engine_.cancelBackground(session);
+    wake();
+}
+
+int64_t GenerationSession::active() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return has_request_ ? queued_ : running_;
+}
+
+void GenerationSession::wake() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cv_.notify_all();
+}
+
+void GenerationSession::stopLocked(std::unique_lock<std::mutex>& lock, int64_t session) {
+    // At most one session is queued or running at any time
+    int64_t current = has_request_ ? queued_ : running_;
+    if (current == 0 || (session != 0 && session != current)) return;
+    
+    // cancel_ goes first: a start still resetting the engine's stop flag
+    // sees it before its first token
+    cancel_ = current;
+    if (running_ == current) {
+        engine_.stopGeneration();
+    }
+    
+    // A sink cannot wait for its own final event
+    if (std::this_thread::get_id() == thread_.get_id()) return;
+    idle_cv_.wait(lock, [this, current] {
+        return running_ != current && !(has_request_ && queued_ == current);
+    });
+}
+
+void GenerationSession::threadFunc() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        cv_.wait(lock, [this] { return has_request_ || shutdown_ || engine_.hasBackgroundWork(); });
+        if (shutdown_) break;
+        
+        if (!has_request_) {
+            lock.unlock();
+            runBackground();
+            lock.lock();
+            continue;
+        }
+        
+        SessionRequest request = std::move(request_);
+        SessionSink sink = std::move(sink_);
+        running_ = queued_;
+        queued_ = 0;
+        has_request_ = false;
+        int64_t session = running_;
+        int64_t queued_us = queued_us_;
+        
+        lock.unlock();
+        LatencyTrace::getInstance().record(LatencyStage::Queue, LatencyTrace::nowUs() - queued_us);
+        run(request, sink, session, queued_us);
+        lock.lock();
+        
+        running_ = 0;
+        idle_cv_.notify_all();
+    }
+    
+    // Background sessions still get their final event
+    lock.unlock();
+    engine_.cancelBackground(0);
+    engine_.stepBackground();
+    engine_.deliverBackground();
+}
+
+void GenerationSession::runBackground() {
+    // Nothing in the foreground: background sessions decode on their own
+    engine_.pinGenerationThread();
+    engine_.stepBackground();
+    engine_.deliverBackground();
+}
+
+void GenerationSession::run(const SessionRequest& request, const SessionSink& sink, int64_t session,
+                            int64_t queued_us) {
+    SessionEvent event;
+    event.session = session;
+    
+    // Cancelled while queued: it still gets its final event
+    if (cancelled(session)) {
+        event.type = SessionEventType::Done;
+        event.stats.finish_reason = FinishReason::Stopped;
+        sink(event);
+        return;
+    }
+    
+    // The decode pools follow the model; pin to wherever they are now
+    engine_.pinGenerationThread();
+    
+    bool started = !request.turns.empty()
+        ? engine_.startChat(request.turns, request.config, request.speculative)
+        : request.speculative
+        ? engine_.startInferenceSpeculative(request.prompt, request.config, request.incremental)
+        : request.incremental
+        ? engine_.startInferenceIncremental(request.prompt, request.config)
+        : engine_.startInference(request.prompt, request.config);
+    
+    if (!started) {
+        LOGW("session %lld: generation failed to start", static_cast<long long>(session));
+        event.type = SessionEventType::Error;
+        event.text = "generation failed to start";
+        event.stats = engine_.getStats();
+        event.stats.finish_reason = FinishReason::Error;
+        sink(event);
+        return;
+    }
+    
+    // Text goes out as soon as the detokenizer releases it; the loop ends
+    // on end of text, a limit, an error or a stop. Latency is measured up
+    // to the sink handing the text over, as the app would see it.
+    LatencyTrace& trace = LatencyTrace::getInstance();
+    int64_t last_text_us = 0;
+    event.type = SessionEventType::Token;
+    while (engine_.isGenerating()) {
+        if (cancelled(session)) {
+            engine_.stopGeneration();
+            break;
+        }
+        event.text = engine_.getNextToken();
+        if (!event.text.empty()) {
+            int64_t now_us = LatencyTrace::nowUs();
+            if (last_text_us == 0) {
+                trace.record(LatencyStage::FirstToken, now_us - queued_us);
+            } else {
+                trace.record(LatencyStage::TokenGap, now_us - last_text_us);
+            }
+            last_text_us = now_us;
+            
+            StageTimer timer(LatencyStage::Deliver);
+            sink(event);
+        }
+        engine_.deliverBackground();
+    }
+    
+    event.stats = engine_.getStats();
+    event.text.clear();
+    if (event.stats.finish_reason == FinishReason::Error) {
+        event.type = SessionEventType::Error;
+        event.text = "decode failed";
+    } else {
+        event.type = SessionEventType::Done;
+    }
+    LOGD("session %lld done: %lld tokens", static_cast<long long>(session),
+         static_cast<long long>(event.stats.generated_tokens));
+    sink(event);
+    engine_.deliverBackground();
+}
+
+} // namespace cortex
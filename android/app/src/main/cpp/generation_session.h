@@ -0,0 +1,69 @@
+#pragma once
+
+#include "inference_engine.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+namespace cortex {
+
+// The engine's generation thread. Runs one SessionRequest at a time: starts
+// it, pushes text to the sink as it is decoded and ends every session with
+// exactly one Done or Error event. Background sessions ride along in its
+// decode steps, or are stepped alone while it has nothing else to do.
+// With neither, the thread sleeps on a condition variable; nothing polls
+// it, and no other thread decodes.
+class GenerationSession {
+public:
+    explicit GenerationSession(InferenceEngine& engine);
+    ~GenerationSession();
+    
+    GenerationSession(const GenerationSession&) = delete;
+    GenerationSession& operator=(const GenerationSession&) = delete;
+    
+    // Ends the running session (its sink sees Done, finish_reason Stopped)
+    // and queues the request; returns its handle, always > 0
+    int64_t start(SessionRequest request, SessionSink sink);
+    
+    // Adds a background session next to whatever runs; -1 when the engine
+    // has no free background sequence
+    int64_t startBackground(SessionRequest request, SessionSink sink);
+    
+    // Stops the session and waits until its final event was delivered;
+    // 0 stops whichever runs. Waits a decode step or prefill chunk at most.
+    // From inside a sink it only requests the stop. Background sessions
+    // are only flagged; their final event follows on the thread.
+    void cancel(int64_t session = 0);
+    
+    int64_t active() const;  // Queued or running session, 0 when idle
+    void wake();             // Background events were queued from another thread
+
+private:
+    void threadFunc();
+    void run(const SessionRequest& request, const SessionSink& sink, int64_t session, int64_t queued_us);
+    void runBackground();
+    bool cancelled(int64_t session) const { return cancel_ == session; }
+    void stopLocked(std::unique_lock<std::mutex>& lock, int64_t session);
+    
+    InferenceEngine& engine_;
+    std::thread thread_;
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;      // Request queued, or shutting down
+    std::condition_variable idle_cv_; // A session delivered its final event
+    
+    // Queued by start(), taken by the thread
+    bool has_request_ = false;
+    SessionRequest request_;
+    SessionSink sink_;
+    int64_t queued_ = 0;
+    int64_t queued_us_ = 0;           // When start() queued it, for the queue and first-token latency
+    
+    int64_t running_ = 0;             // Session on the thread, 0 between sessions
+    std::atomic<int64_t> cancel_{0};  // Stop requested; read once per token, so no lock
+    int64_t next_id_ = 1;
+    bool shutdown_ = false;
+};
+
+} // namespace cortex
@@ -0,0 +1,354 @@
+#include "gpu_offload.h"
+#include "memory_manager.h"
+#include "model_preflight.h"
+#include "cpu_backend.h"
+#include "thread_scheduler.h"
+#include "llama.h"
+#include "ggml-backend.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <sys/stat.h>
+
+#ifdef __ANDROID__
+    #include <android/log.h>
+    #define LOG_TAG "CortexGpu"
+    #define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+    #define LOGW(...) __android_log_print(ANDROID_LOG_WARN, LOG_TAG, __VA_ARGS__)
+#else
+    #define LOG_TAG "CortexGpu"
+    #define LOGI(...) printf("[INFO] " __VA_ARGS__); printf("\n")
+    #define LOGW(...) printf("[WARN] " __VA_ARGS__); printf("\n")
+#endif
+
+#ifndef CORTEX_GPU_BACKEND_NAME
+    #define CORTEX_GPU_BACKEND_NAME "none"
+#endif
+
+namespace cortex {
+
+namespace {
+
+constexpr size_t MB = 1024 * 1024;
+
+// Fixed seed so every split is fed the same tokens
+constexpr uint32_t TOKEN_SEED = 1234;
+
+// llama.cpp clamps this to every repeating layer plus the output layer
+constexpr int ALL_LAYERS = 999;
+
+double nowMs() {
+    using namespace std::chrono;
+    return duration<double, std::milli>(steady_clock::now().time_since_epoch()).count();
+}
+
+std::string escape(const std::string& value) {
+    std::string out;
+    for (char c : value) {
+        if (c == '"' || c == '\\') out += '\\';
+        if (static_cast<unsigned char>(c) >= 0x20) out += c;
+    }
+    return out;
+}
+
+// The device splits are measured on: the first GPU ggml found
+std::string primaryDevice() {
+    std::vector<GpuDevice> devices = listGpuDevices();
+    return devices.empty() ? "" : devices.front().description;
+}
+
+// Tune files live under <models dir>/gpu_tune/<model name>.txt
+std::string tunePath(const std::string& model_path, bool create_dir) {
+    size_t slash = model_path.find_last_of('/');
+    std::string dir = slash == std::string::npos ? "." : model_path.substr(0, slash);
+    std::string name = slash == std::string::npos ? model_path : model_path.substr(slash + 1);
+    size_t dot = name.find_last_of('.');
+    if (dot != std::string::npos && dot > 0) {
+        name = name.substr(0, dot);
+    }
+    dir += "/gpu_tune";
+    if (create_dir && mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+        return "";
+    }
+    return dir + "/" + name + ".txt";
+}
+
+// Identifies the exact file a tune was measured on
+std::string fileStamp(const std::string& path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) return "";
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%lld:%lld", static_cast<long long>(st.st_size),
+             static_cast<long long>(st.st_mtime));
+    return buf;
+}
+
+bool decodeTokens(llama_context* ctx, llama_batch& batch, const std::vector<llama_token>& tokens,
+                  int start, int n, int n_batch) {
+    for (int i = 0; i < n; i += n_batch) {
+        int n_eval = std::min(n_batch, n - i);
+        batch.n_tokens = 0;
+        for (int j = 0; j < n_eval; j++) {
+            int k = batch.n_tokens++;
+            batch.token[k] = tokens[(start + i + j) % tokens.size()];
+            batch.pos[k] = start + i + j;
+            batch.n_seq_id[k] = 1;
+            batch.seq_id[k][0] = 0;
+            batch.logits[k] = (i + j == n - 1);
+        }
+        if (llama_decode(ctx, batch) != 0) return false;
+    }
+    return true;
+}
+
+GpuSplitResult measureSplit(const std::string& model_path, int gpu_layers, int ubatch,
+                            int n_threads, int n_threads_batch, const GpuTuneConfig& config) {
+    GpuSplitResult result;
+    result.gpu_layers = gpu_layers;
+    result.ubatch = ubatch;
+    
+    llama_model_params model_params = llama_model_default_params();
+    model_params.n_gpu_layers = gpu_layers;
+    model_params.use_mmap = true;
+    
+    llama_model* model = llama_model_load_from_file(model_path.c_str(), model_params);
+    if (model == nullptr) {
+        LOGW("split %d: load failed", gpu_layers);
+        return result;
+    }
+    
+    // The engine's attention, KV type and threads, sized for one measurement
+    llama_context_params params = llama_context_default_params();
+    params.n_ctx = config.measure_prompt * 2 + config.measure_decode + 16;
+    params.n_batch = config.measure_prompt;
+    params.n_ubatch = std::min(ubatch, config.measure_prompt);
+    params.n_seq_max = 1;
+    params.n_threads = n_threads;
+    params.n_threads_batch = n_threads_batch;
+    params.flash_attn_type = LLAMA_FLASH_ATTN_TYPE_ENABLED;
+    params.type_k = config.kv_type;
+    params.type_v = config.kv_type;
+    params.no_perf = true;
+    
+    llama_context* ctx = llama_init_from_model(model, params);
+    if (ctx == nullptr) {
+        LOGW("split %d: context failed", gpu_layers);
+        llama_model_free(model);
+        return result;
+    }
+    
+    const llama_vocab* vocab = llama_model_get_vocab(model);
+    std::mt19937 rng(TOKEN_SEED);
+    std::uniform_int_distribution<int> dist(0, llama_vocab_n_tokens(vocab) - 1);
+    std::vector<llama_token> tokens(config.measure_prompt + config.measure_decode);
+    for (llama_token& token : tokens) token = dist(rng);
+    
+    llama_memory_t mem = llama_get_memory(ctx);
+    llama_batch batch = llama_batch_init(config.measure_prompt, 0, 1);
+    
+    // Warmup compiles the GPU pipelines and pages in the weights; the
+    // first pass on a GPU backend is far slower than the rest
+    bool ok = decodeTokens(ctx, batch, tokens, 0, config.measure_prompt, config.measure_prompt) &&
+              decodeTokens(ctx, batch, tokens, config.measure_prompt, 1, 1);
+    llama_synchronize(ctx);
+    llama_memory_clear(mem, true);
+    
+    double start = nowMs();
+    ok = ok && decodeTokens(ctx, batch, tokens, 0, config.measure_prompt, config.measure_prompt);
+    llama_synchronize(ctx);
+    double prefill_ms = nowMs() - start;
+    
+    start = nowMs();
+    for (int i = 0; ok && i < config.measure_decode; i++) {
+        ok = decodeTokens(ctx, batch, tokens, config.measure_prompt + i, 1, 1);
+    }
+    llama_synchronize(ctx);
+    double decode_ms = nowMs() - start;
+    
+    llama_batch_free(batch);
+    llama_free(ctx);
+    llama_model_free(model);
+    
+    if (!ok) {
+        LOGW("split %d: decode failed", gpu_layers);
+        return result;
+    }
+    
+    result.ok = true;
+    result.prefill_tps = config.measure_prompt * 1000.0 / std::max(prefill_ms, 1e-3);
+    result.decode_tps = config.measure_decode * 1000.0 / std::max(decode_ms, 1e-3);
+    result.turn_ms = config.turn_prompt * 1000.0 / result.prefill_tps +
+                     config.turn_decode * 1000.0 / result.decode_tps;
+    LOGI("split %d (ubatch %d): prefill %.1f t/s, decode %.1f t/s, turn %.0f ms",
+         gpu_layers, ubatch, result.prefill_tps, result.decode_tps, result.turn_ms);
+    return result;
+}
+
+} // namespace
+
+bool gpuBackendCompiled() {
+#ifdef CORTEX_GPU
+    return true;
+#else
+    return false;
+#endif
+}
+
+const char* gpuBackendName() {
+    return CORTEX_GPU_BACKEND_NAME;
+}
+
+std::vector<GpuDevice> listGpuDevices() {
+    std::vector<GpuDevice> devices;
+    if (!gpuBackendCompiled()) return devices;
+    
+    loadBackends();  // Without an engine yet, the GPU module may not be registered
+    for (size_t i = 0; i < ggml_backend_dev_count(); i++) {
+        ggml_backend_dev_t dev = ggml_backend_dev_get(i);
+        enum ggml_backend_dev_type type = ggml_backend_dev_type(dev);
+        if (type != GGML_BACKEND_DEVICE_TYPE_GPU && type != GGML_BACKEND_DEVICE_TYPE_IGPU) {
+            continue;
+        }
+        
+        GpuDevice device;
+        device.name = ggml_backend_dev_name(dev);
+        device.description = ggml_backend_dev_description(dev);
+        device.integrated = type == GGML_BACKEND_DEVICE_TYPE_IGPU;
+        ggml_backend_dev_memory(dev, &device.memory_free, &device.memory_total);
+        devices.push_back(device);
+    }
+    return devices;
+}
+
+GpuTuneResult tuneGpuLayers(const std::string& model_path, const GpuTuneConfig& config) {
+    GpuTuneResult result;
+    result.device = primaryDevice();
+    if (result.device.empty()) {
+        result.error = gpuBackendCompiled() ? "no GPU device found" : "built without a GPU backend";
+        return result;
+    }
+    
+    GGUFInfo info;
+    if (!readGGUFInfo(model_path, info, result.error)) {
+        return result;
+    }
+    result.n_layer = info.geometry.n_layer;
+    
+    std::vector<int> splits = config.splits;
+    if (splits.empty()) {
+        int n = result.n_layer;
+        splits = {0, n / 4, n / 2, n * 3 / 4, ALL_LAYERS};
+        splits.erase(std::unique(splits.begin(), splits.end()), splits.end());
+    }
+    
+    const CpuTopology& topology = CpuTopology::get();
+    int n_threads = config.threads > 0 ? config.threads : topology.defaultDecodeThreads();
+    int n_threads_batch = config.threads_batch > 0 ? config.threads_batch
+                        : topology.defaultPrefillThreads();
+    
+    LOGI("tuning %s on %s: %zu splits of %d layers", model_path.c_str(), result.device.c_str(),
+         splits.size(), result.n_layer);
+    
+    MemoryManager& memMgr = MemoryManager::getInstance();
+    for (int split : splits) {
+        // Offloaded weights are copied into GPU buffers next to the mapping
+        int layers = std::min(split, result.n_layer);
+        size_t offloaded = result.n_layer > 0 ? info.weight_bytes / result.n_layer * layers : 0;
+        if (memMgr.getAllocationBudget() < info.weight_bytes + offloaded) {
+            LOGW("split %d: needs %zu MB, skipped", split, (info.weight_bytes + offloaded) / MB);
+            continue;
+        }
+        
+        int ubatch = split > 0 ? config.gpu_ubatch : config.cpu_ubatch;
+        result.splits.push_back(measureSplit(model_path, split, ubatch, n_threads, n_threads_batch, config));
+    }
+    
+    // Offload only pays if it clearly beats the CPU; the CPU path is also
+    // the one with the fewest driver surprises
+    const GpuSplitResult* cpu = nullptr;
+    const GpuSplitResult* best = nullptr;
+    for (const GpuSplitResult& split : result.splits) {
+        if (!split.ok) continue;
+        if (split.gpu_layers == 0) cpu = &split;
+        if (best == nullptr || split.turn_ms < best->turn_ms) best = &split;
+    }
+    if (best == nullptr) {
+        result.error = "no split ran";
+        return result;
+    }
+    if (cpu != nullptr && best->gpu_layers > 0 && best->turn_ms > cpu->turn_ms * (1.0 - config.min_gain)) {
+        best = cpu;
+    }
+    
+    result.ok = true;
+    result.gpu_layers = best->gpu_layers;
+    result.ubatch = best->ubatch;
+    LOGI("best split: %d layers, ubatch %d", result.gpu_layers, result.ubatch);
+    return result;
+}
+
+std::string GpuTuneResult::toJson() const {
+    std::string out;
+    char buf[512];
+    snprintf(buf, sizeof(buf),
+             "{\"ok\":%s,\"error\":\"%s\",\"backend\":\"%s\",\"device\":\"%s\",\"n_layer\":%d,"
+             "\"gpu_layers\":%d,\"ubatch\":%d,\"splits\":[",
+             ok ? "true" : "false", escape(error).c_str(), gpuBackendName(), escape(device).c_str(), n_layer,
+             gpu_layers, ubatch);
+    out += buf;
+    for (size_t i = 0; i < splits.size(); i++) {
+        const GpuSplitResult& split = splits[i];
+        snprintf(buf, sizeof(buf),
+                 "%s{\"gpu_layers\":%d,\"ubatch\":%d,\"ok\":%s,\"prefill_tps\":%.2f,"
+                 "\"decode_tps\":%.2f,\"turn_ms\":%.1f}",
+                 i ? "," : "", split.gpu_layers, split.ubatch, split.ok ? "true" : "false",
+                 split.prefill_tps, split.decode_tps, split.turn_ms);
+        out += buf;
+    }
+    out += "]}";
+    return out;
+}
+
+bool loadGpuTune(const std::string& model_path, int& gpu_layers, int& ubatch) {
+    FILE* f = fopen(tunePath(model_path, false).c_str(), "r");
+    if (f == nullptr) return false;
+    
+    std::string device, stamp;
+    int layers = -1, batch = 0;
+    char line[512];
+    while (fgets(line, sizeof(line), f) != nullptr) {
+        line[strcspn(line, "\n")] = '\0';
+        if (strncmp(line, "device=", 7) == 0) device = line + 7;
+        else if (strncmp(line, "file=", 5) == 0) stamp = line + 5;
+        else if (strncmp(line, "gpu_layers=", 11) == 0) layers = atoi(line + 11);
+        else if (strncmp(line, "ubatch=", 7) == 0) batch = atoi(line + 7);
+    }
+    fclose(f);
+    
+    // A new driver name or re-downloaded model needs a new measurement
+    if (layers < 0 || device != primaryDevice() || stamp != fileStamp(model_path)) {
+        return false;
+    }
+    gpu_layers = layers;
+    ubatch = batch;
+    return true;
+}
+
+bool saveGpuTune(const std::string& model_path, const GpuTuneResult& result) {
+    if (!result.ok) return false;
+    std::string path = tunePath(model_path, true);
+    if (path.empty()) return false;
+    
+    FILE* f = fopen(path.c_str(), "w");
+    if (f == nullptr) return false;
+    fprintf(f, "device=%s\nfile=%s\ngpu_layers=%d\nubatch=%d\n", result.device.c_str(),
+            fileStamp(model_path).c_str(), result.gpu_layers, result.ubatch);
+    fclose(f);
+    return true;
+}
+
+} // namespace cortex
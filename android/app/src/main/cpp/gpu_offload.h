@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "ggml.h"
+
+namespace cortex {
+
+// Built with -DCORTEX_GPU_BACKEND=vulkan|opencl; CPU-only otherwise
+bool gpuBackendCompiled();
+const char* gpuBackendName();
+
+struct GpuDevice {
+    std::string name;
+    std::string description;
+    bool integrated = true;        // Shares RAM with the CPU (every phone GPU)
+    size_t memory_free = 0;
+    size_t memory_total = 0;
+};
+
+// GPU devices the compiled backend found at runtime; empty on CPU builds
+// or when the driver is missing
+std::vector<GpuDevice> listGpuDevices();
+
+struct GpuTuneConfig {
+    std::vector<int> splits;       // gpu_layers to try; empty: none, 1/4, 1/2, 3/4, all
+    
+    // A typical chat turn; each split is scored by its time for one
+    int turn_prompt = 256;
+    int turn_decode = 64;
+    
+    int measure_prompt = 128;      // Tokens prefilled per measurement
+    int measure_decode = 16;       // Tokens generated per measurement
+    int cpu_ubatch = 32;           // The engine's CPU ubatch
+    int gpu_ubatch = 128;          // GPU kernels want wider batches
+    int threads = 0;               // Decode threads; 0: CPU topology default, as in the engine
+    int threads_batch = 0;         // Prefill threads; 0: CPU topology default
+    ggml_type kv_type = GGML_TYPE_F16;  // The engine's K/V type
+    
+    double min_gain = 0.05;        // Offload must beat CPU-only by this much
+};
+
+struct GpuSplitResult {
+    int gpu_layers = 0;
+    int ubatch = 0;
+    bool ok = false;
+    double prefill_tps = 0;
+    double decode_tps = 0;
+    double turn_ms = 0;
+};
+
+struct GpuTuneResult {
+    bool ok = false;
+    std::string error;
+    std::string device;
+    int n_layer = 0;
+    int gpu_layers = 0;            // Best split
+    int ubatch = 0;
+    std::vector<GpuSplitResult> splits;
+    
+    std::string toJson() const;
+};
+
+// Loads the model once per split with nothing else resident, measures
+// prefill and decode speed, and picks the fastest split for a chat turn.
+// Slow (one load per split), so run once per model and cache the result.
+GpuTuneResult tuneGpuLayers(const std::string& model_path, const GpuTuneConfig& config);
+
+// Tuned split for this model file on this device, kept under
+// <models dir>/gpu_tune/. False if not tuned, or the file or device changed.
+bool loadGpuTune(const std::string& model_path, int& gpu_layers, int& ubatch);
+bool saveGpuTune(const std::string& model_path, const GpuTuneResult& result);
+
+} // namespace cortex
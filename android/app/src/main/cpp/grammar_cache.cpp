@@ -0,0 +1,98 @@
+#include "grammar_cache.h"
+#include "json_schema.h"
+#include <functional>
+
+#ifdef __ANDROID__
+    #include <android/log.h>
+    #define LOG_TAG "CortexGrammar"
+    #define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
+    #define LOGW(...) __android_log_print(ANDROID_LOG_WARN, LOG_TAG, __VA_ARGS__)
+#else
+    #include <cstdio>
+    #define LOG_TAG "CortexGrammar"
+    #define LOGD(...) printf("[DEBUG] " __VA_ARGS__); printf("\n")
+    #define LOGW(...) printf("[WARN] " __VA_ARGS__); printf("\n")
+#endif
+
+namespace cortex {
+
+GrammarCache::~GrammarCache() {
+    clear();
+}
+
+llama_sampler* GrammarCache::acquire(const llama_vocab* vocab, const std::string& grammar,
+                                     const std::string& json_schema, std::string& error) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (vocab != vocab_) {
+        for (Entry& entry : entries_) {
+            if (entry.sampler != nullptr) llama_sampler_free(entry.sampler);
+        }
+        entries_.clear();
+        vocab_ = vocab;
+    }
+    
+    // The kind is part of the key: the same text means different things
+    std::string source = json_schema.empty() ? "gbnf:" + grammar : "schema:" + json_schema;
+    size_t hash = std::hash<std::string>()(source);
+    
+    Entry* found = nullptr;
+    for (Entry& entry : entries_) {
+        if (entry.hash == hash && entry.source == source) {
+            found = &entry;
+            break;
+        }
+    }
+    if (found == nullptr) {
+        found = &compile(hash, source, grammar, json_schema);
+    }
+    found->last_used = ++use_counter_;
+    
+    if (found->sampler == nullptr) {
+        error = found->error;
+        return nullptr;
+    }
+    return llama_sampler_clone(found->sampler);
+}
+
+GrammarCache::Entry& GrammarCache::compile(size_t hash, const std::string& source,
+                                           const std::string& grammar, const std::string& json_schema) {
+    if (entries_.size() >= CAPACITY) {
+        size_t oldest = 0;
+        for (size_t i = 1; i < entries_.size(); i++) {
+            if (entries_[i].last_used < entries_[oldest].last_used) oldest = i;
+        }
+        if (entries_[oldest].sampler != nullptr) llama_sampler_free(entries_[oldest].sampler);
+        entries_.erase(entries_.begin() + oldest);
+    }
+    
+    entries_.emplace_back();
+    Entry& entry = entries_.back();
+    entry.hash = hash;
+    entry.source = source;
+    
+    std::string gbnf = grammar;
+    if (!json_schema.empty() && !jsonSchemaToGrammar(json_schema, gbnf, entry.error)) {
+        LOGW("json schema rejected: %s", entry.error.c_str());
+        return entry;
+    }
+    
+    entry.sampler = llama_sampler_init_grammar(vocab_, gbnf.c_str(), "root");
+    if (entry.sampler == nullptr) {
+        entry.error = "grammar does not parse";
+        LOGW("grammar rejected (%zu chars)", gbnf.size());
+    } else {
+        LOGD("grammar compiled: %zu chars, %zu cached", gbnf.size(), entries_.size());
+    }
+    return entry;
+}
+
+void GrammarCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (Entry& entry : entries_) {
+        if (entry.sampler != nullptr) llama_sampler_free(entry.sampler);
+    }
+    entries_.clear();
+    vocab_ = nullptr;
+}
+
+} // namespace cortex
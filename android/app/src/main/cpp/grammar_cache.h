@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "llama.h"
+
+namespace cortex {
+
+// Compiled grammar samplers keyed by a hash of their source. Parsing GBNF
+// (after converting a JSON schema, when that is what was given) costs far
+// more than cloning the parsed result, and structured-output requests
+// reuse the same few grammars. Each request gets its own clone, since the
+// clone carries the parse state of that one generation.
+class GrammarCache {
+public:
+    static const size_t CAPACITY = 8;
+    
+    GrammarCache() = default;
+    ~GrammarCache();
+    
+    GrammarCache(const GrammarCache&) = delete;
+    GrammarCache& operator=(const GrammarCache&) = delete;
+    
+    // A fresh sampler enforcing the grammar, or the schema when one is
+    // given; the caller owns it. nullptr with error set if it does not
+    // compile. Failures are cached as well.
+    llama_sampler* acquire(const llama_vocab* vocab, const std::string& grammar,
+                           const std::string& json_schema, std::string& error);
+    
+    void clear();  // Samplers are tied to the vocab; call when the model changes
+
+private:
+    struct Entry {
+        size_t hash = 0;
+        std::string source;
+        llama_sampler* sampler = nullptr;  // nullptr: did not compile
+        std::string error;
+        uint64_t last_used = 0;
+    };
+    
+    std::mutex mutex_;
+    const llama_vocab* vocab_ = nullptr;
+    std::vector<Entry> entries_;
+    uint64_t use_counter_ = 0;
+    
+    Entry& compile(size_t hash, const std::string& source, const std::string& grammar,
+                   const std::string& json_schema);
+};
+
+} // namespace cortex
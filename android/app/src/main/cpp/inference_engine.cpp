@@ -1,11 +1,14 @@
 #include "inference_engine.h"
+#include "generation_session.h"
+#include "cpu_backend.h"
+#include <algorithm>
 #include <chrono>
+#include <cstdio>
+#include <sys/stat.h>
 #include <thread>
 
 #ifdef __ANDROID__
     #include <android/log.h>
-    #include <sched.h>
-    #include <pthread.h>
     #define LOG_TAG "CortexInference"
     #define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
     #define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
@@ -22,19 +25,92 @@
 
 namespace cortex {
 
+// Prefix cache entries live under <models dir>/prefix_cache/<model name>
+static std::string prefixCacheDir(const std::string& model_path) {
+    size_t slash = model_path.find_last_of('/');
+    std::string dir = slash == std::string::npos ? "." : model_path.substr(0, slash);
+    std::string name = slash == std::string::npos ? model_path : model_path.substr(slash + 1);
+    size_t dot = name.find_last_of('.');
+    if (dot != std::string::npos && dot > 0) {
+        name = name.substr(0, dot);
+    }
+    return dir + "/prefix_cache/" + name;
+}
+
+// What a prefix entry's KV state depends on: the weights, told apart by
+// size and mtime (a re-download lands on the same path), and the KV type
+static std::string prefixCacheKey(const std::string& model_path, ggml_type kv_type) {
+    struct stat st;
+    long long size = 0;
+    long long mtime = 0;
+    if (stat(model_path.c_str(), &st) == 0) {
+        size = static_cast<long long>(st.st_size);
+        mtime = static_cast<long long>(st.st_mtime);
+    }
+    char stamp[96];
+    snprintf(stamp, sizeof(stamp), "|%lld:%lld|%s", size, mtime, ggml_type_name(kv_type));
+    return model_path + stamp;
+}
+
+// FNV-1a, extended piece by piece as a chat grows
+constexpr uint64_t CHAT_HASH_BASIS = 0xcbf29ce484222325ULL;
+
+static uint64_t hashText(uint64_t hash, const std::string& text) {
+    for (unsigned char c : text) {
+        hash ^= c;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// KV cache types llama.cpp handles on CPU with flash attention
+static ggml_type kvCacheType(ggml_type requested) {
+    if (requested == GGML_TYPE_F16 || requested == GGML_TYPE_Q8_0 || requested == GGML_TYPE_Q4_0) {
+        return requested;
+    }
+    LOGW("unsupported KV cache type %s, using f16", ggml_type_name(requested));
+    return GGML_TYPE_F16;
+}
+
+// Some head sizes cannot be stored quantized; fall back to f16 rather than
+// failing the load
+static llama_context* createContext(llama_model* model, llama_context_params& params) {
+    llama_context* ctx = llama_init_from_model(model, params);
+    if (ctx == nullptr && (params.type_k != GGML_TYPE_F16 || params.type_v != GGML_TYPE_F16)) {
+        LOGW("%s KV cache rejected, retrying with f16", ggml_type_name(params.type_k));
+        params.type_k = GGML_TYPE_F16;
+        params.type_v = GGML_TYPE_F16;
+        ctx = llama_init_from_model(model, params);
+    }
+    return ctx;
+}
+
 InferenceEngine::InferenceEngine() {
+    // Backend modules have to be registered before llama looks for devices
+    loadBackends();
     llama_backend_init();
 }
 
 InferenceEngine::~InferenceEngine() {
+    // The generation thread goes before anything it decodes with; it may
+    // still look for the session while it stops, so not under the lock
+    std::unique_ptr<GenerationSession> session;
+    {
+        std::lock_guard<std::mutex> lock(session_mutex_);
+        session = std::move(session_);
+    }
+    session.reset();
+    
+    // Nothing is parked once the engine goes
+    model_cache_ = nullptr;
     unloadModel();
+    unloadDraftModel();
     llama_backend_free();
 }
 
-bool InferenceEngine::loadModel(const std::string& model_path, const InferenceConfig& config) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    
-    // Unload any existing model
+bool InferenceEngine::loadModel(const std::string& model_path, const InferenceConfig& config,
+                                LoadProgressCallback progress) {
+    // Unload any existing model; it takes the lock itself
     if (model_ != nullptr) {
         unloadModel();
     }
@@ -45,53 +121,215 @@ bool InferenceEngine::loadModel(const std::string& model_path, const InferenceCo
     model_params.n_gpu_layers = config.gpu_layers;
     model_params.use_mmap = config.use_mmap;
     model_params.use_mlock = config.use_mlock;
+    model_params.use_extra_bufts = config.repack_weights;
+    if (progress) {
+        // Returning false from the callback aborts the load
+        model_params.progress_callback = [](float value, void* user_data) {
+            return (*static_cast<LoadProgressCallback*>(user_data))(value);
+        };
+        model_params.progress_callback_user_data = &progress;
+    }
     
-    // Load the model
-    model_ = llama_model_load_from_file(model_path.c_str(), model_params);
-    if (model_ == nullptr) {
-        LOGE("failed to load: %s", model_path.c_str());
+    // A model used earlier may still be resident; only its context is new
+    llama_model* model = model_cache_ != nullptr ? model_cache_->take(model_path, model_params) : nullptr;
+    if (model != nullptr) {
+        if (progress) progress(1.0f);
+    } else {
+        // Load the model. This is the slow part and needs none of the
+        // engine's state, so it runs unlocked.
+        int64_t load_start = getCurrentTimeMs();
+        model = llama_model_load_from_file(model_path.c_str(), model_params);
+        if (model == nullptr) {
+            LOGE("failed to load: %s", model_path.c_str());
+            return false;
+        }
+        LOGI("loaded in %lld ms%s", static_cast<long long>(getCurrentTimeMs() - load_start),
+             config.repack_weights ? ", weights repacked for this CPU" : "");
+    }
+    
+    std::lock_guard<std::mutex> lock(mutex_);
+    model_ = model;
+    model_params_ = model_params;
+    model_params_.progress_callback = nullptr;
+    model_params_.progress_callback_user_data = nullptr;
+    model_path_ = model_path;
+    
+    // Decode and prefill get separate thread counts and core sets; the
+    // pools are attached below, the context's counts match them as a fallback
+    scheduler_.configure(config.threads, config.threads_batch);
+    int n_slots = std::max(1, config.conversation_slots);
+    llama_context_params ctx_params = contextParams(config);
+    
+    // create context
+    ctx_ = createContext(model_, ctx_params);
+    if (ctx_ == nullptr) {
+        LOGE("failed to create context");
+        releaseModel();
         return false;
     }
     
-    // context params with optimizations
+    scheduler_.attach(ctx_);
+    if (draft_ctx_ != nullptr) {
+        scheduler_.attach(draft_ctx_);
+    }
+    
+    // Initialize sampler
+    initSampler(config);
+    
+    // One batch for every decode, sized for a full prompt chunk and able to
+    // address all conversation slots and background sequences
+    batch_ = llama_batch_init(config.batch_size, 0, ctx_params.n_seq_max);
+    batch_capacity_ = config.batch_size;
+    
+    // Conversation 0 is active until the app selects one
+    initKVCache(ctx_params, n_slots);
+    seq_id_ = kv_cache_.acquireSlot(0);
+    background_base_ = n_slots;
+    
+    // Store config
+    current_config_ = config;
+    current_config_.kv_type = ctx_params.type_k;
+    chat_template_.init(model_);
+    
+    if (config.prefix_cache) {
+        PrefixCacheConfig cache_config;
+        if (config.prefix_cache_persist) {
+            cache_config.disk_dir = prefixCacheDir(model_path);
+        }
+        prefix_cache_.attach(prefixCacheKey(model_path, ctx_params.type_k), cache_config);
+    }
+    
+    return true;
+}
+
+llama_context_params InferenceEngine::contextParams(const InferenceConfig& config) const {
     llama_context_params ctx_params = llama_context_default_params();
     
-    ctx_params.n_ctx = config.context_length;
+    // Every conversation slot gets a full context window, each background
+    // sequence a small one. The cache is unified so forked conversations
+    // share their common prefix cells.
+    int n_slots = std::max(1, config.conversation_slots);
+    int n_background = std::max(0, config.background_sequences);
+    ctx_params.n_ctx = config.context_length * n_slots + config.background_context * n_background;
     ctx_params.n_batch = config.batch_size;
+    ctx_params.n_seq_max = n_slots + n_background;
+    ctx_params.kv_unified = true;
     
-    int n_cores = std::thread::hardware_concurrency();
-    ctx_params.n_threads = std::max(1, n_cores - 1);
-    ctx_params.n_threads_batch = n_cores;
+    ctx_params.n_threads = scheduler_.decodeThreads();
+    ctx_params.n_threads_batch = scheduler_.prefillThreads();
     
-    // flash attention + f16 kv cache
+    // flash attention + configured kv cache type
     ctx_params.flash_attn_type = LLAMA_FLASH_ATTN_TYPE_ENABLED;
-    ctx_params.type_k = GGML_TYPE_F16;
-    ctx_params.type_v = GGML_TYPE_F16;
-    ctx_params.n_ubatch = 32;
+    ctx_params.type_k = kvCacheType(config.kv_type);
+    ctx_params.type_v = ctx_params.type_k;
+    ctx_params.n_ubatch = std::min(config.ubatch_size, config.batch_size);
     ctx_params.embeddings = false;
     ctx_params.no_perf = true;
+    return ctx_params;
+}
+
+void InferenceEngine::initKVCache(const llama_context_params& ctx_params, int n_slots) {
+    // Only the conversation slots; background sequences are managed here
+    KVCacheConfig kv_config;
+    kv_config.n_ctx = ctx_params.n_ctx;
+    kv_config.n_batch = ctx_params.n_batch;
+    kv_config.n_seq = n_slots;
+    kv_config.type_k = ctx_params.type_k;
+    kv_config.type_v = ctx_params.type_v;
+    kv_config.geometry = KVCacheGeometry::fromModel(model_);
+    kv_cache_.initialize(ctx_, kv_config);
+}
+
+bool InferenceEngine::shrinkContext(int context_length, ggml_type kv_type, int ubatch_size) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!isModelLoaded()) return false;
+    
+    InferenceConfig config = current_config_;
+    config.context_length = std::min(context_length, current_config_.context_length);
+    config.kv_type = kv_type;
+    config.ubatch_size = ubatch_size;
+    
+    // A prompt still being decoded is given up; the caller sees the
+    // generation end. The draft goes next. Tokens the user has already seen
+    // stay and are decoded again below, so sampling continues from the
+    // same place.
+    if (prefill_pending_) {
+        abortPrefill();
+        finish(FinishReason::Stopped);
+    }
+    std::vector<llama_token> pending;
+    reconcileSpeculative(pending);
+    tokens_.insert(tokens_.end(), pending.begin(), pending.end());
+    n_past_ = tokens_.size();
+    freeDraft();
+    
+    // Fit the active conversation into the smaller window; without context
+    // shifting the window keeps its size and only the type/ubatch change
+    int old_context = current_config_.context_length;
+    current_config_.context_length = config.context_length;
+    if (!makeRoom(current_config_.shift_margin)) {
+        LOGW("cannot shift into a %d-token context", config.context_length);
+        config.context_length = old_context;
+    }
+    current_config_.context_length = old_context;
     
-    // create context
-    ctx_ = llama_init_from_model(model_, ctx_params);
+    ConversationSlot* slot = kv_cache_.getSlot(seq_id_);
+    int64_t conversation_id = slot != nullptr ? slot->conversation_id : 0;
+    
+    // Other conversations are dropped; they are re-evaluated when selected.
+    // Background sessions end, they are cheap to ask for again.
+    endAllBackground(FinishReason::Stopped);
+    kv_cache_.shutdown();
+    scheduler_.detach(ctx_);
+    llama_free(ctx_);
+    
+    llama_context_params ctx_params = contextParams(config);
+    ctx_ = createContext(model_, ctx_params);
     if (ctx_ == nullptr) {
-        LOGE("failed to create context");
-        llama_model_free(model_);
-        model_ = nullptr;
+        LOGE("failed to recreate context at %d tokens", config.context_length);
+        finish(FinishReason::Error);
+        tokens_.clear();
+        n_past_ = 0;
+        current_pos_ = 0;
         return false;
     }
+    scheduler_.attach(ctx_);
     
-    // Initialize sampler
-    initSampler(config);
-    
-    // Store config and path
+    initKVCache(ctx_params, std::max(1, config.conversation_slots));
+    seq_id_ = kv_cache_.acquireSlot(conversation_id);
+    if (ctx_params.type_k != current_config_.kv_type) {
+        prefix_cache_.rekey(prefixCacheKey(model_path_, ctx_params.type_k));
+    }
     current_config_ = config;
-    model_path_ = model_path;
+    current_config_.kv_type = ctx_params.type_k;
+    
+    if (!tokens_.empty()) {
+        if (!evaluateTokens(tokens_, 0, tokens_.size())) {
+            LOGE("failed to restore the conversation after shrinking");
+            finish(FinishReason::Error);
+            tokens_.clear();
+        }
+        n_past_ = tokens_.size();
+        current_pos_ = n_past_;
+        kv_cache_.getSlot(seq_id_)->tokens = tokens_;
+        kv_cache_.getSlot(seq_id_)->n_keep = n_keep_;
+    }
     
+    LOGI("context rebuilt: %d tokens x %d slots, kv=%s, ubatch=%d, %d restored",
+         config.context_length, ctx_params.n_seq_max, ggml_type_name(ctx_params.type_k),
+         ctx_params.n_ubatch, n_past_);
     return true;
 }
 
+size_t InferenceEngine::dropCaches() {
+    size_t before = prefix_cache_.getStats().memory_bytes;
+    prefix_cache_.clearMemory();
+    return before;
+}
+
 void InferenceEngine::unloadModel() {
     stop_requested_ = true;
+    finish(FinishReason::Stopped);
     
     // Wait for generation to stop
     while (is_generating_) {
@@ -100,17 +338,32 @@ void InferenceEngine::unloadModel() {
     
     std::lock_guard<std::mutex> lock(mutex_);
     
-    freeSampler();
+    abortPrefill();
+    endAllBackground(FinishReason::Stopped);
+    sampler_.release();
+    grammar_cache_.clear();
+    kv_cache_.shutdown();
+    chat_template_.clear();
+    
+    if (batch_capacity_ > 0) {
+        llama_batch_free(batch_);
+        batch_ = {};
+        batch_capacity_ = 0;
+    }
+    seq_id_ = 0;
+    n_keep_ = 0;
     
     if (ctx_ != nullptr) {
         llama_free(ctx_);
         ctx_ = nullptr;
     }
     
-    if (model_ != nullptr) {
-        llama_model_free(model_);
-        model_ = nullptr;
-    }
+    // The draft may outlive the target; it falls back to its own threads
+    scheduler_.detach(draft_ctx_);
+    scheduler_.release();
+    governor_.reset();
+    
+    releaseModel();
     
     tokens_.clear();
     current_pos_ = 0;
@@ -118,6 +371,16 @@ void InferenceEngine::unloadModel() {
     stop_requested_ = false;
 }
 
+void InferenceEngine::releaseModel() {
+    if (model_ == nullptr) return;
+    if (model_cache_ != nullptr) {
+        model_cache_->park(model_path_, model_params_, model_);
+    } else {
+        llama_model_free(model_);
+    }
+    model_ = nullptr;
+}
+
 bool InferenceEngine::isModelLoaded() const {
     return model_ != nullptr && ctx_ != nullptr;
 }
@@ -138,53 +401,156 @@ std::string InferenceEngine::getModelInfo() const {
     return info;
 }
 
-void InferenceEngine::initSampler(const InferenceConfig& config) {
-    freeSampler();
+bool InferenceEngine::loadDraftModel(const std::string& model_path) {
+    unloadDraftModel();
     
-    // Create sampler chain
-    llama_sampler_chain_params chain_params = llama_sampler_chain_default_params();
-    sampler_ = llama_sampler_chain_init(chain_params);
+    std::lock_guard<std::mutex> lock(mutex_);
     
-    // Add samplers to the chain
-    // Repetition penalty (new API: only 4 args)
-    llama_sampler_chain_add(sampler_, 
-        llama_sampler_init_penalties(
-            config.repeat_last_n,       // penalty_last_n
-            config.repeat_penalty,      // penalty_repeat
-            0.0f,                        // penalty_freq
-            0.0f                         // penalty_present
-        )
-    );
+    LOGI("loading draft: %s", model_path.c_str());
     
-    // Top-K sampling
-    llama_sampler_chain_add(sampler_, 
-        llama_sampler_init_top_k(config.top_k)
-    );
+    llama_model_params model_params = llama_model_default_params();
+    model_params.n_gpu_layers = 0;
+    model_params.use_mmap = true;
     
-    // Top-P (nucleus) sampling
-    llama_sampler_chain_add(sampler_, 
-        llama_sampler_init_top_p(config.top_p, 1)
-    );
+    draft_model_ = llama_model_load_from_file(model_path.c_str(), model_params);
+    if (draft_model_ == nullptr) {
+        LOGE("failed to load draft: %s", model_path.c_str());
+        return false;
+    }
     
-    // Temperature
-    llama_sampler_chain_add(sampler_, 
-        llama_sampler_init_temp(config.temperature)
-    );
+    // The draft only ever sees the prompt plus a few proposed tokens, so it
+    // mirrors the target context size and batch
+    llama_context_params ctx_params = llama_context_default_params();
+    ctx_params.n_ctx = current_config_.context_length;
+    ctx_params.n_batch = current_config_.batch_size;
+    ctx_params.n_ubatch = std::min(current_config_.ubatch_size, current_config_.batch_size);
+    
+    // Shares the target's pools when there is one
+    const CpuTopology& topology = CpuTopology::get();
+    ctx_params.n_threads = scheduler_.decodeThreads() > 0 ? scheduler_.decodeThreads()
+                                                          : topology.defaultDecodeThreads();
+    ctx_params.n_threads_batch = scheduler_.prefillThreads() > 0 ? scheduler_.prefillThreads()
+                                                                 : topology.defaultPrefillThreads();
+    ctx_params.flash_attn_type = LLAMA_FLASH_ATTN_TYPE_ENABLED;
+    ctx_params.type_k = kvCacheType(current_config_.kv_type);
+    ctx_params.type_v = ctx_params.type_k;
+    ctx_params.no_perf = true;
     
-    // Distribution sampler (final selection)
-    llama_sampler_chain_add(sampler_, 
-        llama_sampler_init_dist(LLAMA_DEFAULT_SEED)
-    );
+    draft_ctx_ = createContext(draft_model_, ctx_params);
+    draft_kv_type_ = ctx_params.type_k;
+    if (draft_ctx_ == nullptr) {
+        LOGE("failed to create draft context");
+        llama_model_free(draft_model_);
+        draft_model_ = nullptr;
+        return false;
+    }
+    scheduler_.attach(draft_ctx_);
+    
+    // Greedy drafting: the draft only needs its most likely continuation
+    draft_sampler_ = llama_sampler_chain_init(llama_sampler_chain_default_params());
+    llama_sampler_chain_add(draft_sampler_, llama_sampler_init_greedy());
     
-    LOGD("Sampler initialized: temp=%.2f, top_k=%d, top_p=%.2f, repeat_penalty=%.2f",
-         config.temperature, config.top_k, config.top_p, config.repeat_penalty);
+    draft_n_past_ = 0;
+    return true;
+}
+
+void InferenceEngine::unloadDraftModel() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    freeDraft();
+}
+
+void InferenceEngine::freeDraft() {
+    speculative_ = false;
+    spec_pending_.clear();
+    
+    if (draft_sampler_ != nullptr) {
+        llama_sampler_free(draft_sampler_);
+        draft_sampler_ = nullptr;
+    }
+    if (draft_ctx_ != nullptr) {
+        llama_free(draft_ctx_);
+        draft_ctx_ = nullptr;
+    }
+    if (draft_model_ != nullptr) {
+        llama_model_free(draft_model_);
+        draft_model_ = nullptr;
+    }
+    draft_n_past_ = 0;
+}
+
+bool InferenceEngine::hasDraftModel() const {
+    return draft_model_ != nullptr && draft_ctx_ != nullptr;
+}
+
+bool InferenceEngine::isDraftCompatible() const {
+    if (!isModelLoaded() || !hasDraftModel()) return false;
+    
+    const llama_vocab* target_vocab = llama_model_get_vocab(model_);
+    const llama_vocab* draft_vocab = llama_model_get_vocab(draft_model_);
+    
+    // Draft tokens are verified by id, so both models must tokenize identically
+    if (llama_vocab_n_tokens(target_vocab) != llama_vocab_n_tokens(draft_vocab) ||
+        llama_vocab_bos(target_vocab) != llama_vocab_bos(draft_vocab) ||
+        llama_vocab_eos(target_vocab) != llama_vocab_eos(draft_vocab)) {
+        LOGW("draft vocab mismatch: target=%d draft=%d tokens",
+             llama_vocab_n_tokens(target_vocab), llama_vocab_n_tokens(draft_vocab));
+        return false;
+    }
+    
+    return true;
+}
+
+static SamplerParams samplerParams(const InferenceConfig& config) {
+    SamplerParams params;
+    params.temperature = config.temperature;
+    params.top_p = config.top_p;
+    params.top_k = config.top_k;
+    params.repeat_penalty = config.repeat_penalty;
+    params.repeat_last_n = config.repeat_last_n;
+    params.seed = config.seed;
+    return params;
+}
+
+bool InferenceEngine::initSampler(const InferenceConfig& config) {
+    // Only rebuilt when a setting changed
+    const llama_vocab* vocab = llama_model_get_vocab(model_);
+    if (sampler_.configure(samplerParams(config), vocab)) {
+        LOGD("Sampler initialized: temp=%.2f, top_k=%d, top_p=%.2f, repeat_penalty=%.2f",
+             config.temperature, config.top_k, config.top_p, config.repeat_penalty);
+    }
+    
+    // The grammar's parse state belongs to one generation, so every start
+    // takes a fresh copy
+    llama_sampler* grammar = nullptr;
+    if (!config.grammar.empty() || !config.json_schema.empty()) {
+        std::string error;
+        grammar = grammar_cache_.acquire(vocab, config.grammar, config.json_schema, error);
+        if (grammar == nullptr) {
+            LOGE("grammar failed: %s", error.c_str());
+            sampler_.setGrammar(nullptr);
+            return false;
+        }
+    }
+    sampler_.setGrammar(grammar);
+    return true;
 }
 
-void InferenceEngine::freeSampler() {
-    if (sampler_ != nullptr) {
-        llama_sampler_free(sampler_);
-        sampler_ = nullptr;
+bool InferenceEngine::checkGrammar(const InferenceConfig& config, std::string& error) {
+    if (config.grammar.empty() && config.json_schema.empty()) {
+        return true;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (model_ == nullptr) {
+        error = "model not loaded";
+        return false;
+    }
+    llama_sampler* grammar = grammar_cache_.acquire(llama_model_get_vocab(model_), config.grammar,
+                                                    config.json_schema, error);
+    if (grammar == nullptr) {
+        return false;
     }
+    llama_sampler_free(grammar);
+    return true;
 }
 
 bool InferenceEngine::startInference(const std::string& prompt, const InferenceConfig& config) {
@@ -197,48 +563,71 @@ bool InferenceEngine::startInference(const std::string& prompt, const InferenceC
     if (is_generating_) {
         LOGW("Previous generation still marked as active, forcing stop");
         stop_requested_ = true;
-        is_generating_ = false;
+        finish(FinishReason::Stopped);
     }
     
     std::lock_guard<std::mutex> lock(mutex_);
     
     // Reset state - clear everything for fresh start
+    abortPrefill();
     stop_requested_ = false;
+    finish_reason_ = FinishReason::None;
+    speculative_ = false;
+    spec_pending_.clear();
     tokens_.clear();
     current_pos_ = 0;
     n_past_ = 0;
+    chat_hash_ = 0;    // startChat() sets it again for a chat
+    detokenizer_.reset(llama_model_get_vocab(model_));
     
-    // Update sampler with new config if needed
-    current_config_ = config;
-    initSampler(config);
+    // Same settings keep the sampler; a fresh sequence starts a fresh
+    // penalty window
+    applyConfig(config);
+    if (!initSampler(config)) {
+        return false;
+    }
+    sampler_.reset();
     
     // Tokenize the prompt
-    if (!tokenizePrompt(prompt, tokens_)) {
+    if (!tokenizePrompt(prompt, tokens_, true)) {
         LOGE("tokenize failed");
         return false;
     }
     
-    // Clear the memory (KV cache)
-    llama_memory_t mem = llama_get_memory(ctx_);
-    if (mem != nullptr) {
-        llama_memory_clear(mem, true);
+    // Clear the active conversation's sequence; other slots stay resident
+    kv_cache_.sequenceRemove(seq_id_, -1, -1);
+    n_keep_ = 0;
+    pinPrompt(tokens_.size());
+    
+    // The draft re-syncs from tokens_ on the next speculative step
+    if (draft_ctx_ != nullptr) {
+        llama_memory_t draft_mem = llama_get_memory(draft_ctx_);
+        if (draft_mem != nullptr) {
+            llama_memory_clear(draft_mem, true);
+        }
+        draft_n_past_ = 0;
     }
     
     // Record start time
     eval_start_time_ = getCurrentTimeMs();
+    governor_.beginGeneration();
     stats_.prompt_tokens = tokens_.size();
     stats_.generated_tokens = 0;
     
-    // Evaluate prompt tokens
-    if (!evaluateTokens(tokens_, 0, tokens_.size())) {
-        LOGE("prompt eval failed");
+    // Skip the longest prefix whose KV state is already cached
+    int n_cached = config.prefix_cache ? prefix_cache_.restore(ctx_, tokens_, seq_id_) : 0;
+    stats_.cached_tokens = n_cached;
+    bool store_prefix = config.prefix_cache && n_cached < static_cast<int>(tokens_.size()) - 1;
+    
+    // The rest of the prompt still has to be decoded; a stop before it
+    // finishes leaves the sequence empty
+    std::vector<llama_token> remaining(tokens_.begin() + n_cached, tokens_.end());
+    tokens_.resize(n_cached);
+    n_past_ = n_cached;
+    current_pos_ = n_cached;
+    if (!beginPrefill(std::move(remaining), 0, store_prefix)) {
         return false;
     }
-    
-    stats_.prompt_eval_time_ms = getCurrentTimeMs() - eval_start_time_;
-    
-    n_past_ = tokens_.size();
-    current_pos_ = tokens_.size();
     is_generating_ = true;
     
     return true;
@@ -252,202 +641,669 @@ bool InferenceEngine::startInferenceIncremental(const std::string& prompt, const
     
     if (is_generating_) {
         stop_requested_ = true;
-        is_generating_ = false;
+        finish(FinishReason::Stopped);
     }
     
     std::lock_guard<std::mutex> lock(mutex_);
     
+    abortPrefill();
     stop_requested_ = false;
-    current_config_ = config;
-    initSampler(config);
+    finish_reason_ = FinishReason::None;
+    applyConfig(config);
+    if (!initSampler(config)) {  // The penalty window carries over from the last turn
+        return false;
+    }
+    chat_hash_ = 0;
+    detokenizer_.reset(llama_model_get_vocab(model_));
     
+    // BOS only belongs at the start of the sequence, not before each turn
     std::vector<llama_token> new_tokens;
-    if (!tokenizePrompt(prompt, new_tokens)) {
+    if (!tokenizePrompt(prompt, new_tokens, tokens_.empty())) {
         LOGE("tokenize failed");
         return false;
     }
+    reconcileSpeculative(new_tokens);
+    pinPrompt(new_tokens.size());
     
-    int available_space = current_config_.context_length - n_past_ - 32;
-    if (static_cast<int>(new_tokens.size()) > available_space) {
-        shiftContext(64);
+    // Shift early rather than truncate; the caller falls back to a full
+    // prompt only when the new turn cannot fit next to the pinned prefix
+    if (!makeRoom(new_tokens.size() + current_config_.shift_margin)) {
+        LOGE("prompt does not fit in context");
+        return false;
     }
     
     eval_start_time_ = getCurrentTimeMs();
+    governor_.beginGeneration();
     stats_.prompt_tokens = new_tokens.size();
     stats_.generated_tokens = 0;
     
-    if (!evaluateTokens(new_tokens, n_past_, new_tokens.size())) {
-        LOGE("eval failed");
+    // A stopped turn leaves the conversation as it was before it
+    if (!beginPrefill(std::move(new_tokens), n_past_, false)) {
         return false;
     }
-    
-    tokens_.insert(tokens_.end(), new_tokens.begin(), new_tokens.end());
-    stats_.prompt_eval_time_ms = getCurrentTimeMs() - eval_start_time_;
-    
-    n_past_ += new_tokens.size();
-    current_pos_ = tokens_.size();
     is_generating_ = true;
     
     return true;
 }
 
-void InferenceEngine::clearCache() {
-    std::lock_guard<std::mutex> lock(mutex_);
-    
-    llama_memory_t mem = llama_get_memory(ctx_);
-    if (mem != nullptr) {
-        llama_memory_clear(mem, true);
+bool InferenceEngine::startInferenceSpeculative(const std::string& prompt, const InferenceConfig& config,
+                                                bool incremental) {
+    bool started = incremental ? startInferenceIncremental(prompt, config)
+                               : startInference(prompt, config);
+    if (!started) {
+        return false;
     }
     
-    tokens_.clear();
-    n_past_ = 0;
-    current_pos_ = 0;
-}
-
-std::string InferenceEngine::getNextToken() {
-    if (!is_generating_ || stop_requested_) {
-        is_generating_ = false;
-        return "";
+    if (!isDraftCompatible()) {
+        LOGW("speculative decoding unavailable, using standard decoding");
+        return true;
     }
     
     std::lock_guard<std::mutex> lock(mutex_);
     
-    if (n_past_ >= current_config_.context_length - 1) {
-        is_generating_ = false;
-        return "";
+    stats_.draft_tokens = 0;
+    stats_.accepted_tokens = 0;
+    stats_.acceptance_rate = 0;
+    
+    // The first token needs the prompt's logits; a queued prompt seeds it
+    // from getNextToken() once decoded
+    spec_last_token_ = -1;
+    spec_pending_.clear();
+    speculative_ = true;
+    if (!prefill_pending_) {
+        seedSpeculative();
     }
     
-    if (stats_.generated_tokens >= current_config_.max_tokens) {
-        is_generating_ = false;
-        return "";
+    return true;
+}
+
+void InferenceEngine::seedSpeculative() {
+    // The first token comes straight from the prompt logits; it is decoded
+    // together with the first batch of draft tokens. The draft catches up on
+    // the prompt during the first step.
+    spec_last_token_ = sampleNextToken();
+    spec_pending_.clear();
+    spec_pending_.push_back(spec_last_token_);
+}
+
+bool InferenceEngine::startChat(const std::vector<ChatTurn>& turns, const InferenceConfig& config,
+                                bool speculative) {
+    if (!isModelLoaded() || turns.empty()) {
+        LOGE("Cannot start chat: model not loaded or no messages");
+        return false;
     }
     
-    // Sample next token
-    llama_token new_token = sampleNextToken();
-    
-    const llama_vocab* vocab = llama_model_get_vocab(model_);
-    if (llama_vocab_is_eog(vocab, new_token)) {
-        is_generating_ = false;
-        return "";
+    if (is_generating_) {
+        stopGeneration();
     }
     
-    // Convert token to text
-    std::string token_text = tokenToString(new_token);
+    // A slot that already holds the conversation only needs the new turn.
+    // Whatever the sequence holds has to be the conversation up to the
+    // reply: not a raw prompt, and not a reply whose end never reached the
+    // app.
+    std::string past;
+    std::string prompt;
+    bool incremental = false;
+    uint64_t past_hash = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        past_hash = chatHash();
+        if (past_hash != 0 && !tokens_.empty() && chat_template_.renderContinuation(turns, past, prompt)) {
+            incremental = hashText(CHAT_HASH_BASIS, past) == past_hash;
+            if (!incremental) {
+                LOGD("cached sequence is not this conversation, re-evaluating it");
+            }
+        }
+    }
+    if (!incremental && !chat_template_.render(turns, true, prompt)) {
+        LOGE("chat template failed");
+        return false;
+    }
     
-    // Add token to sequence
-    tokens_.push_back(new_token);
+    bool started = speculative ? startInferenceSpeculative(prompt, config, incremental)
+                 : incremental ? startInferenceIncremental(prompt, config)
+                               : startInference(prompt, config);
     
-    // Evaluate the new token
-    std::vector<llama_token> single_token = {new_token};
-    if (!evaluateTokens(single_token, n_past_, 1)) {
-        LOGE("Failed to evaluate token");
-        is_generating_ = false;
-        return "";
+    if (!started && incremental) {
+        // The new turn did not fit next to the pinned prefix; start over
+        LOGW("incremental chat failed, re-evaluating conversation");
+        if (!chat_template_.render(turns, true, prompt)) {
+            return false;
+        }
+        incremental = false;
+        started = speculative ? startInferenceSpeculative(prompt, config, false)
+                              : startInference(prompt, config);
     }
     
-    n_past_++;
-    stats_.generated_tokens++;
-    current_pos_++;
-    
-    // Update stats
-    double total_time = getCurrentTimeMs() - eval_start_time_;
-    stats_.eval_time_ms = total_time - stats_.prompt_eval_time_ms;
-    if (stats_.eval_time_ms > 0) {
-        stats_.tokens_per_second = (stats_.generated_tokens * 1000.0) / stats_.eval_time_ms;
+    if (started) {
+        // The sequence holds the new turn once its prompt is decoded; until
+        // then a stop leaves it at the reply
+        std::lock_guard<std::mutex> lock(mutex_);
+        uint64_t rendered = hashText(incremental ? past_hash : CHAT_HASH_BASIS, prompt);
+        if (prefill_pending_) {
+            chat_hash_ = incremental ? past_hash : 0;
+            pending_chat_hash_ = rendered;
+        } else {
+            chat_hash_ = rendered;
+        }
     }
     
-    return token_text;
+    LOGD("chat started: %zu turns, %s, %zu chars", turns.size(),
+         incremental ? "incremental" : "full", prompt.size());
+    return started;
 }
 
-std::vector<std::string> InferenceEngine::getNextTokens(int count) {
-    std::vector<std::string> result;
-    result.reserve(count);
+bool InferenceEngine::speculativeStep() {
+    const llama_vocab* vocab = llama_model_get_vocab(model_);
     
-    for (int i = 0; i < count && is_generating_ && !stop_requested_; i++) {
-        if (n_past_ >= current_config_.context_length - 16) {
-            shiftContext(64);
+    makeRoom(current_config_.draft_tokens + 1);
+    
+    // Leave room for the last token plus the drafted ones
+    int n_draft = std::min(current_config_.draft_tokens,
+                           current_config_.context_length - n_past_ - 2);
+    if (n_draft < 0) {
+        return false;
+    }
+    
+    // Catch the draft up on accepted tokens it has not decoded yet
+    if (draft_n_past_ < n_past_) {
+        llama_memory_t draft_mem = llama_get_memory(draft_ctx_);
+        if (draft_mem != nullptr) {
+            llama_memory_seq_rm(draft_mem, 0, draft_n_past_, -1);
         }
-        
-        std::string token = getNextToken();
-        if (token.empty() && !is_generating_) {
-            break;  // End of generation
+        std::vector<llama_token> missing(tokens_.begin() + draft_n_past_, tokens_.end());
+        if (!evaluateDraft(missing, draft_n_past_)) {
+            return false;
         }
-        result.push_back(token);
+        draft_n_past_ = n_past_;
     }
     
-    return result;
-}
-
-void InferenceEngine::shiftContext(int keep_tokens) {
-    if (n_past_ <= keep_tokens) return;
+    // Draft proposes up to n_draft tokens, one cheap decode each
+    std::vector<llama_token> draft;
+    draft.reserve(n_draft);
+    llama_token cur = spec_last_token_;
+    for (int i = 0; i < n_draft; i++) {
+        if (!evaluateDraft({cur}, draft_n_past_)) {
+            break;
+        }
+        draft_n_past_++;
+        
+        cur = llama_sampler_sample(draft_sampler_, draft_ctx_, -1);
+        draft.push_back(cur);
+        if (llama_vocab_is_eog(vocab, cur)) {
+            break;
+        }
+    }
     
-    std::lock_guard<std::mutex> lock(mutex_);
+    // Target verifies the last token and all drafted tokens in one decode
+    int n_verify = std::min<int>(draft.size() + 1, batch_capacity_);
+    draft.resize(n_verify - 1);
+    batchClear();
+    for (int i = 0; i < n_verify; i++) {
+        batchAdd((i == 0) ? spec_last_token_ : draft[i - 1], n_past_ + i, seq_id_, true);
+    }
     
-    int shift_amount = n_past_ - keep_tokens;
+    if (llama_decode(ctx_, batch_) != 0) {
+        LOGE("llama_decode failed for draft verification");
+        return false;
+    }
     
-    // Shift the KV cache using the new memory API
-    llama_memory_t mem = llama_get_memory(ctx_);
-    if (mem != nullptr) {
-        // Remove old tokens from cache and shift remaining
-        llama_memory_seq_rm(mem, 0, 0, shift_amount);
-        llama_memory_seq_add(mem, 0, shift_amount, n_past_, -shift_amount);
+    // Sample the target at each position and keep going while it agrees with
+    // the draft. The first disagreement (or the bonus token after a fully
+    // accepted draft) is still a valid target sample.
+    int n_accepted = 0;
+    for (int i = 0; i < n_verify; i++) {
+        llama_token token = sampler_.sample(ctx_, i);
+        spec_pending_.push_back(token);
+        
+        if (i < static_cast<int>(draft.size()) && token == draft[i] &&
+            !llama_vocab_is_eog(vocab, token)) {
+            n_accepted++;
+            continue;
+        }
+        break;
     }
     
-    // Update position
-    n_past_ = keep_tokens;
+    // The last token and the accepted drafts are now part of the sequence
+    tokens_.push_back(spec_last_token_);
+    tokens_.insert(tokens_.end(), draft.begin(), draft.begin() + n_accepted);
+    n_past_ += 1 + n_accepted;
+    current_pos_ = tokens_.size();
+    spec_last_token_ = spec_pending_.back();
     
-    // Keep only recent tokens
-    if (tokens_.size() > static_cast<size_t>(keep_tokens)) {
-        tokens_.erase(tokens_.begin(), tokens_.end() - keep_tokens);
+    // Drop the rejected tail from both caches
+    kv_cache_.sequenceRemove(seq_id_, n_past_, -1);
+    llama_memory_t draft_mem = llama_get_memory(draft_ctx_);
+    if (draft_mem != nullptr) {
+        llama_memory_seq_rm(draft_mem, 0, n_past_, -1);
     }
+    draft_n_past_ = std::min(draft_n_past_, n_past_);
     
-    current_pos_ = tokens_.size();
+    stats_.draft_tokens += draft.size();
+    stats_.accepted_tokens += n_accepted;
+    updateSpeculativeStats();
+    
+    return true;
 }
 
-bool InferenceEngine::isGenerating() const {
-    return is_generating_;
+void InferenceEngine::reconcileSpeculative(std::vector<llama_token>& next_tokens) {
+    if (!speculative_) return;
+    
+    // Accepted tokens still pending were never shown to the user, so drop
+    // them from the cache. The final pending token was never decoded.
+    int n_unseen = std::max<int>(0, spec_pending_.size() - 1);
+    if (n_unseen > 0) {
+        n_past_ -= n_unseen;
+        tokens_.resize(n_past_);
+        kv_cache_.sequenceRemove(seq_id_, n_past_, -1);
+    } else if (spec_pending_.empty() && spec_last_token_ >= 0 &&
+               !llama_vocab_is_eog(llama_model_get_vocab(model_), spec_last_token_)) {
+        // Last token was shown but not decoded yet
+        next_tokens.insert(next_tokens.begin(), spec_last_token_);
+    }
+    
+    current_pos_ = tokens_.size();
+    speculative_ = false;
+    spec_pending_.clear();
 }
 
-void InferenceEngine::stopGeneration() {
-    stop_requested_ = true;
-    is_generating_ = false;
+void InferenceEngine::updateSpeculativeStats() {
+    if (stats_.draft_tokens > 0) {
+        stats_.acceptance_rate = static_cast<double>(stats_.accepted_tokens) / stats_.draft_tokens;
+    }
 }
 
-bool InferenceEngine::generateWithCallback(const std::string& prompt,
-                                           const InferenceConfig& config,
-                                           TokenCallback callback) {
-    if (!startInference(prompt, config)) {
-        return false;
-    }
-    
-    while (is_generating_ && !stop_requested_) {
-        std::string token = getNextToken();
+bool InferenceEngine::evaluateDraft(const std::vector<llama_token>& tokens, int n_past) {
+    // Shares the engine batch; target and draft never decode concurrently
+    int n_tokens = tokens.size();
+    int n_batch = std::min(current_config_.batch_size, batch_capacity_);
+    
+    for (int i = 0; i < n_tokens; i += n_batch) {
+        int n_eval = std::min(n_batch, n_tokens - i);
+        batchClear();
         
-        if (token.empty() && !is_generating_) {
-            // Generation ended
-            if (callback) {
-                callback("", true);
-            }
-            break;
+        for (int j = 0; j < n_eval; j++) {
+            batchAdd(tokens[i + j], n_past + i + j, 0, i + j == n_tokens - 1);
         }
         
-        if (callback) {
-            bool should_continue = callback(token, false);
-            if (!should_continue) {
-                stopGeneration();
-                break;
-            }
+        if (llama_decode(draft_ctx_, batch_) != 0) {
+            LOGE("llama_decode failed on draft");
+            return false;
         }
     }
     
-    is_generating_ = false;
-    stats_.total_tokens = stats_.prompt_tokens + stats_.generated_tokens;
-    
     return true;
 }
 
-bool InferenceEngine::tokenizePrompt(const std::string& prompt, std::vector<llama_token>& tokens) {
-    const llama_vocab* vocab = llama_model_get_vocab(model_);
+void InferenceEngine::clearCache() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    
+    abortPrefill();
+    
+    // Only the active conversation; other slots keep their cache
+    kv_cache_.sequenceRemove(seq_id_, -1, -1);
+    ConversationSlot* slot = kv_cache_.getSlot(seq_id_);
+    if (slot != nullptr) {
+        slot->tokens.clear();
+        slot->n_keep = 0;
+        slot->chat_hash = 0;
+    }
+    n_keep_ = 0;
+    chat_hash_ = 0;
+    
+    if (draft_ctx_ != nullptr) {
+        llama_memory_t draft_mem = llama_get_memory(draft_ctx_);
+        if (draft_mem != nullptr) {
+            llama_memory_clear(draft_mem, true);
+        }
+        draft_n_past_ = 0;
+    }
+    
+    speculative_ = false;
+    spec_pending_.clear();
+    sampler_.reset();
+    tokens_.clear();
+    n_past_ = 0;
+    current_pos_ = 0;
+}
+
+int InferenceEngine::selectConversation(int64_t conversation_id) {
+    if (!isModelLoaded() || conversation_id < 0) {
+        return -1;
+    }
+    
+    if (is_generating_) {
+        stopGeneration();
+    }
+    
+    std::lock_guard<std::mutex> lock(mutex_);
+    
+    ConversationSlot* active = kv_cache_.getSlot(seq_id_);
+    if (active != nullptr && active->conversation_id == conversation_id) {
+        return n_past_;
+    }
+    
+    saveActiveSlot();
+    
+    int seq_id = kv_cache_.acquireSlot(conversation_id);
+    if (seq_id < 0) {
+        return -1;
+    }
+    activateSlot(seq_id);
+    
+    LOGD("conversation %lld -> slot %d (%d cached tokens)",
+         static_cast<long long>(conversation_id), seq_id, n_past_);
+    return n_past_;
+}
+
+bool InferenceEngine::forkConversation(int64_t src_id, int64_t dst_id) {
+    if (!isModelLoaded() || src_id < 0 || dst_id < 0 || src_id == dst_id) {
+        return false;
+    }
+    
+    if (is_generating_) {
+        stopGeneration();
+    }
+    
+    std::lock_guard<std::mutex> lock(mutex_);
+    
+    saveActiveSlot();
+    
+    int src_seq = kv_cache_.findSlot(src_id);
+    if (src_seq < 0) {
+        LOGW("fork source %lld is not resident", static_cast<long long>(src_id));
+        return false;
+    }
+    
+    int dst_seq = kv_cache_.forkSlot(src_seq, dst_id);
+    if (dst_seq < 0) {
+        return false;
+    }
+    activateSlot(dst_seq);
+    
+    LOGD("forked conversation %lld -> %lld (%d shared tokens)",
+         static_cast<long long>(src_id), static_cast<long long>(dst_id), n_past_);
+    return true;
+}
+
+void InferenceEngine::releaseConversation(int64_t conversation_id) {
+    if (is_generating_) {
+        stopGeneration();
+    }
+    
+    std::lock_guard<std::mutex> lock(mutex_);
+    
+    int seq_id = kv_cache_.findSlot(conversation_id);
+    if (seq_id < 0) return;
+    
+    if (seq_id == seq_id_) {
+        // The active slot stays bound but starts over
+        kv_cache_.sequenceRemove(seq_id_, -1, -1);
+        kv_cache_.getSlot(seq_id_)->tokens.clear();
+        kv_cache_.getSlot(seq_id_)->n_keep = 0;
+        kv_cache_.getSlot(seq_id_)->chat_hash = 0;
+        activateSlot(seq_id_);
+    } else {
+        kv_cache_.releaseSlot(seq_id);
+    }
+}
+
+void InferenceEngine::saveActiveSlot() {
+    ConversationSlot* slot = kv_cache_.getSlot(seq_id_);
+    if (slot == nullptr) return;
+    
+    // An undecoded prompt was never answered; the slot parks without it
+    abortPrefill();
+    
+    // Tokens the user has already seen but that are not decoded yet must be
+    // in the cache before it is parked, or the next turn would miss them
+    std::vector<llama_token> pending;
+    reconcileSpeculative(pending);
+    if (!pending.empty() && evaluateTokens(pending, n_past_, pending.size())) {
+        tokens_.insert(tokens_.end(), pending.begin(), pending.end());
+        n_past_ += pending.size();
+    }
+    
+    slot->tokens = tokens_;
+    slot->n_keep = n_keep_;
+    slot->chat_hash = chatHash();
+}
+
+void InferenceEngine::activateSlot(int seq_id) {
+    abortPrefill();
+    seq_id_ = seq_id;
+    tokens_ = kv_cache_.getSlot(seq_id)->tokens;
+    n_keep_ = kv_cache_.getSlot(seq_id)->n_keep;
+    chat_hash_ = kv_cache_.getSlot(seq_id)->chat_hash;
+    n_past_ = tokens_.size();
+    current_pos_ = tokens_.size();
+    detokenizer_.reset(llama_model_get_vocab(model_));  // chatHash() checked the last reply at save
+    
+    speculative_ = false;
+    spec_pending_.clear();
+    sampler_.reset();  // The penalty window belonged to the other conversation
+    
+    // The draft only tracks one sequence; it re-syncs from tokens_
+    if (draft_ctx_ != nullptr) {
+        llama_memory_t draft_mem = llama_get_memory(draft_ctx_);
+        if (draft_mem != nullptr) {
+            llama_memory_clear(draft_mem, true);
+        }
+        draft_n_past_ = 0;
+    }
+}
+
+std::string InferenceEngine::getNextToken() {
+    if (!is_generating_ || stop_requested_) {
+        finish(FinishReason::Stopped);
+        return "";
+    }
+    
+    std::lock_guard<std::mutex> lock(mutex_);
+    
+    // An unload may have won the lock since the check above
+    if (!isModelLoaded()) {
+        finish(FinishReason::Stopped);
+        return "";
+    }
+    
+    // The queued prompt is decoded here, on the generation thread, and the
+    // first token follows in the same call
+    if (prefill_pending_ && !runPrefill()) {
+        finish(stop_requested_ ? FinishReason::Stopped : FinishReason::Error);
+        return "";
+    }
+    
+    if (n_past_ >= current_config_.context_length - 1) {
+        return finishText(FinishReason::Length);
+    }
+    
+    if (stats_.generated_tokens >= current_config_.max_tokens) {
+        return finishText(FinishReason::Length);
+    }
+    
+    // Speculative mode hands out tokens accepted by the last verify pass
+    if (speculative_) {
+        if (spec_last_token_ < 0) {
+            seedSpeculative();
+        } else if (spec_pending_.empty()) {
+            // Steps decode several tokens at once; only the thermal state applies
+            governThreads(-1);
+            StageTimer timer(LatencyStage::Decode);
+            if (!speculativeStep()) {
+                chat_hash_ = 0;
+                return finishText(FinishReason::Error);
+            }
+        }
+        
+        llama_token token = spec_pending_.front();
+        spec_pending_.pop_front();
+        
+        if (llama_vocab_is_eog(llama_model_get_vocab(model_), token)) {
+            return finishText(FinishReason::Eos);
+        }
+        
+        stats_.generated_tokens++;
+        double total_time = getCurrentTimeMs() - eval_start_time_;
+        stats_.eval_time_ms = total_time - stats_.prompt_eval_time_ms;
+        if (stats_.eval_time_ms > 0) {
+            stats_.tokens_per_second = (stats_.generated_tokens * 1000.0) / stats_.eval_time_ms;
+        }
+        
+        StageTimer timer(LatencyStage::Detokenize);
+        detokenizer_.push(token);
+        return recordText(detokenizer_.take());
+    }
+    
+    // Sample next token
+    llama_token new_token;
+    {
+        StageTimer timer(LatencyStage::Sample);
+        new_token = sampleNextToken();
+    }
+    
+    const llama_vocab* vocab = llama_model_get_vocab(model_);
+    if (llama_vocab_is_eog(vocab, new_token)) {
+        return finishText(FinishReason::Eos);
+    }
+    
+    // Convert token to text; may be empty while a character or marker is
+    // still incomplete
+    std::string token_text;
+    {
+        StageTimer timer(LatencyStage::Detokenize);
+        detokenizer_.push(new_token);
+        token_text = detokenizer_.take();
+    }
+    
+    // Evaluate the new token, with the background sessions' tokens in the
+    // same batch
+    int64_t decode_start = getCurrentTimeMs();
+    bool decoded;
+    {
+        StageTimer timer(LatencyStage::Decode);
+        decoded = decodeStep(new_token);
+    }
+    if (!decoded) {
+        // tokens_ and the cache stay at the last decoded token, so the next
+        // turn builds on what is really there
+        LOGE("Failed to evaluate token");
+        kv_cache_.sequenceRemove(seq_id_, n_past_, -1);
+        chat_hash_ = 0;    // Text held back for earlier tokens is lost with it
+        finish(FinishReason::Error);
+        return "";
+    }
+    tokens_.push_back(new_token);
+    // New pools may sit on other cores; follow them
+    if (governThreads(getCurrentTimeMs() - decode_start)) {
+        scheduler_.pinCurrentThread();
+    }
+    
+    n_past_++;
+    stats_.generated_tokens++;
+    current_pos_++;
+    
+    // Shift ahead of time so the next tokens never hit the context limit
+    makeRoom(current_config_.shift_margin);
+    
+    // Update stats
+    double total_time = getCurrentTimeMs() - eval_start_time_;
+    stats_.eval_time_ms = total_time - stats_.prompt_eval_time_ms;
+    if (stats_.eval_time_ms > 0) {
+        stats_.tokens_per_second = (stats_.generated_tokens * 1000.0) / stats_.eval_time_ms;
+    }
+    
+    return recordText(std::move(token_text));
+}
+
+bool InferenceEngine::shiftContext(int n_discard) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return shiftContextLocked(n_discard);
+}
+
+void InferenceEngine::pinPrompt(int n_prompt) {
+    // Only the first prompt of a sequence sets the pinned prefix
+    if (n_keep_ > 0 || n_past_ > 0) return;
+    
+    int n_keep = current_config_.n_keep < 0 ? n_prompt : current_config_.n_keep;
+    n_keep_ = std::min(n_keep, current_config_.context_length / 2);
+}
+
+bool InferenceEngine::shiftContextLocked(int n_discard) {
+    int n_keep = std::min(n_keep_, n_past_);
+    int n_left = n_past_ - n_keep;
+    if (n_discard <= 0) {
+        n_discard = n_left / 2;
+    }
+    n_discard = std::min(n_discard, n_left);
+    if (n_discard <= 0) return false;
+    
+    llama_memory_t mem = llama_get_memory(ctx_);
+    if (mem == nullptr || !llama_memory_can_shift(mem)) {
+        LOGW("context shift not supported by this model");
+        return false;
+    }
+    
+    // Drop the chunk after the pinned prefix and slide the rest down, so
+    // BOS, system prompt and template header survive without re-decoding
+    llama_memory_seq_rm(mem, seq_id_, n_keep, n_keep + n_discard);
+    llama_memory_seq_add(mem, seq_id_, n_keep + n_discard, n_past_, -n_discard);
+    
+    // Keep the draft aligned with the target positions
+    if (draft_ctx_ != nullptr && draft_n_past_ > n_keep) {
+        llama_memory_t draft_mem = llama_get_memory(draft_ctx_);
+        if (draft_mem != nullptr) {
+            llama_memory_seq_rm(draft_mem, 0, n_keep, n_keep + n_discard);
+            llama_memory_seq_add(draft_mem, 0, n_keep + n_discard, draft_n_past_, -n_discard);
+        }
+        draft_n_past_ = std::max(n_keep, draft_n_past_ - n_discard);
+    }
+    
+    tokens_.erase(tokens_.begin() + n_keep, tokens_.begin() + n_keep + n_discard);
+    n_past_ -= n_discard;
+    current_pos_ = tokens_.size();
+    
+    LOGD("context shift: kept %d, discarded %d, %d cached", n_keep, n_discard, n_past_);
+    return true;
+}
+
+bool InferenceEngine::makeRoom(int n_tokens) {
+    int n_ctx = current_config_.context_length;
+    
+    while (n_past_ + n_tokens > n_ctx) {
+        int excess = n_past_ + n_tokens - n_ctx;
+        int n_discard = std::max(excess, current_config_.n_discard);
+        if (current_config_.n_discard <= 0) {
+            n_discard = std::max(excess, (n_past_ - std::min(n_keep_, n_past_)) / 2);
+        }
+        if (!shiftContextLocked(n_discard)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool InferenceEngine::isGenerating() const {
+    return is_generating_;
+}
+
+void InferenceEngine::stopGeneration() {
+    stop_requested_ = true;
+    finish(FinishReason::Stopped);
+}
+
+void InferenceEngine::finish(FinishReason reason) {
+    // The first reason sticks; a stop after the end of text changes nothing
+    FinishReason none = FinishReason::None;
+    if (is_generating_) {
+        finish_reason_.compare_exchange_strong(none, reason);
+    }
+    is_generating_ = false;
+}
+
+bool InferenceEngine::tokenizePrompt(const std::string& prompt, std::vector<llama_token>& tokens,
+                                     bool add_special) {
+    const llama_vocab* vocab = llama_model_get_vocab(model_);
     
     // Allocate buffer for tokens (prompt length + some extra)
     int max_tokens = prompt.length() + 32;
@@ -460,8 +1316,8 @@ bool InferenceEngine::tokenizePrompt(const std::string& prompt, std::vector<llam
         prompt.length(),
         tokens.data(),
         max_tokens,
-        true,   // add_special (BOS token)
-        false   // parse_special
+        add_special,  // BOS token
+        true          // parse_special: template markers are single tokens
     );
     
     if (n_tokens < 0) {
@@ -473,8 +1329,8 @@ bool InferenceEngine::tokenizePrompt(const std::string& prompt, std::vector<llam
             prompt.length(),
             tokens.data(),
             -n_tokens,
-            true,
-            false
+            add_special,
+            true
         );
     }
     
@@ -484,91 +1340,260 @@ bool InferenceEngine::tokenizePrompt(const std::string& prompt, std::vector<llam
     }
     
     tokens.resize(n_tokens);
+    
+    // Templates that spell out BOS themselves would otherwise get two
+    llama_token bos = llama_vocab_bos(vocab);
+    if (add_special && n_tokens >= 2 && tokens[0] == bos && tokens[1] == bos) {
+        tokens.erase(tokens.begin());
+    }
+    
     return true;
 }
 
 bool InferenceEngine::evaluateTokens(const std::vector<llama_token>& tokens, int n_past, int n_tokens) {
-    // OPTIMIZATION: Use llama_batch_get_one for single token (most common case)
-    // This avoids batch allocation overhead
+    // OPTIMIZATION: Single token (most common case) skips the chunking loop;
+    // position and sequence are explicit like every other path
     if (n_tokens == 1) {
-        llama_token token = tokens[0];
-        llama_batch batch = llama_batch_get_one(&token, 1);
-        
-        // Set position for single token
-        // Note: llama_batch_get_one sets pos[0] = 0 by default, we need to override
-        // Actually, llama_decode handles position based on n_past in the KV cache
+        batchClear();
+        batchAdd(tokens[0], n_past, seq_id_, true);
         
-        if (llama_decode(ctx_, batch) != 0) {
+        if (llama_decode(ctx_, batch_) != 0) {
             LOGE("llama_decode failed for single token");
             return false;
         }
         return true;
     }
     
-    // For multiple tokens (prompt evaluation), use batched processing
-    llama_batch batch = llama_batch_init(current_config_.batch_size, 0, 1);
+    // For multiple tokens (prompt evaluation), use batched processing over
+    // the preallocated batch; chunks shrink when the governor throttles
+    int n_batch = std::min(current_config_.batch_size, batch_capacity_);
     
     // Process tokens in batches
-    for (int i = 0; i < n_tokens; i += current_config_.batch_size) {
-        int n_eval = std::min(current_config_.batch_size, n_tokens - i);
+    for (int i = 0; i < n_tokens; ) {
+        if (i > 0) {
+            governThreads(-1);
+        }
+        int n_eval = std::min(governor_.chunkSize(n_batch), n_tokens - i);
         
         // Clear batch
-        batch.n_tokens = 0;
+        batchClear();
         
-        // Add tokens to batch
+        // Add tokens to batch, only computing logits for the last token
         for (int j = 0; j < n_eval; j++) {
-            batch.token[batch.n_tokens] = tokens[i + j];
-            batch.pos[batch.n_tokens] = n_past + i + j;
-            batch.n_seq_id[batch.n_tokens] = 1;
-            batch.seq_id[batch.n_tokens][0] = 0;
-            // Only compute logits for the last token
-            batch.logits[batch.n_tokens] = (i + j == n_tokens - 1);
-            batch.n_tokens++;
+            batchAdd(tokens[i + j], n_past + i + j, seq_id_, i + j == n_tokens - 1);
         }
         
         // Decode batch
-        if (llama_decode(ctx_, batch) != 0) {
+        if (llama_decode(ctx_, batch_) != 0) {
             LOGE("llama_decode failed");
-            llama_batch_free(batch);
             return false;
         }
+        i += n_eval;
     }
     
-    llama_batch_free(batch);
     return true;
 }
 
-llama_token InferenceEngine::sampleNextToken() {
-    // Get logits from the last token
-    llama_token new_token = llama_sampler_sample(sampler_, ctx_, -1);
+bool InferenceEngine::beginPrefill(std::vector<llama_token> tokens, int keep, bool store_prefix) {
+    prefill_tokens_ = std::move(tokens);
+    prefill_keep_ = keep;
+    prefill_store_ = store_prefix;
+    prefill_pending_ = true;
+    prefill_done_ = 0;
+    prefill_total_ = prefill_tokens_.size();
+    
+    if (current_config_.async_prefill) {
+        return true;
+    }
+    return runPrefill();
+}
+
+bool InferenceEngine::runPrefill() {
+    // Chunks bound how long a stop waits; each is one llama_decode batch
+    // or a few, so throughput is the same as one big call
+    int n_chunk = current_config_.prefill_chunk > 0 ? current_config_.prefill_chunk
+                                                    : current_config_.batch_size;
+    int n_total = prefill_tokens_.size();
+    
+    for (int done = 0; done < n_total; ) {
+        if (stop_requested_) {
+            LOGD("prefill stopped at %d of %d tokens", done, n_total);
+            abortPrefill();
+            return false;
+        }
+        
+        int n_eval = std::min(n_chunk, n_total - done);
+        std::vector<llama_token> chunk(prefill_tokens_.begin() + done,
+                                       prefill_tokens_.begin() + done + n_eval);
+        bool evaluated;
+        {
+            StageTimer timer(LatencyStage::Prefill);
+            evaluated = evaluateTokens(chunk, n_past_, n_eval);
+        }
+        if (!evaluated) {
+            LOGE("prompt eval failed");
+            abortPrefill();
+            return false;
+        }
+        
+        tokens_.insert(tokens_.end(), chunk.begin(), chunk.end());
+        n_past_ += n_eval;
+        done += n_eval;
+        prefill_done_ = done;
+    }
+    current_pos_ = tokens_.size();
     
-    // Accept the token (updates sampler state)
-    llama_sampler_accept(sampler_, new_token);
+    if (prefill_store_) {
+        prefix_cache_.store(ctx_, tokens_, seq_id_);
+    }
+    stats_.prompt_eval_time_ms = getCurrentTimeMs() - eval_start_time_;
     
-    return new_token;
+    if (pending_chat_hash_ != 0) {
+        chat_hash_ = pending_chat_hash_;
+        pending_chat_hash_ = 0;
+    }
+    prefill_pending_ = false;
+    prefill_tokens_.clear();
+    prefill_done_ = 0;
+    prefill_total_ = 0;
+    return true;
 }
 
-std::string InferenceEngine::tokenToString(llama_token token) {
-    const llama_vocab* vocab = llama_model_get_vocab(model_);
+void InferenceEngine::abortPrefill() {
+    if (!prefill_pending_) return;
     
-    // Get the token text
-    char buf[256];
-    int n = llama_token_to_piece(vocab, token, buf, sizeof(buf), 0, false);
+    // Back to where the start call found the sequence
+    kv_cache_.sequenceRemove(seq_id_, prefill_keep_, -1);
+    tokens_.resize(std::min<size_t>(tokens_.size(), prefill_keep_));
+    n_past_ = tokens_.size();
+    current_pos_ = n_past_;
+    n_keep_ = std::min(n_keep_, n_past_);
+    pending_chat_hash_ = 0;
+    
+    prefill_pending_ = false;
+    prefill_tokens_.clear();
+    prefill_done_ = 0;
+    prefill_total_ = 0;
+}
+
+void InferenceEngine::batchClear() {
+    batch_.n_tokens = 0;
+}
+
+void InferenceEngine::batchAdd(llama_token token, llama_pos pos, llama_seq_id seq_id, bool logits) {
+    int i = batch_.n_tokens++;
+    batch_.token[i] = token;
+    batch_.pos[i] = pos;
+    batch_.n_seq_id[i] = 1;
+    batch_.seq_id[i][0] = seq_id;
+    batch_.logits[i] = logits;
+}
+
+llama_token InferenceEngine::sampleNextToken() {
+    // Logits of the last decoded row; the token is accepted into the
+    // penalty window
+    return sampler_.sample(ctx_, -1);
+}
+
+void InferenceEngine::applyConfig(const InferenceConfig& config) {
+    // Per-request settings change freely; the context was sized at load
+    // (possibly below what the caller asked for) and keeps its shape
+    InferenceConfig loaded = current_config_;
+    current_config_ = config;
+    current_config_.context_length = loaded.context_length;
+    current_config_.batch_size = loaded.batch_size;
+    current_config_.ubatch_size = loaded.ubatch_size;
+    current_config_.kv_type = loaded.kv_type;
+    current_config_.conversation_slots = loaded.conversation_slots;
+    current_config_.background_sequences = loaded.background_sequences;
+    current_config_.background_context = loaded.background_context;
+    current_config_.threads = loaded.threads;
+    current_config_.threads_batch = loaded.threads_batch;
+    current_config_.gpu_layers = loaded.gpu_layers;
+    current_config_.use_mmap = loaded.use_mmap;
+    current_config_.use_mlock = loaded.use_mlock;
+    current_config_.repack_weights = loaded.repack_weights;
+}
+
+std::string InferenceEngine::finishText(FinishReason reason) {
+    // Text held back for an incomplete character or marker is released at
+    // the end instead of being lost
+    finish(reason);
+    detokenizer_.flush();
+    return recordText(detokenizer_.take());
+}
+
+std::string InferenceEngine::recordText(std::string text) {
+    if (chat_hash_ != 0) {
+        chat_hash_ = hashText(chat_hash_, text);
+    }
+    return text;
+}
+
+uint64_t InferenceEngine::chatHash() const {
+    // Bytes held back or rewritten by the detokenizer are in the cache but
+    // not in the reply the app keeps
+    return detokenizer_.exact() ? chat_hash_ : 0;
+}
+
+std::string InferenceEngine::runBenchmark(const BenchmarkConfig& config) {
+    if (!isModelLoaded()) {
+        return "{\"error\":\"No model loaded\"}";
+    }
     
-    if (n < 0) {
-        // Buffer too small (shouldn't happen for single tokens)
-        return "";
+    if (is_generating_) {
+        stopGeneration();
     }
     
-    return std::string(buf, n);
+    // Held for the whole run so no generation competes for the cores (and
+    // the thermal governor cannot swap the pools the default split runs on)
+    std::lock_guard<std::mutex> lock(mutex_);
+    
+    // Measure what the engine actually runs: its KV type and pinned pools
+    BenchmarkConfig run = config;
+    run.kv_type = current_config_.kv_type;
+    run.scheduler = &scheduler_;
+    return cortex::runBenchmark(model_, model_path_, run);
+}
+
+bool InferenceEngine::governThreads(double decode_ms) {
+    // Between decodes with mutex_ held; the pools are swapped while no
+    // context is using them
+    if (!current_config_.thermal_governor) return false;
+    if (!governor_.update(decode_ms, getCurrentTimeMs())) return false;
+    
+    scheduler_.detach(ctx_);
+    scheduler_.detach(draft_ctx_);
+    scheduler_.setThrottleLevel(governor_.level());
+    scheduler_.attach(ctx_);
+    scheduler_.attach(draft_ctx_);
+    
+    // Fallback counts in case the pools could not be created
+    llama_set_n_threads(ctx_, scheduler_.decodeThreads(), scheduler_.prefillThreads());
+    return true;
+}
+
+void InferenceEngine::setThermalState(int status, float headroom) {
+    governor_.setThermalState(status, headroom);
 }
 
 GenerationStats InferenceEngine::getStats() const {
-    return stats_;
+    GenerationStats stats = stats_;
+    stats.prefill_done = prefill_done_;
+    stats.prefill_total = prefill_total_;
+    stats.thermal_level = governor_.level();
+    stats.thermal_status = governor_.thermalStatus();
+    stats.thermal_headroom = governor_.thermalHeadroom();
+    stats.decode_latency_ms = governor_.latencyMs();
+    stats.decode_threads = scheduler_.decodeThreads();
+    stats.total_tokens = stats.prompt_tokens + stats.generated_tokens;
+    stats.finish_reason = finish_reason_;
+    return stats;
 }
 
 void InferenceEngine::resetStats() {
     stats_ = GenerationStats();
+    LatencyTrace::getInstance().reset();
 }
 
 size_t InferenceEngine::getModelMemoryUsage() const {
@@ -578,8 +1603,19 @@ size_t InferenceEngine::getModelMemoryUsage() const {
 
 size_t InferenceEngine::getContextMemoryUsage() const {
     if (ctx_ == nullptr) return 0;
-    // Approximate context memory usage
-    return llama_n_ctx(ctx_) * llama_model_n_embd(model_) * sizeof(float) * 2;
+    
+    const KVCacheConfig& kv_config = kv_cache_.getConfig();
+    size_t bytes = KVCache::estimateMemory(kv_config.geometry, llama_n_ctx(ctx_),
+                                           kv_config.type_k, kv_config.type_v);
+    if (draft_ctx_ != nullptr) {
+        bytes += KVCache::estimateMemory(KVCacheGeometry::fromModel(draft_model_), llama_n_ctx(draft_ctx_),
+                                         draft_kv_type_, draft_kv_type_);
+    }
+    return bytes;
+}
+
+KVCacheStats InferenceEngine::getKVCacheStats() const {
+    return kv_cache_.getStats();
 }
 
 int64_t InferenceEngine::getCurrentTimeMs() const {
@@ -589,257 +1625,329 @@ int64_t InferenceEngine::getCurrentTimeMs() const {
 }
 
 // ============================================================================
-// MULTI-THREADED GENERATION
+// BACKGROUND SEQUENCES
 // ============================================================================
 
-void InferenceEngine::setTokenCallback(std::function<void(const std::string&)> callback) {
-    std::lock_guard<std::mutex> lock(callback_mutex_);
-    token_callback_ = callback;
+bool InferenceEngine::addBackground(int64_t session, const SessionRequest& request, SessionSink sink) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!isModelLoaded()) return false;
+    
+    // Sequences background_base_ .. base + background_sequences - 1
+    int n_sequences = std::max(0, current_config_.background_sequences);
+    llama_seq_id seq_id = -1;
+    for (int i = 0; i < n_sequences && seq_id < 0; i++) {
+        seq_id = background_base_ + i;
+        for (const auto& seq : background_) {
+            if (seq->seq_id == seq_id) {
+                seq_id = -1;
+                break;
+            }
+        }
+    }
+    if (seq_id < 0) {
+        LOGW("background session %lld: all %d sequences busy", static_cast<long long>(session), n_sequences);
+        return false;
+    }
+    
+    std::string prompt = request.prompt;
+    if (!request.turns.empty() && !chat_template_.render(request.turns, true, prompt)) {
+        LOGE("chat template failed");
+        return false;
+    }
+    
+    auto seq = std::make_unique<BackgroundSequence>();
+    if (!tokenizePrompt(prompt, seq->pending, true) || seq->pending.empty()) {
+        LOGE("tokenize failed");
+        return false;
+    }
+    
+    // The prompt and every generated token have to fit the sequence's cells
+    int n_prompt = seq->pending.size();
+    int room = current_config_.background_context - n_prompt;
+    if (room < 1) {
+        LOGW("background prompt of %d tokens exceeds %d cells", n_prompt, current_config_.background_context);
+        return false;
+    }
+    
+    seq->session = session;
+    seq->seq_id = seq_id;
+    seq->sink = std::move(sink);
+    const llama_vocab* vocab = llama_model_get_vocab(model_);
+    seq->sampler.configure(samplerParams(request.config), vocab);
+    if (!request.config.grammar.empty() || !request.config.json_schema.empty()) {
+        std::string error;
+        llama_sampler* grammar = grammar_cache_.acquire(vocab, request.config.grammar,
+                                                        request.config.json_schema, error);
+        if (grammar == nullptr) {
+            LOGE("background grammar failed: %s", error.c_str());
+            return false;
+        }
+        seq->sampler.setGrammar(grammar);
+    }
+    seq->detokenizer.reset(llama_model_get_vocab(model_));
+    seq->max_tokens = std::min(request.config.max_tokens, room);
+    seq->stats.prompt_tokens = n_prompt;
+    seq->start_time = getCurrentTimeMs();
+    
+    // Whatever an earlier session left behind
+    kv_cache_.sequenceRemove(seq_id, -1, -1);
+    
+    LOGD("background session %lld on sequence %d: %d prompt tokens", static_cast<long long>(session),
+         seq_id, n_prompt);
+    background_.push_back(std::move(seq));
+    background_running_ = true;
+    return true;
 }
 
-void InferenceEngine::clearTokenCallback() {
-    std::lock_guard<std::mutex> lock(callback_mutex_);
-    token_callback_ = nullptr;
+void InferenceEngine::cancelBackground(int64_t session) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& seq : background_) {
+        if (session == 0 || seq->session == session) {
+            seq->cancelled = true;
+        }
+    }
 }
 
-std::string InferenceEngine::popTokenFromQueue() {
-    std::lock_guard<std::mutex> lock(buffer_mutex_);
-    if (output_buffer_.empty()) {
-        return "";
+void InferenceEngine::stepBackground() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!isModelLoaded()) {
+        endAllBackground(FinishReason::Stopped);
+        return;
+    }
+    if (!decodeStep(-1)) {
+        LOGE("background decode failed");
     }
-    std::string result = output_buffer_;
-    output_buffer_.clear();
-    return result;
 }
 
-void InferenceEngine::stopThreads() {
-    stop_requested_ = true;
-    generation_complete_ = true;
+bool InferenceEngine::decodeStep(llama_token token) {
+    // Background rows first and the foreground token last: its logits are
+    // the batch's last row, which is where sampleNextToken() reads
+    reapBackground();
+    batchClear();
+    packBackground(token >= 0 ? 1 : 0);
+    int n_background = batch_.n_tokens;
+    if (token >= 0) {
+        batchAdd(token, n_past_, seq_id_, true);
+    }
+    if (batch_.n_tokens == 0) return true;
     
-    // Wake up the processor thread
-    queue_cv_.notify_all();
+    if (llama_decode(ctx_, batch_) == 0) {
+        sampleBackground();
+        return true;
+    }
     
-    // Wait for threads to finish
-    if (generation_thread_.joinable()) {
-        generation_thread_.join();
+    // A background sequence may be what broke the batch (no free cells);
+    // they end and the foreground token goes again on its own
+    if (n_background == 0) {
+        LOGE("llama_decode failed for single token");
+        return false;
     }
-    if (processor_thread_.joinable()) {
-        processor_thread_.join();
+    LOGW("batch of %d background tokens failed, ending background sessions", n_background);
+    for (auto& seq : background_) {
+        seq->n_batch = 0;
+        endBackground(*seq, FinishReason::Error);
     }
+    reapBackground();
+    if (token < 0) return false;
+    
+    kv_cache_.sequenceRemove(seq_id_, n_past_, -1);
+    std::vector<llama_token> single_token = {token};
+    return evaluateTokens(single_token, n_past_, 1);
 }
 
-void InferenceEngine::generationThreadFunc() {
-#ifdef __ANDROID__
-    // Set thread priority to real-time for lower latency
-    struct sched_param param;
-    param.sched_priority = sched_get_priority_max(SCHED_FIFO);
-    pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
-    
-    // Try to pin to performance cores (cores 4-7 on most big.LITTLE devices)
-    cpu_set_t cpuset;
-    CPU_ZERO(&cpuset);
-    int num_cores = std::thread::hardware_concurrency();
-    // Use upper half cores (performance cores on big.LITTLE)
-    for (int i = num_cores / 2; i < num_cores; i++) {
-        CPU_SET(i, &cpuset);
-    }
-    sched_setaffinity(0, sizeof(cpuset), &cpuset);
-#endif
-    
-    const llama_vocab* vocab = llama_model_get_vocab(model_);
-    
-    while (!stop_requested_ && is_generating_) {
-        // Check limits
-        if (n_past_ >= current_config_.context_length - 1 ||
-            stats_.generated_tokens >= current_config_.max_tokens) {
-            break;
-        }
-        
-        // Sample next token - this is fast
-        llama_token new_token = llama_sampler_sample(sampler_, ctx_, -1);
-        llama_sampler_accept(sampler_, new_token);
-        
-        if (llama_vocab_is_eog(vocab, new_token)) {
-            break;
-        }
-        
-        // Push token to queue (producer side)
-        {
-            std::lock_guard<std::mutex> lock(queue_mutex_);
-            token_queue_.push(new_token);
-        }
-        queue_cv_.notify_one();
-        
-        // Evaluate the token - THE SLOW PART (llama_decode)
-        // This is where 90%+ of time is spent
-        std::vector<llama_token> single_token = {new_token};
-        tokens_.push_back(new_token);
-        
-        {
-            std::lock_guard<std::mutex> lock(mutex_);
-            if (!evaluateTokens(single_token, n_past_, 1)) {
-                LOGE("Failed to evaluate token");
-                break;
-            }
+void InferenceEngine::packBackground(int reserve) {
+    int budget = std::min(current_config_.batch_size, batch_capacity_) - reserve;
+    
+    // Sessions past their prompt get their row first, so a long prompt
+    // never holds up text already streaming
+    int n_prompts = 0;
+    for (auto& seq : background_) {
+        seq->n_batch = 0;
+        seq->logits_index = -1;
+        if (seq->pending.size() == 1 && budget > 0) {
+            seq->n_batch = 1;
+            seq->logits_index = batch_.n_tokens;
+            batchAdd(seq->pending[0], seq->n_past, seq->seq_id, true);
+            budget--;
+        } else if (seq->pending.size() > 1) {
+            n_prompts++;
         }
-        
-        n_past_++;
-        stats_.generated_tokens++;
     }
     
-    // Mark generation as complete
-    generation_complete_ = true;
-    is_generating_ = false;
-    queue_cv_.notify_all();
-    
-    // Update final stats
-    double total_time = getCurrentTimeMs() - eval_start_time_;
-    stats_.eval_time_ms = total_time - stats_.prompt_eval_time_ms;
-    if (stats_.eval_time_ms > 0) {
-        stats_.tokens_per_second = (stats_.generated_tokens * 1000.0) / stats_.eval_time_ms;
+    // Prompts share what is left, in chunks small enough that the
+    // foreground's step time barely moves
+    for (auto& seq : background_) {
+        if (seq->pending.size() <= 1 || budget <= 0) continue;
+        int share = std::max(1, budget / std::max(1, n_prompts--));
+        int n_eval = std::min({share, current_config_.background_chunk, static_cast<int>(seq->pending.size())});
+        n_eval = std::max(1, n_eval);
+        bool last = n_eval == static_cast<int>(seq->pending.size());
+        for (int i = 0; i < n_eval; i++) {
+            batchAdd(seq->pending[i], seq->n_past + i, seq->seq_id, last && i == n_eval - 1);
+        }
+        seq->n_batch = n_eval;
+        seq->logits_index = last ? batch_.n_tokens - 1 : -1;
+        budget -= n_eval;
     }
 }
 
-void InferenceEngine::processorThreadFunc() {
-    
-    std::string batch_buffer;
-    batch_buffer.reserve(256);
-    int batch_count = 0;
-    auto last_flush = std::chrono::steady_clock::now();
-    
-    while (!generation_complete_ || !token_queue_.empty()) {
-        llama_token token;
-        bool got_token = false;
+void InferenceEngine::sampleBackground() {
+    const llama_vocab* vocab = llama_model_get_vocab(model_);
+    int64_t now = getCurrentTimeMs();
+    
+    for (auto& seq : background_) {
+        if (seq->n_batch == 0) continue;
+        seq->pending.erase(seq->pending.begin(), seq->pending.begin() + seq->n_batch);
+        seq->n_past += seq->n_batch;
+        seq->n_batch = 0;
+        if (seq->logits_index < 0) continue;  // More prompt to go
         
-        // Wait for token with timeout
-        {
-            std::unique_lock<std::mutex> lock(queue_mutex_);
-            if (queue_cv_.wait_for(lock, std::chrono::milliseconds(10), 
-                [this] { return !token_queue_.empty() || generation_complete_; })) {
-                if (!token_queue_.empty()) {
-                    token = token_queue_.front();
-                    token_queue_.pop();
-                    got_token = true;
-                }
-            }
+        if (seq->stats.prompt_eval_time_ms == 0 && seq->stats.generated_tokens == 0) {
+            seq->stats.prompt_eval_time_ms = now - seq->start_time;
         }
         
-        if (got_token) {
-            // Convert token to string (moved OFF the main generation thread)
-            std::string token_text = tokenToString(token);
-            batch_buffer += token_text;
-            batch_count++;
+        // Each session's own row and sampler
+        llama_token token = seq->sampler.sample(ctx_, seq->logits_index);
+        seq->logits_index = -1;
+        if (llama_vocab_is_eog(vocab, token)) {
+            endBackground(*seq, FinishReason::Eos);
+            continue;
         }
         
-        // Flush batch when we have BATCH_SIZE tokens or timeout
-        auto now = std::chrono::steady_clock::now();
-        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - last_flush);
+        seq->detokenizer.push(token);
+        std::string text = seq->detokenizer.take();
+        if (!text.empty()) {
+            queueBackground(*seq, SessionEventType::Token, text);
+        }
         
-        bool should_flush = (batch_count >= BATCH_SIZE) || 
-                           (elapsed.count() > 50 && batch_count > 0) ||
-                           (generation_complete_ && batch_count > 0);
+        seq->stats.generated_tokens++;
+        seq->stats.eval_time_ms = now - seq->start_time - seq->stats.prompt_eval_time_ms;
+        if (seq->stats.eval_time_ms > 0) {
+            seq->stats.tokens_per_second = (seq->stats.generated_tokens * 1000.0) / seq->stats.eval_time_ms;
+        }
         
-        if (should_flush && !batch_buffer.empty()) {
-            // Store in output buffer for polling
-            {
-                std::lock_guard<std::mutex> lock(buffer_mutex_);
-                output_buffer_ += batch_buffer;
-            }
-            
-            // Call callback if registered
-            {
-                std::lock_guard<std::mutex> lock(callback_mutex_);
-                if (token_callback_) {
-                    token_callback_(batch_buffer);
-                }
-            }
-            
-            batch_buffer.clear();
-            batch_count = 0;
-            last_flush = now;
+        if (seq->stats.generated_tokens >= seq->max_tokens) {
+            endBackground(*seq, FinishReason::Length);
+        } else {
+            seq->pending.assign(1, token);
         }
     }
+    reapBackground();
+}
+
+void InferenceEngine::endBackground(BackgroundSequence& seq, FinishReason reason) {
+    if (seq.ended) return;
     
-    // Flush any remaining tokens
-    if (!batch_buffer.empty()) {
-        {
-            std::lock_guard<std::mutex> lock(buffer_mutex_);
-            output_buffer_ += batch_buffer;
-        }
-        {
-            std::lock_guard<std::mutex> lock(callback_mutex_);
-            if (token_callback_) {
-                token_callback_(batch_buffer);
-            }
-        }
+    seq.detokenizer.flush();
+    std::string text = seq.detokenizer.take();
+    if (!text.empty()) {
+        queueBackground(seq, SessionEventType::Token, text);
     }
+    
+    seq.stats.total_tokens = seq.stats.prompt_tokens + seq.stats.generated_tokens;
+    seq.stats.finish_reason = reason;
+    queueBackground(seq, reason == FinishReason::Error ? SessionEventType::Error : SessionEventType::Done,
+                    reason == FinishReason::Error ? "decode failed" : "");
+    
+    kv_cache_.sequenceRemove(seq.seq_id, -1, -1);
+    seq.sampler.release();
+    seq.ended = true;
+    seq.pending.clear();
+    
+    LOGD("background session %lld done: %lld tokens", static_cast<long long>(seq.session),
+         static_cast<long long>(seq.stats.generated_tokens));
 }
 
-bool InferenceEngine::startInferenceThreaded(const std::string& prompt, const InferenceConfig& config) {
-    if (!isModelLoaded()) {
-        LOGE("model not loaded");
-        return false;
+void InferenceEngine::endAllBackground(FinishReason reason) {
+    for (auto& seq : background_) {
+        endBackground(*seq, reason);
     }
+    reapBackground();
     
-    if (is_generating_) {
-        stopThreads();
+    // Called off the generation thread too; it delivers the final events
+    if (GenerationSession* session = existingSession()) {
+        session->wake();
     }
-    
-    // Reset state
-    stop_requested_ = false;
-    generation_complete_ = false;
-    
-    // Clear queues and buffers
-    {
-        std::lock_guard<std::mutex> lock(queue_mutex_);
-        while (!token_queue_.empty()) token_queue_.pop();
+}
+
+void InferenceEngine::reapBackground() {
+    for (auto& seq : background_) {
+        if (seq->cancelled) {
+            endBackground(*seq, FinishReason::Stopped);
+        }
     }
+    background_.erase(std::remove_if(background_.begin(), background_.end(),
+                                     [](const std::unique_ptr<BackgroundSequence>& seq) {
+                                         return seq->ended;
+                                     }),
+                      background_.end());
+    background_running_ = !background_.empty();
+}
+
+void InferenceEngine::queueBackground(const BackgroundSequence& seq, SessionEventType type,
+                                      const std::string& text) {
+    SessionEvent event;
+    event.type = type;
+    event.session = seq.session;
+    event.text = text;
+    event.stats = seq.stats;
+    
+    std::lock_guard<std::mutex> lock(background_events_mutex_);
+    background_events_.emplace_back(seq.sink, std::move(event));
+    background_queued_ = true;
+}
+
+void InferenceEngine::deliverBackground() {
+    // Sinks run without any lock held, so they may call back into the engine
+    std::vector<std::pair<SessionSink, SessionEvent>> events;
     {
-        std::lock_guard<std::mutex> lock(buffer_mutex_);
-        output_buffer_.clear();
+        std::lock_guard<std::mutex> lock(background_events_mutex_);
+        if (background_events_.empty()) return;
+        events.swap(background_events_);
+        background_queued_ = false;
     }
-    
-    // Standard setup (same as startInferenceIncremental)
-    {
-        std::lock_guard<std::mutex> lock(mutex_);
-        
-        current_config_ = config;
-        initSampler(config);
-        
-        // Tokenize the new prompt
-        std::vector<llama_token> new_tokens;
-        if (!tokenizePrompt(prompt, new_tokens)) {
-            LOGE("Failed to tokenize prompt");
-            return false;
-        }
-        
-        int available_space = current_config_.context_length - n_past_ - 32;
-        if (static_cast<int>(new_tokens.size()) > available_space) {
-            shiftContext(64);
-        }
-        
-        eval_start_time_ = getCurrentTimeMs();
-        stats_.prompt_tokens = new_tokens.size();
-        stats_.generated_tokens = 0;
-        
-        if (!evaluateTokens(new_tokens, n_past_, new_tokens.size())) {
-            LOGE("eval failed");
-            return false;
-        }
-        
-        tokens_.insert(tokens_.end(), new_tokens.begin(), new_tokens.end());
-        stats_.prompt_eval_time_ms = getCurrentTimeMs() - eval_start_time_;
-        
-        n_past_ += new_tokens.size();
+    for (const auto& entry : events) {
+        entry.first(entry.second);
     }
-    
-    is_generating_ = true;
-    
-    // Start worker threads
-    generation_thread_ = std::thread(&InferenceEngine::generationThreadFunc, this);
-    processor_thread_ = std::thread(&InferenceEngine::processorThreadFunc, this);
-    
-    return true;
+}
+
+// ============================================================================
+// GENERATION SESSIONS
+// ============================================================================
+
+GenerationSession* InferenceEngine::session() {
+    // Created on first use; engines that never generate own no thread.
+    // Once created it lives as long as the engine, so the pointer can be
+    // used after the lock is released.
+    std::lock_guard<std::mutex> lock(session_mutex_);
+    if (!session_) {
+        session_ = std::make_unique<GenerationSession>(*this);
+    }
+    return session_.get();
+}
+
+GenerationSession* InferenceEngine::existingSession() const {
+    std::lock_guard<std::mutex> lock(session_mutex_);
+    return session_.get();
+}
+
+int64_t InferenceEngine::startSession(SessionRequest request, SessionSink sink) {
+    return session()->start(std::move(request), std::move(sink));
+}
+
+void InferenceEngine::cancelSession(int64_t session) {
+    if (GenerationSession* generation = existingSession()) {
+        generation->cancel(session);
+    }
+}
+
+int64_t InferenceEngine::activeSession() const {
+    GenerationSession* session = existingSession();
+    return session != nullptr ? session->active() : 0;
+}
+
+int64_t InferenceEngine::startBackgroundSession(SessionRequest request, SessionSink sink) {
+    return session()->startBackground(std::move(request), std::move(sink));
 }
 
 } // namespace cortex
@@ -7,38 +7,101 @@
 #include <atomic>
 #include <mutex>
 #include <thread>
-#include <queue>
-#include <condition_variable>
+#include <deque>
 
 // llama.cpp headers
 #include "llama.h"
 #include "ggml.h"
 
-// JNI callback for push-based token delivery
-#ifdef __ANDROID__
-#include <jni.h>
-#endif
+#include "kv_cache.h"
+#include "model_cache.h"
+#include "prefix_cache.h"
+#include "detokenizer.h"
+#include "token_sampler.h"
+#include "grammar_cache.h"
+#include "chat_template.h"
+#include "benchmark.h"
+#include "latency_trace.h"
+#include "thread_scheduler.h"
+#include "thermal_governor.h"
 
 namespace cortex {
 
+class GenerationSession;
+
 // Configuration for the inference engine
 struct InferenceConfig {
     int context_length = 4096;
     int batch_size = 512;
+    int ubatch_size = 32;     // Tokens per compute graph; sizes llama's compute buffer
+    int prefill_chunk = 0;    // Prompt tokens decoded between stop checks (<= 0: batch_size)
+    bool async_prefill = true;  // start*() only tokenizes; the generating thread decodes the prompt
     int max_tokens = 2048;
-    int threads = 4;
+    int threads = 4;          // Decode threads (<= 0: CPU topology default)
+    int threads_batch = 0;    // Prompt/prefill threads (<= 0: CPU topology default)
     bool use_mmap = true;
     bool use_mlock = false;
     
+    // Interleave Q4_0/Q4_K/IQ4_NL/Q8_0 weights at load into the layouts
+    // the dotprod/i8mm GEMV kernels read (ggml's CPU repack buffer). Those
+    // tensors become anonymous memory instead of mmap'd file pages and are
+    // converted again on every load that misses the model cache.
+    bool repack_weights = true;
+    
+    // KV cache element type for K and V: GGML_TYPE_F16, GGML_TYPE_Q8_0 or
+    // GGML_TYPE_Q4_0. q8_0 roughly halves the cache at no visible quality
+    // cost; quantized V relies on flash attention, which is always on.
+    ggml_type kv_type = GGML_TYPE_F16;
+    
     // Sampling parameters
     float temperature = 0.7f;
     float top_p = 0.9f;
     int top_k = 40;
     float repeat_penalty = 1.1f;
     int repeat_last_n = 64;
+    uint32_t seed = 0;        // 0: random per sampler; fixed makes a prompt's output repeatable
     
-    // GPU offload (for future use)
+    // Constrained decoding: only output the grammar accepts is sampled.
+    // Compiled grammars are cached by their text (see grammar_cache.h).
+    std::string grammar;      // GBNF with a root rule; empty: unconstrained
+    std::string json_schema;  // Converted to GBNF (see json_schema.h); wins over grammar
+    
+    // Layers offloaded to the GPU backend (see gpu_offload.h); needs a GPU build
     int gpu_layers = 0;
+    
+    // Speculative decoding: tokens proposed by the draft model per target pass
+    int draft_tokens = 4;
+    
+    // Prompt prefix cache: reuse KV state of previously evaluated prompts
+    bool prefix_cache = true;
+    bool prefix_cache_persist = true;  // Keep entries on disk next to the model
+    
+    // Conversations kept resident in the KV cache, one sequence each
+    int conversation_slots = 1;
+    
+    // Background sessions (titles, summaries, suggestions) decode on their
+    // own sequences, batched into the chat's decode steps
+    int background_sequences = 2;
+    int background_context = 512;   // KV cells per background sequence, prompt + output
+    int background_chunk = 32;      // Prompt tokens per session and step; bounds the chat's extra latency
+    
+    // Context shifting (n_keep/n_discard): the first n_keep tokens stay
+    // pinned, n_discard tokens after them are dropped and the rest slide down
+    int n_keep = -1;        // -1 pins the conversation's first prompt
+    int n_discard = 0;      // 0 discards half of the unpinned tokens
+    int shift_margin = 16;  // Free cells kept ahead of generation
+    
+    // Trade burst speed for sustained speed as the device heats up
+    bool thermal_governor = true;
+};
+
+// Why the last generation ended
+enum class FinishReason {
+    None = 0,       // Still running, or nothing started yet
+    Eos,            // The model produced an end-of-generation token
+    Length,         // max_tokens or the context ran out
+    Stopped,        // stopGeneration(), a new start, or an unload
+    Error,          // A decode failed
 };
 
 // Statistics about generation
@@ -47,12 +110,77 @@ struct GenerationStats {
     int64_t prompt_tokens = 0;
     int64_t generated_tokens = 0;
     double prompt_eval_time_ms = 0;
+    int prefill_done = 0;           // Prompt tokens decoded so far
+    int prefill_total = 0;          // Prompt tokens to decode, 0 when none is queued
     double eval_time_ms = 0;
     double tokens_per_second = 0;
+    
+    // Speculative decoding
+    int64_t draft_tokens = 0;       // Tokens proposed by the draft model
+    int64_t accepted_tokens = 0;    // Draft tokens confirmed by the target model
+    double acceptance_rate = 0;
+    
+    // Prompt tokens restored from the prefix cache instead of decoded
+    int64_t cached_tokens = 0;
+    
+    // Thermal governor
+    int thermal_level = 0;          // 0 = unthrottled, see ThermalGovernor
+    int thermal_status = 0;         // PowerManager.THERMAL_STATUS_*
+    float thermal_headroom = -1;    // -1 if the device does not report it
+    double decode_latency_ms = 0;   // Moving average per token
+    int decode_threads = 0;
+    
+    FinishReason finish_reason = FinishReason::None;
+};
+
+// Model load progress in [0, 1]; return false to cancel the load
+using LoadProgressCallback = std::function<bool(float progress)>;
+
+// One generation request, run by GenerationSession on the engine's
+// generation thread
+struct SessionRequest {
+    std::vector<ChatTurn> turns;   // Rendered with the model's chat template
+    std::string prompt;            // Raw prompt, used when turns is empty
+    bool incremental = false;      // Raw prompt continues the cached sequence
+    bool speculative = false;      // Draft model + batched verify, if compatible
+    InferenceConfig config;
+};
+
+enum class SessionEventType {
+    Token = 0,      // text holds the next piece of UTF-8 output
+    Done = 1,       // stats is final; nothing follows
+    Error = 2,      // text holds the reason, stats is final; nothing follows
 };
 
-// Token callback for streaming
-using TokenCallback = std::function<bool(const std::string& token, bool is_final)>;
+struct SessionEvent {
+    SessionEventType type = SessionEventType::Token;
+    int64_t session = 0;
+    std::string text;
+    GenerationStats stats;
+};
+
+// Called on the generation thread; keep it short, it runs between decodes
+using SessionSink = std::function<void(const SessionEvent& event)>;
+
+// A background session on its own KV sequence, see stepBackground()
+struct BackgroundSequence {
+    int64_t session = 0;
+    llama_seq_id seq_id = -1;
+    SessionSink sink;
+    TokenSampler sampler;               // Own penalty window and RNG
+    StreamingDetokenizer detokenizer;
+    
+    std::vector<llama_token> pending;   // Prompt left to decode, or the last sampled token
+    int n_past = 0;
+    int max_tokens = 0;
+    int n_batch = 0;                    // Rows in the current batch
+    int logits_index = -1;              // Batch row to sample from, -1 if none
+    bool cancelled = false;
+    bool ended = false;                 // Final event queued
+    
+    GenerationStats stats;
+    int64_t start_time = 0;
+};
 
 class InferenceEngine {
 public:
@@ -64,74 +192,154 @@ public:
     InferenceEngine& operator=(const InferenceEngine&) = delete;
     
     // Model management
-    bool loadModel(const std::string& model_path, const InferenceConfig& config);
+    bool loadModel(const std::string& model_path, const InferenceConfig& config,
+                   LoadProgressCallback progress = nullptr);
     void unloadModel();
     bool isModelLoaded() const;
     std::string getModelInfo() const;
     
-    // Inference
+    // Unloaded models are parked here instead of freed; not owned
+    void setModelCache(ModelCache* cache) { model_cache_ = cache; }
+    
+    // Draft model for speculative decoding (must share the target vocab)
+    bool loadDraftModel(const std::string& model_path);
+    void unloadDraftModel();
+    bool hasDraftModel() const;
+    
+    // Generation sessions: the request runs on the engine's one generation
+    // thread, which pushes text to the sink as it is decoded and ends with
+    // a single Done or Error event carrying the final stats. Starting a
+    // session ends the running one first. Returns the session handle.
+    int64_t startSession(SessionRequest request, SessionSink sink);
+    void cancelSession(int64_t session = 0);  // Waits for its final event; 0: any
+    int64_t activeSession() const;  // 0 when idle
+    
+    // Compiles (or finds cached) the config's grammar; false with the
+    // reason when it does not compile. Starting with it would fail too.
+    bool checkGrammar(const InferenceConfig& config, std::string& error);
+    
+    // Background sessions run next to the foreground one, each on its own
+    // KV sequence: every decode step of the foreground generation carries
+    // one token (or a prompt chunk) of each of them in the same batch, and
+    // each is sampled with its own chain. While the foreground is idle the
+    // generation thread steps them alone. Returns the handle, -1 if all
+    // background sequences are busy.
+    int64_t startBackgroundSession(SessionRequest request, SessionSink sink);
+    
+    // Background building blocks, used by GenerationSession. Sinks are
+    // queued under the engine lock and run by deliverBackground().
+    bool addBackground(int64_t session, const SessionRequest& request, SessionSink sink);
+    void cancelBackground(int64_t session);  // 0: all; the final event follows on the thread
+    void stepBackground();  // One batch of background tokens alone
+    void deliverBackground();
+    bool hasBackgroundWork() const { return background_running_ || background_queued_; }
+    
+    // Building blocks of a session, on the generation thread. With
+    // async_prefill the start calls return once the prompt is tokenized;
+    // the first getNextToken() decodes it chunk by chunk and returns the
+    // first token, and stopGeneration() interrupts it between chunks.
+    // Progress is in GenerationStats::prefill_done/prefill_total.
     bool startInference(const std::string& prompt, const InferenceConfig& config);
     bool startInferenceIncremental(const std::string& prompt, const InferenceConfig& config);  // KV cache reuse
-    bool startInferenceThreaded(const std::string& prompt, const InferenceConfig& config);  // Multi-threaded generation
-    std::string getNextToken();
-    std::vector<std::string> getNextTokens(int count = 4);  // Batch token decoding
+    bool startInferenceSpeculative(const std::string& prompt, const InferenceConfig& config,
+                                   bool incremental = false);  // Draft proposes, target verifies in one batch
+    
+    // Chat: turns are rendered with the model's own template. A warm slot
+    // only evaluates the new turn; otherwise the whole conversation is.
+    bool startChat(const std::vector<ChatTurn>& turns, const InferenceConfig& config,
+                   bool speculative = false);
+    std::string getNextToken();  // Empty once done, or while a character is incomplete
     bool isGenerating() const;
     void stopGeneration();
-    
-    // Threaded generation control
-    void setTokenCallback(std::function<void(const std::string&)> callback);
-    void clearTokenCallback();
-    std::string popTokenFromQueue();  // Non-blocking pop for polling mode
+    void pinGenerationThread() const { scheduler_.pinCurrentThread(); }
     
     // Context management
-    void shiftContext(int keep_tokens = 64);  // Context shifting for infinite generation
+    bool shiftContext(int n_discard = 0);  // Drop tokens after the pinned prefix (0: half)
     void clearCache();  // Clear KV cache for new conversation
     int getCachedTokenCount() const { return n_past_; }  // How many tokens are cached
     
-    // Streaming inference with callback
-    bool generateWithCallback(const std::string& prompt, 
-                              const InferenceConfig& config,
-                              TokenCallback callback);
+    // Conversation slots: each conversation keeps its own KV sequence, so
+    // switching back to a resident conversation needs no prompt re-evaluation
+    int selectConversation(int64_t conversation_id);  // Returns cached tokens, -1 on error
+    bool forkConversation(int64_t src_id, int64_t dst_id);  // Share src's KV with dst, make dst active
+    void releaseConversation(int64_t conversation_id);
+    
+    // Memory pressure (see MemoryManager::onTrimMemory), cheapest first:
+    // free cached prompt states, then rebuild the context smaller. The
+    // active conversation is decoded again, so a running generation goes
+    // on instead of being killed with the app.
+    size_t dropCaches();  // Returns bytes released
+    bool shrinkContext(int context_length, ggml_type kv_type, int ubatch_size);
+    const InferenceConfig& getConfig() const { return current_config_; }
+    const std::string& getModelPath() const { return model_path_; }
     
     // Statistics
     GenerationStats getStats() const;
     void resetStats();
     
+    // Benchmark sweep on private contexts; stops any generation first
+    std::string runBenchmark(const BenchmarkConfig& config);
+    
+    // Thermal status and headroom from the platform; any thread
+    void setThermalState(int status, float headroom);
+    
     // Memory info
     size_t getModelMemoryUsage() const;
-    size_t getContextMemoryUsage() const;
+    size_t getContextMemoryUsage() const;  // K/V tensors of the target and draft contexts
+    KVCacheStats getKVCacheStats() const;
+    ggml_type getKVCacheType() const { return kv_cache_.getConfig().type_k; }
     
 private:
     // llama.cpp structures
     llama_model* model_ = nullptr;
     llama_context* ctx_ = nullptr;
-    llama_sampler* sampler_ = nullptr;
+    TokenSampler sampler_;
+    GrammarCache grammar_cache_;
+    
+    // Reused by prefill, decode and speculative verification
+    llama_batch batch_ = {};
+    int batch_capacity_ = 0;
+    
+    // Draft model for speculative decoding
+    llama_model* draft_model_ = nullptr;
+    llama_context* draft_ctx_ = nullptr;
+    llama_sampler* draft_sampler_ = nullptr;
+    ggml_type draft_kv_type_ = GGML_TYPE_F16;
+    int draft_n_past_ = 0;
+    
+    // Speculative state: the last sampled token is not yet in the target KV cache
+    bool speculative_ = false;
+    llama_token spec_last_token_ = -1;
+    std::deque<llama_token> spec_pending_;  // Accepted tokens waiting for getNextToken()
     
     // State
     std::atomic<bool> is_generating_{false};
     std::atomic<bool> stop_requested_{false};
+    std::atomic<FinishReason> finish_reason_{FinishReason::None};
     mutable std::mutex mutex_;
     
-    // Threaded generation
-    std::thread generation_thread_;
-    std::thread processor_thread_;
-    std::queue<llama_token> token_queue_;
-    std::mutex queue_mutex_;
-    std::condition_variable queue_cv_;
-    std::atomic<bool> generation_complete_{false};
-    std::function<void(const std::string&)> token_callback_;
-    std::mutex callback_mutex_;
-    
-    // Output buffer for batched delivery
-    std::string output_buffer_;
-    std::mutex buffer_mutex_;
-    static constexpr int BATCH_SIZE = 4;  // Tokens to batch before callback
+    // Prompt queued by start*(), decoded in chunks by the first
+    // getNextToken() on the generation thread. tokens_ only ever holds
+    // decoded tokens; a stopped prefill rolls back to prefill_keep_.
+    bool prefill_pending_ = false;
+    std::vector<llama_token> prefill_tokens_;
+    int prefill_keep_ = 0;
+    bool prefill_store_ = false;   // Save the prompt in the prefix cache once decoded
+    std::atomic<int> prefill_done_{0};
+    std::atomic<int> prefill_total_{0};
     
     // Token state for getNextToken()
     std::vector<llama_token> tokens_;
+    StreamingDetokenizer detokenizer_;
     int current_pos_ = 0;
     int n_past_ = 0;
     
+    // Hash of the chat text the active sequence holds, rendered turns plus
+    // the replies as handed out; startChat() only continues a sequence whose
+    // text is the conversation's. 0 after raw prompts or a lost reply.
+    uint64_t chat_hash_ = 0;
+    uint64_t pending_chat_hash_ = 0;   // chat_hash_ once the queued prompt is decoded
+    
     // Stats
     GenerationStats stats_;
     int64_t eval_start_time_ = 0;
@@ -139,20 +347,79 @@ private:
     // Configuration
     InferenceConfig current_config_;
     std::string model_path_;
+    llama_model_params model_params_ = {};  // Cache key of model_
+    ModelCache* model_cache_ = nullptr;
+    
+    // Template from the GGUF, set at load
+    ChatTemplate chat_template_;
+    
+    // Compute threadpools pinned to the fast clusters
+    ThreadScheduler scheduler_;
+    ThermalGovernor governor_;
+    
+    // Saved prompt KV state, survives model reloads
+    PrefixCache prefix_cache_;
+    
+    // Conversation slots; seq_id_ is the active conversation's sequence
+    KVCache kv_cache_;
+    llama_seq_id seq_id_ = 0;
+    int n_keep_ = 0;  // Pinned prefix of the active sequence
+    
+    // Background sessions; their sequences follow the conversation slots
+    std::vector<std::unique_ptr<BackgroundSequence>> background_;
+    std::vector<std::pair<SessionSink, SessionEvent>> background_events_;
+    std::mutex background_events_mutex_;  // Taken after mutex_, never before
+    std::atomic<bool> background_running_{false};
+    std::atomic<bool> background_queued_{false};
+    llama_seq_id background_base_ = 1;
     
     // Internal methods
-    bool tokenizePrompt(const std::string& prompt, std::vector<llama_token>& tokens);
+    bool tokenizePrompt(const std::string& prompt, std::vector<llama_token>& tokens, bool add_special);
     bool evaluateTokens(const std::vector<llama_token>& tokens, int n_past, int n_tokens);
+    bool beginPrefill(std::vector<llama_token> tokens, int keep, bool store_prefix);
+    bool runPrefill();
+    void abortPrefill();
+    void batchClear();
+    void batchAdd(llama_token token, llama_pos pos, llama_seq_id seq_id, bool logits);
     llama_token sampleNextToken();
-    std::string tokenToString(llama_token token);
-    void initSampler(const InferenceConfig& config);
-    void freeSampler();
+    bool decodeStep(llama_token token);
+    void packBackground(int reserve);
+    void sampleBackground();
+    void endBackground(BackgroundSequence& seq, FinishReason reason);
+    void endAllBackground(FinishReason reason);
+    void reapBackground();
+    void queueBackground(const BackgroundSequence& seq, SessionEventType type, const std::string& text);
+    std::string finishText(FinishReason reason);
+    void finish(FinishReason reason);
+    std::string recordText(std::string text);  // Into chat_hash_, on its way out
+    uint64_t chatHash() const;
+    void applyConfig(const InferenceConfig& config);
+    llama_context_params contextParams(const InferenceConfig& config) const;
+    void initKVCache(const llama_context_params& ctx_params, int n_slots);
+    void freeDraft();
+    void releaseModel();
+    bool initSampler(const InferenceConfig& config);
+    bool isDraftCompatible() const;
+    bool evaluateDraft(const std::vector<llama_token>& tokens, int n_past);
+    void seedSpeculative();
+    bool speculativeStep();
+    void reconcileSpeculative(std::vector<llama_token>& next_tokens);
+    void updateSpeculativeStats();
+    void pinPrompt(int n_prompt);
+    bool shiftContextLocked(int n_discard);
+    bool makeRoom(int n_tokens);
+    void saveActiveSlot();
+    void activateSlot(int seq_id);
+    bool governThreads(double decode_ms);
     int64_t getCurrentTimeMs() const;
+    GenerationSession* session();               // Created on first use
+    GenerationSession* existingSession() const;  // Null until then
     
-    // Thread worker functions
-    void generationThreadFunc();
-    void processorThreadFunc();
-    void stopThreads();
+    // The generation thread; declared last so it stops before the rest goes.
+    // Starts arrive on different threads, so creating
+    // and reading the pointer take session_mutex_.
+    mutable std::mutex session_mutex_;
+    std::unique_ptr<GenerationSession> session_;
 };
 
 } // namespace cortex
@@ -0,0 +1,534 @@
+#include "json_schema.h"
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <vector>
+
+namespace cortex {
+
+namespace {
+
+// Parsed schema document. Only what the converter looks at is kept apart;
+// numbers stay as their source text.
+struct JsonValue {
+    enum Type { Null, Bool, Number, String, Array, Object } type = Null;
+    bool boolean = false;
+    std::string text;  // String contents, or the number as written
+    std::vector<JsonValue> items;
+    std::vector<std::pair<std::string, JsonValue>> members;
+    
+    const JsonValue* get(const char* key) const {
+        if (type != Object) return nullptr;
+        for (const auto& member : members) {
+            if (member.first == key) return &member.second;
+        }
+        return nullptr;
+    }
+};
+
+// Recursive descent, no exceptions; depth-limited so a hostile schema
+// cannot blow the stack
+class JsonParser {
+public:
+    explicit JsonParser(const std::string& src) : src_(src) {}
+    
+    bool parse(JsonValue& out, std::string& error) {
+        skipSpace();
+        if (!value(out, 0)) {
+            error = error_.empty() ? "invalid JSON" : error_;
+            return false;
+        }
+        skipSpace();
+        if (pos_ != src_.size()) {
+            error = "trailing characters after the schema";
+            return false;
+        }
+        return true;
+    }
+
+private:
+    static const int MAX_DEPTH = 64;
+    
+    const std::string& src_;
+    size_t pos_ = 0;
+    std::string error_;
+    
+    bool fail(const char* what) {
+        char buf[96];
+        snprintf(buf, sizeof(buf), "%s at offset %zu", what, pos_);
+        error_ = buf;
+        return false;
+    }
+    
+    void skipSpace() {
+        while (pos_ < src_.size() && (src_[pos_] == ' ' || src_[pos_] == '\t' ||
+                                      src_[pos_] == '\n' || src_[pos_] == '\r')) {
+            pos_++;
+        }
+    }
+    
+    bool literal(const char* word) {
+        size_t n = strlen(word);
+        if (src_.compare(pos_, n, word) != 0) return fail("unexpected token");
+        pos_ += n;
+        return true;
+    }
+    
+    bool value(JsonValue& out, int depth) {
+        if (depth > MAX_DEPTH) return fail("schema nested too deeply");
+        if (pos_ >= src_.size()) return fail("unexpected end");
+        
+        char c = src_[pos_];
+        if (c == '{') return object(out, depth);
+        if (c == '[') return array(out, depth);
+        if (c == '"') {
+            out.type = JsonValue::String;
+            return string(out.text);
+        }
+        if (c == 't' || c == 'f') {
+            out.type = JsonValue::Bool;
+            out.boolean = c == 't';
+            return literal(c == 't' ? "true" : "false");
+        }
+        if (c == 'n') {
+            out.type = JsonValue::Null;
+            return literal("null");
+        }
+        return number(out);
+    }
+    
+    bool number(JsonValue& out) {
+        size_t start = pos_;
+        if (pos_ < src_.size() && src_[pos_] == '-') pos_++;
+        while (pos_ < src_.size() && (isdigit(static_cast<unsigned char>(src_[pos_])) ||
+                                      src_[pos_] == '.' || src_[pos_] == 'e' || src_[pos_] == 'E' ||
+                                      src_[pos_] == '+' || src_[pos_] == '-')) {
+            pos_++;
+        }
+        if (pos_ == start) return fail("unexpected character");
+        out.type = JsonValue::Number;
+        out.text = src_.substr(start, pos_ - start);
+        return true;
+    }
+    
+    bool string(std::string& out) {
+        pos_++;  // Opening quote
+        out.clear();
+        while (pos_ < src_.size()) {
+            char c = src_[pos_++];
+            if (c == '"') return true;
+            if (c != '\\') {
+                out += c;
+                continue;
+            }
+            if (pos_ >= src_.size()) break;
+            char e = src_[pos_++];
+            switch (e) {
+                case 'n': out += '\n'; break;
+                case 't': out += '\t'; break;
+                case 'r': out += '\r'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'u': {
+                    if (pos_ + 4 > src_.size()) return fail("bad \\u escape");
+                    unsigned cp = strtoul(src_.substr(pos_, 4).c_str(), nullptr, 16);
+                    pos_ += 4;
+                    // BMP only; enough for property names and enum values
+                    if (cp < 0x80) {
+                        out += static_cast<char>(cp);
+                    } else if (cp < 0x800) {
+                        out += static_cast<char>(0xC0 | (cp >> 6));
+                        out += static_cast<char>(0x80 | (cp & 0x3F));
+                    } else {
+                        out += static_cast<char>(0xE0 | (cp >> 12));
+                        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+                        out += static_cast<char>(0x80 | (cp & 0x3F));
+                    }
+                    break;
+                }
+                default: out += e; break;
+            }
+        }
+        return fail("unterminated string");
+    }
+    
+    bool array(JsonValue& out, int depth) {
+        out.type = JsonValue::Array;
+        pos_++;
+        skipSpace();
+        if (pos_ < src_.size() && src_[pos_] == ']') {
+            pos_++;
+            return true;
+        }
+        while (true) {
+            out.items.emplace_back();
+            skipSpace();
+            if (!value(out.items.back(), depth + 1)) return false;
+            skipSpace();
+            if (pos_ >= src_.size()) return fail("unterminated array");
+            if (src_[pos_] == ']') {
+                pos_++;
+                return true;
+            }
+            if (src_[pos_++] != ',') return fail("expected ',' in array");
+        }
+    }
+    
+    bool object(JsonValue& out, int depth) {
+        out.type = JsonValue::Object;
+        pos_++;
+        skipSpace();
+        if (pos_ < src_.size() && src_[pos_] == '}') {
+            pos_++;
+            return true;
+        }
+        while (true) {
+            skipSpace();
+            if (pos_ >= src_.size() || src_[pos_] != '"') return fail("expected a property name");
+            out.members.emplace_back();
+            if (!string(out.members.back().first)) return false;
+            skipSpace();
+            if (pos_ >= src_.size() || src_[pos_++] != ':') return fail("expected ':'");
+            skipSpace();
+            if (!value(out.members.back().second, depth + 1)) return false;
+            skipSpace();
+            if (pos_ >= src_.size()) return fail("unterminated object");
+            if (src_[pos_] == '}') {
+                pos_++;
+                return true;
+            }
+            if (src_[pos_++] != ',') return fail("expected ',' in object");
+        }
+    }
+};
+
+// Shared rules, added to the grammar the first time a schema needs them.
+// Whitespace is bounded so a constrained model cannot pad forever.
+const std::map<std::string, std::string> PRIMITIVES = {
+    {"ws", "| \" \" | \"\\n\" [ \\t]{0,20}"},
+    {"char", "[^\"\\\\\\x7F\\x00-\\x1F] | \"\\\\\" ([\"\\\\/bfnrt] | \"u\" [0-9a-fA-F]{4})"},
+    {"string", "\"\\\"\" char* \"\\\"\" ws"},
+    {"number", "\"-\"? (\"0\" | [1-9] [0-9]{0,15}) (\".\" [0-9]+)? ([eE] [-+]? [0-9]{1,15})? ws"},
+    {"integer", "\"-\"? (\"0\" | [1-9] [0-9]{0,15}) ws"},
+    {"boolean", "(\"true\" | \"false\") ws"},
+    {"null", "\"null\" ws"},
+    {"value", "object | array | string | number | boolean | null"},
+    {"object", "\"{\" ws (string \":\" ws value (\",\" ws string \":\" ws value)*)? \"}\" ws"},
+    {"array", "\"[\" ws (value (\",\" ws value)*)? \"]\" ws"},
+};
+
+// Which primitives each one refers to
+const std::map<std::string, std::vector<std::string>> PRIMITIVE_DEPS = {
+    {"string", {"char", "ws"}},
+    {"number", {"ws"}},
+    {"integer", {"ws"}},
+    {"boolean", {"ws"}},
+    {"null", {"ws"}},
+    {"value", {"object", "array", "string", "number", "boolean", "null"}},
+    {"object", {"ws", "string", "value"}},
+    {"array", {"ws", "value"}},
+};
+
+// GBNF string literal for raw text
+std::string quote(const std::string& text) {
+    std::string out = "\"";
+    for (unsigned char c : text) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (c < 0x20) {
+                    char buf[8];
+                    snprintf(buf, sizeof(buf), "\\x%02X", c);
+                    out += buf;
+                } else {
+                    out += static_cast<char>(c);
+                }
+        }
+    }
+    return out + "\"";
+}
+
+// Compact JSON text of a value, as the model has to write it
+void serialize(const JsonValue& value, std::string& out) {
+    switch (value.type) {
+        case JsonValue::Null: out += "null"; break;
+        case JsonValue::Bool: out += value.boolean ? "true" : "false"; break;
+        case JsonValue::Number: out += value.text; break;
+        case JsonValue::String:
+            out += '"';
+            for (unsigned char c : value.text) {
+                if (c == '"' || c == '\\') {
+                    out += '\\';
+                    out += static_cast<char>(c);
+                } else if (c == '\n') {
+                    out += "\\n";
+                } else if (c < 0x20) {
+                    char buf[8];
+                    snprintf(buf, sizeof(buf), "\\u%04x", c);
+                    out += buf;
+                } else {
+                    out += static_cast<char>(c);
+                }
+            }
+            out += '"';
+            break;
+        case JsonValue::Array:
+            out += '[';
+            for (size_t i = 0; i < value.items.size(); i++) {
+                if (i > 0) out += ',';
+                serialize(value.items[i], out);
+            }
+            out += ']';
+            break;
+        case JsonValue::Object:
+            out += '{';
+            for (size_t i = 0; i < value.members.size(); i++) {
+                if (i > 0) out += ',';
+                JsonValue key;
+                key.type = JsonValue::String;
+                key.text = value.members[i].first;
+                serialize(key, out);
+                out += ':';
+                serialize(value.members[i].second, out);
+            }
+            out += '}';
+            break;
+    }
+}
+
+class GrammarBuilder {
+public:
+    bool build(const JsonValue& schema, std::string& grammar, std::string& error) {
+        std::string root;
+        if (!rule(schema, root)) {
+            error = error_;
+            return false;
+        }
+        
+        grammar = "root ::= " + root + "\n";
+        for (const auto& entry : rules_) {
+            grammar += entry.first + " ::= " + entry.second + "\n";
+        }
+        for (const auto& name : used_) {
+            grammar += name + " ::= " + PRIMITIVES.at(name) + "\n";
+        }
+        return true;
+    }
+
+private:
+    std::vector<std::pair<std::string, std::string>> rules_;
+    std::vector<std::string> used_;
+    int next_rule_ = 0;
+    std::string error_;
+    
+    std::string primitive(const std::string& name) {
+        for (const auto& used : used_) {
+            if (used == name) return name;
+        }
+        used_.push_back(name);
+        auto deps = PRIMITIVE_DEPS.find(name);
+        if (deps != PRIMITIVE_DEPS.end()) {
+            for (const auto& dep : deps->second) {
+                primitive(dep);
+            }
+        }
+        return name;
+    }
+    
+    std::string addRule(const std::string& body) {
+        std::string name = "r" + std::to_string(next_rule_++);
+        rules_.emplace_back(name, body);
+        return name;
+    }
+    
+    // The expression matching one schema; named rules for anything nested
+    bool rule(const JsonValue& schema, std::string& out) {
+        if (schema.type == JsonValue::Bool) {
+            // true accepts anything; false cannot be satisfied, treat it alike
+            out = primitive("value");
+            return true;
+        }
+        if (schema.type != JsonValue::Object) {
+            error_ = "schema must be an object";
+            return false;
+        }
+        if (schema.get("$ref") != nullptr) {
+            error_ = "$ref is not supported";
+            return false;
+        }
+        
+        if (const JsonValue* value = schema.get("const")) {
+            std::string text;
+            serialize(*value, text);
+            out = addRule(quote(text) + " " + primitive("ws"));
+            return true;
+        }
+        
+        if (const JsonValue* values = schema.get("enum")) {
+            if (values->type != JsonValue::Array || values->items.empty()) {
+                error_ = "enum must be a non-empty array";
+                return false;
+            }
+            std::string body;
+            for (size_t i = 0; i < values->items.size(); i++) {
+                std::string text;
+                serialize(values->items[i], text);
+                body += (i > 0 ? " | " : "") + quote(text);
+            }
+            out = addRule("(" + body + ") " + primitive("ws"));
+            return true;
+        }
+        
+        const JsonValue* any = schema.get("anyOf");
+        if (any == nullptr) any = schema.get("oneOf");
+        if (any != nullptr) {
+            if (any->type != JsonValue::Array || any->items.empty()) {
+                error_ = "anyOf/oneOf must be a non-empty array";
+                return false;
+            }
+            return alternatives(any->items, out);
+        }
+        
+        const JsonValue* type = schema.get("type");
+        if (type != nullptr && type->type == JsonValue::Array) {
+            // {"type": ["string", "null"]}: one alternative per type
+            std::vector<JsonValue> variants;
+            for (const JsonValue& item : type->items) {
+                JsonValue variant = schema;
+                for (auto& member : variant.members) {
+                    if (member.first == "type") member.second = item;
+                }
+                variants.push_back(variant);
+            }
+            return alternatives(variants, out);
+        }
+        
+        std::string name = type != nullptr && type->type == JsonValue::String ? type->text : "";
+        if (name.empty()) {
+            // Untyped: infer from the keywords, else anything
+            name = schema.get("properties") ? "object" : schema.get("items") ? "array" : "";
+        }
+        
+        if (name == "object") return object(schema, out);
+        if (name == "array") return array(schema, out);
+        if (name == "string" || name == "number" || name == "integer" || name == "boolean" ||
+            name == "null") {
+            out = primitive(name);
+            return true;
+        }
+        if (name.empty()) {
+            out = primitive("value");
+            return true;
+        }
+        error_ = "unknown type " + name;
+        return false;
+    }
+    
+    bool alternatives(const std::vector<JsonValue>& schemas, std::string& out) {
+        std::string body;
+        for (size_t i = 0; i < schemas.size(); i++) {
+            std::string alt;
+            if (!rule(schemas[i], alt)) return false;
+            body += (i > 0 ? " | " : "") + alt;
+        }
+        out = addRule(body);
+        return true;
+    }
+    
+    bool array(const JsonValue& schema, std::string& out) {
+        const JsonValue* items = schema.get("items");
+        std::string item;
+        if (items == nullptr) {
+            item = primitive("value");
+        } else if (!rule(*items, item)) {
+            return false;
+        }
+        std::string ws = primitive("ws");
+        out = addRule("\"[\" " + ws + " (" + item + " (\",\" " + ws + " " + item + ")*)? \"]\" " + ws);
+        return true;
+    }
+    
+    bool object(const JsonValue& schema, std::string& out) {
+        const JsonValue* properties = schema.get("properties");
+        if (properties == nullptr || properties->type != JsonValue::Object || properties->members.empty()) {
+            out = primitive("object");
+            return true;
+        }
+        
+        const JsonValue* required = schema.get("required");
+        auto isRequired = [required](const std::string& key) {
+            if (required == nullptr || required->type != JsonValue::Array) return false;
+            for (const JsonValue& item : required->items) {
+                if (item.type == JsonValue::String && item.text == key) return true;
+            }
+            return false;
+        };
+        
+        // One rule per "key": value pair, in declaration order
+        std::string ws = primitive("ws");
+        std::vector<std::string> pairs;
+        std::vector<bool> needed;
+        int first_required = -1;
+        for (const auto& member : properties->members) {
+            std::string value;
+            if (!rule(member.second, value)) return false;
+            JsonValue key;
+            key.type = JsonValue::String;
+            key.text = member.first;
+            std::string key_text;
+            serialize(key, key_text);
+            pairs.push_back(addRule(quote(key_text) + " " + ws + " \":\" " + ws + " " + value));
+            needed.push_back(isRequired(member.first));
+            if (needed.back() && first_required < 0) first_required = pairs.size() - 1;
+        }
+        
+        // Commas only go between properties that are present: optional ones
+        // before the first required end in one, those after start with one
+        std::string body;
+        int n = pairs.size();
+        if (first_required >= 0) {
+            for (int i = 0; i < first_required; i++) {
+                body += "(" + pairs[i] + " \",\" " + ws + ")? ";
+            }
+            body += pairs[first_required];
+            for (int i = first_required + 1; i < n; i++) {
+                std::string next = "\",\" " + ws + " " + pairs[i];
+                body += needed[i] ? " " + next : " (" + next + ")?";
+            }
+        } else {
+            // All optional: whichever comes first, then any of the later ones
+            std::string alts;
+            for (int i = 0; i < n; i++) {
+                std::string alt = pairs[i];
+                for (int j = i + 1; j < n; j++) {
+                    alt += " (\",\" " + ws + " " + pairs[j] + ")?";
+                }
+                alts += (i > 0 ? " | " : "") + alt;
+            }
+            body = "(" + alts + ")?";
+        }
+        out = addRule("\"{\" " + ws + " " + body + " \"}\" " + ws);
+        return true;
+    }
+};
+
+} // namespace
+
+bool jsonSchemaToGrammar(const std::string& schema, std::string& grammar, std::string& error) {
+    JsonValue root;
+    JsonParser parser(schema);
+    if (!parser.parse(root, error)) {
+        return false;
+    }
+    
+    GrammarBuilder builder;
+    return builder.build(root, grammar, error);
+}
+
+} // namespace cortex
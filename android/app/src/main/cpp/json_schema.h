@@ -0,0 +1,18 @@
+#pragma once
+
+#include <string>
+
+namespace cortex {
+
+// JSON Schema -> GBNF for llama's grammar sampler. Covers what structured
+// output and tool calls use: type (one or a list), properties with
+// required (emitted in declaration order), items, enum, const, anyOf and
+// oneOf. An empty schema, or one without any of these, accepts any JSON
+// value. $ref, pattern, format and length bounds are not supported;
+// $ref fails, the rest are ignored.
+//
+// Returns false with a reason in error when the schema is not valid JSON
+// or uses $ref.
+bool jsonSchemaToGrammar(const std::string& schema, std::string& grammar, std::string& error);
+
+} // namespace cortex
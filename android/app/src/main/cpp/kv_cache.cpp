@@ -1,5 +1,8 @@
 #include "kv_cache.h"
 #include "llama.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
 #ifdef __ANDROID__
 #include <android/log.h>
 #else
@@ -40,7 +43,12 @@ bool KVCache::initialize(llama_context* ctx, const KVCacheConfig& config) {
     config_ = config;
     initialized_ = true;
     
-    LOGI("KV cache initialized with %d context size", config.n_ctx);
+    slots_.assign(std::max(1, config.n_seq), ConversationSlot());
+    use_counter_ = 0;
+    
+    LOGI("KV cache initialized with %d context size, %zu slots, %s/%s, %zu KB per token",
+         config.n_ctx, slots_.size(), ggml_type_name(config.type_k), ggml_type_name(config.type_v),
+         bytesPerCell(config.geometry, config.type_k, config.type_v) / 1024);
     return true;
 }
 
@@ -60,6 +68,12 @@ void KVCache::clear() {
     if (mem != nullptr) {
         llama_memory_clear(mem, true);
     }
+    
+    for (ConversationSlot& slot : slots_) {
+        slot.tokens.clear();
+        slot.n_keep = 0;
+        slot.chat_hash = 0;
+    }
     LOGD("KV cache cleared");
 }
 
@@ -131,6 +145,86 @@ void KVCache::sequenceKeep(int seq_id) {
     LOGD("Keeping only sequence %d", seq_id);
 }
 
+int KVCache::findSlot(int64_t conversation_id) const {
+    for (size_t i = 0; i < slots_.size(); i++) {
+        if (slots_[i].conversation_id == conversation_id) {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+int KVCache::acquireSlot(int64_t conversation_id) {
+    if (!initialized_ || ctx_ == nullptr) return -1;
+    
+    int seq_id = findSlot(conversation_id);
+    
+    if (seq_id < 0) {
+        // Prefer a free slot, otherwise reuse the least recently used one
+        seq_id = findSlot(-1);
+        if (seq_id < 0) {
+            seq_id = 0;
+            for (size_t i = 1; i < slots_.size(); i++) {
+                if (slots_[i].last_used < slots_[seq_id].last_used) {
+                    seq_id = static_cast<int>(i);
+                }
+            }
+            LOGD("Evicting conversation %lld from slot %d",
+                 static_cast<long long>(slots_[seq_id].conversation_id), seq_id);
+        }
+        
+        sequenceRemove(seq_id, -1, -1);
+        slots_[seq_id].conversation_id = conversation_id;
+        slots_[seq_id].tokens.clear();
+        slots_[seq_id].n_keep = 0;
+        slots_[seq_id].chat_hash = 0;
+    }
+    
+    slots_[seq_id].last_used = ++use_counter_;
+    return seq_id;
+}
+
+int KVCache::forkSlot(int src_seq, int64_t dst_conversation_id, int n_tokens) {
+    ConversationSlot* src = getSlot(src_seq);
+    if (src == nullptr || src->conversation_id < 0) return -1;
+    
+    // Touch the source first so acquiring the destination cannot evict it
+    src->last_used = ++use_counter_;
+    int dst_seq = acquireSlot(dst_conversation_id);
+    if (dst_seq < 0 || dst_seq == src_seq) return -1;
+    
+    ConversationSlot& dst = slots_[dst_seq];
+    size_t n_copy = src->tokens.size();
+    if (n_tokens >= 0 && static_cast<size_t>(n_tokens) < n_copy) {
+        n_copy = n_tokens;
+    }
+    
+    // With a unified KV cache the copy shares cells instead of duplicating them
+    sequenceRemove(dst_seq, -1, -1);
+    if (!sequenceCopy(src_seq, dst_seq, 0, static_cast<int>(n_copy))) {
+        dst.tokens.clear();
+        return -1;
+    }
+    dst.tokens.assign(src->tokens.begin(), src->tokens.begin() + n_copy);
+    dst.n_keep = std::min(src->n_keep, static_cast<int>(n_copy));
+    dst.chat_hash = n_copy == src->tokens.size() ? src->chat_hash : 0;
+    
+    return dst_seq;
+}
+
+void KVCache::releaseSlot(int seq_id) {
+    ConversationSlot* slot = getSlot(seq_id);
+    if (slot == nullptr) return;
+    
+    sequenceRemove(seq_id, -1, -1);
+    *slot = ConversationSlot();
+}
+
+ConversationSlot* KVCache::getSlot(int seq_id) {
+    if (seq_id < 0 || seq_id >= static_cast<int>(slots_.size())) return nullptr;
+    return &slots_[seq_id];
+}
+
 void KVCache::defragment() {
     if (!initialized_ || ctx_ == nullptr) return;
     
@@ -157,10 +251,9 @@ KVCacheStats KVCache::getStats() const {
     stats.total_cells = getTotalCells();
     stats.usage_ratio = getUsageRatio();
     
-    // Rough memory estimate (actual depends on model architecture)
-    // KV cache typically uses 2 * n_layer * n_embd * sizeof(float) per token
-    // We can't easily get these values without model reference, so estimate
-    stats.memory_bytes = stats.used_cells * 4096;  // Rough estimate
+    stats.bytes_per_cell = bytesPerCell(config_.geometry, config_.type_k, config_.type_v);
+    stats.memory_bytes = stats.used_cells * stats.bytes_per_cell;
+    stats.allocated_bytes = stats.total_cells * stats.bytes_per_cell;
     
     return stats;
 }
@@ -168,12 +261,18 @@ KVCacheStats KVCache::getStats() const {
 size_t KVCache::getUsedCells() const {
     if (!initialized_ || ctx_ == nullptr) return 0;
     
-    // Use llama_memory_seq_pos_max to estimate used cells
+    // Positions held by every sequence; forked prefixes share cells, so
+    // this is an upper bound when conversations were forked
     llama_memory_t mem = llama_get_memory(ctx_);
     if (mem == nullptr) return 0;
     
-    llama_pos max_pos = llama_memory_seq_pos_max(mem, 0);
-    return max_pos > 0 ? static_cast<size_t>(max_pos) : 0;
+    size_t used = 0;
+    for (int seq = 0; seq < static_cast<int>(slots_.size()); seq++) {
+        llama_pos max_pos = llama_memory_seq_pos_max(mem, seq);
+        if (max_pos < 0) continue;
+        used += max_pos - llama_memory_seq_pos_min(mem, seq) + 1;
+    }
+    return std::min(used, getTotalCells());
 }
 
 size_t KVCache::getTotalCells() const {
@@ -187,20 +286,48 @@ float KVCache::getUsageRatio() const {
     return static_cast<float>(getUsedCells()) / static_cast<float>(total);
 }
 
-size_t KVCache::estimateMemory(int n_ctx, int n_embd, int n_layer, int n_head) {
-    // KV cache stores key and value tensors for each layer
-    // Each has size: n_ctx * n_embd * sizeof(float)
-    // Total: 2 * n_layer * n_ctx * n_embd * sizeof(float)
+static int metaInt(const llama_model* model, const char* arch, const char* key) {
+    char name[128];
+    char value[32];
+    snprintf(name, sizeof(name), "%s.%s", arch, key);
+    if (llama_model_meta_val_str(model, name, value, sizeof(value)) < 0) return 0;
+    return atoi(value);
+}
+
+KVCacheGeometry KVCacheGeometry::fromModel(const llama_model* model) {
+    KVCacheGeometry geometry;
+    if (model == nullptr) return geometry;
     
-    size_t kv_size = 2 * static_cast<size_t>(n_layer) * 
-                     static_cast<size_t>(n_ctx) * 
-                     static_cast<size_t>(n_embd) * 
-                     sizeof(float);
+    geometry.n_layer = llama_model_n_layer(model);
+    geometry.n_head_kv = llama_model_n_head_kv(model);
     
-    // Add some overhead for metadata and alignment
-    size_t overhead = kv_size / 10;  // 10% overhead
+    int n_head = llama_model_n_head(model);
+    int head_dim = n_head > 0 ? llama_model_n_embd(model) / n_head : 0;
+    
+    // Some architectures (Gemma, Qwen3) set the head size explicitly
+    char arch[64] = {0};
+    if (llama_model_meta_val_str(model, "general.architecture", arch, sizeof(arch)) < 0) {
+        arch[0] = 0;
+    }
+    int key_length = arch[0] ? metaInt(model, arch, "attention.key_length") : 0;
+    int value_length = arch[0] ? metaInt(model, arch, "attention.value_length") : 0;
+    geometry.head_dim_k = key_length > 0 ? key_length : head_dim;
+    geometry.head_dim_v = value_length > 0 ? value_length : head_dim;
     
-    return kv_size + overhead;
+    return geometry;
+}
+
+size_t KVCache::bytesPerCell(const KVCacheGeometry& geometry, ggml_type type_k, ggml_type type_v) {
+    // K and V rows of every KV head, in every layer; ggml_row_size accounts
+    // for the block scales of quantized types
+    size_t k_row = ggml_row_size(type_k, static_cast<int64_t>(geometry.n_head_kv) * geometry.head_dim_k);
+    size_t v_row = ggml_row_size(type_v, static_cast<int64_t>(geometry.n_head_kv) * geometry.head_dim_v);
+    return static_cast<size_t>(geometry.n_layer) * (k_row + v_row);
+}
+
+size_t KVCache::estimateMemory(const KVCacheGeometry& geometry, int n_ctx,
+                               ggml_type type_k, ggml_type type_v) {
+    return static_cast<size_t>(n_ctx) * bytesPerCell(geometry, type_k, type_v);
 }
 
 } // namespace cortex
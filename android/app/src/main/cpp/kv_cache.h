@@ -3,9 +3,13 @@
 #include <cstddef>
 #include <cstdint>
 #include <string>
+#include <vector>
 
-// Forward declaration
+#include "ggml.h"
+
+// Forward declarations
 struct llama_context;
+struct llama_model;
 
 namespace cortex {
 
@@ -14,16 +18,43 @@ struct KVCacheStats {
     size_t total_cells = 0;
     size_t used_cells = 0;
     size_t max_seq_len = 0;
-    size_t memory_bytes = 0;
+    size_t memory_bytes = 0;       // K/V bytes held by used cells
+    size_t allocated_bytes = 0;    // K/V bytes reserved for all cells
+    size_t bytes_per_cell = 0;     // One token across all layers
     float usage_ratio = 0.0f;
 };
 
+// Per-layer K/V shape from the model's hyperparameters. With grouped-query
+// attention there are fewer KV heads than query heads, so n_embd overstates
+// the cache several times over.
+struct KVCacheGeometry {
+    int n_layer = 0;
+    int n_head_kv = 0;
+    int head_dim_k = 0;     // <arch>.attention.key_length, else n_embd / n_head
+    int head_dim_v = 0;     // <arch>.attention.value_length, else n_embd / n_head
+    
+    static KVCacheGeometry fromModel(const llama_model* model);
+};
+
 // KV cache configuration
 struct KVCacheConfig {
     int n_ctx = 4096;           // Context size
     int n_batch = 512;          // Batch size
     bool use_cache = true;      // Enable KV cache
     float defrag_threshold = 0.8f;  // When to defragment
+    int n_seq = 1;              // Conversation slots (one sequence each)
+    ggml_type type_k = GGML_TYPE_F16;
+    ggml_type type_v = GGML_TYPE_F16;
+    KVCacheGeometry geometry;
+};
+
+// A conversation bound to a KV sequence; the slot index is the seq id
+struct ConversationSlot {
+    int64_t conversation_id = -1;   // -1 when free
+    std::vector<int32_t> tokens;    // Tokens held in the sequence
+    int n_keep = 0;                 // Pinned prefix kept by context shifts
+    uint64_t chat_hash = 0;         // Chat text the sequence holds (see startChat), 0: unknown
+    int64_t last_used = 0;
 };
 
 class KVCache {
@@ -49,6 +80,14 @@ public:
     bool sequenceRemove(int seq_id, int start_pos, int end_pos);
     void sequenceKeep(int seq_id);
     
+    // Conversation slots
+    int findSlot(int64_t conversation_id) const;
+    int acquireSlot(int64_t conversation_id);  // Evicts the least recently used slot when full
+    int forkSlot(int src_seq, int64_t dst_conversation_id, int n_tokens = -1);
+    void releaseSlot(int seq_id);
+    ConversationSlot* getSlot(int seq_id);
+    int getSlotCount() const { return static_cast<int>(slots_.size()); }
+    
     // Defragmentation
     void defragment();
     bool needsDefragmentation() const;
@@ -59,13 +98,21 @@ public:
     size_t getTotalCells() const;
     float getUsageRatio() const;
     
-    // Memory estimation
-    static size_t estimateMemory(int n_ctx, int n_embd, int n_layer, int n_head);
+    const KVCacheConfig& getConfig() const { return config_; }
+    
+    // Memory estimation: exact K/V tensor sizes, without llama's padding
+    // of n_ctx or its compute buffers
+    static size_t bytesPerCell(const KVCacheGeometry& geometry, ggml_type type_k, ggml_type type_v);
+    static size_t estimateMemory(const KVCacheGeometry& geometry, int n_ctx,
+                                 ggml_type type_k, ggml_type type_v);
     
 private:
     llama_context* ctx_ = nullptr;
     KVCacheConfig config_;
     bool initialized_ = false;
+    
+    std::vector<ConversationSlot> slots_;
+    int64_t use_counter_ = 0;
 };
 
 } // namespace cortex
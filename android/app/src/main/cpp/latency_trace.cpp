@@ -0,0 +1,175 @@
+#include "latency_trace.h"
+#include <cstdio>
+
+#ifdef __ANDROID__
+    #include <dlfcn.h>
+#endif
+
+namespace cortex {
+
+static const int STAGE_COUNT = static_cast<int>(LatencyStage::Count);
+
+static const char* const STAGE_NAMES[STAGE_COUNT] = {
+    "queue", "prefill", "decode", "sample", "detokenize", "deliver", "jni", "first_token", "token_gap",
+};
+
+// Section names as they show up in Perfetto
+static const char* const SECTION_NAMES[STAGE_COUNT] = {
+    "cortex:queue", "cortex:prefill", "cortex:decode", "cortex:sample", "cortex:detokenize",
+    "cortex:deliver", "cortex:jni", "cortex:first_token", "cortex:token_gap",
+};
+
+static int bucketIndex(int64_t us) {
+    if (us <= 0) return 0;
+    int octave = 63 - __builtin_clzll(static_cast<uint64_t>(us));
+    // The SUB_BUCKETS bits right below the leading one pick the sub-bucket
+    int sub = octave >= 3 ? static_cast<int>(us >> (octave - 3)) & 7
+                          : static_cast<int>(us << (3 - octave)) & 7;
+    int index = octave * LatencyHistogram::SUB_BUCKETS + sub;
+    return index < LatencyHistogram::BUCKETS ? index : LatencyHistogram::BUCKETS - 1;
+}
+
+// Middle of the bucket, in microseconds
+static double bucketValue(int index) {
+    int octave = index / LatencyHistogram::SUB_BUCKETS;
+    int sub = index % LatencyHistogram::SUB_BUCKETS;
+    double width = static_cast<double>(1ULL << octave) / LatencyHistogram::SUB_BUCKETS;
+    return (LatencyHistogram::SUB_BUCKETS + sub + 0.5) * width;
+}
+
+void LatencyHistogram::record(int64_t us) {
+    buckets_[bucketIndex(us)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_us_.fetch_add(us > 0 ? static_cast<uint64_t>(us) : 0, std::memory_order_relaxed);
+    
+    int64_t max = max_us_.load(std::memory_order_relaxed);
+    while (us > max && !max_us_.compare_exchange_weak(max, us, std::memory_order_relaxed)) {
+    }
+}
+
+void LatencyHistogram::reset() {
+    for (auto& bucket : buckets_) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    count_.store(0, std::memory_order_relaxed);
+    sum_us_.store(0, std::memory_order_relaxed);
+    max_us_.store(0, std::memory_order_relaxed);
+}
+
+double LatencyHistogram::percentileMs(double p) const {
+    // Buckets are read one by one while others may still record; the
+    // result is as good as the counts it saw
+    uint64_t total = 0;
+    uint32_t counts[BUCKETS];
+    for (int i = 0; i < BUCKETS; i++) {
+        counts[i] = buckets_[i].load(std::memory_order_relaxed);
+        total += counts[i];
+    }
+    if (total == 0) return 0;
+    
+    uint64_t rank = static_cast<uint64_t>(p * total + 0.5);
+    if (rank < 1) rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        seen += counts[i];
+        if (seen >= rank) {
+            return bucketValue(i) / 1000.0;
+        }
+    }
+    return maxMs();
+}
+
+double LatencyHistogram::meanMs() const {
+    uint64_t n = count();
+    return n > 0 ? sum_us_.load(std::memory_order_relaxed) / 1000.0 / n : 0;
+}
+
+LatencyTrace& LatencyTrace::getInstance() {
+    static LatencyTrace instance;
+    return instance;
+}
+
+void LatencyTrace::reset() {
+    for (auto& histogram : histograms_) {
+        histogram.reset();
+    }
+}
+
+const char* LatencyTrace::stageName(LatencyStage stage) {
+    int index = static_cast<int>(stage);
+    return index >= 0 && index < STAGE_COUNT ? STAGE_NAMES[index] : "unknown";
+}
+
+std::string LatencyTrace::toJson() const {
+    std::string json = "{";
+    char buffer[192];
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        const LatencyHistogram& h = histograms_[i];
+        snprintf(buffer, sizeof(buffer),
+            "%s\"%s\":{\"count\":%llu,\"p50_ms\":%.3f,\"p90_ms\":%.3f,\"p99_ms\":%.3f,"
+            "\"mean_ms\":%.3f,\"max_ms\":%.3f}",
+            i > 0 ? "," : "", STAGE_NAMES[i], static_cast<unsigned long long>(h.count()),
+            h.percentileMs(0.50), h.percentileMs(0.90), h.percentileMs(0.99), h.meanMs(), h.maxMs());
+        json += buffer;
+    }
+    json += "}";
+    return json;
+}
+
+#ifdef __ANDROID__
+// ATrace_* are API 23; resolved once so older devices just skip tracing
+struct ATraceApi {
+    bool (*is_enabled)() = nullptr;
+    void (*begin_section)(const char*) = nullptr;
+    void (*end_section)() = nullptr;
+};
+
+static const ATraceApi& atrace() {
+    static const ATraceApi api = [] {
+        ATraceApi resolved;
+        void* lib = dlopen("libandroid.so", RTLD_NOW | RTLD_LOCAL);
+        if (lib == nullptr) return resolved;
+        resolved.is_enabled = reinterpret_cast<bool (*)()>(dlsym(lib, "ATrace_isEnabled"));
+        resolved.begin_section = reinterpret_cast<void (*)(const char*)>(dlsym(lib, "ATrace_beginSection"));
+        resolved.end_section = reinterpret_cast<void (*)()>(dlsym(lib, "ATrace_endSection"));
+        if (!resolved.is_enabled || !resolved.begin_section || !resolved.end_section) {
+            return ATraceApi();
+        }
+        return resolved;
+    }();
+    return api;
+}
+
+bool LatencyTrace::tracing() {
+    const ATraceApi& api = atrace();
+    return api.is_enabled != nullptr && api.is_enabled();
+}
+
+void LatencyTrace::beginSection(const char* name) {
+    atrace().begin_section(name);
+}
+
+void LatencyTrace::endSection() {
+    atrace().end_section();
+}
+#else
+bool LatencyTrace::tracing() {
+    return false;
+}
+
+void LatencyTrace::beginSection(const char*) {}
+
+void LatencyTrace::endSection() {}
+#endif
+
+StageTimer::StageTimer(LatencyStage stage)
+    : stage_(stage), start_us_(LatencyTrace::nowUs()), traced_(LatencyTrace::tracing()) {
+    if (traced_) LatencyTrace::beginSection(SECTION_NAMES[static_cast<int>(stage)]);
+}
+
+StageTimer::~StageTimer() {
+    if (traced_) LatencyTrace::endSection();
+    LatencyTrace::getInstance().record(stage_, LatencyTrace::nowUs() - start_us_);
+}
+
+} // namespace cortex
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace cortex {
+
+// Stages of the token path, one histogram each
+enum class LatencyStage {
+    Queue = 0,      // start() to the generation thread picking the request up
+    Prefill,        // One prompt chunk through llama_decode
+    Decode,         // One generation step (a whole verify pass when speculative)
+    Sample,
+    Detokenize,
+    Deliver,        // One sink call: FFI ring write or JNI/platform event
+    Jni,            // JNI up-call into Kotlin, inside Deliver
+    FirstToken,     // start() to a session's first text
+    TokenGap,       // Between consecutive text events of one session
+    Count,
+};
+
+// Log-bucketed latency counts: 8 buckets per power of two of microseconds,
+// 1 us to 2^29 us (~9 min), so a percentile is off by at most 1/16 of its
+// value. Lock-free; record() is a handful of relaxed atomic adds.
+class LatencyHistogram {
+public:
+    static const int SUB_BUCKETS = 8;
+    static const int OCTAVES = 29;
+    static const int BUCKETS = SUB_BUCKETS * OCTAVES;
+    
+    void record(int64_t us);
+    void reset();
+    
+    uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+    double percentileMs(double p) const;  // p in (0, 1]; 0 when empty
+    double meanMs() const;
+    double maxMs() const { return max_us_.load(std::memory_order_relaxed) / 1000.0; }
+
+private:
+    std::atomic<uint32_t> buckets_[BUCKETS] = {};
+    std::atomic<uint64_t> count_{0};
+    std::atomic<uint64_t> sum_us_{0};
+    std::atomic<int64_t> max_us_{0};
+};
+
+// Process-wide stage histograms plus ATrace sections, cheap enough to stay
+// on in release builds: a section costs one ATrace_isEnabled() check while
+// no trace is being captured (Perfetto / systrace with the app category),
+// a record two clock reads and a few atomics. ATrace is looked up in
+// libandroid at runtime since it needs API 23; elsewhere sections are
+// no-ops and only the histograms run.
+class LatencyTrace {
+public:
+    static LatencyTrace& getInstance();
+    
+    static int64_t nowUs() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    
+    void record(LatencyStage stage, int64_t us) { histograms_[static_cast<int>(stage)].record(us); }
+    void reset();
+    
+    // {"decode":{"count":..,"p50_ms":..,"p90_ms":..,"p99_ms":..,"mean_ms":..,"max_ms":..},...}
+    std::string toJson() const;
+    
+    static const char* stageName(LatencyStage stage);
+    
+    // Thin ATrace wrappers; name must outlive the section
+    static bool tracing();
+    static void beginSection(const char* name);
+    static void endSection();
+
+private:
+    LatencyTrace() = default;
+    LatencyHistogram histograms_[static_cast<int>(LatencyStage::Count)];
+};
+
+// Times the enclosing scope into a stage and marks it as an ATrace section
+class StageTimer {
+public:
+    explicit StageTimer(LatencyStage stage);
+    ~StageTimer();
+    
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+
+private:
+    LatencyStage stage_;
+    int64_t start_us_;
+    bool traced_;
+};
+
+// An ATrace section without a histogram, for JNI entry points and the like
+class TraceSection {
+public:
+    explicit TraceSection(const char* name) : traced_(LatencyTrace::tracing()) {
+        if (traced_) LatencyTrace::beginSection(name);
+    }
+    ~TraceSection() {
+        if (traced_) LatencyTrace::endSection();
+    }
+    
+    TraceSection(const TraceSection&) = delete;
+    TraceSection& operator=(const TraceSection&) = delete;
+
+private:
+    bool traced_;
+};
+
+} // namespace cortex
@@ -23,39 +23,215 @@ typedef bool jboolean;
 #define LOGI(...)
 #define LOGE(...)
 #endif
+#include <memory>
 #include <string>
+#include <vector>
+#include "ffi_stream.h"
+#include "latency_trace.h"
 #include "platform_channel.h"
 
+#ifdef __ANDROID__
+#include <pthread.h>
+
+// Session events reach Kotlin from the engine's generation thread, which
+// is attached to the VM on its first event and detached when it exits
+static JavaVM* g_vm = nullptr;
+static pthread_key_t g_detach_key;
+
+static void detachThread(void*) {
+    g_vm->DetachCurrentThread();
+}
+
+static JNIEnv* attachedEnv() {
+    JNIEnv* env = nullptr;
+    if (g_vm->GetEnv(reinterpret_cast<void**>(&env), JNI_VERSION_1_6) == JNI_OK) {
+        return env;
+    }
+    if (g_vm->AttachCurrentThread(&env, nullptr) != JNI_OK) {
+        return nullptr;
+    }
+    pthread_setspecific(g_detach_key, env);
+    return env;
+}
+#endif
+
 // Helper to convert jstring to std::string
 static std::string jstringToString(JNIEnv* env, jstring jstr) {
 #ifdef __ANDROID__
     if (jstr == nullptr) return "";
     
-    const char* chars = env->GetStringUTFChars(jstr, nullptr);
+    // GetStringUTFChars returns modified UTF-8, which encodes emoji as two
+    // 3-byte surrogates the tokenizer does not understand; convert UTF-16
+    jsize len = env->GetStringLength(jstr);
+    const jchar* chars = env->GetStringChars(jstr, nullptr);
     if (chars == nullptr) return "";
     
-    std::string result(chars);
-    env->ReleaseStringUTFChars(jstr, chars);
+    std::string result;
+    result.reserve(len);
+    for (jsize i = 0; i < len; i++) {
+        uint32_t cp = chars[i];
+        if (cp >= 0xD800 && cp <= 0xDBFF && i + 1 < len &&
+            chars[i + 1] >= 0xDC00 && chars[i + 1] <= 0xDFFF) {
+            cp = 0x10000 + ((cp - 0xD800) << 10) + (chars[i + 1] - 0xDC00);
+            i++;
+        } else if (cp >= 0xD800 && cp <= 0xDFFF) {
+            cp = 0xFFFD;  // Unpaired surrogate
+        }
+        
+        if (cp < 0x80) {
+            result += static_cast<char>(cp);
+        } else if (cp < 0x800) {
+            result += static_cast<char>(0xC0 | (cp >> 6));
+            result += static_cast<char>(0x80 | (cp & 0x3F));
+        } else if (cp < 0x10000) {
+            result += static_cast<char>(0xE0 | (cp >> 12));
+            result += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+            result += static_cast<char>(0x80 | (cp & 0x3F));
+        } else {
+            result += static_cast<char>(0xF0 | (cp >> 18));
+            result += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+            result += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+            result += static_cast<char>(0x80 | (cp & 0x3F));
+        }
+    }
+    
+    env->ReleaseStringChars(jstr, chars);
     return result;
 #else
     return ""; // Non-Android stub
 #endif
 }
 
+// Helper to convert a Java String[] to std::vector<std::string>
+static std::vector<std::string> jstringArrayToVector(JNIEnv* env, jobjectArray array) {
+    std::vector<std::string> result;
+#ifdef __ANDROID__
+    if (array == nullptr) return result;
+    
+    jsize len = env->GetArrayLength(array);
+    result.reserve(len);
+    for (jsize i = 0; i < len; i++) {
+        jstring jstr = static_cast<jstring>(env->GetObjectArrayElement(array, i));
+        result.push_back(jstringToString(env, jstr));
+        env->DeleteLocalRef(jstr);
+    }
+#endif
+    return result;
+}
+
+// Helper to convert a Java int[] to std::vector<int>
+static std::vector<int> jintArrayToVector(JNIEnv* env, jintArray array) {
+    std::vector<int> result;
+#ifdef __ANDROID__
+    if (array == nullptr) return result;
+    
+    jsize len = env->GetArrayLength(array);
+    jint* values = env->GetIntArrayElements(array, nullptr);
+    if (values == nullptr) return result;
+    result.assign(values, values + len);
+    env->ReleaseIntArrayElements(array, values, JNI_ABORT);
+#endif
+    return result;
+}
+
 // Helper to convert std::string to jstring
 static jstring stringToJstring(JNIEnv* env, const std::string& str) {
 #ifdef __ANDROID__
-    return env->NewStringUTF(str.c_str());
+    // NewStringUTF expects modified UTF-8 and rejects 4-byte sequences
+    // (emoji and other non-BMP text), so build the UTF-16 string here
+    std::u16string utf16;
+    utf16.reserve(str.size());
+    const unsigned char* s = reinterpret_cast<const unsigned char*>(str.data());
+    size_t n = str.size();
+    
+    for (size_t i = 0; i < n;) {
+        uint32_t cp;
+        unsigned char c = s[i];
+        if (c < 0x80) {
+            cp = c;
+            i += 1;
+        } else if ((c >> 5) == 0x6 && i + 1 < n) {
+            cp = ((c & 0x1F) << 6) | (s[i + 1] & 0x3F);
+            i += 2;
+        } else if ((c >> 4) == 0xE && i + 2 < n) {
+            cp = ((c & 0x0F) << 12) | ((s[i + 1] & 0x3F) << 6) | (s[i + 2] & 0x3F);
+            i += 3;
+        } else if ((c >> 3) == 0x1E && i + 3 < n) {
+            cp = ((c & 0x07) << 18) | ((s[i + 1] & 0x3F) << 12) |
+                 ((s[i + 2] & 0x3F) << 6) | (s[i + 3] & 0x3F);
+            i += 4;
+        } else {
+            cp = 0xFFFD;
+            i += 1;
+        }
+        
+        if (cp >= 0x10000) {
+            cp -= 0x10000;
+            utf16.push_back(static_cast<char16_t>(0xD800 + (cp >> 10)));
+            utf16.push_back(static_cast<char16_t>(0xDC00 + (cp & 0x3FF)));
+        } else {
+            utf16.push_back(static_cast<char16_t>(cp));
+        }
+    }
+    
+    return env->NewString(reinterpret_cast<const jchar*>(utf16.data()), utf16.size());
 #else
     return nullptr; // Non-Android stub
 #endif
 }
 
+// Session output, built per start: the FFI ring when Dart opened it,
+// otherwise InferenceEnginePlugin.onSessionEvent on the plugin that started
+// the session. Called on the generation thread.
+static cortex::SessionCallback sessionCallback(JNIEnv* env, jobject thiz, jboolean ffi_stream) {
+    if (ffi_stream == JNI_TRUE) {
+        cortex::SessionCallback callback = cortex::streamSessionCallback();
+        if (callback) return callback;
+        LOGE("ffi stream not open, sending session events over the channel");
+    }
+#ifdef __ANDROID__
+    jclass pluginClass = env->GetObjectClass(thiz);
+    jmethodID onSessionEvent = env->GetMethodID(pluginClass, "onSessionEvent", "(JILjava/lang/String;)V");
+    env->DeleteLocalRef(pluginClass);
+    if (onSessionEvent == nullptr) {
+        env->ExceptionClear();
+        LOGE("onSessionEvent not found");
+        return nullptr;
+    }
+    
+    // The last event may outlive this call by a long way; the plugin is
+    // kept alive by a global reference until the callback goes
+    std::shared_ptr<_jobject> plugin(env->NewGlobalRef(thiz), [](jobject ref) {
+        JNIEnv* env = attachedEnv();
+        if (env != nullptr) env->DeleteGlobalRef(ref);
+    });
+    return [plugin, onSessionEvent](int64_t session, int type, const std::string& data) {
+        cortex::StageTimer timer(cortex::LatencyStage::Jni);
+        JNIEnv* env = attachedEnv();
+        if (env == nullptr) return;
+        jstring text = stringToJstring(env, data);
+        env->CallVoidMethod(plugin.get(), onSessionEvent, static_cast<jlong>(session),
+                            static_cast<jint>(type), text);
+        if (env->ExceptionCheck()) {
+            env->ExceptionDescribe();
+            env->ExceptionClear();
+        }
+        env->DeleteLocalRef(text);
+    };
+#else
+    return nullptr;
+#endif
+}
+
 extern "C" {
 
 // JNI_OnLoad - called when library is loaded
 JNIEXPORT jint JNI_OnLoad(JavaVM* vm, void* reserved) {
     LOGI("llama_jni library loaded");
+#ifdef __ANDROID__
+    g_vm = vm;
+    pthread_key_create(&g_detach_key, detachThread);
+#endif
     return JNI_VERSION_1_6;
 }
 
@@ -73,6 +249,57 @@ Java_com_aarav_cortex_cortex2_InferenceEnginePlugin_loadModelNative(
     return result ? JNI_TRUE : JNI_FALSE;
 }
 
+// Size a model from its GGUF header without loading it
+JNIEXPORT jstring JNICALL
+Java_com_aarav_cortex_cortex2_InferenceEnginePlugin_preflightModelNative(
+    JNIEnv* env,
+    jobject thiz,
+    jstring model_path
+) {
+    std::string path = jstringToString(env, model_path);
+    return stringToJstring(env, cortex::preflightModel(path));
+}
+
+// Reason the last load failed, empty if it did not
+JNIEXPORT jstring JNICALL
+Java_com_aarav_cortex_cortex2_InferenceEnginePlugin_getLoadErrorNative(
+    JNIEnv* env,
+    jobject thiz
+) {
+    return stringToJstring(env, cortex::getLoadError());
+}
+
+// Start a background load; progress is polled with getLoadProgressNative
+JNIEXPORT jboolean JNICALL
+Java_com_aarav_cortex_cortex2_InferenceEnginePlugin_startModelLoadNative(
+    JNIEnv* env,
+    jobject thiz,
+    jstring model_path
+) {
+    std::string path = jstringToString(env, model_path);
+    LOGI("JNI startModelLoad: %s", path.c_str());
+    
+    return cortex::startModelLoad(path) ? JNI_TRUE : JNI_FALSE;
+}
+
+// Cancel a background load or its prefetch
+JNIEXPORT void JNICALL
+Java_com_aarav_cortex_cortex2_InferenceEnginePlugin_cancelModelLoadNative(
+    JNIEnv* env,
+    jobject thiz
+) {
+    cortex::cancelModelLoad();
+}
+
+// Background load state as JSON
+JNIEXPORT jstring JNICALL
+Java_com_aarav_cortex_cortex2_InferenceEnginePlugin_getLoadProgressNative(
+    JNIEnv* env,
+    jobject thiz
+) {
+    return stringToJstring(env, cortex::getLoadProgress());
+}
+
 // Unload the current model
 JNIEXPORT void JNICALL
 Java_com_aarav_cortex_cortex2_InferenceEnginePlugin_unloadModelNative(
@@ -92,6 +319,17 @@ Java_com_aarav_cortex_cortex2_InferenceEnginePlugin_isModelLoadedNative(
     return cortex::isModelLoaded() ? JNI_TRUE : JNI_FALSE;
 }
 
+// ComponentCallbacks2.onTrimMemory level from the plugin
+JNIEXPORT void JNICALL
+Java_com_aarav_cortex_cortex2_InferenceEnginePlugin_onTrimMemoryNative(
+    JNIEnv* env,
+    jobject thiz,
+    jint level
+) {
+    LOGI("JNI onTrimMemory: %d", level);
+    cortex::onTrimMemory(level);
+}
+
 // Get model information
 JNIEXPORT jstring JNICALL
 Java_com_aarav_cortex_cortex2_InferenceEnginePlugin_getModelInfoNative(
@@ -102,54 +340,193 @@ Java_com_aarav_cortex_cortex2_InferenceEnginePlugin_getModelInfoNative(
     return stringToJstring(env, info);
 }
 
-// Start text generation
+// GPU backend, devices and the tuned split for a model, as JSON
+JNIEXPORT jstring JNICALL
+Java_com_aarav_cortex_cortex2_InferenceEnginePlugin_getGpuInfoNative(
+    JNIEnv* env,
+    jobject thiz,
+    jstring model_path
+) {
+    std::string path = jstringToString(env, model_path);
+    return stringToJstring(env, cortex::getGpuInfo(path));
+}
+
+// Measure gpu_layers splits for a model and cache the best one
+JNIEXPORT jstring JNICALL
+Java_com_aarav_cortex_cortex2_InferenceEnginePlugin_tuneGpuLayersNative(
+    JNIEnv* env,
+    jobject thiz,
+    jstring model_path
+) {
+    std::string path = jstringToString(env, model_path);
+    LOGI("JNI tuneGpuLayers: %s", path.c_str());
+    return stringToJstring(env, cortex::tuneGpuLayers(path));
+}
+
+// Load a draft model for speculative decoding
+JNIEXPORT jboolean JNICALL
+Java_com_aarav_cortex_cortex2_InferenceEnginePlugin_loadDraftModelNative(
+    JNIEnv* env,
+    jobject thiz,
+    jstring model_path
+) {
+    std::string path = jstringToString(env, model_path);
+    LOGI("JNI loadDraftModel: %s", path.c_str());
+    
+    return cortex::loadDraftModel(path) ? JNI_TRUE : JNI_FALSE;
+}
+
+// Unload the draft model
+JNIEXPORT void JNICALL
+Java_com_aarav_cortex_cortex2_InferenceEnginePlugin_unloadDraftModelNative(
+    JNIEnv* env,
+    jobject thiz
+) {
+    LOGI("JNI unloadDraftModel");
+    cortex::unloadDraftModel();
+}
+
+// Check if a draft model is loaded
 JNIEXPORT jboolean JNICALL
-Java_com_aarav_cortex_cortex2_InferenceEnginePlugin_startGenerationNative(
+Java_com_aarav_cortex_cortex2_InferenceEnginePlugin_hasDraftModelNative(
+    JNIEnv* env,
+    jobject thiz
+) {
+    return cortex::hasDraftModel() ? JNI_TRUE : JNI_FALSE;
+}
+
+// Start a session replying to structured messages; the native side
+// applies the model's chat template. Returns the handle, -1 on failure.
+JNIEXPORT jlong JNICALL
+Java_com_aarav_cortex_cortex2_InferenceEnginePlugin_startChatSessionNative(
+    JNIEnv* env,
+    jobject thiz,
+    jobjectArray roles,
+    jobjectArray contents,
+    jfloat temperature,
+    jfloat top_p,
+    jint top_k,
+    jint max_tokens,
+    jstring grammar,
+    jstring json_schema,
+    jboolean speculative,
+    jboolean ffi_stream
+) {
+    cortex::TraceSection trace("cortex:jni startChatSession");
+    std::vector<std::string> roleVec = jstringArrayToVector(env, roles);
+    std::vector<std::string> contentVec = jstringArrayToVector(env, contents);
+    LOGI("JNI startChatSession: %zu messages", roleVec.size());
+    
+    cortex::SessionCallback callback = sessionCallback(env, thiz, ffi_stream);
+    if (!callback) return -1;
+    
+    int64_t session = cortex::startChatSession(
+        roleVec,
+        contentVec,
+        static_cast<float>(temperature),
+        static_cast<float>(top_p),
+        static_cast<int>(top_k),
+        static_cast<int>(max_tokens),
+        jstringToString(env, grammar),
+        jstringToString(env, json_schema),
+        speculative == JNI_TRUE,
+        callback
+    );
+    // The ring was handed out, but no session will end it
+    if (session < 0 && ffi_stream == JNI_TRUE) cortex::abandonStream();
+    return session;
+}
+
+// Start a session on a raw prompt; incremental continues the cached sequence
+JNIEXPORT jlong JNICALL
+Java_com_aarav_cortex_cortex2_InferenceEnginePlugin_startPromptSessionNative(
     JNIEnv* env,
     jobject thiz,
     jstring prompt,
+    jboolean incremental,
     jfloat temperature,
     jfloat top_p,
     jint top_k,
-    jint max_tokens
+    jint max_tokens,
+    jstring grammar,
+    jstring json_schema,
+    jboolean speculative,
+    jboolean ffi_stream
 ) {
+    cortex::TraceSection trace("cortex:jni startPromptSession");
     std::string promptStr = jstringToString(env, prompt);
-    LOGI("JNI startGeneration: prompt length=%zu", promptStr.length());
+    LOGI("JNI startPromptSession: prompt length=%zu", promptStr.length());
+    
+    cortex::SessionCallback callback = sessionCallback(env, thiz, ffi_stream);
+    if (!callback) return -1;
     
-    bool result = cortex::startGeneration(
+    int64_t session = cortex::startPromptSession(
         promptStr,
+        incremental == JNI_TRUE,
         static_cast<float>(temperature),
         static_cast<float>(top_p),
         static_cast<int>(top_k),
-        static_cast<int>(max_tokens)
+        static_cast<int>(max_tokens),
+        jstringToString(env, grammar),
+        jstringToString(env, json_schema),
+        speculative == JNI_TRUE,
+        callback
     );
-    
-    return result ? JNI_TRUE : JNI_FALSE;
+    // The ring was handed out, but no session will end it
+    if (session < 0 && ffi_stream == JNI_TRUE) cortex::abandonStream();
+    return session;
 }
 
-// Start incremental generation (KV cache reuse for faster prompt eval)
-JNIEXPORT jboolean JNICALL
-Java_com_aarav_cortex_cortex2_InferenceEnginePlugin_startGenerationIncrementalNative(
+// Start a background session next to the running one, on chat messages or
+// a raw prompt; its events come through onSessionEvent like any other.
+// Returns the handle, -1 when all background sequences are busy.
+JNIEXPORT jlong JNICALL
+Java_com_aarav_cortex_cortex2_InferenceEnginePlugin_startBackgroundSessionNative(
     JNIEnv* env,
     jobject thiz,
+    jobjectArray roles,
+    jobjectArray contents,
     jstring prompt,
     jfloat temperature,
     jfloat top_p,
     jint top_k,
-    jint max_tokens
+    jint max_tokens,
+    jstring grammar,
+    jstring json_schema
 ) {
+    cortex::TraceSection trace("cortex:jni startBackgroundSession");
+    std::vector<std::string> roleVec = jstringArrayToVector(env, roles);
+    std::vector<std::string> contentVec = jstringArrayToVector(env, contents);
     std::string promptStr = jstringToString(env, prompt);
-    LOGI("JNI startGenerationIncremental: prompt length=%zu", promptStr.length());
+    LOGI("JNI startBackgroundSession: %zu messages, prompt length=%zu", roleVec.size(), promptStr.length());
+    
+    // The FFI ring belongs to the foreground session
+    cortex::SessionCallback callback = sessionCallback(env, thiz, JNI_FALSE);
+    if (!callback) return -1;
     
-    bool result = cortex::startGenerationIncremental(
+    return cortex::startBackgroundSession(
+        roleVec,
+        contentVec,
         promptStr,
         static_cast<float>(temperature),
         static_cast<float>(top_p),
         static_cast<int>(top_k),
-        static_cast<int>(max_tokens)
+        static_cast<int>(max_tokens),
+        jstringToString(env, grammar),
+        jstringToString(env, json_schema),
+        callback
     );
-    
-    return result ? JNI_TRUE : JNI_FALSE;
+}
+
+// End a session; returns once its final event was sent
+JNIEXPORT void JNICALL
+Java_com_aarav_cortex_cortex2_InferenceEnginePlugin_cancelSessionNative(
+    JNIEnv* env,
+    jobject thiz,
+    jlong session
+) {
+    cortex::TraceSection trace("cortex:jni cancelSession");
+    cortex::cancelSession(static_cast<int64_t>(session));
 }
 
 // Clear KV cache
@@ -171,35 +548,37 @@ Java_com_aarav_cortex_cortex2_InferenceEnginePlugin_getCachedTokenCountNative(
     return static_cast<jint>(cortex::getCachedTokenCount());
 }
 
-// Get the next generated token
-JNIEXPORT jstring JNICALL
-Java_com_aarav_cortex_cortex2_InferenceEnginePlugin_getNextTokenNative(
+// Activate a conversation slot, returns its cached token count
+JNIEXPORT jint JNICALL
+Java_com_aarav_cortex_cortex2_InferenceEnginePlugin_selectConversationNative(
     JNIEnv* env,
-    jobject thiz
+    jobject thiz,
+    jlong conversationId
 ) {
-    std::string token = cortex::getNextToken();
-    return stringToJstring(env, token);
+    return static_cast<jint>(cortex::selectConversation(static_cast<int64_t>(conversationId)));
 }
 
-// Get batch of next tokens (reduces JNI overhead)
-JNIEXPORT jobjectArray JNICALL
-Java_com_aarav_cortex_cortex2_InferenceEnginePlugin_getNextTokensNative(
+// Fork a conversation, sharing its KV prefix
+JNIEXPORT jboolean JNICALL
+Java_com_aarav_cortex_cortex2_InferenceEnginePlugin_forkConversationNative(
     JNIEnv* env,
     jobject thiz,
-    jint count
+    jlong srcId,
+    jlong dstId
 ) {
-    std::vector<std::string> tokens = cortex::getNextTokens(static_cast<int>(count));
-    
-    jclass stringClass = env->FindClass("java/lang/String");
-    jobjectArray result = env->NewObjectArray(tokens.size(), stringClass, nullptr);
-    
-    for (size_t i = 0; i < tokens.size(); i++) {
-        jstring jstr = stringToJstring(env, tokens[i]);
-        env->SetObjectArrayElement(result, i, jstr);
-        env->DeleteLocalRef(jstr);
-    }
-    
-    return result;
+    LOGI("JNI forkConversation: %lld -> %lld", static_cast<long long>(srcId), static_cast<long long>(dstId));
+    bool result = cortex::forkConversation(static_cast<int64_t>(srcId), static_cast<int64_t>(dstId));
+    return result ? JNI_TRUE : JNI_FALSE;
+}
+
+// Free a conversation slot
+JNIEXPORT void JNICALL
+Java_com_aarav_cortex_cortex2_InferenceEnginePlugin_releaseConversationNative(
+    JNIEnv* env,
+    jobject thiz,
+    jlong conversationId
+) {
+    cortex::releaseConversation(static_cast<int64_t>(conversationId));
 }
 
 // Check if generation is in progress
@@ -211,7 +590,7 @@ Java_com_aarav_cortex_cortex2_InferenceEnginePlugin_isGeneratingNative(
     return cortex::isGenerating() ? JNI_TRUE : JNI_FALSE;
 }
 
-// Stop ongoing generation
+// Stop the running session
 JNIEXPORT void JNICALL
 Java_com_aarav_cortex_cortex2_InferenceEnginePlugin_stopGenerationNative(
     JNIEnv* env,
@@ -231,6 +610,17 @@ Java_com_aarav_cortex_cortex2_InferenceEnginePlugin_getStatsNative(
     return stringToJstring(env, stats);
 }
 
+// Thermal status/headroom from PowerManager for the governor
+JNIEXPORT void JNICALL
+Java_com_aarav_cortex_cortex2_InferenceEnginePlugin_updateThermalStateNative(
+    JNIEnv* env,
+    jobject thiz,
+    jint status,
+    jfloat headroom
+) {
+    cortex::setThermalState(status, headroom);
+}
+
 // Get memory information
 JNIEXPORT jstring JNICALL
 Java_com_aarav_cortex_cortex2_InferenceEnginePlugin_getMemoryInfoNative(
@@ -251,32 +641,6 @@ Java_com_aarav_cortex_cortex2_InferenceEnginePlugin_resetStatsNative(
     cortex::resetStats();
 }
 
-// Start generation in TURBO mode (maximum speed)
-JNIEXPORT jboolean JNICALL
-Java_com_aarav_cortex_cortex2_InferenceEnginePlugin_startGenerationTurboNative(
-    JNIEnv* env,
-    jobject thiz,
-    jstring prompt
-) {
-    const char* promptChars = env->GetStringUTFChars(prompt, nullptr);
-    LOGI("JNI startGenerationTurbo: prompt length=%zu", strlen(promptChars));
-    
-    bool result = cortex::startGenerationTurbo(promptChars);
-    env->ReleaseStringUTFChars(prompt, promptChars);
-    return result;
-}
-
-// Get batch of tokens as concatenated string (faster than array)
-JNIEXPORT jstring JNICALL
-Java_com_aarav_cortex_cortex2_InferenceEnginePlugin_getNextTokensBatchNative(
-    JNIEnv* env,
-    jobject thiz,
-    jint count
-) {
-    std::string tokens = cortex::getNextTokensBatch(count);
-    return stringToJstring(env, tokens);
-}
-
 // Get memory usage in bytes
 JNIEXPORT jlong JNICALL
 Java_com_aarav_cortex_cortex2_InferenceEnginePlugin_getMemoryUsageNative(
@@ -286,72 +650,37 @@ Java_com_aarav_cortex_cortex2_InferenceEnginePlugin_getMemoryUsageNative(
     return cortex::getMemoryUsage();
 }
 
-// Start threaded generation with custom parameters
-JNIEXPORT jboolean JNICALL
-Java_com_aarav_cortex_cortex2_InferenceEnginePlugin_startGenerationThreadedNative(
-    JNIEnv* env,
-    jobject thiz,
-    jstring prompt,
-    jfloat temperature,
-    jfloat top_p,
-    jint top_k,
-    jint max_tokens
-) {
-    std::string promptStr = jstringToString(env, prompt);
-    LOGI("JNI startGenerationThreaded: prompt length=%zu", promptStr.length());
-    
-    bool result = cortex::startGenerationThreaded(
-        promptStr,
-        static_cast<float>(temperature),
-        static_cast<float>(top_p),
-        static_cast<int>(top_k),
-        static_cast<int>(max_tokens)
-    );
-    
-    return result ? JNI_TRUE : JNI_FALSE;
-}
-
-// Get tokens from threaded generation buffer
-JNIEXPORT jstring JNICALL
-Java_com_aarav_cortex_cortex2_InferenceEnginePlugin_getBufferedTokensNative(
-    JNIEnv* env,
-    jobject thiz
-) {
-    std::string tokens = cortex::getBufferedTokens();
-    return stringToJstring(env, tokens);
-}
-
-// Benchmark function for testing
+// Benchmark sweep: prefill/TTFT per prompt length, decode per depth, for
+// every thread count x ubatch size. Returns JSON.
 JNIEXPORT jstring JNICALL
 Java_com_aarav_cortex_cortex2_InferenceEnginePlugin_runBenchmarkNative(
     JNIEnv* env,
     jobject thiz,
-    jint num_tokens
+    jintArray prompt_lengths,
+    jintArray decode_depths,
+    jint decode_tokens,
+    jintArray thread_counts,
+    jintArray ubatch_sizes,
+    jint warmup,
+    jint repetitions
 ) {
-    LOGI("JNI runBenchmark: %d tokens", num_tokens);
+    LOGI("JNI runBenchmark");
     
     if (!cortex::isModelLoaded()) {
         return stringToJstring(env, "{\"error\":\"No model loaded\"}");
     }
     
-    // Simple benchmark: generate tokens and measure speed
-    std::string prompt = "Hello, my name is";
-    bool started = cortex::startGeneration(prompt, 0.7f, 0.9f, 40, num_tokens);
-    
-    if (!started) {
-        return stringToJstring(env, "{\"error\":\"Failed to start generation\"}");
-    }
-    
-    int tokens_generated = 0;
-    while (cortex::isGenerating() && tokens_generated < num_tokens) {
-        std::string token = cortex::getNextToken();
-        if (!token.empty()) {
-            tokens_generated++;
-        }
-    }
+    std::string result = cortex::runBenchmark(
+        jintArrayToVector(env, prompt_lengths),
+        jintArrayToVector(env, decode_depths),
+        static_cast<int>(decode_tokens),
+        jintArrayToVector(env, thread_counts),
+        jintArrayToVector(env, ubatch_sizes),
+        static_cast<int>(warmup),
+        static_cast<int>(repetitions)
+    );
     
-    std::string stats = cortex::getStats();
-    return stringToJstring(env, stats);
+    return stringToJstring(env, result);
 }
 
 } // extern "C"
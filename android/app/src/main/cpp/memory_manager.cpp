@@ -1,6 +1,6 @@
 #include "memory_manager.h"
-#include <fstream>
-#include <sstream>
+#include <algorithm>
+#include <chrono>
 
 #ifdef __ANDROID__
 #include <android/log.h>
@@ -23,6 +23,24 @@ constexpr size_t MEMORY_MEDIUM_THRESHOLD = 256 * 1024 * 1024;   // 256 MB
 constexpr size_t MEMORY_HIGH_THRESHOLD = 128 * 1024 * 1024;     // 128 MB
 constexpr size_t MEMORY_CRITICAL_THRESHOLD = 64 * 1024 * 1024;  // 64 MB
 
+// The thresholds above are for a 4 GB device and scale with RAM beyond
+// that: a 12 GB phone under pressure still has more than 512 MB free
+constexpr size_t REFERENCE_TOTAL_MEMORY = 4ull * 1024 * 1024 * 1024;
+
+// ComponentCallbacks2.TRIM_MEMORY_*
+constexpr int TRIM_MEMORY_RUNNING_MODERATE = 5;
+constexpr int TRIM_MEMORY_RUNNING_LOW = 10;
+constexpr int TRIM_MEMORY_RUNNING_CRITICAL = 15;
+constexpr int TRIM_MEMORY_BACKGROUND = 40;
+constexpr int TRIM_MEMORY_MODERATE = 60;
+constexpr int TRIM_MEMORY_COMPLETE = 80;
+
+// PSI avg10 (% of the last 10 s) at which stalls count as pressure
+constexpr float PSI_SOME_MEDIUM = 10.0f;   // Some task waited on memory
+constexpr float PSI_SOME_HIGH = 25.0f;
+constexpr float PSI_FULL_HIGH = 2.0f;      // Every task waited on memory
+constexpr float PSI_FULL_CRITICAL = 10.0f;
+
 // Safety margins
 constexpr size_t ALLOCATION_SAFETY_MARGIN = 100 * 1024 * 1024;  // 100 MB
 constexpr double MAX_MEMORY_USAGE_RATIO = 0.90;  // Use at most 90% of available (mobile can handle more)
@@ -33,76 +51,110 @@ MemoryManager& MemoryManager::getInstance() {
 }
 
 MemoryManager::MemoryManager() {
+    // Before the sampler, whose triggers post to it
+    reclaim_thread_ = std::thread(&MemoryManager::runReclaims, this);
+    
+    MemoryTelemetryConfig config;
+    telemetry_.start(config, [this](const MemorySnapshot& snapshot) {
+        onPressureEvent(snapshot);
+    });
+    
     LOGI("MemoryManager initialized");
     LOGI("Total memory: %zu MB", getTotalMemory() / (1024 * 1024));
     LOGI("Available memory: %zu MB", getAvailableMemory() / (1024 * 1024));
 }
 
-size_t MemoryManager::readMemInfo(const char* field) const {
-    std::ifstream meminfo("/proc/meminfo");
-    if (!meminfo.is_open()) {
-        LOGE("Failed to open /proc/meminfo");
-        return 0;
-    }
+MemoryManager::~MemoryManager() {
+    // Before the reclaim handler goes away
+    telemetry_.stop();
     
-    std::string line;
-    while (std::getline(meminfo, line)) {
-        if (line.find(field) == 0) {
-            std::istringstream iss(line);
-            std::string name;
-            size_t value;
-            std::string unit;
-            iss >> name >> value >> unit;
-            // Value is in kB, convert to bytes
-            return value * 1024;
-        }
+    {
+        std::lock_guard<std::mutex> lock(request_mutex_);
+        reclaim_stop_ = true;
     }
-    
-    return 0;
+    request_cv_.notify_one();
+    if (reclaim_thread_.joinable()) {
+        reclaim_thread_.join();
+    }
+}
+
+MemorySnapshot MemoryManager::getSnapshot() const {
+    return telemetry_.snapshot();
+}
+
+void MemoryManager::refreshSnapshot() {
+    telemetry_.refresh();
+}
+
+void MemoryManager::setModelFile(const std::string& path) {
+    telemetry_.setModelFile(path);
 }
 
 size_t MemoryManager::getTotalMemory() const {
-    return readMemInfo("MemTotal:");
+    return getSnapshot().total;
 }
 
 size_t MemoryManager::getAvailableMemory() const {
-    // Try MemAvailable first (more accurate on newer kernels)
-    size_t available = readMemInfo("MemAvailable:");
-    if (available > 0) {
-        return available;
-    }
-    
-    // Fallback to MemFree + Buffers + Cached
-    size_t free = readMemInfo("MemFree:");
-    size_t buffers = readMemInfo("Buffers:");
-    size_t cached = readMemInfo("Cached:");
-    
-    return free + buffers + cached;
+    return getSnapshot().available;
 }
 
 MemoryStats MemoryManager::getMemoryStats() const {
+    // One snapshot so the fields agree with each other
+    MemorySnapshot snapshot = getSnapshot();
+    int64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    
     MemoryStats stats;
-    stats.total_memory = getTotalMemory();
-    stats.available_memory = getAvailableMemory();
-    stats.used_memory = stats.total_memory - stats.available_memory;
+    stats.total_memory = snapshot.total;
+    stats.available_memory = snapshot.available;
+    stats.used_memory = snapshot.total > snapshot.available ? snapshot.total - snapshot.available : 0;
     stats.model_memory = model_memory_;
     stats.context_memory = context_memory_;
-    stats.pressure = getMemoryPressure();
+    stats.pressure = pressureFor(snapshot);
+    stats.rss = snapshot.rss;
+    stats.pss = snapshot.pss;
+    stats.model_resident = snapshot.model_resident;
+    stats.psi_some_avg10 = snapshot.psi_some_avg10;
+    stats.psi_full_avg10 = snapshot.psi_full_avg10;
+    stats.psi_events = snapshot.psi_events;
+    stats.sample_age_ms = now_ms - snapshot.timestamp_ms;
     return stats;
 }
 
+static size_t scaledThreshold(size_t threshold, size_t total) {
+    if (total <= REFERENCE_TOTAL_MEMORY) return threshold;
+    return static_cast<size_t>(static_cast<double>(threshold) * total / REFERENCE_TOTAL_MEMORY);
+}
+
 MemoryPressure MemoryManager::getMemoryPressure() const {
-    size_t available = getAvailableMemory();
+    return pressureFor(getSnapshot());
+}
+
+MemoryPressure MemoryManager::pressureFor(const MemorySnapshot& snapshot) {
+    size_t available = snapshot.available;
+    size_t total = snapshot.total;
     
-    if (available < MEMORY_CRITICAL_THRESHOLD) {
-        return MemoryPressure::Critical;
-    } else if (available < MEMORY_HIGH_THRESHOLD) {
-        return MemoryPressure::High;
-    } else if (available < MEMORY_MEDIUM_THRESHOLD) {
-        return MemoryPressure::Medium;
+    MemoryPressure pressure = MemoryPressure::Low;
+    if (available < scaledThreshold(MEMORY_CRITICAL_THRESHOLD, total)) {
+        pressure = MemoryPressure::Critical;
+    } else if (available < scaledThreshold(MEMORY_HIGH_THRESHOLD, total)) {
+        pressure = MemoryPressure::High;
+    } else if (available < scaledThreshold(MEMORY_MEDIUM_THRESHOLD, total)) {
+        pressure = MemoryPressure::Medium;
     }
     
-    return MemoryPressure::Low;
+    // Stalls show pressure that MemAvailable hides, e.g. the model's pages
+    // being evicted and faulted back in while plenty looks free
+    MemoryPressure stalls = MemoryPressure::Low;
+    if (snapshot.psi_full_avg10 >= PSI_FULL_CRITICAL) {
+        stalls = MemoryPressure::Critical;
+    } else if (snapshot.psi_full_avg10 >= PSI_FULL_HIGH || snapshot.psi_some_avg10 >= PSI_SOME_HIGH) {
+        stalls = MemoryPressure::High;
+    } else if (snapshot.psi_some_avg10 >= PSI_SOME_MEDIUM) {
+        stalls = MemoryPressure::Medium;
+    }
+    
+    return std::max(pressure, stalls);
 }
 
 bool MemoryManager::canAllocate(size_t bytes) const {
@@ -127,33 +179,35 @@ bool MemoryManager::canAllocate(size_t bytes) const {
     return true;
 }
 
-size_t MemoryManager::getRecommendedContextSize() const {
+size_t MemoryManager::getAllocationBudget() const {
+    // Same limits as canAllocate(): keep the safety margin and 500MB free
+    constexpr size_t MIN_FREE_AFTER_ALLOC = 500 * 1024 * 1024;
     size_t available = getAvailableMemory();
+    size_t reserve = std::max(ALLOCATION_SAFETY_MARGIN, MIN_FREE_AFTER_ALLOC);
+    return available > reserve ? available - reserve : 0;
+}
+
+size_t MemoryManager::getRecommendedContextSize(size_t fixed_bytes, size_t bytes_per_token,
+                                                size_t max_tokens) const {
+    size_t budget = getAllocationBudget();
+    if (bytes_per_token == 0 || fixed_bytes >= budget) {
+        return 0;
+    }
     
-    // Reserve memory for model and system
-    size_t usable = available > ALLOCATION_SAFETY_MARGIN ? 
-                    available - ALLOCATION_SAFETY_MARGIN : 0;
-    
-    // Rough estimate: each context token uses ~4KB for KV cache
-    // This varies significantly based on model architecture
-    constexpr size_t BYTES_PER_TOKEN = 4 * 1024;
-    
-    size_t max_tokens = usable / BYTES_PER_TOKEN;
-    
-    // Clamp to reasonable range
-    max_tokens = std::max(max_tokens, static_cast<size_t>(512));
-    max_tokens = std::min(max_tokens, static_cast<size_t>(32768));
+    size_t max_fit = (budget - fixed_bytes) / bytes_per_token;
+    max_fit = std::min(max_fit, max_tokens);
     
-    // Round to power of 2 for efficiency
-    size_t result = 512;
-    while (result < max_tokens && result < 32768) {
+    // Largest power of 2 that fits
+    size_t result = 1;
+    while (result * 2 <= max_fit) {
         result *= 2;
     }
-    if (result > max_tokens) {
-        result /= 2;
+    if (result > max_fit) {
+        result = 0;
     }
     
-    LOGI("Recommended context size: %zu tokens", result);
+    LOGI("Recommended context size: %zu tokens (%zu KB per token, %zu MB budget)",
+         result, bytes_per_token / 1024, budget / (1024 * 1024));
     return result;
 }
 
@@ -172,6 +226,19 @@ void MemoryManager::setMemoryPressureCallback(MemoryPressureCallback callback) {
     pressure_callback_ = std::move(callback);
 }
 
+void MemoryManager::onPressureEvent(const MemorySnapshot& snapshot) {
+    // Telemetry thread, on a PSI trigger
+    MemoryPressure pressure = pressureFor(snapshot);
+    LOGW("PSI stall: some=%.2f full=%.2f, %zu MB available, pressure %d",
+         snapshot.psi_some_avg10, snapshot.psi_full_avg10,
+         snapshot.available / (1024 * 1024), static_cast<int>(pressure));
+    
+    if (pressure != MemoryPressure::Low && pressure_callback_) {
+        pressure_callback_(pressure);
+    }
+    postReclaim(pressure, false);
+}
+
 void MemoryManager::checkMemoryPressure() {
     MemoryPressure pressure = getMemoryPressure();
     
@@ -184,12 +251,98 @@ void MemoryManager::checkMemoryPressure() {
 void MemoryManager::requestMemoryCleanup() {
     LOGI("Memory cleanup requested");
     
-    // Memory cleanup - let garbage collection handle it
-    // Direct memory manipulation APIs vary by Android version
+    reclaim(getMemoryPressure(), false);
     
     LOGI("After cleanup - Available: %zu MB", getAvailableMemory() / (1024 * 1024));
 }
 
+void MemoryManager::setReclaimHandler(ReclaimHandler handler) {
+    std::lock_guard<std::mutex> lock(reclaim_mutex_);
+    reclaim_handler_ = std::move(handler);
+}
+
+void MemoryManager::onTrimMemory(int level) {
+    MemoryPressure pressure = MemoryPressure::Low;
+    if (level >= TRIM_MEMORY_COMPLETE || level == TRIM_MEMORY_RUNNING_CRITICAL) {
+        pressure = MemoryPressure::Critical;
+    } else if (level >= TRIM_MEMORY_MODERATE || level == TRIM_MEMORY_RUNNING_LOW) {
+        pressure = MemoryPressure::High;
+    } else if (level >= TRIM_MEMORY_BACKGROUND || level == TRIM_MEMORY_RUNNING_MODERATE) {
+        pressure = MemoryPressure::Medium;
+    }
+    // UI_HIDDEN alone is not pressure
+    
+    // The kernel's view can be worse than what the system reported
+    pressure = std::max(pressure, getMemoryPressure());
+    
+    LOGI("onTrimMemory(%d): pressure %d, %zu MB available", level,
+         static_cast<int>(pressure), getAvailableMemory() / (1024 * 1024));
+    postReclaim(pressure, level >= TRIM_MEMORY_BACKGROUND);
+}
+
+void MemoryManager::postReclaim(MemoryPressure pressure, bool background) {
+    if (pressure == MemoryPressure::Low) return;
+    {
+        std::lock_guard<std::mutex> lock(request_mutex_);
+        request_pressure_ = request_pending_ ? std::max(request_pressure_, pressure) : pressure;
+        request_background_ = (request_pending_ && request_background_) || background;
+        request_pending_ = true;
+    }
+    request_cv_.notify_one();
+}
+
+void MemoryManager::runReclaims() {
+    std::unique_lock<std::mutex> lock(request_mutex_);
+    while (true) {
+        request_cv_.wait(lock, [this] { return request_pending_ || reclaim_stop_; });
+        if (reclaim_stop_) return;
+        
+        MemoryPressure pressure = request_pressure_;
+        bool background = request_background_;
+        request_pending_ = false;
+        
+        lock.unlock();
+        reclaim(pressure, background);
+        lock.lock();
+    }
+}
+
+void MemoryManager::reclaim(MemoryPressure pressure, bool background) {
+    std::lock_guard<std::mutex> lock(reclaim_mutex_);
+    if (!reclaim_handler_) return;
+    
+    // Deepest stage this pressure justifies. Critical pressure unloads when
+    // the app is in the background (next in line for the low-memory
+    // killer) or when everything short of that has already been done.
+    ReclaimStage target = ReclaimStage::None;
+    switch (pressure) {
+        case MemoryPressure::Medium:   target = ReclaimStage::DropCaches; break;
+        case MemoryPressure::High:     target = ReclaimStage::ShrinkKV; break;
+        case MemoryPressure::Critical:
+            target = (background || reclaim_stage_ >= ReclaimStage::ReleaseCompute)
+                     ? ReclaimStage::UnloadModel : ReclaimStage::ReleaseCompute;
+            break;
+        default: break;
+    }
+    
+    // Stages run once each, in order, until the target
+    while (reclaim_stage_ < target) {
+        reclaim_stage_ = static_cast<ReclaimStage>(static_cast<int>(reclaim_stage_) + 1);
+        size_t freed = reclaim_handler_(reclaim_stage_);
+        LOGI("Reclaim stage %d freed %zu MB", static_cast<int>(reclaim_stage_), freed / (1024 * 1024));
+    }
+}
+
+void MemoryManager::resetReclaim() {
+    std::lock_guard<std::mutex> lock(reclaim_mutex_);
+    reclaim_stage_ = ReclaimStage::None;
+}
+
+ReclaimStage MemoryManager::getReclaimStage() const {
+    std::lock_guard<std::mutex> lock(reclaim_mutex_);
+    return reclaim_stage_;
+}
+
 void MemoryManager::registerModelMemory(size_t bytes) {
     model_memory_ += bytes;
     LOGI("Model memory registered: %zu MB (total: %zu MB)", 
@@ -1,8 +1,12 @@
 #pragma once
 
+#include <condition_variable>
 #include <cstddef>
 #include <string>
 #include <functional>
+#include <mutex>
+#include <thread>
+#include "memory_telemetry.h"
 
 namespace cortex {
 
@@ -22,11 +26,33 @@ struct MemoryStats {
     size_t model_memory = 0;
     size_t context_memory = 0;
     MemoryPressure pressure = MemoryPressure::Low;
+    
+    // From the telemetry sampler
+    size_t rss = 0;
+    size_t pss = 0;
+    size_t model_resident = 0;     // Model file pages in the page cache
+    float psi_some_avg10 = -1;     // -1 if PSI is unavailable
+    float psi_full_avg10 = -1;
+    int64_t psi_events = 0;
+    int64_t sample_age_ms = 0;
 };
 
 // Memory callback for pressure notifications
 using MemoryPressureCallback = std::function<void(MemoryPressure level)>;
 
+// Ways to give memory back, cheapest first. Each one costs speed or
+// context; the next is only taken when pressure persists or grows.
+enum class ReclaimStage {
+    None,
+    DropCaches,      // Cached prompt states
+    ShrinkKV,        // Draft model, smaller and/or quantized KV cache
+    ReleaseCompute,  // Smaller compute buffers (smaller ubatch)
+    UnloadModel,     // Reloaded on next use
+};
+
+// Runs one stage; returns bytes freed (0 if it could not)
+using ReclaimHandler = std::function<size_t(ReclaimStage stage)>;
+
 class MemoryManager {
 public:
     static MemoryManager& getInstance();
@@ -35,21 +61,39 @@ public:
     MemoryManager(const MemoryManager&) = delete;
     MemoryManager& operator=(const MemoryManager&) = delete;
     
-    // Memory queries
+    // Memory queries, answered from the telemetry snapshot without I/O
     MemoryStats getMemoryStats() const;
     size_t getAvailableMemory() const;
     size_t getTotalMemory() const;
     MemoryPressure getMemoryPressure() const;
+    MemorySnapshot getSnapshot() const;
+    void refreshSnapshot();  // After freeing memory, before the next budget query
+    
+    // Model file whose page cache residency is reported; empty clears
+    void setModelFile(const std::string& path);
     
     // Memory management
     bool canAllocate(size_t bytes) const;
-    size_t getRecommendedContextSize() const;
+    size_t getAllocationBudget() const;  // Largest allocation canAllocate() accepts
+    // Largest power-of-2 token count whose KV cache fits next to fixed_bytes
+    // (weights, compute buffers); 0 if nothing fits
+    size_t getRecommendedContextSize(size_t fixed_bytes, size_t bytes_per_token,
+                                     size_t max_tokens) const;
     size_t getMaxModelSize() const;
     
     // Memory pressure handling
     void setMemoryPressureCallback(MemoryPressureCallback callback);
     void checkMemoryPressure();
-    void requestMemoryCleanup();
+    void requestMemoryCleanup();  // Reclaims for the current meminfo/PSI pressure
+    
+    // Staged reclaim driven by ComponentCallbacks2.onTrimMemory levels
+    // (onLowMemory reports TRIM_MEMORY_COMPLETE) and PSI triggers. Both
+    // hand the stages to the reclaim worker and return right away; the
+    // handler runs there, never on the sampler or the UI thread.
+    void setReclaimHandler(ReclaimHandler handler);
+    void onTrimMemory(int level);
+    void resetReclaim();  // A model was (re)loaded at full size
+    ReclaimStage getReclaimStage() const;
     
     // Model memory tracking
     void registerModelMemory(size_t bytes);
@@ -59,13 +103,36 @@ public:
     
 private:
     MemoryManager();
-    ~MemoryManager() = default;
+    ~MemoryManager();
     
     size_t model_memory_ = 0;
     size_t context_memory_ = 0;
     MemoryPressureCallback pressure_callback_;
     
-    size_t readMemInfo(const char* field) const;
+    mutable std::mutex reclaim_mutex_;
+    ReclaimHandler reclaim_handler_;
+    ReclaimStage reclaim_stage_ = ReclaimStage::None;
+    
+    // Reclaim worker: shrinking the context re-decodes the conversation,
+    // which would stall sampling for seconds. Requests waiting for it merge
+    // into the worst pressure seen.
+    std::thread reclaim_thread_;
+    std::mutex request_mutex_;
+    std::condition_variable request_cv_;
+    bool request_pending_ = false;
+    MemoryPressure request_pressure_ = MemoryPressure::Low;
+    bool request_background_ = false;
+    bool reclaim_stop_ = false;
+    
+    // Sampler state only; snapshot() takes its own lock
+    mutable MemoryTelemetry telemetry_;
+    
+    void reclaim(MemoryPressure pressure, bool background);
+    void postReclaim(MemoryPressure pressure, bool background);
+    void runReclaims();
+    void onPressureEvent(const MemorySnapshot& snapshot);
+    
+    static MemoryPressure pressureFor(const MemorySnapshot& snapshot);
 };
 
 } // namespace cortex
@@ -0,0 +1,350 @@
+#include "memory_telemetry.h"
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __APPLE__
+    #include <TargetConditionals.h>
+    #include <mach/mach.h>
+    #include <sys/sysctl.h>
+    #if TARGET_OS_IPHONE
+        #include <os/proc.h>
+    #endif
+#endif
+
+#ifdef __ANDROID__
+    #include <android/log.h>
+    #define LOG_TAG "CortexTelemetry"
+    #define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+    #define LOGW(...) __android_log_print(ANDROID_LOG_WARN, LOG_TAG, __VA_ARGS__)
+#else
+    #define LOG_TAG "CortexTelemetry"
+    #define LOGI(...) printf("[INFO] " __VA_ARGS__); printf("\n")
+    #define LOGW(...) printf("[WARN] " __VA_ARGS__); printf("\n")
+#endif
+
+namespace cortex {
+
+namespace {
+
+int64_t nowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int openProc(const char* path, int flags = O_RDONLY) {
+    return open(path, flags | O_CLOEXEC);
+}
+
+void closeFd(int& fd) {
+    if (fd >= 0) close(fd);
+    fd = -1;
+}
+
+// Regenerates a /proc file from an open descriptor; seq_file rebuilds the
+// contents on every read at offset 0
+bool readFd(int fd, char* buf, size_t size) {
+    if (fd < 0) return false;
+    ssize_t n = pread(fd, buf, size - 1, 0);
+    if (n <= 0) return false;
+    buf[n] = '\0';
+    return true;
+}
+
+// Value of a "Key:   1234 kB" line in bytes; the key must start a line so
+// "Cached:" does not match "SwapCached:"
+bool findKb(const char* text, const char* key, size_t& bytes) {
+    size_t key_len = strlen(key);
+    for (const char* line = text; line != nullptr && *line != '\0'; ) {
+        if (strncmp(line, key, key_len) == 0) {
+            bytes = strtoull(line + key_len, nullptr, 10) * 1024;
+            return true;
+        }
+        line = strchr(line, '\n');
+        if (line != nullptr) line++;
+    }
+    return false;
+}
+
+#ifdef __APPLE__
+// Darwin has no /proc; the same fields come from sysctl and Mach. iOS
+// kills apps at a per-app footprint limit long before RAM runs out, so
+// what is available is the headroom under that limit.
+void sampleMach(MemorySnapshot& snap) {
+    uint64_t memsize = 0;
+    size_t len = sizeof(memsize);
+    if (sysctlbyname("hw.memsize", &memsize, &len, nullptr, 0) == 0) {
+        snap.total = static_cast<size_t>(memsize);
+    }
+
+#if TARGET_OS_IPHONE
+    // 0 in the simulator
+    snap.available = os_proc_available_memory();
+#endif
+    if (snap.available == 0) {
+        vm_statistics64_data_t vm;
+        mach_msg_type_number_t count = HOST_VM_INFO64_COUNT;
+        if (host_statistics64(mach_host_self(), HOST_VM_INFO64,
+                              reinterpret_cast<host_info64_t>(&vm), &count) == KERN_SUCCESS) {
+            snap.available = (static_cast<size_t>(vm.free_count) + vm.inactive_count +
+                              vm.purgeable_count) * vm_page_size;
+        }
+    }
+    
+    task_vm_info_data_t info;
+    mach_msg_type_number_t count = TASK_VM_INFO_COUNT;
+    if (task_info(mach_task_self(), TASK_VM_INFO,
+                  reinterpret_cast<task_info_t>(&info), &count) == KERN_SUCCESS) {
+        snap.rss = static_cast<size_t>(info.resident_size);
+        // What the jetsam limit is measured against
+        snap.pss = static_cast<size_t>(info.phys_footprint);
+    }
+}
+#endif
+
+} // namespace
+
+MemoryTelemetry::~MemoryTelemetry() {
+    stop();
+    setModelFile("");
+}
+
+void MemoryTelemetry::openFiles() {
+    if (meminfo_fd_ < 0) meminfo_fd_ = openProc("/proc/meminfo");
+    if (status_fd_ < 0) status_fd_ = openProc("/proc/self/status");
+    if (psi_fd_ < 0) psi_fd_ = openProc("/proc/pressure/memory");
+}
+
+void MemoryTelemetry::closeFiles() {
+    closeFd(meminfo_fd_);
+    closeFd(status_fd_);
+    closeFd(psi_fd_);
+    closeFd(psi_trigger_fd_);
+}
+
+void MemoryTelemetry::start(const MemoryTelemetryConfig& config, PressureEvent on_event) {
+    if (isRunning()) return;
+    
+    config_ = config;
+    on_event_ = std::move(on_event);
+    {
+        std::lock_guard<std::mutex> lock(files_mutex_);
+        openFiles();
+    }
+    
+    if (pipe(wake_pipe_) == 0) {
+        fcntl(wake_pipe_[0], F_SETFD, FD_CLOEXEC);
+        fcntl(wake_pipe_[1], F_SETFD, FD_CLOEXEC);
+    }
+    
+    psi_trigger_fd_ = openProc("/proc/pressure/memory", O_RDWR | O_NONBLOCK);
+    if (psi_trigger_fd_ >= 0) {
+        char trigger[64];
+        snprintf(trigger, sizeof(trigger), "some %d %d", config_.psi_stall_us, config_.psi_window_us);
+        if (write(psi_trigger_fd_, trigger, strlen(trigger) + 1) < 0) {
+            LOGW("PSI trigger rejected (%s), sampling averages only", strerror(errno));
+            closeFd(psi_trigger_fd_);
+        }
+    }
+    
+    LOGI("telemetry started: interval=%dms psi=%s trigger=%s", config_.interval_ms,
+         psi_fd_ >= 0 ? "yes" : "no", psi_trigger_fd_ >= 0 ? "yes" : "no");
+    
+    {
+        // Readers have a snapshot before the first interval elapses
+        MemorySnapshot snap = sample(true);
+        std::lock_guard<std::mutex> lock(mutex_);
+        snapshot_ = snap;
+    }
+    
+    thread_ = std::thread(&MemoryTelemetry::run, this);
+}
+
+void MemoryTelemetry::stop() {
+    if (thread_.joinable()) {
+        char one = 1;
+        if (write(wake_pipe_[1], &one, sizeof(one)) < 0) {
+            LOGW("failed to wake telemetry thread");
+        }
+        thread_.join();
+    }
+    closeFd(wake_pipe_[0]);
+    closeFd(wake_pipe_[1]);
+    
+    std::lock_guard<std::mutex> lock(files_mutex_);
+    closeFiles();
+}
+
+void MemoryTelemetry::run() {
+    int n = 0;
+    while (true) {
+        pollfd fds[2] = {};
+        fds[0].fd = wake_pipe_[0];
+        fds[0].events = POLLIN;
+        fds[1].fd = psi_trigger_fd_;
+        fds[1].events = POLLPRI;
+        
+        int ready = poll(fds, psi_trigger_fd_ >= 0 ? 2 : 1, config_.interval_ms);
+        if (ready < 0 && errno != EINTR) break;
+        if (fds[0].revents & POLLIN) break;
+        
+        bool event = false;
+        if (fds[1].revents & POLLERR) {
+            // The trigger went away (cgroup or PSI teardown)
+            LOGW("PSI trigger failed, sampling averages only");
+            closeFd(psi_trigger_fd_);
+        } else if (fds[1].revents & POLLPRI) {
+            event = true;
+        }
+        
+        // Stalls make the slow fields worth refreshing at once
+        bool slow = event || (++n % config_.slow_every) == 0;
+        MemorySnapshot snap = sample(slow);
+        
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!slow) {
+                snap.pss = snapshot_.pss;
+                snap.model_resident = snapshot_.model_resident;
+            }
+            snap.psi_events = snapshot_.psi_events + (event ? 1 : 0);
+            snapshot_ = snap;
+        }
+        
+        if (event && on_event_) {
+            on_event_(snap);
+        }
+    }
+}
+
+MemorySnapshot MemoryTelemetry::sample(bool slow) {
+    MemorySnapshot snap;
+    snap.timestamp_ms = nowMs();
+    
+    // Large enough for /proc/meminfo and /proc/self/status in one read
+    char buf[4096];
+    
+    std::unique_lock<std::mutex> files_lock(files_mutex_);
+    openFiles();  // Only does something before the sampler started
+    if (readFd(meminfo_fd_, buf, sizeof(buf))) {
+        findKb(buf, "MemTotal:", snap.total);
+        if (!findKb(buf, "MemAvailable:", snap.available)) {
+            // Pre-3.14 kernels
+            size_t free_bytes = 0, buffers = 0, cached = 0;
+            findKb(buf, "MemFree:", free_bytes);
+            findKb(buf, "Buffers:", buffers);
+            findKb(buf, "Cached:", cached);
+            snap.available = free_bytes + buffers + cached;
+        }
+    }
+    
+    if (readFd(status_fd_, buf, sizeof(buf))) {
+        findKb(buf, "VmRSS:", snap.rss);
+    }
+    
+    if (readFd(psi_fd_, buf, sizeof(buf))) {
+        // "some avg10=0.00 avg60=0.00 avg300=0.00 total=0\nfull avg10=..."
+        const char* some = strstr(buf, "some avg10=");
+        const char* full = strstr(buf, "full avg10=");
+        if (some != nullptr) snap.psi_some_avg10 = strtof(some + 11, nullptr);
+        if (full != nullptr) snap.psi_full_avg10 = strtof(full + 11, nullptr);
+    }
+    files_lock.unlock();
+    
+    if (slow) {
+        // smaps_rollup walks every mapping in the kernel, so it is opened
+        // per read and only on the slow cadence
+        int fd = openProc("/proc/self/smaps_rollup");
+        if (readFd(fd, buf, sizeof(buf))) {
+            findKb(buf, "Pss:", snap.pss);
+        }
+        closeFd(fd);
+        
+        snap.model_resident = modelResident();
+    }
+    
+#ifdef __APPLE__
+    sampleMach(snap);
+#endif
+    
+    std::lock_guard<std::mutex> lock(model_mutex_);
+    snap.model_bytes = model_size_;
+    return snap;
+}
+
+MemorySnapshot MemoryTelemetry::snapshot() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (snapshot_.timestamp_ms != 0) return snapshot_;
+    }
+    
+    // Sampler not started
+    MemorySnapshot snap = sample(true);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (snapshot_.timestamp_ms == 0) snapshot_ = snap;
+    return snapshot_;
+}
+
+MemorySnapshot MemoryTelemetry::refresh() {
+    MemorySnapshot snap = sample(false);
+    std::lock_guard<std::mutex> lock(mutex_);
+    // The slow fields keep their last values
+    snap.pss = snapshot_.pss;
+    snap.model_resident = snapshot_.model_resident;
+    snap.psi_events = snapshot_.psi_events;
+    snapshot_ = snap;
+    return snap;
+}
+
+void MemoryTelemetry::setModelFile(const std::string& path) {
+    std::lock_guard<std::mutex> lock(model_mutex_);
+    
+    if (model_map_ != nullptr) {
+        munmap(model_map_, model_size_);
+        model_map_ = nullptr;
+        model_size_ = 0;
+    }
+    if (path.empty()) return;
+    
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        // Never touched, so it faults nothing in
+        void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map != MAP_FAILED) {
+            model_map_ = map;
+            model_size_ = st.st_size;
+        }
+    }
+    close(fd);
+}
+
+size_t MemoryTelemetry::modelResident() {
+    std::lock_guard<std::mutex> lock(model_mutex_);
+    if (model_map_ == nullptr) return 0;
+    
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t pages = (model_size_ + page - 1) / page;
+#ifdef __APPLE__
+    std::vector<char> vec(pages);
+#else
+    std::vector<unsigned char> vec(pages);
+#endif
+    if (mincore(model_map_, model_size_, vec.data()) != 0) return 0;
+    
+    size_t resident = 0;
+    for (auto v : vec) resident += v & 1;
+    return resident * page;
+}
+
+} // namespace cortex
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace cortex {
+
+// One sample of system and process memory
+struct MemorySnapshot {
+    int64_t timestamp_ms = 0;      // Steady clock; 0 until the first sample
+    size_t total = 0;
+    size_t available = 0;          // MemAvailable, or MemFree + Buffers + Cached on old kernels;
+                                   // on iOS the headroom under the app's jetsam limit
+    size_t rss = 0;                // VmRSS of this process
+    size_t pss = 0;                // smaps_rollup, slow cadence; phys_footprint on Apple
+    size_t model_bytes = 0;        // Size of the tracked model file
+    size_t model_resident = 0;     // Its pages in the page cache (mincore), slow cadence
+    float psi_some_avg10 = -1;     // /proc/pressure/memory, -1 if unreadable
+    float psi_full_avg10 = -1;
+    int64_t psi_events = 0;        // PSI triggers fired since start
+};
+
+struct MemoryTelemetryConfig {
+    int interval_ms = 1000;
+    int slow_every = 5;            // PSS and model residency every N samples
+    
+    // PSI trigger: a "some" stall this long within the window. Unprivileged
+    // processes need the window to be a multiple of 2 s.
+    int psi_stall_us = 150000;
+    int psi_window_us = 2000000;
+};
+
+// Samples /proc once per interval on its own thread into a cached snapshot,
+// so readers never touch the filesystem. The /proc files stay open and are
+// re-read from offset 0. A PSI trigger on /proc/pressure/memory wakes the
+// sampler early and reports the event; where the kernel or SELinux does
+// not allow one, the PSI averages are still sampled if readable.
+class MemoryTelemetry {
+public:
+    using PressureEvent = std::function<void(const MemorySnapshot& snapshot)>;
+    
+    MemoryTelemetry() = default;
+    ~MemoryTelemetry();
+    
+    MemoryTelemetry(const MemoryTelemetry&) = delete;
+    MemoryTelemetry& operator=(const MemoryTelemetry&) = delete;
+    
+    void start(const MemoryTelemetryConfig& config, PressureEvent on_event);
+    void stop();
+    bool isRunning() const { return thread_.joinable(); }
+    
+    // Latest sample; samples synchronously if the sampler has none yet
+    MemorySnapshot snapshot();
+    
+    // Samples now, for callers that just freed memory and act on the result
+    MemorySnapshot refresh();
+    
+    // Model file whose page cache residency is tracked; empty clears
+    void setModelFile(const std::string& path);
+
+private:
+    MemoryTelemetryConfig config_;
+    PressureEvent on_event_;
+    std::thread thread_;
+    int wake_pipe_[2] = {-1, -1};  // Written to wake the sampler to stop
+    
+    // Opened on first use and read by the sampler and by callers of
+    // snapshot()/refresh(), all under files_mutex_
+    std::mutex files_mutex_;
+    int meminfo_fd_ = -1;
+    int status_fd_ = -1;
+    int psi_fd_ = -1;              // Averages
+    int psi_trigger_fd_ = -1;      // Sampler thread only while it runs
+    
+    mutable std::mutex mutex_;
+    MemorySnapshot snapshot_;
+    
+    // Private read-only mapping of the model; mincore() on it reports the
+    // file's page cache, which llama's own mapping shares
+    std::mutex model_mutex_;
+    void* model_map_ = nullptr;
+    size_t model_size_ = 0;
+    
+    void openFiles();   // files_mutex_ held
+    void closeFiles();  // files_mutex_ held
+    void run();
+    MemorySnapshot sample(bool slow);
+    size_t modelResident();
+};
+
+} // namespace cortex
@@ -0,0 +1,120 @@
+#include "model_cache.h"
+#include "memory_manager.h"
+
+#ifdef __ANDROID__
+    #include <android/log.h>
+    #define LOG_TAG "CortexModelCache"
+    #define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#else
+    #include <cstdio>
+    #define LOG_TAG "CortexModelCache"
+    #define LOGI(...) printf("[INFO] " __VA_ARGS__); printf("\n")
+#endif
+
+namespace cortex {
+
+static constexpr size_t MB = 1024 * 1024;
+
+ModelCache::~ModelCache() {
+    clear();
+}
+
+llama_model* ModelCache::take(const std::string& path, const llama_model_params& params) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+        if (it->path == path && it->gpu_layers == params.n_gpu_layers && it->use_mlock == params.use_mlock &&
+            it->repacked == params.use_extra_bufts) {
+            llama_model* model = it->model;
+            size_t bytes = it->bytes;
+            entries_.erase(it);
+            stats_.hits++;
+            stats_.models--;
+            stats_.bytes -= bytes;
+            
+            // Its memory is the engine's again
+            MemoryManager::getInstance().unregisterModelMemory(bytes);
+            LOGI("hit: %s (%zu MB)", path.c_str(), bytes / MB);
+            return model;
+        }
+    }
+    stats_.misses++;
+    return nullptr;
+}
+
+void ModelCache::park(const std::string& path, const llama_model_params& params, llama_model* model) {
+    if (model == nullptr) return;
+    
+    Entry entry;
+    entry.path = path;
+    entry.gpu_layers = params.n_gpu_layers;
+    entry.use_mlock = params.use_mlock;
+    entry.repacked = params.use_extra_bufts;
+    entry.model = model;
+    entry.bytes = llama_model_size(model);
+    
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (config_.max_models <= 0 || entry.bytes > maxBytes()) {
+        llama_model_free(model);
+        return;
+    }
+    
+    MemoryManager::getInstance().registerModelMemory(entry.bytes);
+    entries_.push_front(entry);
+    stats_.models++;
+    stats_.bytes += entry.bytes;
+    LOGI("parked: %s (%zu MB, %d idle)", path.c_str(), entry.bytes / MB, stats_.models);
+    
+    while (stats_.models > config_.max_models || stats_.bytes > maxBytes()) {
+        evictOldest();
+    }
+}
+
+size_t ModelCache::makeRoom(size_t bytes, const std::string& keep) {
+    MemoryManager& memMgr = MemoryManager::getInstance();
+    size_t freed = 0;
+    
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.end();
+    while (it != entries_.begin() && memMgr.getAllocationBudget() < bytes) {
+        --it;
+        if (it->path == keep) continue;
+        freed += evict(it++);
+        // The budget query reads a snapshot; it must see the free
+        memMgr.refreshSnapshot();
+    }
+    return freed;
+}
+
+size_t ModelCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t freed = 0;
+    while (!entries_.empty()) {
+        freed += evictOldest();
+    }
+    return freed;
+}
+
+ModelCacheStats ModelCache::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+size_t ModelCache::evict(std::list<Entry>::iterator it) {
+    size_t bytes = it->bytes;
+    LOGI("evicted: %s (%zu MB)", it->path.c_str(), bytes / MB);
+    
+    llama_model_free(it->model);
+    MemoryManager::getInstance().unregisterModelMemory(bytes);
+    entries_.erase(it);
+    
+    stats_.models--;
+    stats_.bytes -= bytes;
+    stats_.evictions++;
+    return bytes;
+}
+
+size_t ModelCache::maxBytes() const {
+    return static_cast<size_t>(MemoryManager::getInstance().getTotalMemory() * config_.max_ram_ratio);
+}
+
+} // namespace cortex
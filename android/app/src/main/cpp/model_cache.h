@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <list>
+#include <mutex>
+#include <string>
+
+#include "llama.h"
+
+namespace cortex {
+
+struct ModelCacheConfig {
+    int max_models = 2;            // Idle models kept besides the active one
+    double max_ram_ratio = 0.30;   // Idle weights at most this share of RAM
+};
+
+struct ModelCacheStats {
+    int models = 0;
+    size_t bytes = 0;
+    int64_t hits = 0;
+    int64_t misses = 0;
+    int64_t evictions = 0;
+};
+
+// Loaded models that are not in use, least recently used first out.
+// Unloading parks the llama_model here instead of freeing it, so switching
+// back only creates a new context. Weights are mmap'd, so an idle model
+// mostly costs clean page cache the kernel can drop; anything repacked or
+// mlock'd is anonymous and is what the budget below guards.
+class ModelCache {
+public:
+    ModelCache() = default;
+    explicit ModelCache(const ModelCacheConfig& config) : config_(config) {}
+    ~ModelCache();
+    
+    ModelCache(const ModelCache&) = delete;
+    ModelCache& operator=(const ModelCache&) = delete;
+    
+    // Removes and returns a model loaded with the same parameters, or
+    // nullptr; the caller owns it until it is parked again
+    llama_model* take(const std::string& path, const llama_model_params& params);
+    
+    // Keeps an unused model for later; frees it if it is over budget
+    void park(const std::string& path, const llama_model_params& params, llama_model* model);
+    
+    // Frees idle models, oldest first, until the allocation budget has
+    // room for `bytes`; `keep` is spared. Returns bytes freed.
+    size_t makeRoom(size_t bytes, const std::string& keep = "");
+    
+    size_t clear();  // Returns bytes freed
+    ModelCacheStats getStats() const;
+
+private:
+    struct Entry {
+        std::string path;
+        int gpu_layers = 0;
+        bool use_mlock = false;
+        bool repacked = false;     // Weights in the CPU repack layout, not mmap'd
+        llama_model* model = nullptr;
+        size_t bytes = 0;
+    };
+    
+    ModelCacheConfig config_;
+    mutable std::mutex mutex_;
+    std::list<Entry> entries_;     // Front is the most recently parked
+    ModelCacheStats stats_;
+    
+    size_t evict(std::list<Entry>::iterator it);
+    size_t evictOldest() { return evict(std::prev(entries_.end())); }
+    size_t maxBytes() const;
+};
+
+} // namespace cortex
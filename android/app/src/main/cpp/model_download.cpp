@@ -0,0 +1,550 @@
+#include "model_download.h"
+#include "model_preflight.h"
+#include "latency_trace.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __ANDROID__
+    #include <android/log.h>
+    #define LOG_TAG "CortexDownload"
+    #define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+    #define LOGW(...) __android_log_print(ANDROID_LOG_WARN, LOG_TAG, __VA_ARGS__)
+#else
+    #define LOG_TAG "CortexDownload"
+    #define LOGI(...) printf("[INFO] " __VA_ARGS__); printf("\n")
+    #define LOGW(...) printf("[WARN] " __VA_ARGS__); printf("\n")
+#endif
+
+namespace cortex {
+
+static const size_t HASH_READ_BYTES = 1024 * 1024;
+
+static std::string errnoString(const char* what) {
+    return std::string(what) + ": " + strerror(errno);
+}
+
+// fdatasync is not in Apple's headers
+static int syncData(int fd) {
+#ifdef __APPLE__
+    return fsync(fd);
+#else
+    return fdatasync(fd);
+#endif
+}
+
+// Reserve the whole file up front so the model ends up in as few extents
+// as the filesystem can manage (mmap reads then stay sequential) and a
+// full disk fails now rather than halfway through
+static bool preallocate(int fd, int64_t bytes, std::string& error) {
+#ifdef __APPLE__
+    fstore_t store = {F_ALLOCATECONTIG | F_ALLOCATEALL, F_PEOFPOSMODE, 0, bytes, 0};
+    if (fcntl(fd, F_PREALLOCATE, &store) == -1) {
+        store.fst_flags = F_ALLOCATEALL;
+        if (fcntl(fd, F_PREALLOCATE, &store) == -1 && errno == ENOSPC) {
+            error = "not enough storage for the model";
+            return false;
+        }
+    }
+    if (ftruncate(fd, bytes) != 0) {
+        error = errnoString("ftruncate");
+        return false;
+    }
+#else
+    if (fallocate(fd, 0, 0, bytes) != 0) {
+        if (errno == ENOSPC) {
+            error = "not enough storage for the model";
+            return false;
+        }
+        // E.g. FUSE-backed external storage: sparse is the best it gets
+        LOGW("fallocate: %s, writing a sparse file", strerror(errno));
+        if (ftruncate(fd, bytes) != 0) {
+            error = errnoString("ftruncate");
+            return false;
+        }
+    }
+#endif
+    return true;
+}
+
+ModelDownload::ModelDownload(const std::string& path, int64_t total_bytes, int64_t chunk_bytes,
+                             const std::string& source)
+    : path_(path), part_path_(path + ".part"), manifest_path_(path + ".part.txt"),
+      total_bytes_(std::max<int64_t>(total_bytes, 0)) {
+    // The manifest is one line; keep the source on it
+    for (char c : source) {
+        source_ += (c == '\n' || c == '\r') ? ' ' : c;
+    }
+    
+    // Chunk boundaries are where the hash state is saved, so they have to
+    // fall on SHA-256 blocks
+    chunk_bytes = std::max(chunk_bytes, MIN_CHUNK_BYTES);
+    chunk_bytes_ = (chunk_bytes + Sha256::BLOCK_BYTES - 1) / Sha256::BLOCK_BYTES * Sha256::BLOCK_BYTES;
+    chunks_.assign(static_cast<size_t>((total_bytes_ + chunk_bytes_ - 1) / chunk_bytes_), MISSING);
+    
+    if (total_bytes_ <= 0) {
+        error_ = "unknown download size";
+        return;
+    }
+    if (!openFile()) return;
+    worker_ = std::thread(&ModelDownload::run, this);
+}
+
+ModelDownload::~ModelDownload() {
+    stopWorker();
+    if (fd_ < 0) return;
+    
+    if (!committed_) {
+        // Chunks that finished after the last sync still count next time
+        std::string contents;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            bool written = false;
+            for (ChunkState& state : chunks_) {
+                written |= state == WRITTEN;
+            }
+            if (written && syncData(fd_) == 0) {
+                for (ChunkState& state : chunks_) {
+                    if (state == WRITTEN) state = SYNCED;
+                }
+            }
+            contents = manifest();
+        }
+        saveManifest(contents);
+        LOGI("download paused at %lld of %lld bytes: %s", static_cast<long long>(done_bytes_),
+             static_cast<long long>(total_bytes_), part_path_.c_str());
+    }
+    close(fd_);
+}
+
+bool ModelDownload::openFile() {
+    bool resume = loadManifest();
+    if (!resume) {
+        unlink(manifest_path_.c_str());
+    }
+    
+    fd_ = ::open(part_path_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC | (resume ? 0 : O_TRUNC), 0644);
+    if (fd_ < 0) {
+        error_ = errnoString("open");
+        return false;
+    }
+    if (!preallocate(fd_, total_bytes_, error_)) {
+        close(fd_);
+        fd_ = -1;
+        unlink(part_path_.c_str());
+        return false;
+    }
+    
+    if (resume) {
+        LOGI("resuming %s: %lld of %lld bytes, %lld hashed", part_path_.c_str(),
+             static_cast<long long>(done_bytes_), static_cast<long long>(total_bytes_),
+             static_cast<long long>(hashed_bytes_));
+    }
+    return true;
+}
+
+bool ModelDownload::loadManifest() {
+    struct stat st;
+    if (stat(part_path_.c_str(), &st) != 0 || st.st_size != total_bytes_) return false;
+    
+    FILE* f = fopen(manifest_path_.c_str(), "r");
+    if (f == nullptr) return false;
+    
+    std::string source, done, state;
+    long long total = -1, chunk = -1, hashed = 0;
+    char line[4096];
+    while (fgets(line, sizeof(line), f) != nullptr) {
+        line[strcspn(line, "\n")] = '\0';
+        if (strncmp(line, "source=", 7) == 0) source = line + 7;
+        else if (strncmp(line, "total=", 6) == 0) total = atoll(line + 6);
+        else if (strncmp(line, "chunk=", 6) == 0) chunk = atoll(line + 6);
+        else if (strncmp(line, "done=", 5) == 0) done = line + 5;
+        else if (strncmp(line, "hashed=", 7) == 0) hashed = atoll(line + 7);
+        else if (strncmp(line, "sha=", 4) == 0) state = line + 4;
+    }
+    fclose(f);
+    
+    // A different file upstream, or a different chunking: start over
+    if (source != source_ || total != total_bytes_ || chunk != chunk_bytes_ ||
+        done.size() != (chunks_.size() + 3) / 4) {
+        return false;
+    }
+    
+    // One hex digit per four chunks, lowest chunk in the lowest bit
+    for (size_t i = 0; i < chunks_.size(); i++) {
+        char digit = done[i / 4];
+        int bits = digit >= 'a' ? digit - 'a' + 10 : digit - '0';
+        if (bits & (1 << (i % 4))) {
+            chunks_[i] = SYNCED;
+            done_bytes_ += chunkSize(static_cast<int32_t>(i));
+        }
+    }
+    while (next_hint_ < static_cast<int32_t>(chunks_.size()) && chunks_[next_hint_] != MISSING) {
+        next_hint_++;
+    }
+    
+    // The hash picks up at a chunk boundary it had reached, else from the top
+    int32_t hash_chunk = static_cast<int32_t>(hashed / chunk_bytes_);
+    bool prefix_done = hashed % chunk_bytes_ == 0 && hash_chunk <= static_cast<int32_t>(chunks_.size());
+    for (int32_t i = 0; prefix_done && i < hash_chunk; i++) {
+        prefix_done = chunks_[i] == SYNCED;
+    }
+    if (hashed > 0 && prefix_done && hasher_.restore(state, hashed)) {
+        hash_chunk_ = hash_chunk;
+        hashed_bytes_ = hashed;
+    }
+    return true;
+}
+
+std::string ModelDownload::manifest() const {
+    std::string done((chunks_.size() + 3) / 4, '0');
+    for (size_t i = 0; i < chunks_.size(); i++) {
+        if (chunks_[i] != SYNCED) continue;
+        char& digit = done[i / 4];
+        int bits = (digit >= 'a' ? digit - 'a' + 10 : digit - '0') | (1 << (i % 4));
+        digit = "0123456789abcdef"[bits];
+    }
+    
+    char numbers[128];
+    snprintf(numbers, sizeof(numbers), "total=%lld\nchunk=%lld\nhashed=%lld\n",
+             static_cast<long long>(total_bytes_), static_cast<long long>(chunk_bytes_),
+             static_cast<long long>(hash_state_.empty() ? 0 : hashed_bytes_));
+    return "source=" + source_ + "\n" + numbers + "done=" + done + "\nsha=" + hash_state_ + "\n";
+}
+
+void ModelDownload::saveManifest(const std::string& contents) const {
+    // Replaced in one rename, so a crash leaves the old or the new one
+    std::string tmp = manifest_path_ + ".tmp";
+    FILE* f = fopen(tmp.c_str(), "w");
+    if (f == nullptr) return;
+    bool ok = fwrite(contents.data(), 1, contents.size(), f) == contents.size();
+    ok = fflush(f) == 0 && syncData(fileno(f)) == 0 && ok;
+    fclose(f);
+    if (!ok || rename(tmp.c_str(), manifest_path_.c_str()) != 0) {
+        LOGW("could not save %s", manifest_path_.c_str());
+        unlink(tmp.c_str());
+    }
+}
+
+void ModelDownload::fail(const std::string& message) {
+    if (!error_.empty()) return;
+    error_ = message;
+    LOGW("download %s: %s", path_.c_str(), message.c_str());
+}
+
+std::string ModelDownload::error() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return error_;
+}
+
+int32_t ModelDownload::nextChunk() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!error_.empty() || fd_ < 0) return -1;
+    
+    int32_t n = static_cast<int32_t>(chunks_.size());
+    while (next_hint_ < n && chunks_[next_hint_] != MISSING) {
+        next_hint_++;
+    }
+    if (next_hint_ == n) return -1;
+    chunks_[next_hint_] = FETCHING;
+    return next_hint_++;
+}
+
+int64_t ModelDownload::chunkOffset(int32_t index) const {
+    return static_cast<int64_t>(index) * chunk_bytes_;
+}
+
+int64_t ModelDownload::chunkSize(int32_t index) const {
+    if (index < 0 || index >= static_cast<int32_t>(chunks_.size())) return 0;
+    return std::min(chunk_bytes_, total_bytes_ - chunkOffset(index));
+}
+
+bool ModelDownload::write(int64_t offset, const uint8_t* data, size_t len) {
+    int32_t index = static_cast<int32_t>(offset / chunk_bytes_);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!error_.empty()) return false;
+        if (offset < 0 || index >= static_cast<int32_t>(chunks_.size()) || chunks_[index] != FETCHING ||
+            offset + static_cast<int64_t>(len) > chunkOffset(index) + chunkSize(index)) {
+            fail("write outside the chunk being fetched");
+            return false;
+        }
+    }
+    
+    // Writes of one chunk come from one fetch, and chunks do not overlap,
+    // so this needs no lock
+    while (len > 0) {
+        ssize_t n = pwrite(fd_, data, len, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            fail(errno == ENOSPC ? "not enough storage for the model" : errnoString("pwrite"));
+            return false;
+        }
+        data += n;
+        offset += n;
+        len -= n;
+    }
+    return true;
+}
+
+void ModelDownload::completeChunk(int32_t index) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (index < 0 || index >= static_cast<int32_t>(chunks_.size()) || chunks_[index] != FETCHING) return;
+    chunks_[index] = WRITTEN;
+    done_bytes_ += chunkSize(index);
+    cv_.notify_one();
+}
+
+void ModelDownload::releaseChunk(int32_t index) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (index < 0 || index >= static_cast<int32_t>(chunks_.size()) || chunks_[index] != FETCHING) return;
+    chunks_[index] = MISSING;
+    next_hint_ = std::min(next_hint_, index);
+}
+
+int64_t ModelDownload::doneBytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return done_bytes_;
+}
+
+int64_t ModelDownload::hashedBytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return hashed_bytes_;
+}
+
+int64_t ModelDownload::headerBytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return header_bytes_;
+}
+
+std::string ModelDownload::digest() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return digest_;
+}
+
+void ModelDownload::syncWritten(std::unique_lock<std::mutex>& lock) {
+    std::vector<int32_t> written;
+    for (size_t i = 0; i < chunks_.size(); i++) {
+        if (chunks_[i] == WRITTEN) written.push_back(static_cast<int32_t>(i));
+    }
+    if (written.empty()) return;
+    
+    // One sync covers every chunk completed so far; the manifest only
+    // claims chunks that are on disk
+    lock.unlock();
+    bool synced = syncData(fd_) == 0;
+    lock.lock();
+    if (!synced) {
+        fail(errnoString("fdatasync"));
+        return;
+    }
+    for (int32_t index : written) {
+        chunks_[index] = SYNCED;
+    }
+}
+
+// Runs on the worker without mutex_; hasher_ is the worker's own
+bool ModelDownload::hashChunk(int32_t index) {
+    TraceSection trace("cortex:download_hash");
+    std::vector<uint8_t> buffer(HASH_READ_BYTES);
+    int64_t offset = chunkOffset(index);
+    int64_t end = offset + chunkSize(index);
+    while (offset < end) {
+        size_t want = static_cast<size_t>(std::min<int64_t>(buffer.size(), end - offset));
+        ssize_t n = pread(fd_, buffer.data(), want, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        hasher_.update(buffer.data(), n);
+        offset += n;
+    }
+    return true;
+}
+
+void ModelDownload::run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        cv_.wait(lock, [this] {
+            return stop_ || (error_.empty() && (hashable() || std::find(chunks_.begin(), chunks_.end(), WRITTEN) != chunks_.end()));
+        });
+        if (stop_) break;
+        
+        syncWritten(lock);
+        
+        while (!stop_ && error_.empty() && hashable()) {
+            int32_t index = hash_chunk_;
+            lock.unlock();
+            bool ok = hashChunk(index);
+            lock.lock();
+            if (!ok) {
+                fail(errnoString("pread"));
+                break;
+            }
+            hash_chunk_++;
+            hashed_bytes_ += chunkSize(index);
+            
+            if (hash_chunk_ == static_cast<int32_t>(chunks_.size())) {
+                hash_state_.clear();
+                digest_ = hasher_.finishHex();
+            } else {
+                hash_state_ = hasher_.stateHex();
+            }
+            
+            // The header is read straight from the file, so it can be
+            // looked at once the synced prefix covers it
+            if (header_bytes_ == 0) {
+                int64_t available = hashed_bytes_;
+                lock.unlock();
+                int64_t header = scanGGUFHeader(fd_, available);
+                lock.lock();
+                header_bytes_ = header;
+                if (header < 0) {
+                    fail("not a GGUF model file");
+                } else if (header > 0) {
+                    LOGI("gguf header of %s is %lld bytes", path_.c_str(), static_cast<long long>(header));
+                }
+            }
+        }
+        
+        std::string contents = manifest();
+        lock.unlock();
+        saveManifest(contents);
+        lock.lock();
+    }
+}
+
+void ModelDownload::stopWorker() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    if (worker_.joinable()) {
+        worker_.join();
+    }
+}
+
+bool ModelDownload::commit(const std::string& expected_sha256) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!error_.empty()) return false;
+        if (fd_ < 0 || hashed_bytes_ != total_bytes_ || digest_.empty()) {
+            fail("download is not complete");
+            return false;
+        }
+        if (!expected_sha256.empty() && strcasecmp(expected_sha256.c_str(), digest_.c_str()) != 0) {
+            fail("sha256 mismatch: expected " + expected_sha256 + ", got " + digest_);
+        }
+    }
+    stopWorker();
+    
+    if (!error().empty()) {
+        // Corrupt on disk or changed upstream; resuming would not help
+        close(fd_);
+        fd_ = -1;
+        discard(path_);
+        return false;
+    }
+    
+    bool ok = fsync(fd_) == 0;
+    close(fd_);
+    fd_ = -1;
+    if (!ok || rename(part_path_.c_str(), path_.c_str()) != 0) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        fail(errnoString(ok ? "rename" : "fsync"));
+        return false;
+    }
+    unlink(manifest_path_.c_str());
+    committed_ = true;
+    LOGI("download complete: %s (sha256 %s)", path_.c_str(), digest_.c_str());
+    return true;
+}
+
+void ModelDownload::discard(const std::string& path) {
+    unlink((path + ".part").c_str());
+    unlink((path + ".part.txt").c_str());
+    unlink((path + ".part.txt.tmp").c_str());
+}
+
+} // namespace cortex
+
+using cortex::ModelDownload;
+
+static ModelDownload* downloadOf(void* download) {
+    return static_cast<ModelDownload*>(download);
+}
+
+void* cortex_download_open(const char* path, int64_t total_bytes, int64_t chunk_bytes, const char* source) {
+    return new ModelDownload(path ? path : "", total_bytes, chunk_bytes, source ? source : "");
+}
+
+void cortex_download_close(void* download) {
+    delete downloadOf(download);
+}
+
+void cortex_download_discard(const char* path) {
+    if (path != nullptr) ModelDownload::discard(path);
+}
+
+const char* cortex_download_error(void* download) {
+    // Per thread, so concurrent callers do not overwrite each other's copy
+    static thread_local std::string error;
+    error = downloadOf(download)->error();
+    return error.c_str();
+}
+
+const char* cortex_download_part_path(void* download) {
+    return downloadOf(download)->partPath().c_str();
+}
+
+int32_t cortex_download_next_chunk(void* download) {
+    return downloadOf(download)->nextChunk();
+}
+
+int64_t cortex_download_chunk_offset(void* download, int32_t index) {
+    return downloadOf(download)->chunkOffset(index);
+}
+
+int64_t cortex_download_chunk_size(void* download, int32_t index) {
+    return downloadOf(download)->chunkSize(index);
+}
+
+bool cortex_download_write(void* download, int64_t offset, const uint8_t* data, int64_t len) {
+    return len >= 0 && downloadOf(download)->write(offset, data, static_cast<size_t>(len));
+}
+
+void cortex_download_complete_chunk(void* download, int32_t index) {
+    downloadOf(download)->completeChunk(index);
+}
+
+void cortex_download_release_chunk(void* download, int32_t index) {
+    downloadOf(download)->releaseChunk(index);
+}
+
+int64_t cortex_download_done_bytes(void* download) {
+    return downloadOf(download)->doneBytes();
+}
+
+int64_t cortex_download_hashed_bytes(void* download) {
+    return downloadOf(download)->hashedBytes();
+}
+
+int64_t cortex_download_header_bytes(void* download) {
+    return downloadOf(download)->headerBytes();
+}
+
+bool cortex_download_commit(void* download, const char* expected_sha256) {
+    return downloadOf(download)->commit(expected_sha256 ? expected_sha256 : "");
+}
+
+const char* cortex_download_digest(void* download) {
+    static thread_local std::string digest;
+    digest = downloadOf(download)->digest();
+    return digest.c_str();
+}
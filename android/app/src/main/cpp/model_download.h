@@ -0,0 +1,144 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sha256.h"
+
+// C ABI for dart:ffi (lib/services/model_download.dart): Dart runs the HTTP
+// range requests, native owns the file.
+//
+// A download is split into fixed-size chunks that Dart fetches in
+// parallel. Bytes go straight into a preallocated `<path>.part`; a worker
+// thread syncs finished chunks, records them in `<path>.part.txt` so an
+// interrupted download resumes where it stopped, and hashes them in file
+// order while later ones are still arriving. The GGUF header is checked as
+// soon as it is in, so a model that cannot load is turned down before the
+// weights are fetched. commit() moves the part file into place once the
+// SHA-256 matches.
+
+#ifndef CORTEX_FFI_EXPORT
+    #define CORTEX_FFI_EXPORT extern "C" __attribute__((visibility("default"))) __attribute__((used))
+#endif
+
+// Pick up the part file of an earlier attempt when total, chunk size and
+// source (URL plus ETag) match, else start over. Never null; check
+// cortex_download_error, e.g. when the storage cannot hold total_bytes.
+CORTEX_FFI_EXPORT void* cortex_download_open(const char* path, int64_t total_bytes, int64_t chunk_bytes,
+                                             const char* source);
+// Stop the worker and close the file; the part file stays for a resume
+// unless the download was committed
+CORTEX_FFI_EXPORT void cortex_download_close(void* download);
+// Delete path's part file and its bookkeeping
+CORTEX_FFI_EXPORT void cortex_download_discard(const char* path);
+
+// First error, "" while there is none. Valid until the next call.
+CORTEX_FFI_EXPORT const char* cortex_download_error(void* download);
+CORTEX_FFI_EXPORT const char* cortex_download_part_path(void* download);
+
+// Chunk scheduling: missing chunks in file order, -1 when none is left to
+// fetch. A chunk is written with any number of writes inside its range,
+// then completed, or released to be fetched again.
+CORTEX_FFI_EXPORT int32_t cortex_download_next_chunk(void* download);
+CORTEX_FFI_EXPORT int64_t cortex_download_chunk_offset(void* download, int32_t index);
+CORTEX_FFI_EXPORT int64_t cortex_download_chunk_size(void* download, int32_t index);
+CORTEX_FFI_EXPORT bool cortex_download_write(void* download, int64_t offset, const uint8_t* data, int64_t len);
+CORTEX_FFI_EXPORT void cortex_download_complete_chunk(void* download, int32_t index);
+CORTEX_FFI_EXPORT void cortex_download_release_chunk(void* download, int32_t index);
+
+// Progress: bytes in completed chunks, bytes hashed so far, and the GGUF
+// header length (0 until the header is in, -1 when it is not GGUF)
+CORTEX_FFI_EXPORT int64_t cortex_download_done_bytes(void* download);
+CORTEX_FFI_EXPORT int64_t cortex_download_hashed_bytes(void* download);
+CORTEX_FFI_EXPORT int64_t cortex_download_header_bytes(void* download);
+
+// Once everything is hashed: compare against expected_sha256 (hex; empty
+// skips the check) and rename the part file to path. A mismatch deletes
+// the part file.
+CORTEX_FFI_EXPORT bool cortex_download_commit(void* download, const char* expected_sha256);
+CORTEX_FFI_EXPORT const char* cortex_download_digest(void* download);  // "" until all is hashed
+
+namespace cortex {
+
+class ModelDownload {
+public:
+    static const int64_t MIN_CHUNK_BYTES = 1024 * 1024;
+    
+    ModelDownload(const std::string& path, int64_t total_bytes, int64_t chunk_bytes, const std::string& source);
+    ~ModelDownload();
+    
+    ModelDownload(const ModelDownload&) = delete;
+    ModelDownload& operator=(const ModelDownload&) = delete;
+    
+    std::string error() const;
+    const std::string& partPath() const { return part_path_; }
+    
+    int32_t nextChunk();
+    int64_t chunkOffset(int32_t index) const;
+    int64_t chunkSize(int32_t index) const;
+    bool write(int64_t offset, const uint8_t* data, size_t len);
+    void completeChunk(int32_t index);
+    void releaseChunk(int32_t index);
+    
+    int64_t doneBytes() const;
+    int64_t hashedBytes() const;
+    int64_t headerBytes() const;
+    std::string digest() const;
+    
+    bool commit(const std::string& expected_sha256);
+    
+    static void discard(const std::string& path);
+
+private:
+    enum ChunkState : uint8_t {
+        MISSING,
+        FETCHING,
+        WRITTEN,       // Completed, maybe still in the page cache only
+        SYNCED,        // On disk and in the manifest
+    };
+    
+    std::string path_;
+    std::string part_path_;
+    std::string manifest_path_;
+    std::string source_;
+    int64_t total_bytes_;
+    int64_t chunk_bytes_;
+    int fd_ = -1;
+    
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::thread worker_;
+    bool stop_ = false;
+    bool committed_ = false;
+    std::string error_;
+    
+    std::vector<ChunkState> chunks_;
+    int32_t next_hint_ = 0;        // No missing chunk below this one
+    int64_t done_bytes_ = 0;
+    
+    // Hash cursor, advanced by the worker over synced chunks in order
+    Sha256 hasher_;
+    int32_t hash_chunk_ = 0;
+    int64_t hashed_bytes_ = 0;
+    std::string hash_state_;       // hasher_ at hashed_bytes_, for the manifest
+    std::string digest_;
+    int64_t header_bytes_ = 0;
+    
+    void fail(const std::string& message);  // mutex_ held
+    bool openFile();
+    bool loadManifest();
+    std::string manifest() const;  // mutex_ held
+    void saveManifest(const std::string& contents) const;
+    bool hashable() const { return hash_chunk_ < static_cast<int32_t>(chunks_.size()) && chunks_[hash_chunk_] == SYNCED; }
+    bool hashChunk(int32_t index);
+    void syncWritten(std::unique_lock<std::mutex>& lock);
+    void stopWorker();
+    void run();
+};
+
+} // namespace cortex
@@ -0,0 +1,186 @@
+#include "model_loader.h"
+#include "memory_manager.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __ANDROID__
+    #include <android/log.h>
+    #define LOG_TAG "CortexLoader"
+    #define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+    #define LOGW(...) __android_log_print(ANDROID_LOG_WARN, LOG_TAG, __VA_ARGS__)
+#else
+    #define LOG_TAG "CortexLoader"
+    #define LOGI(...) printf("[INFO] " __VA_ARGS__); printf("\n")
+    #define LOGW(...) printf("[WARN] " __VA_ARGS__); printf("\n")
+#endif
+
+namespace cortex {
+
+static int64_t nowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static const char* stateName(LoadState state) {
+    switch (state) {
+        case LoadState::Loading:   return "loading";
+        case LoadState::Ready:     return "ready";
+        case LoadState::Failed:    return "failed";
+        case LoadState::Cancelled: return "cancelled";
+        default:                   return "idle";
+    }
+}
+
+std::string LoadProgress::toJson() const {
+    std::string escaped;
+    for (char c : error) {
+        if (c == '"' || c == '\\') escaped += '\\';
+        if (static_cast<unsigned char>(c) >= 0x20) escaped += c;
+    }
+    
+    char buf[512];
+    snprintf(buf, sizeof(buf),
+             "{\"state\":\"%s\",\"progress\":%.3f,\"prefetched\":%.3f,\"prefetching\":%s,"
+             "\"elapsed_ms\":%lld,\"error\":\"%s\"}",
+             stateName(state), progress, prefetched, prefetching ? "true" : "false",
+             static_cast<long long>(elapsed_ms), escaped.c_str());
+    return buf;
+}
+
+ModelLoader::~ModelLoader() {
+    wait();
+}
+
+bool ModelLoader::start(const std::string& path, LoadFunction load, const PrefetchConfig& prefetch) {
+    if (isLoading()) {
+        LOGW("load already in progress");
+        return false;
+    }
+    
+    // A finished worker (possibly still prefetching the previous model)
+    wait();
+    cancel_ = false;
+    
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        progress_ = LoadProgress();
+        progress_.state = LoadState::Loading;
+        progress_.path = path;
+        start_ms_ = nowMs();
+    }
+    
+    worker_ = std::thread(&ModelLoader::run, this, path, std::move(load), prefetch);
+    return true;
+}
+
+void ModelLoader::cancel() {
+    cancel_ = true;
+}
+
+void ModelLoader::wait() {
+    if (worker_.joinable()) {
+        cancel_ = true;
+        worker_.join();
+    }
+}
+
+bool ModelLoader::isLoading() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return progress_.state == LoadState::Loading;
+}
+
+LoadProgress ModelLoader::getProgress() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    LoadProgress progress = progress_;
+    if (progress.state == LoadState::Loading) {
+        progress.elapsed_ms = nowMs() - start_ms_;
+    }
+    return progress;
+}
+
+void ModelLoader::finish(LoadState state, const std::string& error) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    progress_.state = state;
+    progress_.error = error;
+    progress_.elapsed_ms = nowMs() - start_ms_;
+    if (state == LoadState::Ready) progress_.progress = 1.0f;
+}
+
+void ModelLoader::run(std::string path, LoadFunction load, PrefetchConfig prefetch_config) {
+    auto progress = [this](float value) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        progress_.progress = value;
+        return !cancel_.load();
+    };
+    
+    if (!load(path, progress)) {
+        finish(cancel_ ? LoadState::Cancelled : LoadState::Failed, cancel_ ? "cancelled" : "load failed");
+        LOGI("load of %s %s", path.c_str(), cancel_ ? "cancelled" : "failed");
+        return;
+    }
+    
+    finish(LoadState::Ready, "");
+    LOGI("model ready in %lld ms", static_cast<long long>(getProgress().elapsed_ms));
+    
+    prefetch(path, prefetch_config);
+}
+
+void ModelLoader::prefetch(const std::string& path, const PrefetchConfig& config) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return;
+    }
+    size_t size = st.st_size;
+    
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        progress_.prefetching = true;
+    }
+    
+    // Readahead fills the page cache that llama's mmap of the same file
+    // shares, which is what MADV_WILLNEED on that mapping would do, without
+    // needing its address. Chunks keep cancel and pressure checks prompt.
+    int64_t start_ms = nowMs();
+    size_t offset = 0;
+    MemoryManager& memMgr = MemoryManager::getInstance();
+    while (offset < size && !cancel_) {
+        if (config.stop_under_pressure && memMgr.getMemoryPressure() >= MemoryPressure::Medium) {
+            LOGW("prefetch stopped under memory pressure at %zu MB", offset / (1024 * 1024));
+            break;
+        }
+        
+        size_t len = std::min(config.chunk_bytes, size - offset);
+#ifdef __APPLE__
+        struct radvisory advice;
+        advice.ra_offset = static_cast<off_t>(offset);
+        advice.ra_count = static_cast<int>(len);
+        fcntl(fd, F_RDADVISE, &advice);
+#else
+        if (readahead(fd, offset, len) != 0) {
+            posix_fadvise(fd, static_cast<off_t>(offset), static_cast<off_t>(len), POSIX_FADV_WILLNEED);
+        }
+#endif
+        offset += len;
+        
+        std::lock_guard<std::mutex> lock(mutex_);
+        progress_.prefetched = static_cast<float>(offset) / size;
+    }
+    close(fd);
+    
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        progress_.prefetching = false;
+    }
+    LOGI("prefetched %zu of %zu MB in %lld ms", offset / (1024 * 1024), size / (1024 * 1024),
+         static_cast<long long>(nowMs() - start_ms));
+}
+
+} // namespace cortex
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace cortex {
+
+enum class LoadState {
+    Idle,
+    Loading,       // llama_model_load_from_file / context creation
+    Ready,         // Usable; the weight prefetch may still be running
+    Failed,
+    Cancelled,
+};
+
+struct LoadProgress {
+    LoadState state = LoadState::Idle;
+    std::string path;
+    float progress = 0;            // llama's load progress, [0, 1]
+    float prefetched = 0;          // Share of the file read ahead, [0, 1]
+    bool prefetching = false;
+    int64_t elapsed_ms = 0;        // Since start(), until Ready/Failed/Cancelled
+    std::string error;
+    
+    std::string toJson() const;
+};
+
+struct PrefetchConfig {
+    size_t chunk_bytes = 8 * 1024 * 1024;
+    bool stop_under_pressure = true;  // Stop at Medium memory pressure or worse
+};
+
+// Loads a model on a worker thread so the caller never blocks on it. The
+// load reports llama's progress and can be cancelled at any point. Once it
+// is usable the worker reads the weight file ahead into the page cache,
+// so the first prompt finds its pages resident instead of faulting them in
+// from flash one by one while the user types.
+class ModelLoader {
+public:
+    // Runs on the worker. Forward progress to llama and return false once
+    // it does; call progress(1) after the last step and undo the load if
+    // that returns false, so a late cancel leaves nothing behind.
+    using LoadFunction = std::function<bool(const std::string& path,
+                                            const std::function<bool(float)>& progress)>;
+    
+    ModelLoader() = default;
+    ~ModelLoader();
+    
+    ModelLoader(const ModelLoader&) = delete;
+    ModelLoader& operator=(const ModelLoader&) = delete;
+    
+    // False if a load is already running
+    bool start(const std::string& path, LoadFunction load, const PrefetchConfig& prefetch = {});
+    
+    // Aborts the load or the prefetch; returns immediately
+    void cancel();
+    
+    // Cancels and joins the worker; must not be called from load()
+    void wait();
+    
+    bool isLoading() const;
+    LoadProgress getProgress() const;
+
+private:
+    std::thread worker_;
+    std::atomic<bool> cancel_{false};
+    
+    mutable std::mutex mutex_;
+    LoadProgress progress_;
+    int64_t start_ms_ = 0;
+    
+    void run(std::string path, LoadFunction load, PrefetchConfig prefetch);
+    void prefetch(const std::string& path, const PrefetchConfig& config);
+    void finish(LoadState state, const std::string& error);
+};
+
+} // namespace cortex
@@ -0,0 +1,401 @@
+#include "model_preflight.h"
+#include "memory_manager.h"
+#include "gguf.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __ANDROID__
+    #include <android/log.h>
+    #define LOG_TAG "CortexPreflight"
+    #define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+    #define LOGW(...) __android_log_print(ANDROID_LOG_WARN, LOG_TAG, __VA_ARGS__)
+#else
+    #include <iostream>
+    #define LOG_TAG "CortexPreflight"
+    #define LOGI(...) printf("[INFO] " __VA_ARGS__); printf("\n")
+    #define LOGW(...) printf("[WARN] " __VA_ARGS__); printf("\n")
+#endif
+
+namespace cortex {
+
+namespace {
+
+constexpr size_t MB = 1024 * 1024;
+
+// llama.cpp rounds the KV cache up to this many cells
+constexpr int KV_CELL_PADDING = 256;
+
+// Graph metadata and allocator slack on top of the tensor estimate
+constexpr size_t COMPUTE_OVERHEAD = 8 * MB;
+
+// Integer metadata of any width; per-layer arrays (e.g. head_count_kv on
+// models with varying attention) report their largest element
+int64_t metaInt(const gguf_context* ctx, const std::string& key) {
+    int64_t id = gguf_find_key(ctx, key.c_str());
+    if (id < 0) return 0;
+    
+    switch (gguf_get_kv_type(ctx, id)) {
+        case GGUF_TYPE_UINT32: return gguf_get_val_u32(ctx, id);
+        case GGUF_TYPE_INT32:  return gguf_get_val_i32(ctx, id);
+        case GGUF_TYPE_UINT64: return static_cast<int64_t>(gguf_get_val_u64(ctx, id));
+        case GGUF_TYPE_INT64:  return gguf_get_val_i64(ctx, id);
+        case GGUF_TYPE_ARRAY: {
+            gguf_type type = gguf_get_arr_type(ctx, id);
+            size_t n = gguf_get_arr_n(ctx, id);
+            const void* data = gguf_get_arr_data(ctx, id);
+            int64_t max_value = 0;
+            for (size_t i = 0; i < n; i++) {
+                if (type == GGUF_TYPE_UINT32) {
+                    max_value = std::max<int64_t>(max_value, static_cast<const uint32_t*>(data)[i]);
+                } else if (type == GGUF_TYPE_INT32) {
+                    max_value = std::max<int64_t>(max_value, static_cast<const int32_t*>(data)[i]);
+                }
+            }
+            return max_value;
+        }
+        default:
+            return 0;
+    }
+}
+
+std::string metaString(const gguf_context* ctx, const char* key) {
+    int64_t id = gguf_find_key(ctx, key);
+    if (id < 0 || gguf_get_kv_type(ctx, id) != GGUF_TYPE_STRING) return "";
+    return gguf_get_val_str(ctx, id);
+}
+
+void appendString(std::string& out, const std::string& value) {
+    out += '"';
+    for (char c : value) {
+        switch (c) {
+            case '"':  out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            default:
+                if (static_cast<unsigned char>(c) >= 0x20) out += c;
+        }
+    }
+    out += '"';
+}
+
+// Bounds past which a header is taken to be garbage rather than a model
+constexpr uint64_t MAX_HEADER_COUNT = 1 << 24;    // KV pairs, tensors, array elements
+constexpr uint64_t MAX_HEADER_STRING = 1 << 24;   // Bytes
+constexpr uint32_t MAX_TENSOR_DIMS = 4;           // GGML_MAX_DIMS
+
+// Sequential reads over the first `limit` bytes of a file
+class HeaderReader {
+public:
+    enum Status { OK, SHORT, INVALID };
+    
+    HeaderReader(int fd, int64_t limit) : fd_(fd), limit_(limit) {}
+    
+    Status status() const { return status_; }
+    int64_t offset() const { return pos_; }
+    
+    bool read(void* out, size_t len) {
+        if (status_ != OK) return false;
+        if (pos_ + static_cast<int64_t>(len) > limit_) return fail(SHORT);
+        uint8_t* dst = static_cast<uint8_t*>(out);
+        while (len > 0) {
+            if (buf_pos_ == buf_len_ && !refill()) return false;
+            size_t take = std::min(len, buf_len_ - buf_pos_);
+            memcpy(dst, buffer_ + buf_pos_, take);
+            buf_pos_ += take;
+            pos_ += take;
+            dst += take;
+            len -= take;
+        }
+        return true;
+    }
+    
+    bool skip(uint64_t len) {
+        if (status_ != OK) return false;
+        if (len > static_cast<uint64_t>(limit_ - pos_)) return fail(SHORT);
+        size_t buffered = buf_len_ - buf_pos_;
+        if (len <= buffered) {
+            buf_pos_ += len;
+        } else {
+            buf_pos_ = buf_len_ = 0;
+            file_pos_ = pos_ + len;
+        }
+        pos_ += len;
+        return true;
+    }
+    
+    template <typename T>
+    bool value(T& out) { return read(&out, sizeof(T)); }
+    
+    bool count(uint64_t& out, uint64_t max) {
+        return value(out) && (out <= max || fail(INVALID));
+    }
+    
+    bool string() {
+        uint64_t len;
+        return count(len, MAX_HEADER_STRING) && skip(len);
+    }
+    
+    bool fail(Status status) {
+        if (status_ == OK) status_ = status;
+        return false;
+    }
+
+private:
+    int fd_;
+    int64_t limit_;
+    int64_t pos_ = 0;
+    int64_t file_pos_ = 0;         // File offset of buffer_[buf_len_]
+    uint8_t buffer_[64 * 1024];
+    size_t buf_pos_ = 0;
+    size_t buf_len_ = 0;
+    Status status_ = OK;
+    
+    bool refill() {
+        int64_t want = std::min<int64_t>(sizeof(buffer_), limit_ - file_pos_);
+        ssize_t n = want > 0 ? pread(fd_, buffer_, want, file_pos_) : 0;
+        if (n <= 0) return fail(SHORT);
+        buf_pos_ = 0;
+        buf_len_ = n;
+        file_pos_ += n;
+        return true;
+    }
+};
+
+// Fixed value sizes, indexed by gguf_type; 0 for strings and arrays
+size_t ggufValueBytes(uint32_t type) {
+    static const size_t SIZES[] = {1, 1, 2, 2, 4, 4, 4, 1, 0, 0, 8, 8, 8};
+    return type < sizeof(SIZES) / sizeof(SIZES[0]) ? SIZES[type] : 0;
+}
+
+bool skipValue(HeaderReader& reader, uint32_t type) {
+    if (type == GGUF_TYPE_STRING) return reader.string();
+    if (type == GGUF_TYPE_ARRAY) {
+        uint32_t elem_type;
+        uint64_t n;
+        if (!reader.value(elem_type) || !reader.count(n, MAX_HEADER_COUNT)) return false;
+        if (elem_type == GGUF_TYPE_STRING) {
+            for (uint64_t i = 0; i < n; i++) {
+                if (!reader.string()) return false;
+            }
+            return true;
+        }
+        size_t size = ggufValueBytes(elem_type);
+        return size > 0 ? reader.skip(n * size) : reader.fail(HeaderReader::INVALID);
+    }
+    size_t size = ggufValueBytes(type);
+    return size > 0 ? reader.skip(size) : reader.fail(HeaderReader::INVALID);
+}
+
+size_t kvCells(int n_ctx, int n_slots, int n_extra) {
+    int cells = n_ctx * std::max(1, n_slots) + std::max(0, n_extra);
+    return static_cast<size_t>((cells + KV_CELL_PADDING - 1) / KV_CELL_PADDING * KV_CELL_PADDING);
+}
+
+} // namespace
+
+bool readGGUFInfo(const std::string& path, GGUFInfo& info, std::string& error) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        error = "model file not found: " + path;
+        return false;
+    }
+    info.file_bytes = st.st_size;
+    
+    // no_alloc with no ggml context: header, metadata and tensor infos only
+    struct gguf_init_params params = { true, nullptr };
+    gguf_context* ctx = gguf_init_from_file(path.c_str(), params);
+    if (ctx == nullptr) {
+        error = "not a valid GGUF file: " + path;
+        return false;
+    }
+    
+    info.n_tensors = gguf_get_n_tensors(ctx);
+    info.weight_bytes = 0;
+    for (int64_t i = 0; i < info.n_tensors; i++) {
+        info.weight_bytes += gguf_get_tensor_size(ctx, i);
+    }
+    
+    info.architecture = metaString(ctx, "general.architecture");
+    info.name = metaString(ctx, "general.name");
+    const std::string& arch = info.architecture;
+    
+    info.n_ctx_train = metaInt(ctx, arch + ".context_length");
+    info.n_embd = metaInt(ctx, arch + ".embedding_length");
+    info.n_ff = metaInt(ctx, arch + ".feed_forward_length");
+    
+    int64_t tokens_id = gguf_find_key(ctx, "tokenizer.ggml.tokens");
+    info.n_vocab = tokens_id >= 0 ? gguf_get_arr_n(ctx, tokens_id) : 0;
+    
+    // Same fallbacks as KVCacheGeometry::fromModel, from the raw keys
+    int n_head = metaInt(ctx, arch + ".attention.head_count");
+    int n_head_kv = metaInt(ctx, arch + ".attention.head_count_kv");
+    int head_dim = n_head > 0 ? info.n_embd / n_head : 0;
+    int key_length = metaInt(ctx, arch + ".attention.key_length");
+    int value_length = metaInt(ctx, arch + ".attention.value_length");
+    
+    info.geometry.n_layer = metaInt(ctx, arch + ".block_count");
+    info.geometry.n_head_kv = n_head_kv > 0 ? n_head_kv : n_head;
+    info.geometry.head_dim_k = key_length > 0 ? key_length : head_dim;
+    info.geometry.head_dim_v = value_length > 0 ? value_length : head_dim;
+    
+    gguf_free(ctx);
+    
+    if (arch.empty() || info.geometry.n_layer <= 0 || info.geometry.head_dim_k <= 0) {
+        error = "GGUF metadata is missing the model hyperparameters";
+        return false;
+    }
+    return true;
+}
+
+int64_t scanGGUFHeader(int fd, int64_t available) {
+    HeaderReader reader(fd, available);
+    char magic[4];
+    uint32_t version;
+    uint64_t n_tensors, n_kv;
+    if (reader.read(magic, sizeof(magic)) && memcmp(magic, "GGUF", sizeof(magic)) != 0) {
+        return -1;
+    }
+    if (reader.value(version) && (version < 2 || version > 3)) {
+        return -1;
+    }
+    reader.count(n_tensors, MAX_HEADER_COUNT);
+    reader.count(n_kv, MAX_HEADER_COUNT);
+    
+    for (uint64_t i = 0; i < n_kv && reader.status() == HeaderReader::OK; i++) {
+        uint32_t type;
+        if (reader.string() && reader.value(type)) {
+            skipValue(reader, type);
+        }
+    }
+    for (uint64_t i = 0; i < n_tensors && reader.status() == HeaderReader::OK; i++) {
+        // name, n_dims, dims, type, offset
+        uint32_t n_dims;
+        if (reader.string() && reader.value(n_dims)) {
+            if (n_dims > MAX_TENSOR_DIMS) reader.fail(HeaderReader::INVALID);
+            reader.skip(n_dims * sizeof(int64_t) + sizeof(uint32_t) + sizeof(uint64_t));
+        }
+    }
+    
+    switch (reader.status()) {
+        case HeaderReader::OK:      return reader.offset();
+        case HeaderReader::SHORT:   return 0;
+        default:                    return -1;
+    }
+}
+
+size_t estimateComputeBytes(const GGUFInfo& info, int n_ubatch, int n_slots) {
+    // With flash attention no KQ matrix is stored, so the graph is bounded
+    // by the widest activations of one ubatch: the logits row, the FFN
+    // up/gate pair and a few residual-width tensors, all f32. Output logits
+    // are kept for the last token of every sequence.
+    size_t row = static_cast<size_t>(info.n_vocab) + 2 * info.n_ff + 4 * info.n_embd;
+    size_t graph = static_cast<size_t>(n_ubatch) * row * sizeof(float);
+    size_t output = static_cast<size_t>(info.n_vocab) * sizeof(float) * std::max(1, n_slots);
+    return graph + output + COMPUTE_OVERHEAD;
+}
+
+LoadPlan planModelLoad(const std::string& path, const PreflightConfig& config) {
+    LoadPlan plan;
+    if (!readGGUFInfo(path, plan.model, plan.reason)) {
+        LOGW("preflight: %s", plan.reason.c_str());
+        return plan;
+    }
+    
+    MemoryManager& memMgr = MemoryManager::getInstance();
+    plan.budget_bytes = memMgr.getAllocationBudget();
+    plan.kv_bytes_per_token = KVCache::bytesPerCell(plan.model.geometry, config.kv_type, config.kv_type);
+    
+    // Never beyond what the model was trained on
+    int max_context = config.max_context;
+    if (plan.model.n_ctx_train > 0) {
+        max_context = std::min(max_context, plan.model.n_ctx_train);
+    }
+    int min_context = std::min(config.min_context, max_context);
+    int n_slots = std::max(1, config.n_slots);
+    int n_seq = n_slots + std::max(0, config.extra_sequences);
+    
+    if (plan.model.weight_bytes >= plan.budget_bytes) {
+        char buf[256];
+        snprintf(buf, sizeof(buf), "weights need %zu MB but only %zu MB can be allocated",
+                 plan.model.weight_bytes / MB, plan.budget_bytes / MB);
+        plan.reason = buf;
+        LOGW("preflight: %s", buf);
+        return plan;
+    }
+    
+    // Context matters more than batch: take the largest context any batch
+    // allows, then the largest batch at that context
+    for (int batch = config.max_batch; batch >= config.min_batch; batch /= 2) {
+        int n_ubatch = std::min(batch, config.ubatch);
+        size_t compute = estimateComputeBytes(plan.model, n_ubatch, n_seq);
+        size_t fixed = plan.model.weight_bytes + compute + std::max(0, config.extra_cells) * plan.kv_bytes_per_token;
+        
+        // Tokens per slot that fit, as a power of 2
+        size_t fit = memMgr.getRecommendedContextSize(fixed, plan.kv_bytes_per_token * n_slots,
+                                                      static_cast<size_t>(max_context));
+        int context = static_cast<int>(fit);
+        if (context < min_context || context <= plan.context_length) {
+            continue;
+        }
+        
+        plan.ok = true;
+        plan.context_length = context;
+        plan.batch_size = batch;
+        plan.compute_bytes = compute;
+        plan.kv_bytes = kvCells(context, n_slots, config.extra_cells) * plan.kv_bytes_per_token;
+        plan.total_bytes = plan.model.weight_bytes + compute + plan.kv_bytes;
+        
+        if (context >= max_context) break;
+    }
+    
+    if (!plan.ok) {
+        int n_ubatch = std::min(config.min_batch, config.ubatch);
+        size_t compute = estimateComputeBytes(plan.model, n_ubatch, n_seq);
+        size_t kv = kvCells(min_context, n_slots, config.extra_cells) * plan.kv_bytes_per_token;
+        size_t needed = plan.model.weight_bytes + compute + kv;
+        
+        char buf[256];
+        snprintf(buf, sizeof(buf),
+                 "needs %zu MB at a %d-token context (weights %zu MB, KV %zu MB, compute %zu MB) "
+                 "but only %zu MB can be allocated",
+                 needed / MB, min_context, plan.model.weight_bytes / MB, kv / MB, compute / MB,
+                 plan.budget_bytes / MB);
+        plan.reason = buf;
+        LOGW("preflight: %s", buf);
+        return plan;
+    }
+    
+    LOGI("preflight: %s ctx=%d x %d batch=%d, weights %zu MB + KV %zu MB + compute %zu MB of %zu MB",
+         plan.model.architecture.c_str(), plan.context_length, n_slots, plan.batch_size,
+         plan.model.weight_bytes / MB, plan.kv_bytes / MB, plan.compute_bytes / MB,
+         plan.budget_bytes / MB);
+    return plan;
+}
+
+std::string LoadPlan::toJson() const {
+    std::string out = "{\"ok\":";
+    out += ok ? "true" : "false";
+    out += ",\"reason\":";
+    appendString(out, reason);
+    out += ",\"architecture\":";
+    appendString(out, model.architecture);
+    out += ",\"name\":";
+    appendString(out, model.name);
+    
+    char buf[512];
+    snprintf(buf, sizeof(buf),
+             ",\"file_bytes\":%zu,\"weight_bytes\":%zu,\"n_ctx_train\":%d,"
+             "\"n_layer\":%d,\"n_head_kv\":%d,\"head_dim\":%d,\"n_vocab\":%d,"
+             "\"context_length\":%d,\"batch_size\":%d,\"kv_bytes_per_token\":%zu,"
+             "\"kv_bytes\":%zu,\"compute_bytes\":%zu,\"total_bytes\":%zu,\"budget_bytes\":%zu}",
+             model.file_bytes, model.weight_bytes, model.n_ctx_train,
+             model.geometry.n_layer, model.geometry.n_head_kv, model.geometry.head_dim_k, model.n_vocab,
+             context_length, batch_size, kv_bytes_per_token,
+             kv_bytes, compute_bytes, total_bytes, budget_bytes);
+    out += buf;
+    return out;
+}
+
+} // namespace cortex
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "ggml.h"
+#include "kv_cache.h"
+
+namespace cortex {
+
+// Model facts from the GGUF header and metadata; no tensor data is read
+// and nothing is mapped
+struct GGUFInfo {
+    std::string architecture;
+    std::string name;
+    size_t file_bytes = 0;
+    size_t weight_bytes = 0;       // Sum of all tensor sizes
+    int64_t n_tensors = 0;
+    KVCacheGeometry geometry;
+    int n_ctx_train = 0;
+    int n_embd = 0;
+    int n_ff = 0;
+    int n_vocab = 0;
+};
+
+// Bounds for the load plan; the largest context and batch within them that
+// fit the memory budget are chosen
+struct PreflightConfig {
+    int max_context = 2048;        // Per conversation slot
+    int min_context = 256;
+    int max_batch = 256;
+    int min_batch = 32;
+    int ubatch = 32;               // Upper bound of the compute ubatch
+    int n_slots = 1;
+    int extra_cells = 0;           // Fixed-size sequences next to the slots (background sessions)
+    int extra_sequences = 0;
+    ggml_type kv_type = GGML_TYPE_F16;
+};
+
+struct LoadPlan {
+    bool ok = false;
+    std::string reason;            // Why the model does not fit
+    GGUFInfo model;
+    
+    int context_length = 0;        // Per slot
+    int batch_size = 0;
+    size_t kv_bytes_per_token = 0;
+    size_t kv_bytes = 0;
+    size_t compute_bytes = 0;
+    size_t total_bytes = 0;
+    size_t budget_bytes = 0;
+    
+    std::string toJson() const;
+};
+
+bool readGGUFInfo(const std::string& path, GGUFInfo& info, std::string& error);
+
+// Length of the GGUF header (metadata and tensor infos) of the file behind
+// fd, looking at its first `available` bytes only: 0 while those do not
+// cover the header yet, -1 when they are not GGUF. Lets a download check
+// the model once the header is in, long before the weights are.
+int64_t scanGGUFHeader(int fd, int64_t available);
+
+// llama.cpp's CPU compute and output buffers for one ubatch
+size_t estimateComputeBytes(const GGUFInfo& info, int n_ubatch, int n_slots);
+
+// Sizes the model against MemoryManager's allocation budget before
+// anything is loaded
+LoadPlan planModelLoad(const std::string& path, const PreflightConfig& config);
+
+} // namespace cortex
@@ -1,5 +1,13 @@
+#include "platform_channel.h"
+#include "cpu_backend.h"
+#include "gpu_offload.h"
 #include "inference_engine.h"
 #include "memory_manager.h"
+#include "model_cache.h"
+#include "model_loader.h"
+#include "model_preflight.h"
+#include <algorithm>
+#include <mutex>
 #include <thread>
 
 #ifdef __ANDROID__
@@ -15,17 +23,133 @@
 
 namespace cortex {
 
+// Models unloaded recently, kept for switching back; outlives the engine
+static ModelCache g_model_cache;
+
 // Global inference engine instance
 static std::unique_ptr<InferenceEngine> g_engine;
 
+// Why the last loadModel() failed, for the UI
+static std::string g_load_error;
+
+// Model unloaded under memory pressure; reloaded on next use
+static std::string g_suspended_path;
+
+// Both are written by loads (the loader's worker) and by reclaim (the
+// memory manager's worker) and read from any calling thread
+static std::mutex g_state_mutex;
+
+static void setLoadError(const std::string& error) {
+    std::lock_guard<std::mutex> lock(g_state_mutex);
+    g_load_error = error;
+}
+
+static std::string suspendedPath() {
+    std::lock_guard<std::mutex> lock(g_state_mutex);
+    return g_suspended_path;
+}
+
+static void setSuspendedPath(const std::string& path) {
+    std::lock_guard<std::mutex> lock(g_state_mutex);
+    g_suspended_path = path;
+}
+
+// Background loads started by startModelLoad()
+static ModelLoader g_loader;
+
+static size_t reclaimMemory(ReclaimStage stage);
+static void releaseModel();
+
 // Get or create the inference engine
 InferenceEngine* getEngine() {
     if (!g_engine) {
         g_engine = std::make_unique<InferenceEngine>();
+        g_engine->setModelCache(&g_model_cache);
+        MemoryManager::getInstance().setReclaimHandler(reclaimMemory);
     }
     return g_engine.get();
 }
 
+static size_t engineMemory() {
+    return g_engine->getModelMemoryUsage() + g_engine->getContextMemoryUsage();
+}
+
+// Re-register after the engine changed size so MemoryManager stays accurate
+static void updateRegisteredMemory(size_t model_before, size_t context_before) {
+    MemoryManager& memMgr = MemoryManager::getInstance();
+    memMgr.unregisterModelMemory(model_before);
+    memMgr.unregisterContextMemory(context_before);
+    memMgr.registerModelMemory(g_engine->getModelMemoryUsage());
+    memMgr.registerContextMemory(g_engine->getContextMemoryUsage());
+}
+
+static size_t reclaimMemory(ReclaimStage stage) {
+    // Idle models go before anything the active one uses
+    size_t parked = stage == ReclaimStage::DropCaches ? g_model_cache.clear() : 0;
+    if (!g_engine || !g_engine->isModelLoaded()) return parked;
+    
+    size_t model_before = g_engine->getModelMemoryUsage();
+    size_t context_before = g_engine->getContextMemoryUsage();
+    size_t before = model_before + context_before;
+    const InferenceConfig& config = g_engine->getConfig();
+    
+    switch (stage) {
+        case ReclaimStage::DropCaches:
+            return parked + g_engine->dropCaches();
+        
+        case ReclaimStage::ShrinkKV: {
+            // Half the window, and f16 K/V go to q8_0
+            int context = std::max(256, config.context_length / 2);
+            ggml_type kv_type = config.kv_type == GGML_TYPE_F16 ? GGML_TYPE_Q8_0 : config.kv_type;
+            // Already this small: the rebuild would re-decode the
+            // conversation and free nothing
+            if (context >= config.context_length && kv_type == config.kv_type && !g_engine->hasDraftModel()) {
+                return 0;
+            }
+            g_engine->shrinkContext(context, kv_type, config.ubatch_size);
+            break;
+        }
+        
+        case ReclaimStage::ReleaseCompute: {
+            // Compute buffers scale with the ubatch; prompts get slower
+            int ubatch = std::min(config.ubatch_size, 8);
+            if (ubatch == config.ubatch_size) return 0;
+            g_engine->shrinkContext(config.context_length, config.kv_type, ubatch);
+            break;
+        }
+        
+        case ReclaimStage::UnloadModel: {
+            std::string path = g_engine->getModelPath();
+            // The prefetch would only fault the weights back in
+            g_loader.cancel();
+            releaseModel();
+            // Unloading parks it; under this pressure it has to go
+            g_model_cache.clear();
+            setSuspendedPath(path);
+            LOGI("model unloaded under memory pressure, reloads on next use");
+            return before;
+        }
+        
+        default:
+            return 0;
+    }
+    
+    updateRegisteredMemory(model_before, context_before);
+    size_t after = engineMemory();
+    return before > after ? before - after : 0;
+}
+
+// A model unloaded under memory pressure comes back on next use; mmap and
+// the on-disk prefix cache keep that reload fast
+static bool ensureLoaded() {
+    if (g_engine && g_engine->isModelLoaded()) return true;
+    std::string path = suspendedPath();
+    if (path.empty()) return false;
+    
+    LOGI("reloading model unloaded under memory pressure");
+    return loadModel(path);
+}
+
 // create optimal config for mobile
 InferenceConfig createMobileConfig() {
     InferenceConfig config;
@@ -33,17 +157,36 @@ InferenceConfig createMobileConfig() {
     MemoryManager& memMgr = MemoryManager::getInstance();
     size_t availableMemory = memMgr.getAvailableMemory();
     
-    // use n_cores - 1 to leave one for os/ui
-    int hardware_threads = std::thread::hardware_concurrency();
-    config.threads = std::max(2, hardware_threads - 1);
+    // Decode stays on the prime/big cores, prefill may use more; see
+    // CpuTopology for the per-layout defaults
+    const CpuTopology& topology = CpuTopology::get();
+    config.threads = topology.defaultDecodeThreads();
+    config.threads_batch = topology.defaultPrefillThreads();
     
-    config.context_length = 256;
-    config.batch_size = 32;
+    // Upper bounds; loadModel() lowers them to what fits (see planLoad).
+    // q8_0 K/V takes about half of f16.
+    config.context_length = 2048;
+    config.kv_type = GGML_TYPE_Q8_0;
+    config.batch_size = 256;
+    // Wide enough for the dotprod/i8mm matmul kernels to pay off on
+    // prompts; the preflight drops it with the batch when memory is short
+    config.ubatch_size = 128;
     config.max_tokens = 256;
+    config.conversation_slots = 4;
+    
+    // Pin the first prompt, shift out 64 tokens at a time
+    config.n_keep = -1;
+    config.n_discard = 64;
     
     config.use_mmap = true;
     config.use_mlock = false;
+#ifdef __APPLE__
+    // Metal shares RAM with the CPU and wins on every layer; a tuned
+    // split still overrides this
+    config.gpu_layers = 999;
+#else
     config.gpu_layers = 0;
+#endif
     
     config.temperature = 0.7f;
     config.top_p = 0.9f;
@@ -51,53 +194,205 @@ InferenceConfig createMobileConfig() {
     config.repeat_penalty = 1.1f;
     config.repeat_last_n = 64;
     
-    LOGI("config: ctx=%d batch=%d threads=%d flash_attn=on kv=f16", 
-         config.context_length, config.batch_size, config.threads);
+    LOGI("config: ctx=%d batch=%d threads=%d/%d flash_attn=on kv=%s",
+         config.context_length, config.batch_size, config.threads, config.threads_batch,
+         ggml_type_name(config.kv_type));
     
     return config;
 }
 
 // Platform channel functions (called from JNI)
 
-bool loadModel(const std::string& modelPath) {
+static LoadPlan planLoad(const std::string& modelPath, const InferenceConfig& config) {
+    PreflightConfig preflight;
+    preflight.max_context = config.context_length;
+    preflight.max_batch = config.batch_size;
+    preflight.ubatch = config.ubatch_size;
+    preflight.n_slots = config.conversation_slots;
+    preflight.extra_sequences = config.background_sequences;
+    preflight.extra_cells = config.background_sequences * config.background_context;
+    preflight.kv_type = config.kv_type;
+    return planModelLoad(modelPath, preflight);
+}
+
+static bool loadModelWithProgress(const std::string& modelPath, const LoadProgressCallback& progress) {
     LOGI("loading: %s", modelPath.c_str());
     
     InferenceEngine* engine = getEngine();
     InferenceConfig config = createMobileConfig();
+    setLoadError("");
+    setSuspendedPath("");
     
-    // Check if we have enough memory based on available RAM
-    MemoryManager& memMgr = MemoryManager::getInstance();
-    // Estimate memory needed: small Q4 models need ~700MB, larger ones need more
-    // For now, require at least 600MB available (will be refined once model is loaded)
-    size_t estimated_mem = 600 * 1024 * 1024;  // 600 MB minimum
-    if (!memMgr.canAllocate(estimated_mem)) {
-        LOGE("Not enough memory to load model (need ~600MB)");
+    // The split the autotuner measured for this model on this GPU
+    int gpu_layers = 0;
+    int gpu_ubatch = 0;
+    if (loadGpuTune(modelPath, gpu_layers, gpu_ubatch)) {
+        config.gpu_layers = gpu_layers;
+        config.ubatch_size = gpu_ubatch;
+    }
+    if (config.gpu_layers > 0) {
+        LOGI("offloading %d layers to %s, ubatch %d", config.gpu_layers, gpuBackendName(), config.ubatch_size);
+    }
+    
+    // Size weights, KV cache and compute buffers from the GGUF header and
+    // refuse before anything is mapped if the minimum does not fit
+    LoadPlan plan = planLoad(modelPath, config);
+    if (!plan.ok || plan.context_length < config.context_length) {
+        // Idle models may be what is in the way; this one is kept since
+        // taking it from the cache is the cheapest load of all
+        int n_slots = std::max(1, config.conversation_slots);
+        int n_cells = config.context_length * n_slots + config.background_sequences * config.background_context;
+        size_t wanted = plan.model.weight_bytes +
+                        estimateComputeBytes(plan.model, config.ubatch_size, n_slots + config.background_sequences) +
+                        plan.kv_bytes_per_token * n_cells;
+        if (g_model_cache.makeRoom(wanted, modelPath) > 0) {
+            plan = planLoad(modelPath, config);
+        }
+    }
+    if (!plan.ok) {
+        LOGE("Not loading model: %s", plan.reason.c_str());
+        setLoadError(plan.reason);
         return false;
     }
+    config.context_length = plan.context_length;
+    config.batch_size = plan.batch_size;
     
-    bool success = engine->loadModel(modelPath, config);
+    MemoryManager& memMgr = MemoryManager::getInstance();
+    bool success = engine->loadModel(modelPath, config, progress);
     
     if (success) {
         // Register memory usage
         memMgr.registerModelMemory(engine->getModelMemoryUsage());
         memMgr.registerContextMemory(engine->getContextMemoryUsage());
+        memMgr.resetReclaim();
+        memMgr.setModelFile(modelPath);
+        
+        // Cancelled while the context was being created
+        if (progress && !progress(1.0f)) {
+            releaseModel();
+            setLoadError("cancelled");
+            return false;
+        }
+    } else {
+        setLoadError("llama.cpp failed to load the model");
     }
     
     return success;
 }
 
-void unloadModel() {
+bool loadModel(const std::string& modelPath) {
+    // Never two loads at once
+    g_loader.wait();
+    return loadModelWithProgress(modelPath, nullptr);
+}
+
+bool startModelLoad(const std::string& modelPath) {
+    getEngine();
+    return g_loader.start(modelPath, [](const std::string& path, const std::function<bool(float)>& progress) {
+        return loadModelWithProgress(path, progress);
+    });
+}
+
+void cancelModelLoad() {
+    g_loader.cancel();
+}
+
+std::string getLoadProgress() {
+    LoadProgress progress = g_loader.getProgress();
+    std::string error = getLoadError();
+    if (progress.state == LoadState::Failed && !error.empty()) {
+        progress.error = error;
+    }
+    return progress.toJson();
+}
+
+std::string preflightModel(const std::string& modelPath) {
+    return planLoad(modelPath, createMobileConfig()).toJson();
+}
+
+std::string getLoadError() {
+    std::lock_guard<std::mutex> lock(g_state_mutex);
+    return g_load_error;
+}
+
+static void releaseModel() {
     if (g_engine) {
         MemoryManager& memMgr = MemoryManager::getInstance();
         memMgr.unregisterModelMemory(g_engine->getModelMemoryUsage());
         memMgr.unregisterContextMemory(g_engine->getContextMemoryUsage());
+        memMgr.setModelFile("");
         
+        // The session ends with its final event before the model goes
+        g_engine->cancelSession(0);
         g_engine->unloadModel();
     }
 }
 
+void unloadModel() {
+    // Stops a load or prefetch in flight first
+    g_loader.wait();
+    releaseModel();
+    setSuspendedPath("");
+}
+
 bool isModelLoaded() {
-    return g_engine && g_engine->isModelLoaded();
+    // A suspended model counts as loaded; it comes back on the next request
+    return (g_engine && g_engine->isModelLoaded()) || !suspendedPath().empty();
+}
+
+void onTrimMemory(int level) {
+    MemoryManager::getInstance().onTrimMemory(level);
+}
+
+std::string getGpuInfo(const std::string& modelPath) {
+    // The CPU side as well: which ggml-cpu variant this core got
+    std::string out = "{\"cpu_variant\":\"";
+    out += cpuVariant();
+    out += "\",\"cpu_features\":\"";
+    out += cpuFeaturesString(detectCpuFeatures());
+    out += "\",\"compiled\":";
+    out += gpuBackendCompiled() ? "true" : "false";
+    out += ",\"backend\":\"";
+    out += gpuBackendName();
+    out += "\",\"devices\":[";
+    
+    char buf[512];
+    std::vector<GpuDevice> devices = listGpuDevices();
+    for (size_t i = 0; i < devices.size(); i++) {
+        snprintf(buf, sizeof(buf), "%s{\"name\":\"%s\",\"description\":\"%s\",\"integrated\":%s,"
+                 "\"memory_total_mb\":%zu}",
+                 i ? "," : "", devices[i].name.c_str(), devices[i].description.c_str(),
+                 devices[i].integrated ? "true" : "false", devices[i].memory_total / (1024 * 1024));
+        out += buf;
+    }
+    
+    int gpu_layers = 0;
+    int ubatch = 0;
+    bool tuned = !modelPath.empty() && loadGpuTune(modelPath, gpu_layers, ubatch);
+    int active = (g_engine && g_engine->isModelLoaded()) ? g_engine->getConfig().gpu_layers : 0;
+    snprintf(buf, sizeof(buf), "],\"tuned\":%s,\"gpu_layers\":%d,\"ubatch\":%d,\"active_gpu_layers\":%d}",
+             tuned ? "true" : "false", gpu_layers, ubatch, active);
+    out += buf;
+    return out;
+}
+
+std::string tuneGpuLayers(const std::string& modelPath) {
+    // Every split is loaded on its own; nothing else may hold the memory
+    unloadModel();
+    g_model_cache.clear();
+    
+    // Measured with the threads and K/V type the model will run with
+    InferenceConfig mobile = createMobileConfig();
+    GpuTuneConfig config;
+    config.cpu_ubatch = mobile.ubatch_size;
+    config.threads = mobile.threads;
+    config.threads_batch = mobile.threads_batch;
+    config.kv_type = mobile.kv_type;
+    GpuTuneResult result = cortex::tuneGpuLayers(modelPath, config);
+    if (result.ok && !saveGpuTune(modelPath, result)) {
+        LOGE("failed to save the GPU tune for %s", modelPath.c_str());
+    }
+    return result.toJson();
 }
 
 std::string getModelInfo() {
@@ -105,72 +400,144 @@ std::string getModelInfo() {
     return g_engine->getModelInfo();
 }
 
-bool startGeneration(const std::string& prompt, float temperature, float top_p, 
-                     int top_k, int max_tokens) {
-    if (!g_engine || !g_engine->isModelLoaded()) {
-        LOGE("Cannot generate: model not loaded");
+bool loadDraftModel(const std::string& modelPath) {
+    LOGI("loading draft: %s", modelPath.c_str());
+    
+    // Draft models are tiny (SmolLM 135M is ~150MB), keep the same safety margin
+    MemoryManager& memMgr = MemoryManager::getInstance();
+    size_t estimated_mem = 200 * 1024 * 1024;
+    if (!memMgr.canAllocate(estimated_mem)) {
+        LOGE("Not enough memory to load draft model (need ~200MB)");
         return false;
     }
     
+    return getEngine()->loadDraftModel(modelPath);
+}
+
+void unloadDraftModel() {
+    if (g_engine) {
+        g_engine->unloadDraftModel();
+    }
+}
+
+bool hasDraftModel() {
+    return g_engine && g_engine->hasDraftModel();
+}
+
+static std::string statsToJson(const GenerationStats& stats, const char* error = nullptr);
+
+static const char* finishReasonName(FinishReason reason) {
+    switch (reason) {
+        case FinishReason::Eos: return "eos";
+        case FinishReason::Length: return "length";
+        case FinishReason::Stopped: return "stopped";
+        case FinishReason::Error: return "error";
+        default: return "none";
+    }
+}
+
+static InferenceConfig sessionConfig(float temperature, float top_p, int top_k, int max_tokens,
+                                     const std::string& grammar, const std::string& json_schema) {
     InferenceConfig config = createMobileConfig();
-    
-    // Override with user settings
     config.temperature = temperature;
     config.top_p = top_p;
     config.top_k = top_k;
     config.max_tokens = max_tokens;
-    
-    LOGI("generation: temp=%.2f top_p=%.2f top_k=%d",
-         temperature, top_p, top_k);
-    
-    return g_engine->startInference(prompt, config);
+    config.grammar = grammar;
+    config.json_schema = json_schema;
+    return config;
 }
 
-bool startGenerationIncremental(const std::string& prompt, float temperature, float top_p, 
-                                int top_k, int max_tokens) {
-    if (!g_engine || !g_engine->isModelLoaded()) {
+static int64_t startSession(SessionRequest request, SessionCallback callback, bool background = false) {
+    if (!callback) {
+        return -1;
+    }
+    if (!ensureLoaded()) {
         LOGE("model not loaded");
-        return false;
+        return -1;
     }
     
-    InferenceConfig config = createMobileConfig();
-    config.temperature = temperature;
-    config.top_p = top_p;
-    config.top_k = top_k;
-    config.max_tokens = max_tokens;
+    // Fail here rather than as an error event once the session runs
+    std::string grammar_error;
+    if (!g_engine->checkGrammar(request.config, grammar_error)) {
+        LOGE("session grammar rejected: %s", grammar_error.c_str());
+        return -1;
+    }
+    
+    LOGI("session: temp=%.2f top_p=%.2f top_k=%d%s%s%s", request.config.temperature,
+         request.config.top_p, request.config.top_k, request.speculative ? " speculative" : "",
+         background ? " background" : "",
+         request.config.grammar.empty() && request.config.json_schema.empty() ? "" : " constrained");
     
-    return g_engine->startInferenceIncremental(prompt, config);
+    SessionSink sink = [callback](const SessionEvent& event) {
+        switch (event.type) {
+            case SessionEventType::Token:
+                callback(event.session, SESSION_TOKEN, event.text);
+                break;
+            case SessionEventType::Done:
+                callback(event.session, SESSION_DONE, statsToJson(event.stats));
+                break;
+            case SessionEventType::Error:
+                callback(event.session, SESSION_ERROR, statsToJson(event.stats, event.text.c_str()));
+                break;
+        }
+    };
+    return background ? g_engine->startBackgroundSession(std::move(request), std::move(sink))
+                      : g_engine->startSession(std::move(request), std::move(sink));
 }
 
-bool startGenerationTurbo(const std::string& prompt) {
-    if (!g_engine || !g_engine->isModelLoaded()) {
-        LOGE("model not loaded");
-        return false;
+int64_t startChatSession(const std::vector<std::string>& roles, const std::vector<std::string>& contents,
+                         float temperature, float top_p, int top_k, int max_tokens,
+                         const std::string& grammar, const std::string& json_schema,
+                         bool speculative, SessionCallback callback) {
+    if (roles.empty() || roles.size() != contents.size()) {
+        LOGE("chat roles and contents missing or of different length");
+        return -1;
     }
     
-    InferenceConfig config = createMobileConfig();
-    config.temperature = 0.7f;
-    config.top_k = 40;
-    config.top_p = 0.9f;
-    config.repeat_penalty = 1.1f;
-    config.repeat_last_n = 64;
-    config.max_tokens = 256;
-    
-    return g_engine->startInferenceIncremental(prompt, config);
+    SessionRequest request;
+    request.turns.reserve(roles.size());
+    for (size_t i = 0; i < roles.size(); i++) {
+        request.turns.push_back({roles[i], contents[i]});
+    }
+    request.speculative = speculative;
+    request.config = sessionConfig(temperature, top_p, top_k, max_tokens, grammar, json_schema);
+    return startSession(std::move(request), std::move(callback));
 }
 
-std::string getNextTokensBatch(int count) {
-    // OPTIMIZATION: Return concatenated string instead of vector
-    // This reduces JNI overhead by avoiding jobjectArray creation
-    if (!g_engine) return "";
+int64_t startPromptSession(const std::string& prompt, bool incremental, float temperature, float top_p,
+                           int top_k, int max_tokens, const std::string& grammar,
+                           const std::string& json_schema, bool speculative, SessionCallback callback) {
+    SessionRequest request;
+    request.prompt = prompt;
+    request.incremental = incremental;
+    request.speculative = speculative;
+    request.config = sessionConfig(temperature, top_p, top_k, max_tokens, grammar, json_schema);
+    return startSession(std::move(request), std::move(callback));
+}
+
+int64_t startBackgroundSession(const std::vector<std::string>& roles, const std::vector<std::string>& contents,
+                               const std::string& prompt, float temperature, float top_p, int top_k,
+                               int max_tokens, const std::string& grammar, const std::string& json_schema,
+                               SessionCallback callback) {
+    if (roles.size() != contents.size() || (roles.empty() && prompt.empty())) {
+        LOGE("background session needs chat turns or a prompt");
+        return -1;
+    }
     
-    std::vector<std::string> tokens = g_engine->getNextTokens(count);
-    std::string result;
-    result.reserve(count * 8);  // Pre-allocate
-    for (const auto& token : tokens) {
-        result += token;
+    SessionRequest request;
+    for (size_t i = 0; i < roles.size(); i++) {
+        request.turns.push_back({roles[i], contents[i]});
+    }
+    request.prompt = prompt;
+    request.config = sessionConfig(temperature, top_p, top_k, max_tokens, grammar, json_schema);
+    return startSession(std::move(request), std::move(callback), true);
+}
+
+void cancelSession(int64_t session) {
+    if (g_engine) {
+        g_engine->cancelSession(session);
     }
-    return result;
 }
 
 void clearCache() {
@@ -184,46 +551,105 @@ int getCachedTokenCount() {
     return g_engine->getCachedTokenCount();
 }
 
-std::string getNextToken() {
-    if (!g_engine) return "";
-    return g_engine->getNextToken();
+int selectConversation(int64_t conversationId) {
+    if (!g_engine) return -1;
+    return g_engine->selectConversation(conversationId);
+}
+
+bool forkConversation(int64_t srcId, int64_t dstId) {
+    if (!g_engine) return false;
+    return g_engine->forkConversation(srcId, dstId);
 }
 
-std::vector<std::string> getNextTokens(int count) {
-    if (!g_engine) return {};
-    return g_engine->getNextTokens(count);
+void releaseConversation(int64_t conversationId) {
+    if (g_engine) {
+        g_engine->releaseConversation(conversationId);
+    }
 }
 
 bool isGenerating() {
-    return g_engine && g_engine->isGenerating();
+    return g_engine && g_engine->activeSession() != 0;
 }
 
 void stopGeneration() {
-    if (g_engine) {
-        g_engine->stopGeneration();
-    }
+    cancelSession(0);
 }
 
-std::string getStats() {
-    if (!g_engine) return "{}";
+std::string runBenchmark(const std::vector<int>& promptLengths, const std::vector<int>& decodeDepths,
+                         int decodeTokens, const std::vector<int>& threadCounts,
+                         const std::vector<int>& ubatchSizes, int warmup, int repetitions) {
+    if (!g_engine || !g_engine->isModelLoaded()) {
+        return "{\"error\":\"No model loaded\"}";
+    }
     
-    GenerationStats stats = g_engine->getStats();
+    // Empty lists keep the defaults
+    BenchmarkConfig config;
+    if (!promptLengths.empty()) config.prompt_lengths = promptLengths;
+    if (!decodeDepths.empty()) config.decode_depths = decodeDepths;
+    if (decodeTokens > 0) config.decode_tokens = decodeTokens;
+    config.thread_counts = threadCounts;
+    if (!ubatchSizes.empty()) config.ubatch_sizes = ubatchSizes;
+    config.warmup = std::max(0, warmup);
+    if (repetitions > 0) config.repetitions = repetitions;
+    
+    return g_engine->runBenchmark(config);
+}
+
+static std::string statsToJson(const GenerationStats& stats, const char* error) {
+    // Error strings are the engine's own fixed messages; nothing to escape
+    std::string error_field;
+    if (error != nullptr) {
+        error_field = std::string(",\"error\":\"") + error + "\"";
+    }
     
     // Return as simple JSON
-    char buffer[512];
+    char buffer[1024];
     snprintf(buffer, sizeof(buffer),
         "{\"prompt_tokens\":%lld,\"generated_tokens\":%lld,"
         "\"prompt_time_ms\":%.2f,\"eval_time_ms\":%.2f,"
-        "\"tokens_per_second\":%.2f}",
+        "\"prefill_done\":%d,\"prefill_total\":%d,"
+        "\"tokens_per_second\":%.2f,"
+        "\"draft_tokens\":%lld,\"accepted_tokens\":%lld,"
+        "\"acceptance_rate\":%.3f,\"cached_tokens\":%lld,"
+        "\"thermal_level\":%d,\"thermal_status\":%d,\"thermal_headroom\":%.2f,"
+        "\"decode_latency_ms\":%.2f,\"decode_threads\":%d,"
+        "\"finish_reason\":\"%s\"%s}",
         static_cast<long long>(stats.prompt_tokens),
         static_cast<long long>(stats.generated_tokens),
         stats.prompt_eval_time_ms,
         stats.eval_time_ms,
-        stats.tokens_per_second);
+        stats.prefill_done,
+        stats.prefill_total,
+        stats.tokens_per_second,
+        static_cast<long long>(stats.draft_tokens),
+        static_cast<long long>(stats.accepted_tokens),
+        stats.acceptance_rate,
+        static_cast<long long>(stats.cached_tokens),
+        stats.thermal_level,
+        stats.thermal_status,
+        stats.thermal_headroom,
+        stats.decode_latency_ms,
+        stats.decode_threads,
+        finishReasonName(stats.finish_reason),
+        error_field.c_str());
     
     return std::string(buffer);
 }
 
+std::string getStats() {
+    if (!g_engine) return "{}";
+    // Stage histograms since the last resetStats, next to the totals
+    std::string json = statsToJson(g_engine->getStats());
+    json.pop_back();
+    json += ",\"latency\":" + LatencyTrace::getInstance().toJson() + "}";
+    return json;
+}
+
+void setThermalState(int status, float headroom) {
+    // Creates the engine so state reported before the first load is kept
+    getEngine()->setThermalState(status, headroom);
+}
+
 std::string getMemoryInfo() {
     MemoryManager& memMgr = MemoryManager::getInstance();
     MemoryStats stats = memMgr.getMemoryStats();
@@ -237,16 +663,53 @@ std::string getMemoryInfo() {
         default: pressureStr = "unknown";
     }
     
-    char buffer[512];
+    // KV cache of the loaded model, sized from its layer/head layout
+    KVCacheStats kv;
+    const char* kvType = "none";
+    if (g_engine && g_engine->isModelLoaded()) {
+        kv = g_engine->getKVCacheStats();
+        kvType = ggml_type_name(g_engine->getKVCacheType());
+    }
+    
+    ModelCacheStats cache = g_model_cache.getStats();
+    
+    char buffer[1280];
     snprintf(buffer, sizeof(buffer),
         "{\"total_mb\":%zu,\"available_mb\":%zu,\"used_mb\":%zu,"
-        "\"model_mb\":%zu,\"context_mb\":%zu,\"pressure\":\"%s\"}",
+        "\"model_mb\":%zu,\"context_mb\":%zu,\"pressure\":\"%s\","
+        "\"rss_mb\":%zu,\"pss_mb\":%zu,\"model_resident_mb\":%zu,"
+        "\"psi_some_avg10\":%.2f,\"psi_full_avg10\":%.2f,\"psi_events\":%lld,"
+        "\"sample_age_ms\":%lld,"
+        "\"kv_type\":\"%s\",\"kv_cells\":%zu,\"kv_used_cells\":%zu,"
+        "\"kv_bytes_per_token\":%zu,\"kv_allocated_mb\":%.2f,\"kv_used_mb\":%.2f,"
+        "\"reclaim_stage\":%d,\"suspended\":%s,"
+        "\"cached_models\":%d,\"cached_model_mb\":%zu,\"model_cache_hits\":%lld,"
+        "\"model_cache_misses\":%lld}",
         stats.total_memory / (1024 * 1024),
         stats.available_memory / (1024 * 1024),
         stats.used_memory / (1024 * 1024),
         stats.model_memory / (1024 * 1024),
         stats.context_memory / (1024 * 1024),
-        pressureStr);
+        pressureStr,
+        stats.rss / (1024 * 1024),
+        stats.pss / (1024 * 1024),
+        stats.model_resident / (1024 * 1024),
+        stats.psi_some_avg10,
+        stats.psi_full_avg10,
+        static_cast<long long>(stats.psi_events),
+        static_cast<long long>(stats.sample_age_ms),
+        kvType,
+        kv.total_cells,
+        kv.used_cells,
+        kv.bytes_per_cell,
+        kv.allocated_bytes / (1024.0 * 1024.0),
+        kv.memory_bytes / (1024.0 * 1024.0),
+        static_cast<int>(memMgr.getReclaimStage()),
+        suspendedPath().empty() ? "false" : "true",
+        cache.models,
+        cache.bytes / (1024 * 1024),
+        static_cast<long long>(cache.hits),
+        static_cast<long long>(cache.misses));
     
     return std::string(buffer);
 }
@@ -263,37 +726,4 @@ void resetStats() {
     }
 }
 
-bool startGenerationThreaded(const std::string& prompt, float temperature, float top_p,
-                             int top_k, int max_tokens) {
-    if (!g_engine || !g_engine->isModelLoaded()) {
-        LOGE("model not loaded");
-        return false;
-    }
-    
-    InferenceConfig config = createMobileConfig();
-    config.temperature = temperature;
-    config.top_p = top_p;
-    config.top_k = top_k;
-    config.max_tokens = max_tokens;
-    
-    return g_engine->startInferenceThreaded(prompt, config);
-}
-
-std::string getBufferedTokens() {
-    if (!g_engine) return "";
-    return g_engine->popTokenFromQueue();
-}
-
-void setTokenCallback(std::function<void(const std::string&)> callback) {
-    if (g_engine) {
-        g_engine->setTokenCallback(callback);
-    }
-}
-
-void clearTokenCallback() {
-    if (g_engine) {
-        g_engine->clearTokenCallback();
-    }
-}
-
 } // namespace cortex
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <functional>
@@ -7,36 +8,82 @@
 namespace cortex {
 
 // Model loading
-bool loadModel(const std::string& modelPath);
+bool loadModel(const std::string& modelPath);  // Context and batch sized by the GGUF preflight
+std::string preflightModel(const std::string& modelPath);  // Load plan JSON, nothing is loaded
+std::string getLoadError();  // Reason the last loadModel() failed
+
+// Background load with progress and weight prefetch; poll getLoadProgress()
+bool startModelLoad(const std::string& modelPath);  // False if a load is running
+void cancelModelLoad();
+std::string getLoadProgress();  // JSON, see LoadProgress
 void unloadModel();
 bool isModelLoaded();
+void onTrimMemory(int level);  // ComponentCallbacks2 level; runs the staged reclaim
 std::string getModelInfo();
 
-// Text generation
-bool startGeneration(const std::string& prompt, float temperature, float top_p, 
-                     int top_k, int max_tokens);
-bool startGenerationIncremental(const std::string& prompt, float temperature, float top_p, 
-                                int top_k, int max_tokens);  // KV cache reuse
-bool startGenerationTurbo(const std::string& prompt);  // Multi-threaded with quality sampling
-bool startGenerationThreaded(const std::string& prompt, float temperature, float top_p,
-                             int top_k, int max_tokens);  // Multi-threaded generation
-std::string getNextToken();
-std::vector<std::string> getNextTokens(int count = 4);  // Batch token decoding
-std::string getNextTokensBatch(int count);  // Returns concatenated string for speed
-std::string getBufferedTokens();  // Get tokens from threaded generation buffer
-bool isGenerating();
-void stopGeneration();
-
-// Threaded generation callbacks
-void setTokenCallback(std::function<void(const std::string&)> callback);
-void clearTokenCallback();
+// Backends: the CPU variant and features, the compiled GPU backend, its
+// devices and the tuned split for a model
+std::string getGpuInfo(const std::string& modelPath);  // JSON
+std::string tuneGpuLayers(const std::string& modelPath);  // Unloads, measures splits, saves the best; JSON
+
+// Draft model for speculative decoding
+bool loadDraftModel(const std::string& modelPath);
+void unloadDraftModel();
+bool hasDraftModel();
+
+// Generation sessions. The engine's generation thread pushes events to the
+// callback as they happen: SESSION_TOKEN carries UTF-8 text, then exactly
+// one SESSION_DONE (data: stats JSON, see getStats) or SESSION_ERROR (the
+// same JSON plus "error"). Starting a session ends the running one.
+enum SessionEventKind {
+    SESSION_TOKEN = 0,
+    SESSION_DONE = 1,
+    SESSION_ERROR = 2,
+};
+using SessionCallback = std::function<void(int64_t session, int type, const std::string& data)>;
+
+// Return the session handle, or -1 when no model is loaded or the grammar
+// does not compile. grammar is GBNF, json_schema a JSON Schema the output
+// has to follow (it wins over grammar); empty: unconstrained.
+int64_t startChatSession(const std::vector<std::string>& roles, const std::vector<std::string>& contents,
+                         float temperature, float top_p, int top_k, int max_tokens,
+                         const std::string& grammar, const std::string& json_schema,
+                         bool speculative, SessionCallback callback);  // Rendered with the model's chat template
+int64_t startPromptSession(const std::string& prompt, bool incremental, float temperature, float top_p,
+                           int top_k, int max_tokens, const std::string& grammar,
+                           const std::string& json_schema, bool speculative,
+                           SessionCallback callback);  // Incremental: continue the cached sequence
+// Runs next to the foreground session on its own KV sequence (turns, or
+// the raw prompt when there are none); -1 when all background sequences
+// are busy. Events come the same way, from the same thread.
+int64_t startBackgroundSession(const std::vector<std::string>& roles, const std::vector<std::string>& contents,
+                               const std::string& prompt, float temperature, float top_p, int top_k,
+                               int max_tokens, const std::string& grammar, const std::string& json_schema,
+                               SessionCallback callback);
+void cancelSession(int64_t session);  // 0: whichever runs; waits for its final event
+bool isGenerating();  // A session is queued or running
+void stopGeneration();  // cancelSession(0)
 
 // Cache management
 void clearCache();
 int getCachedTokenCount();
 
-// Statistics
+// Conversation slots (one KV sequence per conversation)
+int selectConversation(int64_t conversationId);  // Cached tokens, -1 on error
+bool forkConversation(int64_t srcId, int64_t dstId);
+void releaseConversation(int64_t conversationId);
+
+// Benchmark sweep, JSON results (see benchmark.h)
+std::string runBenchmark(const std::vector<int>& promptLengths, const std::vector<int>& decodeDepths,
+                         int decodeTokens, const std::vector<int>& threadCounts,
+                         const std::vector<int>& ubatchSizes, int warmup, int repetitions);
+
+// Statistics. getStats adds "latency": per-stage histograms (queue,
+// prefill, decode, sample, detokenize, deliver, jni, first_token,
+// token_gap) with count, p50/p90/p99, mean and max in ms; resetStats
+// clears them too.
 std::string getStats();
+void setThermalState(int status, float headroom);  // PowerManager status, headroom < 0 if unknown
 void resetStats();
 std::string getMemoryInfo();
 long getMemoryUsage();
@@ -0,0 +1,432 @@
+#include "prefix_cache.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __ANDROID__
+    #include <android/log.h>
+    #define LOG_TAG "CortexPrefixCache"
+    #define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+    #define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+    #define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
+    #define LOGW(...) __android_log_print(ANDROID_LOG_WARN, LOG_TAG, __VA_ARGS__)
+#else
+    #include <iostream>
+    #define LOG_TAG "CortexPrefixCache"
+    #define LOGI(...) printf("[INFO] " __VA_ARGS__); printf("\n")
+    #define LOGE(...) printf("[ERROR] " __VA_ARGS__); printf("\n")
+    #define LOGD(...) printf("[DEBUG] " __VA_ARGS__); printf("\n")
+    #define LOGW(...) printf("[WARN] " __VA_ARGS__); printf("\n")
+#endif
+
+namespace cortex {
+
+// On-disk entry layout: header, model key, tokens, then the llama seq
+// state blob. Version 1 files carried no key and are dropped on index.
+constexpr uint32_t PREFIX_FILE_MAGIC = 0x43505843;  // "CXPC"
+constexpr uint32_t PREFIX_FILE_VERSION = 2;
+constexpr size_t MAX_DISK_ENTRIES = 32;
+constexpr uint32_t MAX_KEY_SIZE = 4096;
+
+struct PrefixFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t n_tokens;
+    uint32_t key_size;
+    uint64_t state_size;
+};
+
+static uint64_t hashKey(const std::string& key) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (unsigned char c : key) {
+        hash ^= c;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+PrefixCache::PrefixCache() {
+    LOGD("PrefixCache created");
+}
+
+PrefixCache::~PrefixCache() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        writer_stop_ = true;
+    }
+    write_cv_.notify_all();
+    if (writer_thread_.joinable()) {
+        writer_thread_.join();
+    }
+    LOGD("PrefixCache destroyed");
+}
+
+uint64_t PrefixCache::hashTokens(const llama_token* tokens, size_t n_tokens) {
+    // FNV-1a over the raw token ids
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(tokens);
+    for (size_t i = 0; i < n_tokens * sizeof(llama_token); i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+void PrefixCache::attach(const std::string& model_key, const PrefixCacheConfig& config) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    
+    model_key_ = model_key;
+    key_hash_ = hashKey(model_key);
+    config_ = config;
+    
+    if (!config_.disk_dir.empty()) {
+        // Create the cache directory (parent first)
+        size_t slash = config_.disk_dir.find_last_of('/');
+        if (slash != std::string::npos && slash > 0) {
+            mkdir(config_.disk_dir.substr(0, slash).c_str(), 0755);
+        }
+        if (mkdir(config_.disk_dir.c_str(), 0755) != 0 && errno != EEXIST) {
+            LOGW("Cannot create prefix cache dir %s, persistence disabled", config_.disk_dir.c_str());
+            config_.disk_dir.clear();
+        } else {
+            indexDisk();
+        }
+        
+        if (!writer_thread_.joinable()) {
+            writer_thread_ = std::thread(&PrefixCache::writerThreadFunc, this);
+        }
+    }
+    
+    evictToBudget();
+    LOGI("Prefix cache attached: %zu entries, %zu MB in memory",
+         entries_.size(), memory_bytes_ / (1024 * 1024));
+}
+
+void PrefixCache::rekey(const std::string& model_key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    model_key_ = model_key;
+    key_hash_ = hashKey(model_key);
+}
+
+int PrefixCache::restore(llama_context* ctx, const std::vector<llama_token>& tokens, llama_seq_id seq_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    
+    if (ctx == nullptr || tokens.size() < 2) return 0;
+    
+    // Longest common prefix among this model's entries
+    auto best = entries_.end();
+    size_t best_len = 0;
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+        const Entry& entry = **it;
+        if (entry.model_key != model_key_) continue;
+        
+        size_t n = std::min(entry.tokens.size(), tokens.size());
+        size_t i = 0;
+        while (i < n && entry.tokens[i] == tokens[i]) i++;
+        if (i > best_len) {
+            best_len = i;
+            best = it;
+        }
+    }
+    
+    if (best == entries_.end() || best_len < static_cast<size_t>(config_.min_prefix_tokens)) {
+        stats_.misses++;
+        return 0;
+    }
+    
+    // Most recently used first, so eviction below keeps this entry
+    entries_.splice(entries_.begin(), entries_, best);
+    Entry& entry = *entries_.front();
+    
+    // An entry that cannot be restored never will be; dropping it lets
+    // store() put a fresh one in its place
+    if (entry.state.empty()) {
+        if (!loadState(entry)) {
+            erase(entries_.begin());
+            stats_.misses++;
+            return 0;
+        }
+        evictToBudget();
+    }
+    
+    if (llama_state_seq_set_data(ctx, entry.state.data(), entry.state.size(), seq_id) == 0) {
+        LOGW("Failed to restore prefix state (%zu tokens), dropping it", entry.tokens.size());
+        erase(entries_.begin());
+        stats_.misses++;
+        return 0;
+    }
+    
+    // Trim to the shared part, always leaving one token for fresh logits
+    int n_restored = static_cast<int>(std::min(best_len, tokens.size() - 1));
+    llama_memory_t mem = llama_get_memory(ctx);
+    if (mem != nullptr && !llama_memory_seq_rm(mem, seq_id, n_restored, -1)) {
+        llama_memory_seq_rm(mem, seq_id, -1, -1);
+        stats_.misses++;
+        return 0;
+    }
+    
+    stats_.hits++;
+    stats_.tokens_reused += n_restored;
+    LOGD("Restored %d/%zu prompt tokens from prefix cache", n_restored, tokens.size());
+    return n_restored;
+}
+
+void PrefixCache::store(llama_context* ctx, const std::vector<llama_token>& tokens, llama_seq_id seq_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    
+    if (ctx == nullptr || static_cast<int>(tokens.size()) < config_.min_prefix_tokens) return;
+    
+    // An identical entry only needs a refresh; shorter entries it extends
+    // are superseded since restore() trims to the common prefix anyway
+    for (auto it = entries_.begin(); it != entries_.end();) {
+        Entry& entry = **it;
+        if (entry.model_key == model_key_ && entry.tokens.size() <= tokens.size() &&
+            std::equal(entry.tokens.begin(), entry.tokens.end(), tokens.begin())) {
+            if (entry.tokens.size() == tokens.size()) {
+                entries_.splice(entries_.begin(), entries_, it);
+                return;
+            }
+            erase(it++);
+            continue;
+        }
+        ++it;
+    }
+    
+    size_t size = llama_state_seq_get_size(ctx, seq_id);
+    if (size == 0 || size > config_.memory_budget) return;
+    
+    auto entry = std::make_shared<Entry>();
+    entry->model_key = model_key_;
+    entry->tokens = tokens;
+    entry->hash = hashTokens(tokens.data(), tokens.size()) ^ key_hash_;
+    entry->state.resize(size);
+    size_t written = llama_state_seq_get_data(ctx, entry->state.data(), size, seq_id);
+    if (written == 0) {
+        LOGW("Failed to snapshot prefix state");
+        return;
+    }
+    entry->state.resize(written);
+    
+    if (!config_.disk_dir.empty()) {
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.kvp", static_cast<unsigned long long>(entry->hash));
+        entry->file = config_.disk_dir + "/" + name;
+    }
+    
+    entries_.push_front(entry);
+    memory_bytes_ += written;
+    evictToBudget();
+    
+    if (!entry->file.empty()) {
+        write_queue_.push_back(entry);
+        write_cv_.notify_one();
+    }
+    
+    LOGD("Stored prefix: %zu tokens, %zu KB", tokens.size(), written / 1024);
+}
+
+void PrefixCache::clearMemory() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    
+    for (auto it = entries_.begin(); it != entries_.end();) {
+        Entry& entry = **it;
+        memory_bytes_ -= entry.state.size();
+        entry.state.clear();
+        entry.state.shrink_to_fit();
+        if (!entry.on_disk) {
+            it = entries_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    memory_bytes_ = 0;
+    LOGI("Prefix cache memory released");
+}
+
+PrefixCacheStats PrefixCache::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    PrefixCacheStats stats = stats_;
+    stats.entries = entries_.size();
+    stats.memory_bytes = memory_bytes_;
+    return stats;
+}
+
+void PrefixCache::evictToBudget() {
+    // Drop in-memory state from the least recently used end; entries that
+    // are persisted stay indexed and reload from disk on demand
+    size_t n_disk = 0;
+    for (auto it = entries_.begin(); it != entries_.end();) {
+        Entry& entry = **it;
+        if (entry.on_disk && ++n_disk > MAX_DISK_ENTRIES) {
+            memory_bytes_ -= entry.state.size();
+            unlink(entry.file.c_str());
+            it = entries_.erase(it);
+            continue;
+        }
+        ++it;
+    }
+    
+    auto it = entries_.end();
+    while (memory_bytes_ > config_.memory_budget && it != entries_.begin()) {
+        --it;
+        Entry& entry = **it;
+        if (entry.state.empty()) continue;
+        
+        memory_bytes_ -= entry.state.size();
+        entry.state.clear();
+        entry.state.shrink_to_fit();
+        if (!entry.on_disk) {
+            it = entries_.erase(it);
+        }
+    }
+}
+
+void PrefixCache::erase(std::list<EntryPtr>::iterator it) {
+    // Clearing the state also tells a pending write to skip it, or to
+    // delete what it just wrote
+    Entry& entry = **it;
+    memory_bytes_ -= entry.state.size();
+    entry.state.clear();
+    if (entry.on_disk) unlink(entry.file.c_str());
+    entries_.erase(it);
+}
+
+bool PrefixCache::loadState(Entry& entry) {
+    if (entry.file.empty() || !entry.on_disk) return false;
+    
+    if (!readEntry(entry.file, entry, true)) {
+        LOGW("Failed to read prefix entry %s", entry.file.c_str());
+        return false;
+    }
+    memory_bytes_ += entry.state.size();
+    return true;
+}
+
+void PrefixCache::indexDisk() {
+    DIR* dir = opendir(config_.disk_dir.c_str());
+    if (dir == nullptr) return;
+    
+    struct dirent* ent;
+    while ((ent = readdir(dir)) != nullptr) {
+        size_t len = strlen(ent->d_name);
+        if (len < 5 || strcmp(ent->d_name + len - 4, ".kvp") != 0) continue;
+        
+        std::string path = config_.disk_dir + "/" + ent->d_name;
+        bool known = std::any_of(entries_.begin(), entries_.end(),
+                                 [&](const EntryPtr& e) { return e->file == path; });
+        if (known) continue;
+        
+        // Other weights under the same name (a re-download) or another KV
+        // type: the state would load into the wrong cache
+        auto entry = std::make_shared<Entry>();
+        if (!readEntry(path, *entry, false) || entry->model_key != model_key_) {
+            unlink(path.c_str());
+            continue;
+        }
+        entry->file = path;
+        entry->hash = hashTokens(entry->tokens.data(), entry->tokens.size()) ^ key_hash_;
+        entry->on_disk = true;
+        entries_.push_back(entry);
+    }
+    closedir(dir);
+}
+
+void PrefixCache::writerThreadFunc() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    
+    while (!writer_stop_) {
+        write_cv_.wait(lock, [this] { return writer_stop_ || !write_queue_.empty(); });
+        
+        while (!write_queue_.empty()) {
+            EntryPtr entry = write_queue_.front();
+            write_queue_.pop_front();
+            if (entry->state.empty()) continue;  // Evicted before it was written
+            
+            // Write a private copy so eviction can proceed meanwhile
+            Entry snapshot = *entry;
+            lock.unlock();
+            bool ok = writeEntry(snapshot);
+            lock.lock();
+            
+            // Superseded or evicted while it was being written
+            if (ok && entry->state.empty()) {
+                unlink(entry->file.c_str());
+                ok = false;
+            }
+            entry->on_disk = ok;
+        }
+    }
+}
+
+bool PrefixCache::writeEntry(const Entry& entry) {
+    std::string tmp = entry.file + ".tmp";
+    FILE* f = fopen(tmp.c_str(), "wb");
+    if (f == nullptr) return false;
+    
+    PrefixFileHeader header = {};
+    header.magic = PREFIX_FILE_MAGIC;
+    header.version = PREFIX_FILE_VERSION;
+    header.n_tokens = static_cast<uint32_t>(entry.tokens.size());
+    header.key_size = static_cast<uint32_t>(entry.model_key.size());
+    header.state_size = entry.state.size();
+    
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+              fwrite(entry.model_key.data(), 1, entry.model_key.size(), f) == entry.model_key.size() &&
+              fwrite(entry.tokens.data(), sizeof(llama_token), entry.tokens.size(), f) == entry.tokens.size() &&
+              fwrite(entry.state.data(), 1, entry.state.size(), f) == entry.state.size();
+    ok = (fclose(f) == 0) && ok;
+    
+    // Rename last so readers never see a partial entry
+    if (!ok || rename(tmp.c_str(), entry.file.c_str()) != 0) {
+        unlink(tmp.c_str());
+        LOGW("Failed to persist prefix entry %s", entry.file.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool PrefixCache::readEntry(const std::string& path, Entry& entry, bool with_state) const {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (f == nullptr) return false;
+    
+    PrefixFileHeader header;
+    struct stat st;
+    bool ok = fread(&header, sizeof(header), 1, f) == 1 &&
+              fstat(fileno(f), &st) == 0 &&
+              header.magic == PREFIX_FILE_MAGIC &&
+              header.version == PREFIX_FILE_VERSION &&
+              header.n_tokens > 0 &&
+              header.key_size <= MAX_KEY_SIZE;
+    
+    // Sizes come straight from disk: a truncated or corrupt file must not
+    // ask for more than it holds, nor for a state the budget cannot take
+    if (ok) {
+        uint64_t fixed = sizeof(header) + header.key_size +
+                         static_cast<uint64_t>(header.n_tokens) * sizeof(llama_token);
+        uint64_t file_size = st.st_size;
+        ok = file_size >= fixed && header.state_size == file_size - fixed &&
+             header.state_size <= config_.memory_budget;
+    }
+    if (ok) {
+        entry.model_key.resize(header.key_size);
+        ok = fread(&entry.model_key[0], 1, header.key_size, f) == header.key_size;
+    }
+    if (ok) {
+        entry.tokens.resize(header.n_tokens);
+        ok = fread(entry.tokens.data(), sizeof(llama_token), header.n_tokens, f) == header.n_tokens;
+    }
+    if (ok && with_state) {
+        entry.state.resize(header.state_size);
+        ok = fread(entry.state.data(), 1, header.state_size, f) == header.state_size;
+        if (!ok) entry.state.clear();
+    }
+    
+    fclose(f);
+    return ok;
+}
+
+} // namespace cortex
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <deque>
+#include <condition_variable>
+
+#include "llama.h"
+
+namespace cortex {
+
+// Prefix cache configuration
+struct PrefixCacheConfig {
+    size_t memory_budget = 64 * 1024 * 1024;  // In-memory KV state budget
+    int min_prefix_tokens = 16;               // Shorter prefixes are cheap to re-decode
+    std::string disk_dir;                     // Empty disables persistence
+};
+
+// Prefix cache statistics
+struct PrefixCacheStats {
+    size_t entries = 0;
+    size_t memory_bytes = 0;
+    int64_t hits = 0;
+    int64_t misses = 0;
+    int64_t tokens_reused = 0;
+};
+
+// Saves the KV state of evaluated prompts and restores the longest matching
+// token prefix for later prompts. Entries are keyed by model so they survive
+// a model reload, and can be persisted next to the model for app restarts.
+// The key has to change with anything the state depends on: the weights
+// (see prefixCacheKey) and the KV type.
+class PrefixCache {
+public:
+    PrefixCache();
+    ~PrefixCache();
+    
+    // Non-copyable
+    PrefixCache(const PrefixCache&) = delete;
+    PrefixCache& operator=(const PrefixCache&) = delete;
+    
+    // Bind to a model; indexes any entries persisted for it on disk and
+    // deletes those stored under another key
+    void attach(const std::string& model_key, const PrefixCacheConfig& config);
+    
+    // The KV layout changed under the same model; older entries stop matching
+    void rekey(const std::string& model_key);
+    
+    // Restore the longest cached prefix of tokens into an empty sequence.
+    // Returns how many leading tokens are now in the KV cache (0 on miss).
+    // At least one token is always left for the caller to evaluate.
+    int restore(llama_context* ctx, const std::vector<llama_token>& tokens, llama_seq_id seq_id);
+    
+    // Snapshot a sequence whose KV cache holds exactly tokens
+    void store(llama_context* ctx, const std::vector<llama_token>& tokens, llama_seq_id seq_id);
+    
+    // Drop in-memory state (disk entries stay indexed)
+    void clearMemory();
+    
+    PrefixCacheStats getStats() const;
+    
+    static uint64_t hashTokens(const llama_token* tokens, size_t n_tokens);
+
+private:
+    struct Entry {
+        std::string model_key;
+        std::vector<llama_token> tokens;
+        std::vector<uint8_t> state;  // Empty until loaded when only on disk
+        std::string file;
+        uint64_t hash = 0;
+        bool on_disk = false;        // Set once the writer has persisted it
+    };
+    using EntryPtr = std::shared_ptr<Entry>;
+    
+    mutable std::mutex mutex_;
+    std::list<EntryPtr> entries_;  // Most recently used first
+    std::string model_key_;
+    uint64_t key_hash_ = 0;        // Mixed into file names, keys share a directory
+    PrefixCacheConfig config_;
+    size_t memory_bytes_ = 0;
+    PrefixCacheStats stats_;
+    
+    // Background disk writer
+    std::thread writer_thread_;
+    std::deque<EntryPtr> write_queue_;
+    std::condition_variable write_cv_;
+    bool writer_stop_ = false;
+    
+    void evictToBudget();
+    void erase(std::list<EntryPtr>::iterator it);
+    bool loadState(Entry& entry);
+    void indexDisk();
+    void writerThreadFunc();
+    static bool writeEntry(const Entry& entry);
+    bool readEntry(const std::string& path, Entry& entry, bool with_state) const;
+};
+
+} // namespace cortex
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace cortex {
+
+// Streaming SHA-256 (FIPS 180-4). The running state can be saved at any
+// 64-byte boundary and restored later, so a hash over a file that is
+// being downloaded survives an app restart.
+class Sha256 {
+public:
+    static const size_t BLOCK_BYTES = 64;
+    
+    Sha256() { reset(); }
+    
+    void reset();
+    void update(const void* data, size_t len);
+    std::string finishHex();   // Lowercase hex digest; the state is spent afterwards
+    
+    uint64_t bytes() const { return bytes_; }
+    
+    // 64 hex chars of the chaining state; only valid when bytes() is a
+    // multiple of BLOCK_BYTES. restore() takes the bytes hashed so far.
+    std::string stateHex() const;
+    bool restore(const std::string& state_hex, uint64_t bytes);
+
+private:
+    uint32_t h_[8];
+    uint8_t buffer_[BLOCK_BYTES];
+    size_t buffered_ = 0;
+    uint64_t bytes_ = 0;
+    
+    void compress(const uint8_t* block);
+};
+
+} // namespace cortex
@@ -0,0 +1,117 @@
+#include "thermal_governor.h"
+#include <algorithm>
+
+#ifdef __ANDROID__
+    #include <android/log.h>
+    #define LOG_TAG "CortexThermal"
+    #define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#else
+    #include <cstdio>
+    #define LOG_TAG "CortexThermal"
+    #define LOGI(...) printf("[INFO] " __VA_ARGS__); printf("\n")
+#endif
+
+namespace cortex {
+
+// PowerManager.THERMAL_STATUS_*
+static const int THERMAL_STATUS_LIGHT = 1;
+static const int THERMAL_STATUS_MODERATE = 2;
+static const int THERMAL_STATUS_SEVERE = 3;
+
+// Weight of the newest token in the latency average
+static const double EMA_ALPHA = 0.1;
+
+void ThermalGovernor::setThermalState(int status, float headroom) {
+    status_ = status;
+    headroom_ = headroom;
+}
+
+int ThermalGovernor::thermalTarget() const {
+    int status = status_.load();
+    float headroom = headroom_.load();
+    
+    int target = 0;
+    if (status >= THERMAL_STATUS_SEVERE) target = 3;
+    else if (status >= THERMAL_STATUS_MODERATE) target = 2;
+    else if (status >= THERMAL_STATUS_LIGHT) target = 1;
+    
+    // Headroom moves well before the status does
+    if (headroom >= 0) {
+        if (headroom >= config_.critical_headroom) target = std::max(target, 3);
+        else if (headroom >= config_.hot_headroom) target = std::max(target, 2);
+        else if (headroom >= config_.warm_headroom) target = std::max(target, 1);
+    }
+    return target;
+}
+
+bool ThermalGovernor::update(double decode_ms, int64_t now_ms) {
+    int level = level_.load();
+    if (level_since_ms_ == 0) level_since_ms_ = now_ms;
+    
+    int target = thermalTarget();
+    
+    if (decode_ms >= 0) {
+        ema_ms_ = (samples_ == 0) ? decode_ms : ema_ms_ + EMA_ALPHA * (decode_ms - ema_ms_);
+        samples_++;
+        
+        if (samples_ == config_.min_samples) {
+            baseline_ms_ = ema_ms_;
+        } else if (samples_ > config_.min_samples) {
+            baseline_ms_ = std::min(baseline_ms_, ema_ms_);
+            
+            // Sustained slowdown at an unchanged setting is the clocks
+            // dropping, whether or not the OS has said so yet
+            slow_streak_ = (ema_ms_ > baseline_ms_ * config_.slowdown) ? slow_streak_ + 1 : 0;
+            if (slow_streak_ >= config_.min_samples) {
+                target = std::max(target, level + 1);
+            }
+        }
+    }
+    
+    target = std::min(target, MAX_LEVEL);
+    
+    if (target > level) {
+        // Back off at once, possibly several levels
+        setLevel(target, now_ms);
+        return true;
+    }
+    if (target < level && now_ms - level_since_ms_ >= config_.step_up_ms) {
+        // Recover one level at a time
+        setLevel(level - 1, now_ms);
+        return true;
+    }
+    return false;
+}
+
+void ThermalGovernor::setLevel(int level, int64_t now_ms) {
+    LOGI("throttle level %d -> %d (status=%d headroom=%.2f latency=%.1fms baseline=%.1fms)",
+         level_.load(), level, status_.load(), headroom_.load(), ema_ms_, baseline_ms_);
+    level_ = level;
+    level_since_ms_ = now_ms;
+    samples_ = 0;
+    slow_streak_ = 0;
+}
+
+void ThermalGovernor::beginGeneration() {
+    samples_ = 0;
+    slow_streak_ = 0;
+}
+
+void ThermalGovernor::reset() {
+    level_ = 0;
+    level_since_ms_ = 0;
+    ema_ms_ = 0;
+    baseline_ms_ = 0;
+    samples_ = 0;
+    slow_streak_ = 0;
+}
+
+int ThermalGovernor::chunkSize(int n_batch) const {
+    // Shorter bursts between checks once the phone is hot
+    int level = level_.load();
+    if (level < 2) return n_batch;
+    int divisor = (level == 2) ? 2 : 4;
+    return std::max(std::min(n_batch, 8), n_batch / divisor);
+}
+
+} // namespace cortex
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace cortex {
+
+struct ThermalGovernorConfig {
+    // getThermalHeadroom() forecasts: 1.0 is where the OS starts severe throttling
+    float warm_headroom = 0.70f;
+    float hot_headroom = 0.85f;
+    float critical_headroom = 0.95f;
+    
+    float slowdown = 1.30f;        // Decode latency over the level's baseline that counts as throttling
+    int min_samples = 16;          // Tokens at a level before its baseline is trusted
+    int64_t step_up_ms = 30000;    // Time at a level before stepping back up one
+};
+
+// Picks a throttle level between tokens so sustained chats run at a rate
+// the SoC can hold instead of bursting and then collapsing. Inputs are the
+// Android thermal status/headroom (pushed from the plugin) and the decode
+// latency of each token: a level only steps down once the phone reports
+// heat or tokens get slower than the level's own baseline, and only steps
+// back up after staying cool at it for a while.
+//
+// 0: full speed, 1: off the prime core, 2: fewer threads and smaller
+// prompt chunks, 3: minimum threads.
+class ThermalGovernor {
+public:
+    static const int MAX_LEVEL = 3;
+    
+    ThermalGovernor() = default;
+    explicit ThermalGovernor(const ThermalGovernorConfig& config) : config_(config) {}
+    
+    // Any thread. status is PowerManager.THERMAL_STATUS_*, headroom < 0 if unknown.
+    void setThermalState(int status, float headroom);
+    
+    // Decode thread, after a token; returns true when the level changed.
+    // decode_ms < 0 only re-reads the thermal state (prompt chunks,
+    // speculative steps).
+    bool update(double decode_ms, int64_t now_ms);
+    
+    // New prompt: the context depth changes, so the baseline is re-measured
+    void beginGeneration();
+    
+    // Model unload
+    void reset();
+    
+    int level() const { return level_.load(); }
+    int thermalStatus() const { return status_.load(); }
+    float thermalHeadroom() const { return headroom_.load(); }
+    double latencyMs() const { return ema_ms_; }
+    
+    // Prompt tokens per decode call at the current level
+    int chunkSize(int n_batch) const;
+
+private:
+    ThermalGovernorConfig config_;
+    
+    std::atomic<int> status_{0};
+    std::atomic<float> headroom_{-1.0f};
+    std::atomic<int> level_{0};
+    
+    // Decode thread only
+    int64_t level_since_ms_ = 0;
+    double ema_ms_ = 0;
+    double baseline_ms_ = 0;
+    int samples_ = 0;
+    int slow_streak_ = 0;
+    
+    int thermalTarget() const;
+    void setLevel(int level, int64_t now_ms);
+};
+
+} // namespace cortex
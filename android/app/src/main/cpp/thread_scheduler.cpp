@@ -0,0 +1,311 @@
+#include "thread_scheduler.h"
+#include "cpu_backend.h"
+#include "ggml-backend.h"
+#include "ggml-cpu.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+#ifdef __ANDROID__
+    #include <android/log.h>
+    #include <sched.h>
+    #define LOG_TAG "CortexScheduler"
+    #define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+    #define LOGW(...) __android_log_print(ANDROID_LOG_WARN, LOG_TAG, __VA_ARGS__)
+#else
+    #include <iostream>
+    #define LOG_TAG "CortexScheduler"
+    #define LOGI(...) printf("[INFO] " __VA_ARGS__); printf("\n")
+    #define LOGW(...) printf("[WARN] " __VA_ARGS__); printf("\n")
+#endif
+
+#ifdef __APPLE__
+    #include <sys/sysctl.h>
+#endif
+
+namespace cortex {
+
+// Decode gains nothing past this on current phones; more threads only add
+// barrier overhead
+static const int MAX_DECODE_THREADS = 4;
+
+static long readSysfsLong(const char* fmt, int cpu) {
+    char path[128];
+    snprintf(path, sizeof(path), fmt, cpu);
+    
+    FILE* f = fopen(path, "r");
+    if (f == nullptr) return 0;
+    long value = 0;
+    if (fscanf(f, "%ld", &value) != 1) value = 0;
+    fclose(f);
+    return value;
+}
+
+#ifdef __APPLE__
+// No sysfs on Darwin; perflevel0 is the performance cluster. Threads
+// cannot be pinned there, so only the class counts matter and the ids
+// are nominal.
+static long perfLevelScore(int cpu) {
+    static const int n_perf = [] {
+        int n = 0;
+        size_t len = sizeof(n);
+        if (sysctlbyname("hw.perflevel0.logicalcpu", &n, &len, nullptr, 0) != 0) n = 0;
+        return n;
+    }();
+    if (n_perf <= 0) return 0;
+    return cpu < n_perf ? 2 : 1;
+}
+#endif
+
+const CpuTopology& CpuTopology::get() {
+    static const CpuTopology topology = detect();
+    return topology;
+}
+
+CpuTopology CpuTopology::detect() {
+    CpuTopology topo;
+    int n_cpus = std::max(1u, std::thread::hardware_concurrency());
+    
+    // Prefer the scheduler's capacity; fall back to max frequency
+    std::vector<long> scores;
+    for (int cpu = 0; cpu < n_cpus; cpu++) {
+        CpuCore core;
+        core.id = cpu;
+        core.capacity = readSysfsLong("/sys/devices/system/cpu/cpu%d/cpu_capacity", cpu);
+        core.max_freq_khz = readSysfsLong("/sys/devices/system/cpu/cpu%d/cpufreq/cpuinfo_max_freq", cpu);
+        topo.cores.push_back(core);
+        
+        long score = core.capacity > 0 ? core.capacity : core.max_freq_khz;
+#ifdef __APPLE__
+        if (score == 0) score = perfLevelScore(cpu);
+#endif
+        scores.push_back(score);
+    }
+    
+    std::vector<long> levels = scores;
+    std::sort(levels.begin(), levels.end(), std::greater<long>());
+    levels.erase(std::unique(levels.begin(), levels.end()), levels.end());
+    
+    for (int cpu = 0; cpu < n_cpus; cpu++) {
+        CpuCore& core = topo.cores[cpu];
+        if (levels.size() >= 2 && scores[cpu] == levels.back()) {
+            core.core_class = CoreClass::Little;
+            topo.little.push_back(cpu);
+        } else if (levels.size() >= 3 && scores[cpu] == levels.front()) {
+            core.core_class = CoreClass::Prime;
+            topo.prime.push_back(cpu);
+        } else {
+            core.core_class = CoreClass::Big;
+            topo.big.push_back(cpu);
+        }
+    }
+    
+    // Fastest big cores first so partial selections take the best ones
+    std::stable_sort(topo.big.begin(), topo.big.end(), [&](int a, int b) {
+        return scores[a] > scores[b];
+    });
+    
+    LOGI("cpu topology: %s", topo.describe().c_str());
+    return topo;
+}
+
+std::vector<int> CpuTopology::coresByCapacity() const {
+    std::vector<int> order = prime;
+    order.insert(order.end(), big.begin(), big.end());
+    order.insert(order.end(), little.begin(), little.end());
+    return order;
+}
+
+int CpuTopology::defaultDecodeThreads() const {
+    int n_cores = cores.size();
+    if (!isHeterogeneous()) {
+        // Leave one core for the OS/UI
+        return std::max(1, std::min(n_cores - 1, MAX_DECODE_THREADS));
+    }
+    int n_fast = prime.size() + big.size();
+    return std::max(1, std::min(n_fast, MAX_DECODE_THREADS));
+}
+
+int CpuTopology::defaultPrefillThreads() const {
+    int n_cores = cores.size();
+    int n_fast = prime.size() + big.size();
+    if (!isHeterogeneous() || n_fast < 4) {
+        // Few fast cores: the little ones still add throughput on big batches
+        return std::max(1, n_cores - 1);
+    }
+    return n_fast;
+}
+
+std::string CpuTopology::describe() const {
+    std::string desc;
+    if (!prime.empty()) desc += std::to_string(prime.size()) + "+";
+    desc += std::to_string(big.size());
+    if (!little.empty()) desc += "+" + std::to_string(little.size());
+    return desc;
+}
+
+// ggml_threadpool_new/free live in the CPU backend, which with CPU variants
+// is a module loaded at runtime that nothing links against; take them from
+// its registry, as llama.cpp's own tools do. Null: no threadpools.
+struct ThreadpoolApi {
+    decltype(ggml_threadpool_new)* create = nullptr;
+    decltype(ggml_threadpool_free)* destroy = nullptr;
+};
+
+static ThreadpoolApi threadpoolApi() {
+    loadBackends();
+    ThreadpoolApi api;
+    ggml_backend_dev_t cpu = ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_CPU);
+    ggml_backend_reg_t reg = cpu != nullptr ? ggml_backend_dev_backend_reg(cpu) : nullptr;
+    if (reg == nullptr) return api;
+    
+    api.create = reinterpret_cast<decltype(ggml_threadpool_new)*>(
+        ggml_backend_reg_get_proc_address(reg, "ggml_threadpool_new"));
+    api.destroy = reinterpret_cast<decltype(ggml_threadpool_free)*>(
+        ggml_backend_reg_get_proc_address(reg, "ggml_threadpool_free"));
+    if (api.create == nullptr || api.destroy == nullptr) {
+        api = ThreadpoolApi();
+    }
+    return api;
+}
+
+static ggml_threadpool_t createPool(const ThreadpoolApi& api, const std::vector<int>& cpus, bool pin) {
+    struct ggml_threadpool_params params = ggml_threadpool_params_default(cpus.size());
+    memset(params.cpumask, 0, sizeof(params.cpumask));
+    if (pin) {
+        for (int cpu : cpus) {
+            if (cpu < GGML_MAX_N_THREADS) params.cpumask[cpu] = true;
+        }
+        params.strict_cpu = true;  // One worker per masked core
+    }
+    params.prio = GGML_SCHED_PRIO_NORMAL;  // Apps cannot raise it; do not try
+    return api.create(&params);
+}
+
+ThreadScheduler::~ThreadScheduler() {
+    release();
+}
+
+bool ThreadScheduler::configure(int n_decode, int n_prefill) {
+    release();
+    
+    const CpuTopology& topo = CpuTopology::get();
+    int n_cores = topo.cores.size();
+    
+    if (n_decode <= 0) n_decode = topo.defaultDecodeThreads();
+    if (n_prefill <= 0) n_prefill = topo.defaultPrefillThreads();
+    base_decode_ = std::min(n_decode, n_cores);
+    base_prefill_ = std::min(n_prefill, n_cores);
+    
+    return createPools(0);
+}
+
+bool ThreadScheduler::setThrottleLevel(int level) {
+    if (decode_pool_ == nullptr || level == level_) return false;
+    
+    // The contexts are detached by the caller, so the old pools can go
+    release();
+    return createPools(level);
+}
+
+bool ThreadScheduler::createPools(int level) {
+    const CpuTopology& topo = CpuTopology::get();
+    std::vector<int> order = topo.coresByCapacity();
+    
+    // The prime core heats fastest and, once its clock drops, holds every
+    // other thread at the barriers; throttled levels leave it out
+    if (level >= 1 && !topo.prime.empty() && !topo.big.empty()) {
+        order.erase(order.begin(), order.begin() + topo.prime.size());
+    }
+    int n_cores = order.size();
+    int n_fast = topo.isHeterogeneous() ? n_cores - static_cast<int>(topo.little.size()) : n_cores;
+    
+    int n_decode = base_decode_;
+    int n_prefill = base_prefill_;
+    if (level >= 1) {
+        n_decode = std::min(n_decode, std::max(1, n_fast));
+        n_prefill = std::min(n_prefill, n_cores);
+    }
+    if (level >= 2) {
+        n_decode = std::max(1, n_decode - 1);
+        n_prefill = n_decode;
+    }
+    if (level >= 3) {
+        n_decode = std::max(1, base_decode_ / 2);
+        n_prefill = n_decode;
+    }
+    n_decode = std::min(n_decode, n_cores);
+    n_prefill = std::min(n_prefill, n_cores);
+    
+    decode_cpus_.assign(order.begin(), order.begin() + n_decode);
+    prefill_cpus_.assign(order.begin(), order.begin() + n_prefill);
+    
+    // Without a known layout the kernel places threads better than a guess
+    bool pin = topo.isHeterogeneous();
+    
+    ThreadpoolApi api = threadpoolApi();
+    if (api.create == nullptr) {
+        LOGW("CPU backend exports no threadpools, using llama defaults");
+        return false;
+    }
+    
+    // ggml applies the first worker's affinity to the thread creating the
+    // pool; do that on a throwaway thread instead of the caller's
+    std::thread([&] {
+        decode_pool_ = createPool(api, decode_cpus_, pin);
+        prefill_pool_ = createPool(api, prefill_cpus_, pin);
+    }).join();
+    
+    if (decode_pool_ == nullptr || prefill_pool_ == nullptr) {
+        LOGW("threadpool creation failed, using llama defaults");
+        release();
+        return false;
+    }
+    
+    level_ = level;
+    LOGI("threads: decode=%d prefill=%d (%s, %s, level %d)", n_decode, n_prefill,
+         topo.describe().c_str(), pin ? "pinned" : "unpinned", level);
+    return true;
+}
+
+void ThreadScheduler::attach(llama_context* ctx) const {
+    if (ctx != nullptr && decode_pool_ != nullptr) {
+        llama_attach_threadpool(ctx, decode_pool_, prefill_pool_);
+    }
+}
+
+void ThreadScheduler::detach(llama_context* ctx) const {
+    if (ctx != nullptr) {
+        llama_detach_threadpool(ctx);
+    }
+}
+
+void ThreadScheduler::release() {
+    // Only pools exist when the lookup succeeded, and it gives the same module
+    if (decode_pool_ != nullptr || prefill_pool_ != nullptr) {
+        ThreadpoolApi api = threadpoolApi();
+        if (decode_pool_ != nullptr) api.destroy(decode_pool_);
+        if (prefill_pool_ != nullptr) api.destroy(prefill_pool_);
+        decode_pool_ = nullptr;
+        prefill_pool_ = nullptr;
+    }
+    level_ = 0;
+}
+
+void ThreadScheduler::pinCurrentThread() const {
+#ifdef __ANDROID__
+    if (decode_cpus_.empty() || !CpuTopology::get().isHeterogeneous()) return;
+    
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    for (int cpu : decode_cpus_) {
+        CPU_SET(cpu, &cpuset);
+    }
+    if (sched_setaffinity(0, sizeof(cpuset), &cpuset) != 0) {
+        LOGW("could not pin generation thread");
+    }
+#endif
+}
+
+} // namespace cortex
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "llama.h"
+#include "ggml.h"
+
+namespace cortex {
+
+// Core classes of a big.LITTLE / DynamIQ layout
+enum class CoreClass {
+    Little,
+    Big,
+    Prime,
+};
+
+struct CpuCore {
+    int id = 0;
+    int capacity = 0;         // cpu_capacity (1024 = fastest), 0 if not exposed
+    long max_freq_khz = 0;    // cpuinfo_max_freq
+    CoreClass core_class = CoreClass::Big;
+};
+
+// Per-core capacity and frequency from sysfs, grouped into clusters.
+// Cores with the highest score are prime, the lowest little, the rest big;
+// a homogeneous SoC is all big.
+struct CpuTopology {
+    std::vector<CpuCore> cores;
+    std::vector<int> prime;
+    std::vector<int> big;
+    std::vector<int> little;
+    
+    // Detected once per process
+    static const CpuTopology& get();
+    
+    bool isHeterogeneous() const { return !little.empty(); }
+    
+    // Fastest first: prime, then big, then little
+    std::vector<int> coresByCapacity() const;
+    
+    // Thread counts for the two phases. Decode is memory bound and every
+    // thread waits at the same barriers, so a slow little core holds all of
+    // them back; it stays on the fastest cores. Prefill is compute bound and
+    // can use the little cores when there are few big ones.
+    int defaultDecodeThreads() const;
+    int defaultPrefillThreads() const;
+    
+    std::string describe() const;  // e.g. "1+3+4"
+
+private:
+    static CpuTopology detect();
+};
+
+// Pins llama's compute threads to the chosen clusters via ggml threadpools
+// with a CPU mask: one pool for decode, one for prompt batches.
+class ThreadScheduler {
+public:
+    ThreadScheduler() = default;
+    ~ThreadScheduler();
+    
+    ThreadScheduler(const ThreadScheduler&) = delete;
+    ThreadScheduler& operator=(const ThreadScheduler&) = delete;
+    
+    // Create the pools (thread counts <= 0 use the topology defaults)
+    bool configure(int n_decode, int n_prefill);
+    
+    // Attach the pools to a context; several contexts may share them as
+    // long as they do not decode concurrently (target + draft)
+    void attach(llama_context* ctx) const;
+    void detach(llama_context* ctx) const;
+    
+    void release();
+    
+    // Rebuild the pools for a ThermalGovernor level (0 = as configured).
+    // Contexts must be detached first and re-attached after.
+    bool setThrottleLevel(int level);
+    int throttleLevel() const { return level_; }
+    
+    // Pin the calling thread to the decode cores. ggml runs worker 0 on
+    // the thread that calls llama_decode.
+    void pinCurrentThread() const;
+    
+    int decodeThreads() const { return static_cast<int>(decode_cpus_.size()); }
+    int prefillThreads() const { return static_cast<int>(prefill_cpus_.size()); }
+
+private:
+    ggml_threadpool_t decode_pool_ = nullptr;
+    ggml_threadpool_t prefill_pool_ = nullptr;
+    std::vector<int> decode_cpus_;
+    std::vector<int> prefill_cpus_;
+    int base_decode_ = 0;
+    int base_prefill_ = 0;
+    int level_ = 0;
+    
+    bool createPools(int level);
+};
+
+} // namespace cortex
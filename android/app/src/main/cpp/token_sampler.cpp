@@ -0,0 +1,310 @@
+#include "token_sampler.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+    #include <arm_neon.h>
+#endif
+
+namespace cortex {
+
+// counts_ bit marking a token already adjusted in the current call
+static const uint16_t APPLIED = 0x8000;
+
+static llama_sampler* buildChain(const SamplerParams& params) {
+    llama_sampler* chain = llama_sampler_chain_init(llama_sampler_chain_default_params());
+    llama_sampler_chain_add(chain, llama_sampler_init_penalties(params.repeat_last_n, params.repeat_penalty,
+                                                                0.0f, 0.0f));
+    llama_sampler_chain_add(chain, llama_sampler_init_top_k(params.top_k));
+    llama_sampler_chain_add(chain, llama_sampler_init_top_p(params.top_p, 1));
+    llama_sampler_chain_add(chain, llama_sampler_init_temp(params.temperature));
+    llama_sampler_chain_add(chain, llama_sampler_init_dist(params.seed != 0 ? params.seed : LLAMA_DEFAULT_SEED));
+    return chain;
+}
+
+TokenSampler::~TokenSampler() {
+    release();
+}
+
+bool TokenSampler::configure(const SamplerParams& params, const llama_vocab* vocab) {
+    if (vocab_ != nullptr && vocab == vocab_ && params == params_) {
+        return false;
+    }
+    
+    configure(params, llama_vocab_n_tokens(vocab));
+    vocab_ = vocab;
+    return true;
+}
+
+bool TokenSampler::configure(const SamplerParams& params, int n_vocab) {
+    release();
+    params_ = params;
+    n_vocab_ = n_vocab;
+    
+    // Greedy needs no top-k at all; otherwise k has to fit the scratch list
+    bool fast = params.temperature <= 0 || (params.top_k > 0 && params.top_k <= MAX_TOP_K);
+    if (!fast) {
+        chain_ = buildChain(params);
+    }
+    
+    counts_.assign(n_vocab_, 0);
+    history_.assign(std::max(0, params.repeat_last_n), 0);
+    history_pos_ = 0;
+    history_len_ = 0;
+    top_.reserve(MAX_TOP_K + history_.size());
+    probs_.reserve(MAX_TOP_K + history_.size());
+    rng_.seed(params.seed != 0 ? params.seed : std::random_device{}());
+    return true;
+}
+
+void TokenSampler::reset() {
+    for (int i = 0; i < history_len_; i++) {
+        counts_[history_[i]] = 0;
+    }
+    history_pos_ = 0;
+    history_len_ = 0;
+    if (params_.seed != 0) {
+        rng_.seed(params_.seed);
+    }
+    if (chain_ != nullptr) {
+        llama_sampler_reset(chain_);  // dist goes back to its seed too
+    }
+}
+
+void TokenSampler::setGrammar(llama_sampler* grammar) {
+    if (grammar_ != nullptr) {
+        llama_sampler_free(grammar_);
+    }
+    grammar_ = grammar;
+}
+
+void TokenSampler::release() {
+    setGrammar(nullptr);
+    if (chain_ != nullptr) {
+        llama_sampler_free(chain_);
+        chain_ = nullptr;
+    }
+    vocab_ = nullptr;
+    n_vocab_ = 0;
+    counts_.clear();
+    history_.clear();
+    history_pos_ = 0;
+    history_len_ = 0;
+}
+
+llama_token TokenSampler::sample(llama_context* ctx, int idx) {
+    // llama_sampler_sample accepts the token into the chain itself
+    if (chain_ != nullptr && grammar_ == nullptr) {
+        return llama_sampler_sample(chain_, ctx, idx);
+    }
+    
+    const float* logits = llama_get_logits_ith(ctx, idx);
+    if (logits == nullptr) {
+        return llama_vocab_eos(vocab_);
+    }
+    return sample(logits);
+}
+
+llama_token TokenSampler::sample(const float* logits) {
+    int k = params_.temperature <= 0 ? 1
+          : params_.top_k > 0 ? std::min({params_.top_k, MAX_TOP_K, n_vocab_})
+                              : std::min(MAX_TOP_K, n_vocab_);
+    int n_top = k;
+    if (grammar_ != nullptr) {
+        // A few spare candidates make a full-vocab pass rare
+        n_top = std::min(std::max(k, GRAMMAR_CANDIDATES), n_vocab_);
+    }
+    
+    if (!penalized()) {
+        selectTop(logits, n_top);
+        std::reverse(top_.begin(), top_.end());
+    } else {
+        // Penalties only move the tokens in the window, so the k best after
+        // them are among the k + window best before them plus the window
+        selectTop(logits, std::min(n_top + history_len_, n_vocab_));
+        top_.erase(std::remove_if(top_.begin(), top_.end(),
+                                  [this](const Candidate& c) { return counts_[c.id] != 0; }),
+                   top_.end());
+        for (int i = 0; i < history_len_; i++) {
+            llama_token id = history_[i];
+            if (counts_[id] & APPLIED) continue;
+            counts_[id] |= APPLIED;
+            top_.push_back({penalize(logits[id]), id});
+        }
+        for (int i = 0; i < history_len_; i++) {
+            counts_[history_[i]] &= ~APPLIED;
+        }
+        
+        std::sort(top_.begin(), top_.end(),
+                  [](const Candidate& a, const Candidate& b) { return a.logit > b.logit; });
+        if (static_cast<int>(top_.size()) > n_top) {
+            top_.resize(n_top);
+        }
+    }
+    
+    if (grammar_ != nullptr) {
+        applyGrammar(logits, k);
+    }
+    
+    llama_token token = !top_.empty() ? pick()
+                      : vocab_ != nullptr ? llama_vocab_eos(vocab_) : LLAMA_TOKEN_NULL;
+    accept(token);
+    if (grammar_ != nullptr) {
+        llama_sampler_accept(grammar_, token);
+    }
+    return token;
+}
+
+void TokenSampler::applyGrammar(const float* logits, int k) {
+    // Rejected candidates come back as -inf; top_ keeps its order
+    grammar_data_.resize(top_.size());
+    for (size_t i = 0; i < top_.size(); i++) {
+        grammar_data_[i] = {top_[i].id, top_[i].logit, 0.0f};
+    }
+    llama_token_data_array candidates = {grammar_data_.data(), grammar_data_.size(), -1, false};
+    llama_sampler_apply(grammar_, &candidates);
+    
+    size_t kept = 0;
+    for (size_t i = 0; i < top_.size(); i++) {
+        if (std::isfinite(grammar_data_[i].logit)) top_[kept++] = top_[i];
+    }
+    top_.resize(kept);
+    
+    if (kept == 0) {
+        // None of the likely tokens fit (often: only end of text does); the
+        // grammar sees the whole vocab, penalties applied
+        grammar_data_.resize(n_vocab_);
+        for (int i = 0; i < n_vocab_; i++) {
+            bool repeated = penalized() && counts_[i] != 0;
+            grammar_data_[i] = {i, repeated ? penalize(logits[i]) : logits[i], 0.0f};
+        }
+        candidates = {grammar_data_.data(), grammar_data_.size(), -1, false};
+        llama_sampler_apply(grammar_, &candidates);
+        
+        for (size_t i = 0; i < candidates.size; i++) {
+            const llama_token_data& data = candidates.data[i];
+            if (std::isfinite(data.logit)) top_.push_back({data.logit, data.id});
+        }
+        std::sort(top_.begin(), top_.end(),
+                  [](const Candidate& a, const Candidate& b) { return a.logit > b.logit; });
+    }
+    
+    if (static_cast<int>(top_.size()) > k) {
+        top_.resize(k);
+    }
+}
+
+void TokenSampler::accept(llama_token token) {
+    int capacity = history_.size();
+    if (capacity == 0 || token < 0 || token >= n_vocab_) return;
+    
+    if (history_len_ == capacity) {
+        counts_[history_[history_pos_]]--;
+    } else {
+        history_len_++;
+    }
+    history_[history_pos_] = token;
+    counts_[token]++;
+    history_pos_ = (history_pos_ + 1) % capacity;
+}
+
+bool TokenSampler::penalized() const {
+    return history_len_ > 0 && params_.repeat_penalty != 1.0f;
+}
+
+float TokenSampler::penalize(float logit) const {
+    // Same rule as llama_sampler_init_penalties
+    return logit <= 0 ? logit * params_.repeat_penalty : logit / params_.repeat_penalty;
+}
+
+void TokenSampler::insertTop(float logit, llama_token id, int k) {
+    // top_ is ascending, so top_[0] is the one to beat
+    int i;
+    if (static_cast<int>(top_.size()) < k) {
+        top_.push_back({logit, id});
+        for (i = top_.size() - 1; i > 0 && top_[i - 1].logit > logit; i--) {
+            top_[i] = top_[i - 1];
+        }
+    } else {
+        for (i = 0; i + 1 < k && top_[i + 1].logit < logit; i++) {
+            top_[i] = top_[i + 1];
+        }
+    }
+    top_[i] = {logit, id};
+}
+
+void TokenSampler::selectTop(const float* logits, int k) {
+    top_.clear();
+    float threshold = -INFINITY;
+    int i = 0;
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+    // 16 logits per compare. Once the list is full almost every block is
+    // below its smallest entry and costs one max and one branch.
+    for (; i + 16 <= n_vocab_; i += 16) {
+        float32x4_t a = vld1q_f32(logits + i);
+        float32x4_t b = vld1q_f32(logits + i + 4);
+        float32x4_t c = vld1q_f32(logits + i + 8);
+        float32x4_t d = vld1q_f32(logits + i + 12);
+        float block_max = vmaxvq_f32(vmaxq_f32(vmaxq_f32(a, b), vmaxq_f32(c, d)));
+        if (block_max <= threshold) continue;
+        
+        for (int j = i; j < i + 16; j++) {
+            if (logits[j] > threshold || static_cast<int>(top_.size()) < k) {
+                insertTop(logits[j], j, k);
+                if (static_cast<int>(top_.size()) == k) threshold = top_[0].logit;
+            }
+        }
+    }
+#endif
+    
+    for (; i < n_vocab_; i++) {
+        if (logits[i] > threshold || static_cast<int>(top_.size()) < k) {
+            insertTop(logits[i], i, k);
+            if (static_cast<int>(top_.size()) == k) threshold = top_[0].logit;
+        }
+    }
+}
+
+llama_token TokenSampler::pick() {
+    // top_ is sorted best first
+    int n = top_.size();
+    if (params_.temperature <= 0 || n == 1) {
+        return top_[0].id;
+    }
+    
+    // Top-p sees the distribution before temperature, as in llama's chain
+    float max_logit = top_[0].logit;
+    probs_.resize(n);
+    float sum = 0;
+    for (int i = 0; i < n; i++) {
+        probs_[i] = std::exp(top_[i].logit - max_logit);
+        sum += probs_[i];
+    }
+    if (params_.top_p < 1.0f) {
+        float target = params_.top_p * sum;
+        float cum = 0;
+        for (int i = 0; i < n; i++) {
+            cum += probs_[i];
+            if (cum >= target) {
+                n = i + 1;
+                break;
+            }
+        }
+    }
+    
+    // Temperature, then one draw over what is left
+    sum = 0;
+    for (int i = 0; i < n; i++) {
+        probs_[i] = std::exp((top_[i].logit - max_logit) / params_.temperature);
+        sum += probs_[i];
+    }
+    float r = std::uniform_real_distribution<float>(0.0f, sum)(rng_);
+    for (int i = 0; i < n; i++) {
+        r -= probs_[i];
+        if (r <= 0) return top_[i].id;
+    }
+    return top_[n - 1].id;
+}
+
+} // namespace cortex
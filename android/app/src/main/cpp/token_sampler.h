@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "llama.h"
+
+namespace cortex {
+
+// Sampling settings; the defaults match InferenceConfig
+struct SamplerParams {
+    float temperature = 0.7f;    // <= 0: greedy
+    float top_p = 0.9f;
+    int top_k = 40;
+    float repeat_penalty = 1.1f;
+    int repeat_last_n = 64;      // Window of accepted tokens the penalty looks at
+    uint32_t seed = 0;           // 0: random; else every reset() starts the same sequence
+    
+    bool operator==(const SamplerParams& other) const {
+        return temperature == other.temperature && top_p == other.top_p && top_k == other.top_k &&
+               repeat_penalty == other.repeat_penalty && repeat_last_n == other.repeat_last_n &&
+               seed == other.seed;
+    }
+    bool operator!=(const SamplerParams& other) const { return !(*this == other); }
+};
+
+// penalties -> top-k -> top-p -> temperature -> dist, the same chain as
+// llama's samplers, without their full-vocab passes per token.
+//
+// Top-k runs first on the raw logits: one vectorized scan keeps the k best
+// (plus room for the penalized ones), so softmax and top-p only ever touch
+// k candidates. Temperature 0 is a plain argmax. The repetition penalty
+// keeps a count per token of the last repeat_last_n accepted ones and only
+// adjusts those, instead of rebuilding the window each call. The state
+// lives until the parameters change or reset() is called, so the penalty
+// history carries over from one turn of a conversation to the next.
+//
+// A grammar filters the candidates left after top-k, not the vocab; only
+// when it rejects all of them does it see the full vocab once.
+//
+// top_k outside (0, MAX_TOP_K] falls back to llama's own chain, unless a
+// grammar is set; then top_k is clamped to MAX_TOP_K.
+class TokenSampler {
+public:
+    static constexpr int MAX_TOP_K = 256;
+    static constexpr int GRAMMAR_CANDIDATES = 32;  // At least this many go to the grammar, even when greedy
+    
+    TokenSampler() = default;
+    ~TokenSampler();
+    
+    TokenSampler(const TokenSampler&) = delete;
+    TokenSampler& operator=(const TokenSampler&) = delete;
+    
+    // Keeps the state when nothing changed; returns true if it was rebuilt
+    bool configure(const SamplerParams& params, const llama_vocab* vocab);
+    bool configure(const SamplerParams& params, int n_vocab);  // No model: always rebuilds
+    void reset();    // Forget the penalty history (new conversation); reseeds a fixed seed
+    void release();
+    
+    // Owned; state follows the accepted tokens. nullptr: unconstrained.
+    void setGrammar(llama_sampler* grammar);
+    bool hasGrammar() const { return grammar_ != nullptr; }
+    
+    // Samples from row idx of ctx's logits (-1: the last) and accepts the token
+    llama_token sample(llama_context* ctx, int idx);
+    
+    // The same from a row of n_vocab logits, always on the top-k path
+    // (top_k clamped to MAX_TOP_K); the host tests compare it to llama's chain
+    llama_token sample(const float* logits);
+
+private:
+    struct Candidate {
+        float logit;
+        llama_token id;
+    };
+    
+    SamplerParams params_;
+    const llama_vocab* vocab_ = nullptr;
+    int n_vocab_ = 0;
+    llama_sampler* chain_ = nullptr;     // Fallback for top_k it does not cover
+    llama_sampler* grammar_ = nullptr;
+    std::mt19937 rng_;
+    
+    // Penalty window: ring of the last accepted tokens and a count per token
+    std::vector<llama_token> history_;
+    int history_pos_ = 0;
+    int history_len_ = 0;
+    std::vector<uint16_t> counts_;
+    
+    // Scratch, kept between calls
+    std::vector<Candidate> top_;
+    std::vector<float> probs_;
+    std::vector<llama_token_data> grammar_data_;
+    
+    void accept(llama_token token);
+    bool penalized() const;
+    float penalize(float logit) const;
+    void selectTop(const float* logits, int k);
+    void insertTop(float logit, llama_token id, int k);
+    void applyGrammar(const float* logits, int k);
+    llama_token pick();
+};
+
+} // namespace cortex
@@ -1,5 +1,6 @@
 package com.aarav.cortex.cortex2
 
+import androidx.annotation.Keep
 import androidx.annotation.NonNull
 import io.flutter.embedding.engine.plugins.FlutterPlugin
 import io.flutter.plugin.common.MethodCall
@@ -8,8 +9,13 @@ import io.flutter.plugin.common.MethodChannel.MethodCallHandler
 import io.flutter.plugin.common.MethodChannel.Result
 import io.flutter.plugin.common.EventChannel
 import kotlinx.coroutines.*
+import android.content.ComponentCallbacks2
+import android.content.Context
+import android.content.res.Configuration
+import android.os.Build
 import android.os.Handler
 import android.os.Looper
+import android.os.PowerManager
 
 class InferenceEnginePlugin : FlutterPlugin, MethodCallHandler, EventChannel.StreamHandler {
     
@@ -19,16 +25,83 @@ class InferenceEnginePlugin : FlutterPlugin, MethodCallHandler, EventChannel.Str
     private var eventSink: EventChannel.EventSink? = null
     private val mainHandler = Handler(Looper.getMainLooper())
     
-    // Token streaming job
-    private var streamingJob: Job? = null
+    // Trim callbacks drive the native memory reclaim stages
+    private var appContext: Context? = null
+    private val memoryCallbacks = object : ComponentCallbacks2 {
+        override fun onTrimMemory(level: Int) {
+            // Reclaim may rebuild the context; keep it off the main thread
+            scope.launch { onTrimMemoryNative(level) }
+        }
+        
+        override fun onLowMemory() {
+            scope.launch { onTrimMemoryNative(ComponentCallbacks2.TRIM_MEMORY_COMPLETE) }
+        }
+        
+        override fun onConfigurationChanged(newConfig: Configuration) {}
+    }
+    
+    // Thermal state for the native governor
+    private var powerManager: PowerManager? = null
+    private var thermalListener: PowerManager.OnThermalStatusChangedListener? = null
+    private var thermalJob: Job? = null
+    @Volatile private var thermalStatus = 0
+    @Volatile private var thermalHeadroom = -1f
     
     override fun onAttachedToEngine(@NonNull flutterPluginBinding: FlutterPlugin.FlutterPluginBinding) {
         channel = MethodChannel(flutterPluginBinding.binaryMessenger, "inference_engine")
         channel.setMethodCallHandler(this)
         
-        // EventChannel for push-based token streaming
+        // EventChannel for session events pushed from the native generation thread
         eventChannel = EventChannel(flutterPluginBinding.binaryMessenger, "inference_engine/tokens")
         eventChannel.setStreamHandler(this)
+        
+        powerManager = flutterPluginBinding.applicationContext
+            .getSystemService(Context.POWER_SERVICE) as? PowerManager
+        startThermalMonitor()
+        
+        appContext = flutterPluginBinding.applicationContext
+        appContext?.registerComponentCallbacks(memoryCallbacks)
+    }
+    
+    // Status changes arrive from the listener (API 29+); headroom has no
+    // callback and is polled while generating (API 30+, rate limited by the OS)
+    private fun startThermalMonitor() {
+        val pm = powerManager ?: return
+        if (Build.VERSION.SDK_INT < Build.VERSION_CODES.Q) return
+        
+        val listener = PowerManager.OnThermalStatusChangedListener { status ->
+            thermalStatus = status
+            updateThermalStateNative(status, thermalHeadroom)
+        }
+        pm.addThermalStatusListener(listener)
+        thermalListener = listener
+        thermalStatus = pm.currentThermalStatus
+        updateThermalStateNative(thermalStatus, thermalHeadroom)
+        
+        if (Build.VERSION.SDK_INT >= Build.VERSION_CODES.R) {
+            thermalJob = scope.launch {
+                while (isActive) {
+                    if (isGeneratingNative()) {
+                        val headroom = pm.getThermalHeadroom(THERMAL_FORECAST_SECONDS)
+                        if (!headroom.isNaN()) {
+                            thermalHeadroom = headroom
+                            updateThermalStateNative(thermalStatus, headroom)
+                        }
+                    }
+                    delay(THERMAL_POLL_MS)
+                }
+            }
+        }
+    }
+    
+    private fun stopThermalMonitor() {
+        thermalJob?.cancel()
+        thermalJob = null
+        val listener = thermalListener ?: return
+        if (Build.VERSION.SDK_INT >= Build.VERSION_CODES.Q) {
+            powerManager?.removeThermalStatusListener(listener)
+        }
+        thermalListener = null
     }
     
     // EventChannel.StreamHandler implementation
@@ -38,39 +111,14 @@ class InferenceEnginePlugin : FlutterPlugin, MethodCallHandler, EventChannel.Str
     
     override fun onCancel(arguments: Any?) {
         eventSink = null
-        streamingJob?.cancel()
-        streamingJob = null
-    }
-    
-    // Push tokens to EventChannel from native callback or polling
-    private fun pushTokens(tokens: String) {
-        if (tokens.isNotEmpty()) {
-            mainHandler.post {
-                eventSink?.success(tokens)
-            }
-        }
     }
     
-    // Start polling for tokens (used when EventChannel is active)
-    private fun startTokenPolling() {
-        streamingJob?.cancel()
-        streamingJob = scope.launch {
-            while (isActive && isGeneratingNative()) {
-                val tokens = getBufferedTokensNative()
-                if (tokens.isNotEmpty()) {
-                    pushTokens(tokens)
-                }
-                delay(20) // Poll every 20ms
-            }
-            // Final flush
-            val remaining = getBufferedTokensNative()
-            if (remaining.isNotEmpty()) {
-                pushTokens(remaining)
-            }
-            // Signal end of stream
-            mainHandler.post {
-                eventSink?.endOfStream()
-            }
+    // Called by the native generation thread for every session event:
+    // type 0 carries text, 1 (done) and 2 (error) the final stats JSON
+    @Keep
+    private fun onSessionEvent(session: Long, type: Int, data: String) {
+        mainHandler.post {
+            eventSink?.success(mapOf("session" to session, "type" to type, "data" to data))
         }
     }
     
@@ -90,6 +138,48 @@ class InferenceEnginePlugin : FlutterPlugin, MethodCallHandler, EventChannel.Str
                 }
             }
             
+            "preflightModel" -> {
+                val modelPath = call.argument<String>("modelPath")
+                if (modelPath != null) {
+                    scope.launch {
+                        val plan = preflightModelNative(modelPath)
+                        withContext(Dispatchers.Main) {
+                            result.success(plan)
+                        }
+                    }
+                } else {
+                    result.error("INVALID_ARGUMENT", "Model path is required", null)
+                }
+            }
+            
+            "getLoadError" -> {
+                result.success(getLoadErrorNative())
+            }
+            
+            "startModelLoad" -> {
+                val modelPath = call.argument<String>("modelPath")
+                if (modelPath != null) {
+                    // Only starts the worker; the load itself runs natively
+                    scope.launch {
+                        val started = startModelLoadNative(modelPath)
+                        withContext(Dispatchers.Main) {
+                            result.success(started)
+                        }
+                    }
+                } else {
+                    result.error("INVALID_ARGUMENT", "Model path is required", null)
+                }
+            }
+            
+            "cancelModelLoad" -> {
+                cancelModelLoadNative()
+                result.success(true)
+            }
+            
+            "getLoadProgress" -> {
+                result.success(getLoadProgressNative())
+            }
+            
             "unloadModel" -> {
                 // Run on background thread to avoid blocking while waiting for generation to stop
                 scope.launch {
@@ -100,66 +190,108 @@ class InferenceEnginePlugin : FlutterPlugin, MethodCallHandler, EventChannel.Str
                 }
             }
             
+            "loadDraftModel" -> {
+                val modelPath = call.argument<String>("modelPath")
+                if (modelPath != null) {
+                    scope.launch {
+                        val success = loadDraftModelNative(modelPath)
+                        withContext(Dispatchers.Main) {
+                            result.success(success)
+                        }
+                    }
+                } else {
+                    result.error("INVALID_ARGUMENT", "Model path is required", null)
+                }
+            }
+            
+            "unloadDraftModel" -> {
+                scope.launch {
+                    unloadDraftModelNative()
+                    withContext(Dispatchers.Main) {
+                        result.success(true)
+                    }
+                }
+            }
+            
+            "hasDraftModel" -> {
+                result.success(hasDraftModelNative())
+            }
+            
             "isModelLoaded" -> {
                 result.success(isModelLoadedNative())
             }
             
-            "getModelInfo" -> {
-                result.success(getModelInfoNative())
+            "getGpuInfo" -> {
+                val modelPath = call.argument<String>("modelPath") ?: ""
+                result.success(getGpuInfoNative(modelPath))
             }
             
-            "startInference" -> {
-                val prompt = call.argument<String>("prompt")
-                val temperature = call.argument<Double>("temperature")?.toFloat() ?: 0.7f
-                val topP = call.argument<Double>("topP")?.toFloat() ?: 0.9f
-                val topK = call.argument<Int>("topK") ?: 40
-                val maxTokens = call.argument<Int>("maxTokens") ?: 2048
-                
-                if (prompt != null) {
-                    // Run on background thread - prompt evaluation can take seconds
+            "tuneGpuLayers" -> {
+                val modelPath = call.argument<String>("modelPath")
+                if (modelPath != null) {
+                    // One model load per split; tens of seconds
                     scope.launch {
-                        val success = startGenerationNative(prompt, temperature, topP, topK, maxTokens)
+                        val tune = tuneGpuLayersNative(modelPath)
                         withContext(Dispatchers.Main) {
-                            result.success(success)
+                            result.success(tune)
                         }
                     }
                 } else {
-                    result.error("INVALID_ARGUMENT", "Prompt is required", null)
+                    result.error("INVALID_ARGUMENT", "Model path is required", null)
                 }
             }
             
-            "startInferenceIncremental" -> {
-                // OPTIMIZATION: Use incremental inference with KV cache reuse
-                val prompt = call.argument<String>("prompt")
+            "getModelInfo" -> {
+                result.success(getModelInfoNative())
+            }
+            
+            "startChat" -> {
+                // Structured messages; the chat template is applied natively.
+                // Returns the session handle at once; output follows as events.
+                val messages = call.argument<List<Map<String, String>>>("messages")
                 val temperature = call.argument<Double>("temperature")?.toFloat() ?: 0.7f
                 val topP = call.argument<Double>("topP")?.toFloat() ?: 0.9f
                 val topK = call.argument<Int>("topK") ?: 40
                 val maxTokens = call.argument<Int>("maxTokens") ?: 2048
+                val grammar = call.argument<String>("grammar") ?: ""
+                val jsonSchema = call.argument<String>("jsonSchema") ?: ""
+                val speculative = call.argument<Boolean>("speculative") ?: false
+                val stream = call.argument<Boolean>("stream") ?: false
                 
-                if (prompt != null) {
+                if (messages != null && messages.isNotEmpty()) {
+                    val roles = messages.map { it["role"] ?: "user" }.toTypedArray()
+                    val contents = messages.map { it["content"] ?: "" }.toTypedArray()
+                    // Waits for a running session to end, and may reload a
+                    // suspended model
                     scope.launch {
-                        val success = startGenerationIncrementalNative(prompt, temperature, topP, topK, maxTokens)
+                        val session = startChatSessionNative(roles, contents, temperature, topP, topK, maxTokens, grammar, jsonSchema, speculative, stream)
                         withContext(Dispatchers.Main) {
-                            result.success(success)
+                            result.success(session)
                         }
                     }
                 } else {
-                    result.error("INVALID_ARGUMENT", "Prompt is required", null)
+                    result.error("INVALID_ARGUMENT", "Messages are required", null)
                 }
             }
             
-            "startInferenceTurbo" -> {
-                // TURBO MODE: Multi-threaded with quality sampling
+            "startCompletion" -> {
+                // Raw prompt; incremental continues the cached sequence
                 val prompt = call.argument<String>("prompt")
+                val temperature = call.argument<Double>("temperature")?.toFloat() ?: 0.7f
+                val topP = call.argument<Double>("topP")?.toFloat() ?: 0.9f
+                val topK = call.argument<Int>("topK") ?: 40
+                val maxTokens = call.argument<Int>("maxTokens") ?: 2048
+                val grammar = call.argument<String>("grammar") ?: ""
+                val jsonSchema = call.argument<String>("jsonSchema") ?: ""
+                val incremental = call.argument<Boolean>("incremental") ?: false
+                val speculative = call.argument<Boolean>("speculative") ?: false
+                val stream = call.argument<Boolean>("stream") ?: false
+                
                 if (prompt != null) {
                     scope.launch {
-                        val success = startGenerationTurboNative(prompt)
-                        if (success && eventSink != null) {
-                            // Start pushing tokens via EventChannel
-                            startTokenPolling()
-                        }
+                        val session = startPromptSessionNative(prompt, incremental, temperature, topP, topK, maxTokens, grammar, jsonSchema, speculative, stream)
                         withContext(Dispatchers.Main) {
-                            result.success(success)
+                            result.success(session)
                         }
                     }
                 } else {
@@ -167,35 +299,38 @@ class InferenceEnginePlugin : FlutterPlugin, MethodCallHandler, EventChannel.Str
                 }
             }
             
-            "startInferenceThreaded" -> {
-                // Multi-threaded generation with custom parameters
-                val prompt = call.argument<String>("prompt")
+            "startBackground" -> {
+                // Titles, summaries, suggestions: decoded next to the running
+                // session in the same batches. Messages or a raw prompt.
+                val messages = call.argument<List<Map<String, String>>>("messages") ?: emptyList()
+                val prompt = call.argument<String>("prompt") ?: ""
                 val temperature = call.argument<Double>("temperature")?.toFloat() ?: 0.7f
                 val topP = call.argument<Double>("topP")?.toFloat() ?: 0.9f
                 val topK = call.argument<Int>("topK") ?: 40
-                val maxTokens = call.argument<Int>("maxTokens") ?: 2048
+                val maxTokens = call.argument<Int>("maxTokens") ?: 128
+                val grammar = call.argument<String>("grammar") ?: ""
+                val jsonSchema = call.argument<String>("jsonSchema") ?: ""
                 
-                if (prompt != null) {
+                if (messages.isNotEmpty() || prompt.isNotEmpty()) {
+                    val roles = messages.map { it["role"] ?: "user" }.toTypedArray()
+                    val contents = messages.map { it["content"] ?: "" }.toTypedArray()
                     scope.launch {
-                        val success = startGenerationThreadedNative(prompt, temperature, topP, topK, maxTokens)
-                        if (success && eventSink != null) {
-                            startTokenPolling()
-                        }
+                        val session = startBackgroundSessionNative(roles, contents, prompt, temperature, topP, topK, maxTokens, grammar, jsonSchema)
                         withContext(Dispatchers.Main) {
-                            result.success(success)
+                            result.success(session)
                         }
                     }
                 } else {
-                    result.error("INVALID_ARGUMENT", "Prompt is required", null)
+                    result.error("INVALID_ARGUMENT", "Messages or a prompt are required", null)
                 }
             }
             
-            "getBufferedTokens" -> {
-                // Get tokens from threaded generation buffer
+            "cancelSession" -> {
+                val session = call.argument<Number>("session")?.toLong() ?: 0L
                 scope.launch {
-                    val tokens = getBufferedTokensNative()
+                    cancelSessionNative(session)
                     withContext(Dispatchers.Main) {
-                        result.success(tokens)
+                        result.success(true)
                     }
                 }
             }
@@ -209,34 +344,37 @@ class InferenceEnginePlugin : FlutterPlugin, MethodCallHandler, EventChannel.Str
                 result.success(getCachedTokenCountNative())
             }
             
-            "getNextToken" -> {
-                // Run on background thread - token generation blocks
+            "selectConversation" -> {
+                val conversationId = call.argument<Number>("conversationId")?.toLong() ?: 0L
                 scope.launch {
-                    val token = getNextTokenNative()
+                    val cached = selectConversationNative(conversationId)
                     withContext(Dispatchers.Main) {
-                        result.success(token)
+                        result.success(cached)
                     }
                 }
             }
             
-            "getNextTokens" -> {
-                // Batch token retrieval for reduced JNI overhead
-                val count = call.argument<Int>("count") ?: 4
-                scope.launch {
-                    val tokens = getNextTokensNative(count)
-                    withContext(Dispatchers.Main) {
-                        result.success(tokens.toList())
+            "forkConversation" -> {
+                val srcId = call.argument<Number>("srcId")?.toLong()
+                val dstId = call.argument<Number>("dstId")?.toLong()
+                if (srcId != null && dstId != null) {
+                    scope.launch {
+                        val success = forkConversationNative(srcId, dstId)
+                        withContext(Dispatchers.Main) {
+                            result.success(success)
+                        }
                     }
+                } else {
+                    result.error("INVALID_ARGUMENT", "srcId and dstId are required", null)
                 }
             }
             
-            "getNextTokensBatch" -> {
-                // TURBO: Get batch as single concatenated string (faster)
-                val count = call.argument<Int>("count") ?: 8
+            "releaseConversation" -> {
+                val conversationId = call.argument<Number>("conversationId")?.toLong() ?: 0L
                 scope.launch {
-                    val tokens = getNextTokensBatchNative(count)
+                    releaseConversationNative(conversationId)
                     withContext(Dispatchers.Main) {
-                        result.success(tokens)
+                        result.success(true)
                     }
                 }
             }
@@ -246,7 +384,7 @@ class InferenceEnginePlugin : FlutterPlugin, MethodCallHandler, EventChannel.Str
             }
             
             "stopGeneration" -> {
-                // Run on background thread to avoid blocking
+                // Returns once the running session has sent its final event
                 scope.launch {
                     stopGenerationNative()
                     withContext(Dispatchers.Main) {
@@ -274,9 +412,19 @@ class InferenceEnginePlugin : FlutterPlugin, MethodCallHandler, EventChannel.Str
             }
             
             "runBenchmark" -> {
-                val numTokens = call.argument<Int>("numTokens") ?: 100
+                // Empty lists fall back to the native defaults
+                val promptLengths = call.argument<List<Int>>("promptLengths") ?: emptyList()
+                val decodeDepths = call.argument<List<Int>>("decodeDepths") ?: emptyList()
+                val decodeTokens = call.argument<Int>("decodeTokens") ?: 0
+                val threadCounts = call.argument<List<Int>>("threadCounts") ?: emptyList()
+                val ubatchSizes = call.argument<List<Int>>("ubatchSizes") ?: emptyList()
+                val warmup = call.argument<Int>("warmup") ?: 1
+                val repetitions = call.argument<Int>("repetitions") ?: 0
                 scope.launch {
-                    val stats = runBenchmarkNative(numTokens)
+                    val stats = runBenchmarkNative(
+                        promptLengths.toIntArray(), decodeDepths.toIntArray(), decodeTokens,
+                        threadCounts.toIntArray(), ubatchSizes.toIntArray(), warmup, repetitions
+                    )
                     withContext(Dispatchers.Main) {
                         result.success(stats)
                     }
@@ -292,12 +440,19 @@ class InferenceEnginePlugin : FlutterPlugin, MethodCallHandler, EventChannel.Str
     override fun onDetachedFromEngine(@NonNull binding: FlutterPlugin.FlutterPluginBinding) {
         channel.setMethodCallHandler(null)
         eventChannel.setStreamHandler(null)
-        streamingJob?.cancel()
+        eventSink = null
+        stopThermalMonitor()
+        appContext?.unregisterComponentCallbacks(memoryCallbacks)
+        appContext = null
         scope.cancel()
         unloadModelNative()
     }
     
     companion object {
+        // Headroom polling; the OS returns NaN when asked more than once a second
+        private const val THERMAL_POLL_MS = 2000L
+        private const val THERMAL_FORECAST_SECONDS = 10
+        
         init {
             System.loadLibrary("llama_jni")
         }
@@ -305,24 +460,35 @@ class InferenceEnginePlugin : FlutterPlugin, MethodCallHandler, EventChannel.Str
     
     // Native method declarations - must match JNI function names
     private external fun loadModelNative(modelPath: String): Boolean
+    private external fun preflightModelNative(modelPath: String): String
+    private external fun getLoadErrorNative(): String
+    private external fun startModelLoadNative(modelPath: String): Boolean
+    private external fun cancelModelLoadNative()
+    private external fun getLoadProgressNative(): String
     private external fun unloadModelNative()
     private external fun isModelLoadedNative(): Boolean
     private external fun getModelInfoNative(): String
-    private external fun startGenerationNative(prompt: String, temperature: Float, topP: Float, topK: Int, maxTokens: Int): Boolean
-    private external fun startGenerationIncrementalNative(prompt: String, temperature: Float, topP: Float, topK: Int, maxTokens: Int): Boolean
-    private external fun startGenerationThreadedNative(prompt: String, temperature: Float, topP: Float, topK: Int, maxTokens: Int): Boolean
+    private external fun getGpuInfoNative(modelPath: String): String
+    private external fun tuneGpuLayersNative(modelPath: String): String
+    private external fun loadDraftModelNative(modelPath: String): Boolean
+    private external fun unloadDraftModelNative()
+    private external fun hasDraftModelNative(): Boolean
+    private external fun startChatSessionNative(roles: Array<String>, contents: Array<String>, temperature: Float, topP: Float, topK: Int, maxTokens: Int, grammar: String, jsonSchema: String, speculative: Boolean, ffiStream: Boolean): Long
+    private external fun startPromptSessionNative(prompt: String, incremental: Boolean, temperature: Float, topP: Float, topK: Int, maxTokens: Int, grammar: String, jsonSchema: String, speculative: Boolean, ffiStream: Boolean): Long
+    private external fun startBackgroundSessionNative(roles: Array<String>, contents: Array<String>, prompt: String, temperature: Float, topP: Float, topK: Int, maxTokens: Int, grammar: String, jsonSchema: String): Long
+    private external fun cancelSessionNative(session: Long)
     private external fun clearCacheNative()
     private external fun getCachedTokenCountNative(): Int
-    private external fun getNextTokenNative(): String
-    private external fun getNextTokensNative(count: Int): Array<String>
-    private external fun getNextTokensBatchNative(count: Int): String
-    private external fun getBufferedTokensNative(): String
+    private external fun selectConversationNative(conversationId: Long): Int
+    private external fun forkConversationNative(srcId: Long, dstId: Long): Boolean
+    private external fun releaseConversationNative(conversationId: Long)
     private external fun isGeneratingNative(): Boolean
     private external fun stopGenerationNative()
     private external fun getStatsNative(): String
     private external fun resetStatsNative()
     private external fun getMemoryInfoNative(): String
+    private external fun updateThermalStateNative(status: Int, headroom: Float)
+    private external fun onTrimMemoryNative(level: Int)
     private external fun getMemoryUsageNative(): Long
-    private external fun runBenchmarkNative(numTokens: Int): String
-    private external fun startGenerationTurboNative(prompt: String): Boolean
+    private external fun runBenchmarkNative(promptLengths: IntArray, decodeDepths: IntArray, decodeTokens: Int, threadCounts: IntArray, ubatchSizes: IntArray, warmup: Int, repetitions: Int): String
 }
\ No newline at end of file
@@ -0,0 +1,592 @@
+// Perf-regression runner for the engine on a desktop host.
+//
+// Loads a model the way the app does, runs the benchmark sweep and fixed-
+// seed generation scenarios through the generation thread, and prints one
+// JSON object: flat "metrics" (timings, medians over --repeat runs),
+// "outputs" that have to match exactly between builds on one machine
+// (text hashes, token counts) and the raw benchmark results. With
+// --baseline it compares against an earlier run and exits with 1 on a
+// regression. Engine logs go to stderr, the JSON to stdout or --out.
+
+#include "inference_engine.h"
+#include "benchmark.h"
+#include "cpu_backend.h"
+#include "latency_trace.h"
+#include "thread_scheduler.h"
+#include "llama.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+using namespace cortex;
+
+namespace {
+
+struct Options {
+    std::string model;
+    std::string out;                   // Empty: stdout
+    std::string baseline;
+    double tolerance = 0.10;           // Allowed slowdown per timing
+    bool check_outputs = true;
+    std::string scenarios = "benchmark,prefill,decode,context_shift,cache_reuse";
+    int context = 2048;
+    int batch = 256;
+    int ubatch = 128;
+    int threads = 0;                   // 0: CpuTopology defaults, as in the app
+    uint32_t seed = 42;
+    int repeat = 3;
+    int prompt_tokens = 256;
+    int decode_tokens = 128;
+    bool verbose = false;
+};
+
+const char* USAGE =
+    "usage: cortex_bench --model PATH [options]\n"
+    "  --out PATH            write the JSON here instead of stdout\n"
+    "  --baseline PATH       compare against an earlier run; exit 1 on a regression\n"
+    "  --tolerance F         allowed slowdown per timing (default 0.10)\n"
+    "  --ignore-outputs      do not fail on changed fixed-seed outputs\n"
+    "  --scenarios LIST      comma-separated subset of\n"
+    "                        benchmark,prefill,decode,context_shift,cache_reuse\n"
+    "  --ctx N --batch N --ubatch N --threads N\n"
+    "  --seed N              sampler seed (default 42, never 0)\n"
+    "  --repeat N            runs per scenario, medians are reported (default 3)\n"
+    "  --prompt-tokens N     prefill prompt length (default 256)\n"
+    "  --decode-tokens N     tokens generated by decode (default 128)\n"
+    "  --verbose             keep llama.cpp's own logging\n";
+
+bool parseOptions(int argc, char** argv, Options& opts) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        auto next = [&]() -> const char* {
+            if (value != nullptr) i++;
+            return value;
+        };
+        
+        if (arg == "--ignore-outputs") opts.check_outputs = false;
+        else if (arg == "--verbose") opts.verbose = true;
+        else if (arg == "--help" || arg == "-h") return false;
+        else if (value == nullptr) {
+            fprintf(stderr, "missing value for %s\n", arg.c_str());
+            return false;
+        }
+        else if (arg == "--model") opts.model = next();
+        else if (arg == "--out") opts.out = next();
+        else if (arg == "--baseline") opts.baseline = next();
+        else if (arg == "--tolerance") opts.tolerance = atof(next());
+        else if (arg == "--scenarios") opts.scenarios = next();
+        else if (arg == "--ctx") opts.context = atoi(next());
+        else if (arg == "--batch") opts.batch = atoi(next());
+        else if (arg == "--ubatch") opts.ubatch = atoi(next());
+        else if (arg == "--threads") opts.threads = atoi(next());
+        else if (arg == "--seed") opts.seed = static_cast<uint32_t>(strtoul(next(), nullptr, 10));
+        else if (arg == "--repeat") opts.repeat = std::max(1, atoi(next()));
+        else if (arg == "--prompt-tokens") opts.prompt_tokens = std::max(8, atoi(next()));
+        else if (arg == "--decode-tokens") opts.decode_tokens = std::max(8, atoi(next()));
+        else {
+            fprintf(stderr, "unknown option %s\n", arg.c_str());
+            return false;
+        }
+    }
+    if (opts.seed == 0) opts.seed = 42;
+    return !opts.model.empty();
+}
+
+bool wants(const Options& opts, const char* scenario) {
+    std::string list = "," + opts.scenarios + ",";
+    return list.find(std::string(",") + scenario + ",") != std::string::npos;
+}
+
+void appendString(std::string& out, const std::string& value) {
+    out += '"';
+    for (char c : value) {
+        switch (c) {
+            case '"':  out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            default:
+                if (static_cast<unsigned char>(c) >= 0x20) out += c;
+        }
+    }
+    out += '"';
+}
+
+// FNV-1a; a changed fixed-seed output means the numerics changed
+std::string hashText(const std::string& text) {
+    uint64_t h = 1469598103934665603ULL;
+    for (unsigned char c : text) {
+        h = (h ^ c) * 1099511628211ULL;
+    }
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(h));
+    return hex;
+}
+
+double median(std::vector<double> values) {
+    if (values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    size_t mid = values.size() / 2;
+    return values.size() % 2 ? values[mid] : (values[mid - 1] + values[mid]) / 2;
+}
+
+// Timings from every repetition, reduced to medians for the report
+class Results {
+public:
+    void metric(const std::string& name, double value) { metrics_[name].push_back(value); }
+    
+    // The first repetition's value; later ones have to agree
+    void output(const std::string& name, const std::string& value) {
+        auto it = outputs_.find(name);
+        if (it == outputs_.end()) {
+            outputs_[name] = value;
+        } else if (it->second != value) {
+            fprintf(stderr, "warning: %s differs between repetitions (%s vs %s)\n", name.c_str(),
+                    it->second.c_str(), value.c_str());
+            it->second = "unstable";
+        }
+    }
+    
+    void output(const std::string& name, long long value) { output(name, std::to_string(value)); }
+    
+    std::map<std::string, double> medians() const {
+        std::map<std::string, double> out;
+        for (const auto& entry : metrics_) {
+            out[entry.first] = median(entry.second);
+        }
+        return out;
+    }
+    
+    const std::map<std::string, std::string>& outputs() const { return outputs_; }
+
+private:
+    std::map<std::string, std::vector<double>> metrics_;
+    std::map<std::string, std::string> outputs_;
+};
+
+// Prompts of an exact token count, from a fixed text, so timings do not
+// drift with the wording. Needs only the vocab.
+class PromptMaker {
+public:
+    explicit PromptMaker(const std::string& model_path) {
+        llama_model_params params = llama_model_default_params();
+        params.vocab_only = true;
+        model_ = llama_model_load_from_file(model_path.c_str(), params);
+    }
+    ~PromptMaker() {
+        if (model_ != nullptr) llama_model_free(model_);
+    }
+    
+    bool ok() const { return model_ != nullptr; }
+    
+    std::string make(int n_tokens, int variant = 0) const {
+        static const char* const PARAGRAPH =
+            "The survey ship charted the outer moons one by one, logging the ice, the dust and "
+            "the faint magnetic fields, and each night the crew wrote down what they had seen in "
+            "long careful notes for the people who would come after them. ";
+        const llama_vocab* vocab = llama_model_get_vocab(model_);
+        
+        std::string text = "Part " + std::to_string(variant + 1) + ". ";
+        std::vector<llama_token> tokens;
+        while (true) {
+            text += PARAGRAPH;
+            tokens.resize(text.size() + 16);
+            int n = llama_tokenize(vocab, text.c_str(), static_cast<int32_t>(text.size()), tokens.data(),
+                                   static_cast<int32_t>(tokens.size()), false, false);
+            if (n >= n_tokens) {
+                tokens.resize(n_tokens);
+                break;
+            }
+        }
+        
+        std::string out(tokens.size() * 16 + 16, '\0');
+        int len = llama_detokenize(vocab, tokens.data(), static_cast<int32_t>(tokens.size()), &out[0],
+                                   static_cast<int32_t>(out.size()), false, false);
+        out.resize(std::max(0, len));
+        return out;
+    }
+
+private:
+    llama_model* model_ = nullptr;
+};
+
+struct RunResult {
+    bool ok = false;
+    std::string text;
+    GenerationStats stats;
+    double first_text_ms = 0;    // start to the first text event, 0 if none
+    double total_ms = 0;         // start to the final event
+};
+
+// One session through the generation thread, as the app runs it
+RunResult runSession(InferenceEngine& engine, SessionRequest request) {
+    std::mutex mutex;
+    std::condition_variable done_cv;
+    bool done = false;
+    RunResult result;
+    int64_t start_us = LatencyTrace::nowUs();
+    
+    int64_t session = engine.startSession(std::move(request), [&](const SessionEvent& event) {
+        std::lock_guard<std::mutex> lock(mutex);
+        int64_t now_us = LatencyTrace::nowUs();
+        if (event.type == SessionEventType::Token) {
+            if (result.text.empty()) result.first_text_ms = (now_us - start_us) / 1000.0;
+            result.text += event.text;
+            return;
+        }
+        result.ok = event.type == SessionEventType::Done;
+        result.stats = event.stats;
+        result.total_ms = (now_us - start_us) / 1000.0;
+        done = true;
+        done_cv.notify_all();
+    });
+    if (session < 0) return result;
+    
+    std::unique_lock<std::mutex> lock(mutex);
+    done_cv.wait(lock, [&] { return done; });
+    return result;
+}
+
+SessionRequest makeRequest(const InferenceConfig& base, const std::string& prompt, int max_tokens,
+                           bool incremental = false, bool prefix_cache = false) {
+    SessionRequest request;
+    request.prompt = prompt;
+    request.incremental = incremental;
+    request.config = base;
+    request.config.max_tokens = max_tokens;
+    request.config.prefix_cache = prefix_cache;
+    return request;
+}
+
+double tokensPerSecond(int64_t tokens, double ms) {
+    return ms > 0 ? tokens * 1000.0 / ms : 0;
+}
+
+void recordGaps(Results& results, const std::string& prefix) {
+    // Per-token latency as the app sees it, from the stage histograms
+    std::string latency = LatencyTrace::getInstance().toJson();
+    size_t at = latency.find("\"token_gap\":");
+    if (at == std::string::npos) return;
+    for (const char* key : {"p50_ms", "p99_ms"}) {
+        size_t pos = latency.find(std::string("\"") + key + "\":", at);
+        if (pos != std::string::npos) {
+            results.metric(prefix + ".token_gap_" + key, atof(latency.c_str() + pos + strlen(key) + 3));
+        }
+    }
+}
+
+bool failed(const RunResult& run, const char* scenario) {
+    if (run.ok) return false;
+    fprintf(stderr, "%s: generation failed (%s)\n", scenario, run.text.c_str());
+    return true;
+}
+
+// Prompt evaluation alone: one token out, so prefill dominates
+void scenarioPrefill(InferenceEngine& engine, const InferenceConfig& base, const PromptMaker& prompts,
+                     const Options& opts, Results& results) {
+    std::string prompt = prompts.make(opts.prompt_tokens);
+    for (int r = 0; r < opts.repeat; r++) {
+        engine.clearCache();
+        RunResult run = runSession(engine, makeRequest(base, prompt, 1));
+        if (failed(run, "prefill")) return;
+        results.metric("prefill.ms", run.stats.prompt_eval_time_ms);
+        results.metric("prefill.tokens_per_sec", tokensPerSecond(run.stats.prompt_tokens, run.stats.prompt_eval_time_ms));
+        results.metric("prefill.total_ms", run.total_ms);
+        results.output("prefill.prompt_tokens", run.stats.prompt_tokens);
+    }
+}
+
+// Steady-state generation after a short prompt
+void scenarioDecode(InferenceEngine& engine, const InferenceConfig& base, const PromptMaker& prompts,
+                    const Options& opts, Results& results) {
+    std::string prompt = prompts.make(32, 1);
+    for (int r = 0; r < opts.repeat; r++) {
+        engine.clearCache();
+        LatencyTrace::getInstance().reset();
+        RunResult run = runSession(engine, makeRequest(base, prompt, opts.decode_tokens));
+        if (failed(run, "decode")) return;
+        results.metric("decode.tokens_per_sec", run.stats.tokens_per_second);
+        results.metric("decode.first_text_ms", run.first_text_ms);
+        recordGaps(results, "decode");
+        results.output("decode.generated", run.stats.generated_tokens);
+        results.output("decode.text", hashText(run.text));
+    }
+}
+
+// A prompt that nearly fills the context, so generation has to shift it
+void scenarioContextShift(InferenceEngine& engine, const InferenceConfig& base, const PromptMaker& prompts,
+                          const Options& opts, Results& results) {
+    int context = engine.getConfig().context_length;
+    int room = std::max(64, base.n_discard + base.shift_margin + 32);
+    std::string prompt = prompts.make(std::max(32, context - room), 2);
+    int max_tokens = room * 2;
+    for (int r = 0; r < opts.repeat; r++) {
+        engine.clearCache();
+        LatencyTrace::getInstance().reset();
+        RunResult run = runSession(engine, makeRequest(base, prompt, max_tokens));
+        if (failed(run, "context_shift")) return;
+        if (run.stats.prompt_tokens + run.stats.generated_tokens <= context) {
+            fprintf(stderr, "context_shift: stopped after %lld tokens, before the context filled\n",
+                    static_cast<long long>(run.stats.generated_tokens));
+        }
+        results.metric("context_shift.tokens_per_sec", run.stats.tokens_per_second);
+        recordGaps(results, "context_shift");
+        results.output("context_shift.generated", run.stats.generated_tokens);
+        results.output("context_shift.text", hashText(run.text));
+    }
+}
+
+// A follow-up turn on the cached sequence, then the same prompt again
+// from the prefix cache after the KV cache was cleared
+void scenarioCacheReuse(InferenceEngine& engine, const InferenceConfig& base, const PromptMaker& prompts,
+                        const Options& opts, Results& results) {
+    std::string prompt = prompts.make(opts.prompt_tokens, 3);
+    std::string follow_up = "\n" + prompts.make(16, 4);
+    for (int r = 0; r < opts.repeat; r++) {
+        engine.clearCache();
+        engine.dropCaches();    // Cold again: forget the last repetition's entries
+        RunResult cold = runSession(engine, makeRequest(base, prompt, 16, false, true));
+        RunResult turn = runSession(engine, makeRequest(base, follow_up, 16, true, true));
+        engine.clearCache();
+        RunResult restored = runSession(engine, makeRequest(base, prompt, 16, false, true));
+        if (failed(cold, "cache_reuse") || failed(turn, "cache_reuse") || failed(restored, "cache_reuse")) return;
+        
+        results.metric("cache_reuse.cold_prefill_ms", cold.stats.prompt_eval_time_ms);
+        results.metric("cache_reuse.turn_prefill_ms", turn.stats.prompt_eval_time_ms);
+        results.metric("cache_reuse.restored_prefill_ms", restored.stats.prompt_eval_time_ms);
+        results.output("cache_reuse.turn_prompt_tokens", turn.stats.prompt_tokens);
+        results.output("cache_reuse.restored_tokens", restored.stats.cached_tokens);
+        results.output("cache_reuse.text", hashText(cold.text + turn.text + restored.text));
+    }
+}
+
+std::string report(const Options& opts, const InferenceConfig& config, const Results& results,
+                   const std::string& benchmark) {
+    std::string json = "{\"model\":";
+    appendString(json, opts.model);
+    json += ",\"cpu_variant\":";
+    appendString(json, cpuVariant());
+    json += ",\"cpu_features\":";
+    appendString(json, cpuFeaturesString(detectCpuFeatures()));
+    
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer),
+             ",\"config\":{\"context\":%d,\"batch\":%d,\"ubatch\":%d,\"threads\":%d,"
+             "\"threads_batch\":%d,\"seed\":%u,\"repeat\":%d}",
+             config.context_length, config.batch_size, config.ubatch_size, config.threads,
+             config.threads_batch, config.seed, opts.repeat);
+    json += buffer;
+    
+    json += ",\"metrics\":{";
+    bool first = true;
+    for (const auto& entry : results.medians()) {
+        snprintf(buffer, sizeof(buffer), "%s\"%s\":%.3f", first ? "" : ",", entry.first.c_str(), entry.second);
+        json += buffer;
+        first = false;
+    }
+    json += "},\"outputs\":{";
+    first = true;
+    for (const auto& entry : results.outputs()) {
+        if (!first) json += ",";
+        appendString(json, entry.first);
+        json += ":";
+        appendString(json, entry.second);
+        first = false;
+    }
+    json += "}";
+    if (!benchmark.empty()) {
+        json += ",\"benchmark\":" + benchmark;
+    }
+    json += "}\n";
+    return json;
+}
+
+// "key":value pairs of a flat object of a report; values come back raw,
+// strings without their quotes
+std::map<std::string, std::string> flatObject(const std::string& json, const char* name) {
+    std::map<std::string, std::string> out;
+    size_t pos = json.find(std::string("\"") + name + "\":{");
+    if (pos == std::string::npos) return out;
+    pos = json.find('{', pos) + 1;
+    
+    while (pos < json.size() && json[pos] != '}') {
+        size_t key_start = json.find('"', pos);
+        size_t key_end = json.find('"', key_start + 1);
+        size_t colon = json.find(':', key_end);
+        if (key_start == std::string::npos || key_end == std::string::npos || colon == std::string::npos) break;
+        
+        size_t value_start = colon + 1;
+        size_t value_end;
+        std::string value;
+        if (json[value_start] == '"') {
+            value_end = json.find('"', value_start + 1);
+            if (value_end == std::string::npos) break;
+            value = json.substr(value_start + 1, value_end - value_start - 1);
+            value_end++;
+        } else {
+            value_end = json.find_first_of(",}", value_start);
+            if (value_end == std::string::npos) break;
+            value = json.substr(value_start, value_end - value_start);
+        }
+        out[json.substr(key_start + 1, key_end - key_start - 1)] = value;
+        pos = value_end < json.size() && json[value_end] == ',' ? value_end + 1 : value_end;
+    }
+    return out;
+}
+
+bool readFile(const std::string& path, std::string& out) {
+    FILE* f = fopen(path.c_str(), "r");
+    if (f == nullptr) return false;
+    char buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+        out.append(buffer, n);
+    }
+    fclose(f);
+    return true;
+}
+
+// Throughput has to stay up, times have to stay down
+bool higherIsBetter(const std::string& metric) {
+    return metric.size() >= 14 && metric.compare(metric.size() - 14, 14, "tokens_per_sec") == 0;
+}
+
+int compareBaseline(const Options& opts, const std::string& current_json) {
+    std::string baseline_json;
+    if (!readFile(opts.baseline, baseline_json)) {
+        fprintf(stderr, "cannot read baseline %s\n", opts.baseline.c_str());
+        return 2;
+    }
+    
+    int regressions = 0;
+    std::map<std::string, std::string> before = flatObject(baseline_json, "metrics");
+    std::map<std::string, std::string> now = flatObject(current_json, "metrics");
+    fprintf(stderr, "\n%-36s %12s %12s %8s\n", "metric", "baseline", "current", "change");
+    for (const auto& entry : now) {
+        auto it = before.find(entry.first);
+        if (it == before.end()) continue;
+        double old_value = atof(it->second.c_str());
+        double new_value = atof(entry.second.c_str());
+        if (old_value <= 0) continue;
+        
+        double change = (new_value - old_value) / old_value;
+        double worse = higherIsBetter(entry.first) ? -change : change;
+        bool regressed = worse > opts.tolerance;
+        regressions += regressed;
+        fprintf(stderr, "%-36s %12.3f %12.3f %+7.1f%%%s\n", entry.first.c_str(), old_value, new_value,
+                change * 100, regressed ? "  REGRESSION" : "");
+    }
+    
+    std::map<std::string, std::string> old_outputs = flatObject(baseline_json, "outputs");
+    for (const auto& entry : flatObject(current_json, "outputs")) {
+        auto it = old_outputs.find(entry.first);
+        if (it == old_outputs.end() || it->second == entry.second) continue;
+        fprintf(stderr, "%-36s %12s %12s%s\n", entry.first.c_str(), it->second.c_str(), entry.second.c_str(),
+                opts.check_outputs ? "  CHANGED" : "");
+        regressions += opts.check_outputs;
+    }
+    
+    fprintf(stderr, "%d regression%s against %s\n", regressions, regressions == 1 ? "" : "s",
+            opts.baseline.c_str());
+    return regressions > 0 ? 1 : 0;
+}
+
+void quietLog(ggml_log_level, const char*, void*) {}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options opts;
+    if (!parseOptions(argc, argv, opts)) {
+        fputs(USAGE, stderr);
+        return 2;
+    }
+    
+    // The engine logs with printf off Android; keep stdout for the report
+    FILE* report_out = fdopen(dup(STDOUT_FILENO), "w");
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+    if (!opts.verbose) {
+        llama_log_set(quietLog, nullptr);
+    }
+    
+    InferenceEngine engine;
+    InferenceConfig config;
+    const CpuTopology& topology = CpuTopology::get();
+    config.threads = opts.threads > 0 ? opts.threads : topology.defaultDecodeThreads();
+    config.threads_batch = opts.threads > 0 ? opts.threads : topology.defaultPrefillThreads();
+    config.context_length = opts.context;
+    config.batch_size = opts.batch;
+    config.ubatch_size = opts.ubatch;
+    config.kv_type = GGML_TYPE_Q8_0;   // As createMobileConfig
+    config.n_discard = 64;
+    config.seed = opts.seed;
+    config.prefix_cache = true;        // Attached at load; scenarios opt in per request
+    config.prefix_cache_persist = false;
+    config.background_sequences = 0;
+    config.thermal_governor = false;   // Fixed thread counts, runs have to compare
+    
+    Results results;
+    int64_t load_start = LatencyTrace::nowUs();
+    if (!engine.loadModel(opts.model, config)) {
+        fprintf(stderr, "failed to load %s\n", opts.model.c_str());
+        return 2;
+    }
+    results.metric("load.ms", (LatencyTrace::nowUs() - load_start) / 1000.0);
+    
+    PromptMaker prompts(opts.model);
+    if (!prompts.ok()) {
+        fprintf(stderr, "failed to read the vocab of %s\n", opts.model.c_str());
+        return 2;
+    }
+    
+    std::string benchmark;
+    if (wants(opts, "benchmark")) {
+        BenchmarkConfig bench;
+        if (opts.threads > 0) bench.thread_counts = {opts.threads};
+        bench.ubatch_sizes = {opts.ubatch};
+        bench.repetitions = std::max(opts.repeat, 3);
+        fprintf(stderr, "running benchmark sweep\n");
+        benchmark = engine.runBenchmark(bench);
+    }
+    
+    struct Scenario {
+        const char* name;
+        void (*run)(InferenceEngine&, const InferenceConfig&, const PromptMaker&, const Options&, Results&);
+    };
+    const Scenario SCENARIOS[] = {
+        {"prefill", scenarioPrefill},
+        {"decode", scenarioDecode},
+        {"context_shift", scenarioContextShift},
+        {"cache_reuse", scenarioCacheReuse},
+    };
+    for (const Scenario& scenario : SCENARIOS) {
+        if (!wants(opts, scenario.name)) continue;
+        fprintf(stderr, "running %s x %d\n", scenario.name, opts.repeat);
+        scenario.run(engine, engine.getConfig(), prompts, opts, results);
+    }
+    
+    std::string json = report(opts, engine.getConfig(), results, benchmark);
+    engine.unloadModel();
+    
+    if (opts.out.empty()) {
+        fputs(json.c_str(), report_out);
+    } else {
+        FILE* f = fopen(opts.out.c_str(), "w");
+        if (f == nullptr) {
+            fprintf(stderr, "cannot write %s\n", opts.out.c_str());
+            return 2;
+        }
+        fputs(json.c_str(), f);
+        fclose(f);
+    }
+    fflush(report_out);
+    
+    return opts.baseline.empty() ? 0 : compareBaseline(opts, json);
+}
@@ -0,0 +1,360 @@
+// Unit tests for the engine pieces that need no model: the JSON Schema to
+// GBNF converter, SHA-256, and the top-k sampler against llama's own
+// sampler chain. Run through ctest; prints each failed check and exits
+// with 1 if there was any.
+
+#include "json_schema.h"
+#include "sha256.h"
+#include "token_sampler.h"
+#include "llama.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace cortex;
+
+namespace {
+
+int g_failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            g_failures++; \
+        } \
+    } while (0)
+
+bool contains(const std::string& text, const std::string& part) {
+    return text.find(part) != std::string::npos;
+}
+
+// ============================================
+// JSON Schema -> GBNF
+// ============================================
+
+std::string grammarOf(const std::string& schema) {
+    std::string grammar, error;
+    if (!jsonSchemaToGrammar(schema, grammar, error)) {
+        fprintf(stderr, "schema rejected: %s (%s)\n", schema.c_str(), error.c_str());
+        g_failures++;
+    }
+    return grammar;
+}
+
+void testSchemaCommas() {
+    // Optional before the first required one ends in a comma, optional
+    // after it starts with one
+    std::string grammar = grammarOf(
+        "{\"type\":\"object\",\"properties\":{\"a\":{\"type\":\"string\"},"
+        "\"b\":{\"type\":\"integer\"},\"c\":{\"type\":\"boolean\"}},\"required\":[\"b\"]}");
+    CHECK(contains(grammar, "root ::= r3\n"));
+    CHECK(contains(grammar, "r0 ::= \"\\\"a\\\"\" ws \":\" ws string\n"));
+    CHECK(contains(grammar, "r3 ::= \"{\" ws (r0 \",\" ws)? r1 (\",\" ws r2)? \"}\" ws\n"));
+    
+    // Required ones are joined unconditionally, optional ones in between
+    grammar = grammarOf(
+        "{\"properties\":{\"a\":{\"type\":\"null\"},\"b\":{\"type\":\"null\"},"
+        "\"c\":{\"type\":\"null\"}},\"required\":[\"c\",\"a\"]}");
+    CHECK(contains(grammar, "r3 ::= \"{\" ws r0 (\",\" ws r1)? \",\" ws r2 \"}\" ws\n"));
+    
+    // All optional: any one first, then any of the later ones
+    grammar = grammarOf(
+        "{\"properties\":{\"a\":{\"type\":\"null\"},\"b\":{\"type\":\"null\"},"
+        "\"c\":{\"type\":\"null\"}}}");
+    CHECK(contains(grammar, "r3 ::= \"{\" ws (r0 (\",\" ws r1)? (\",\" ws r2)? | r1 (\",\" ws r2)? | r2)? "
+                            "\"}\" ws\n"));
+    
+    // Only the primitives in use are emitted, once each
+    CHECK(contains(grammar, "null ::= \"null\" ws\n"));
+    CHECK(!contains(grammar, "string ::="));
+    CHECK(grammar.find("ws ::=") == grammar.rfind("ws ::="));
+}
+
+void testSchemaEscaping() {
+    // Each value as the model must write it (JSON), then as a GBNF literal
+    std::string grammar = grammarOf("{\"enum\":[\"a\\\"b\",\"c\\\\d\",\"e\\nf\",1,null]}");
+    CHECK(contains(grammar, "r0 ::= (\"\\\"a\\\\\\\"b\\\"\" | \"\\\"c\\\\\\\\d\\\"\" | \"\\\"e\\\\nf\\\"\" | "
+                            "\"1\" | \"null\") ws\n"));
+    
+    grammar = grammarOf("{\"const\":{\"k\":\"v\\\"w\",\"n\":[1,true]}}");
+    CHECK(contains(grammar, "r0 ::= \"{\\\"k\\\":\\\"v\\\\\\\"w\\\",\\\"n\\\":[1,true]}\" ws\n"));
+    
+    // Control characters in names become \u escapes in the JSON
+    grammar = grammarOf("{\"properties\":{\"t\\u0001\":{\"type\":\"null\"}},\"required\":[\"t\\u0001\"]}");
+    CHECK(contains(grammar, "r0 ::= \"\\\"t\\\\u0001\\\"\" ws"));
+}
+
+void testSchemaRejects() {
+    std::string grammar, error;
+    CHECK(!jsonSchemaToGrammar("{\"$ref\":\"#/$defs/x\"}", grammar, error));
+    CHECK(error == "$ref is not supported");
+    
+    error.clear();
+    CHECK(!jsonSchemaToGrammar("{\"type\":\"object\",\"properties\":{\"x\":{\"$ref\":\"#/$defs/x\"}}}",
+                               grammar, error));
+    CHECK(error == "$ref is not supported");
+    
+    error.clear();
+    CHECK(!jsonSchemaToGrammar("{\"type\":\"object\"", grammar, error));
+    CHECK(!error.empty());
+    
+    error.clear();
+    CHECK(!jsonSchemaToGrammar("{\"enum\":[]}", grammar, error));
+    CHECK(!error.empty());
+}
+
+// ============================================
+// SHA-256
+// ============================================
+
+std::string sha256(const std::string& data) {
+    Sha256 hash;
+    hash.update(data.data(), data.size());
+    return hash.finishHex();
+}
+
+void testSha256Vectors() {
+    // FIPS 180-4 examples
+    CHECK(sha256("") == "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+    CHECK(sha256("abc") == "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+    CHECK(sha256("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq") ==
+          "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+    CHECK(sha256(std::string(1000000, 'a')) ==
+          "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+    
+    // Padding edge: 55 bytes fit one block, 56 need two
+    CHECK(sha256(std::string(55, 'a')) == "9f4390f8d30c2dd92ec9f095b65e2b9ae9b0a925a5258e241c9f1e910f734318");
+    CHECK(sha256(std::string(56, 'a')) == "b35439a4ac6f0948b6d6f9e3c6af0f5f590ce20f1bde7090ef7970686ec6738a");
+}
+
+void testSha256Chunks() {
+    std::string data;
+    std::mt19937 rng(7);
+    for (int i = 0; i < 10000; i++) {
+        data += static_cast<char>(rng() & 0xFF);
+    }
+    std::string whole = sha256(data);
+    
+    // Any split into updates gives the same digest
+    Sha256 hash;
+    size_t pos = 0;
+    while (pos < data.size()) {
+        size_t n = std::min<size_t>(rng() % 200, data.size() - pos);
+        hash.update(data.data() + pos, n);
+        pos += n;
+    }
+    CHECK(hash.bytes() == data.size());
+    CHECK(hash.finishHex() == whole);
+    
+    // Saved at a block boundary and resumed in a fresh hasher
+    size_t split = Sha256::BLOCK_BYTES * 37;
+    Sha256 first;
+    first.update(data.data(), split);
+    Sha256 resumed;
+    CHECK(resumed.restore(first.stateHex(), first.bytes()));
+    resumed.update(data.data() + split, data.size() - split);
+    CHECK(resumed.finishHex() == whole);
+    
+    // Only whole blocks and well-formed states
+    CHECK(!resumed.restore(first.stateHex(), split + 1));
+    CHECK(!resumed.restore(first.stateHex().substr(1), split));
+    CHECK(!resumed.restore(std::string(64, 'g'), split));
+}
+
+// ============================================
+// TokenSampler vs llama's chain
+// ============================================
+
+// Not a multiple of 16, so the scan's scalar tail runs too
+const int N_VOCAB = 1003;
+
+struct Logits {
+    std::vector<float> base;
+    std::vector<float> row;
+    std::mt19937 rng;
+    
+    Logits(float lo, float hi, uint32_t seed) : base(N_VOCAB), row(N_VOCAB), rng(seed) {
+        std::uniform_real_distribution<float> dist(lo, hi);
+        for (float& logit : base) logit = dist(rng);
+    }
+    
+    // The same few tokens stay on top, so the penalty keeps deciding
+    const float* next() {
+        std::uniform_real_distribution<float> noise(-0.2f, 0.2f);
+        for (int i = 0; i < N_VOCAB; i++) row[i] = base[i] + noise(rng);
+        return row.data();
+    }
+};
+
+llama_token_data_array candidates(const float* logits, std::vector<llama_token_data>& data) {
+    data.resize(N_VOCAB);
+    for (int i = 0; i < N_VOCAB; i++) {
+        data[i] = {i, logits[i], 0.0f};
+    }
+    return {data.data(), data.size(), -1, false};
+}
+
+// Greedy under the repetition penalty: llama's penalties + greedy
+bool samplerMatchesGreedy(float lo, float hi, float penalty, int last_n) {
+    SamplerParams params;
+    params.temperature = 0.0f;
+    params.repeat_penalty = penalty;
+    params.repeat_last_n = last_n;
+    TokenSampler sampler;
+    sampler.configure(params, N_VOCAB);
+    
+    llama_sampler* chain = llama_sampler_chain_init(llama_sampler_chain_default_params());
+    llama_sampler_chain_add(chain, llama_sampler_init_penalties(last_n, penalty, 0.0f, 0.0f));
+    llama_sampler_chain_add(chain, llama_sampler_init_greedy());
+    
+    Logits logits(lo, hi, 11);
+    std::vector<llama_token_data> data;
+    bool ok = true;
+    for (int step = 0; ok && step < 300; step++) {
+        const float* row = logits.next();
+        llama_token_data_array cur = candidates(row, data);
+        llama_sampler_apply(chain, &cur);
+        llama_token expected = cur.data[cur.selected].id;
+        llama_sampler_accept(chain, expected);
+        
+        llama_token token = sampler.sample(row);
+        if (token != expected) {
+            fprintf(stderr, "greedy step %d: %d, llama %d\n", step, token, expected);
+            ok = false;
+        }
+    }
+    llama_sampler_free(chain);
+    return ok;
+}
+
+// Sampled: llama's penalties + top-k pick the candidates, the draw from
+// them is TokenSampler's own (same rng, same arithmetic)
+bool samplerMatchesTopK(int top_k, float top_p, float penalty, int last_n) {
+    SamplerParams params;
+    params.temperature = 0.8f;
+    params.top_k = top_k;
+    params.top_p = top_p;
+    params.repeat_penalty = penalty;
+    params.repeat_last_n = last_n;
+    params.seed = 42;
+    TokenSampler sampler;
+    sampler.configure(params, N_VOCAB);
+    
+    llama_sampler* chain = llama_sampler_chain_init(llama_sampler_chain_default_params());
+    llama_sampler_chain_add(chain, llama_sampler_init_penalties(last_n, penalty, 0.0f, 0.0f));
+    llama_sampler_chain_add(chain, llama_sampler_init_top_k(top_k));
+    std::mt19937 rng(params.seed);
+    
+    Logits logits(-4.0f, 4.0f, 23);
+    std::vector<llama_token_data> data;
+    std::vector<float> probs;
+    bool ok = true;
+    for (int step = 0; ok && step < 300; step++) {
+        const float* row = logits.next();
+        llama_token_data_array cur = candidates(row, data);
+        llama_sampler_apply(chain, &cur);
+        
+        // Top-p at temperature 1, then temperature, then one draw
+        int n = cur.size;
+        float max_logit = cur.data[0].logit;
+        probs.resize(n);
+        float sum = 0;
+        for (int i = 0; i < n; i++) {
+            probs[i] = std::exp(cur.data[i].logit - max_logit);
+            sum += probs[i];
+        }
+        if (top_p < 1.0f) {
+            float target = top_p * sum;
+            float cum = 0;
+            for (int i = 0; i < n; i++) {
+                cum += probs[i];
+                if (cum >= target) {
+                    n = i + 1;
+                    break;
+                }
+            }
+        }
+        sum = 0;
+        for (int i = 0; i < n; i++) {
+            probs[i] = std::exp((cur.data[i].logit - max_logit) / params.temperature);
+            sum += probs[i];
+        }
+        float r = std::uniform_real_distribution<float>(0.0f, sum)(rng);
+        llama_token expected = cur.data[n - 1].id;
+        for (int i = 0; i < n; i++) {
+            r -= probs[i];
+            if (r <= 0) {
+                expected = cur.data[i].id;
+                break;
+            }
+        }
+        llama_sampler_accept(chain, expected);
+        
+        llama_token token = sampler.sample(row);
+        if (token != expected) {
+            fprintf(stderr, "top-%d step %d: %d, llama %d\n", top_k, step, token, expected);
+            ok = false;
+        }
+    }
+    llama_sampler_free(chain);
+    return ok;
+}
+
+void testSampler() {
+    // Positive logits are divided by the penalty, negative ones multiplied
+    CHECK(samplerMatchesGreedy(-2.0f, 6.0f, 1.5f, 8));
+    CHECK(samplerMatchesGreedy(-9.0f, -1.0f, 1.5f, 8));
+    CHECK(samplerMatchesGreedy(-2.0f, 6.0f, 1.1f, 64));
+    CHECK(samplerMatchesGreedy(-2.0f, 6.0f, 1.0f, 64));
+    
+    // Window wider than k: the penalized tokens come from outside the top k
+    CHECK(samplerMatchesTopK(5, 1.0f, 1.3f, 64));
+    CHECK(samplerMatchesTopK(40, 0.9f, 1.1f, 64));
+    CHECK(samplerMatchesTopK(TokenSampler::MAX_TOP_K, 0.95f, 1.2f, 16));
+    CHECK(samplerMatchesTopK(40, 1.0f, 1.0f, 0));
+}
+
+void testSamplerReset() {
+    // A fixed seed replays the same tokens after reset()
+    SamplerParams params;
+    params.seed = 5;
+    TokenSampler sampler;
+    sampler.configure(params, N_VOCAB);
+    
+    Logits logits(-4.0f, 4.0f, 31);
+    std::vector<std::vector<float>> rows;
+    for (int i = 0; i < 50; i++) {
+        const float* row = logits.next();
+        rows.emplace_back(row, row + N_VOCAB);
+    }
+    
+    std::vector<llama_token> first, second;
+    for (const auto& row : rows) first.push_back(sampler.sample(row.data()));
+    sampler.reset();
+    for (const auto& row : rows) second.push_back(sampler.sample(row.data()));
+    CHECK(first == second);
+}
+
+} // namespace
+
+int main() {
+    testSchemaCommas();
+    testSchemaEscaping();
+    testSchemaRejects();
+    testSha256Vectors();
+    testSha256Chunks();
+    testSampler();
+    testSamplerReset();
+    
+    if (g_failures > 0) {
+        fprintf(stderr, "%d check(s) failed\n", g_failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
@@ -8,6 +8,9 @@ import UIKit
     didFinishLaunchingWithOptions launchOptions: [UIApplication.LaunchOptionsKey: Any]?
   ) -> Bool {
     GeneratedPluginRegistrant.register(with: self)
+    
+    // Register the inference engine plugin
+    InferenceEnginePlugin.register(with: registrar(forPlugin: "InferenceEnginePlugin")!)
     return super.application(application, didFinishLaunchingWithOptions: launchOptions)
   }
 }
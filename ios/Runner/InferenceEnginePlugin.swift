@@ -0,0 +1,355 @@
+import Flutter
+import UIKit
+
+// iOS side of the "inference_engine" channels, the counterpart of
+// InferenceEnginePlugin.kt on Android. Every call goes to the shared C++
+// engine through cortex_api.h; blocking calls run off the main thread.
+class InferenceEnginePlugin: NSObject, FlutterPlugin, FlutterStreamHandler {
+  
+  // Concurrent like Dispatchers.IO: stopGeneration must not queue behind
+  // a long load or benchmark
+  private let queue = DispatchQueue(label: "com.aarav.cortex.inference", qos: .userInitiated,
+                                    attributes: .concurrent)
+  private var eventSink: FlutterEventSink?
+  private var observers: [NSObjectProtocol] = []
+  
+  // ComponentCallbacks2 levels the native reclaim understands
+  private static let trimMemoryRunningCritical: Int32 = 15
+  private static let trimMemoryBackground: Int32 = 40
+  private static let trimMemoryComplete: Int32 = 80
+  
+  static func register(with registrar: FlutterPluginRegistrar) {
+    let instance = InferenceEnginePlugin()
+    
+    let channel = FlutterMethodChannel(name: "inference_engine", binaryMessenger: registrar.messenger())
+    registrar.addMethodCallDelegate(instance, channel: channel)
+    
+    // EventChannel for session events pushed from the native generation thread
+    let eventChannel = FlutterEventChannel(name: "inference_engine/tokens", binaryMessenger: registrar.messenger())
+    eventChannel.setStreamHandler(instance)
+    
+    instance.startSystemMonitors()
+  }
+  
+  deinit {
+    observers.forEach { NotificationCenter.default.removeObserver($0) }
+  }
+  
+  // Thermal state and memory warnings drive the same native governor and
+  // reclaim stages as PowerManager and onTrimMemory do on Android
+  private func startSystemMonitors() {
+    let center = NotificationCenter.default
+    
+    observers.append(center.addObserver(forName: ProcessInfo.thermalStateDidChangeNotification,
+                                        object: nil, queue: nil) { [weak self] _ in
+      self?.updateThermalState()
+    })
+    updateThermalState()
+    
+    observers.append(center.addObserver(forName: UIApplication.didReceiveMemoryWarningNotification,
+                                        object: nil, queue: .main) { [weak self] _ in
+      let background = UIApplication.shared.applicationState == .background
+      self?.trimMemory(background ? InferenceEnginePlugin.trimMemoryComplete
+                                  : InferenceEnginePlugin.trimMemoryRunningCritical)
+    })
+    
+    observers.append(center.addObserver(forName: UIApplication.didEnterBackgroundNotification,
+                                        object: nil, queue: .main) { [weak self] _ in
+      // Metal command buffers fail once the app is in the background
+      self?.queue.async { cortex_stop_generation() }
+      self?.trimMemory(InferenceEnginePlugin.trimMemoryBackground)
+    })
+  }
+  
+  private func updateThermalState() {
+    // Onto PowerManager.THERMAL_STATUS_*: none, light, severe, critical
+    let status: Int32
+    switch ProcessInfo.processInfo.thermalState {
+    case .nominal: status = 0
+    case .fair: status = 1
+    case .serious: status = 3
+    case .critical: status = 4
+    @unknown default: status = 0
+    }
+    cortex_set_thermal_state(status, -1)
+  }
+  
+  private func trimMemory(_ level: Int32) {
+    // Reclaim may rebuild the context; keep it off the main thread
+    queue.async { cortex_on_trim_memory(level) }
+  }
+  
+  // FlutterStreamHandler implementation
+  func onListen(withArguments arguments: Any?, eventSink events: @escaping FlutterEventSink) -> FlutterError? {
+    eventSink = events
+    return nil
+  }
+  
+  func onCancel(withArguments arguments: Any?) -> FlutterError? {
+    eventSink = nil
+    return nil
+  }
+  
+  // Called by the native generation thread for every session event: type
+  // 0 carries text, 1 (done) and 2 (error) the final stats JSON. The
+  // plugin is passed unretained; the registrar keeps it for the app's life.
+  private static let sessionCallback: CortexSessionCallback = { userData, session, type, data in
+    guard let userData = userData else { return }
+    let plugin = Unmanaged<InferenceEnginePlugin>.fromOpaque(userData).takeUnretainedValue()
+    let text = data.map { String(cString: $0) } ?? ""
+    DispatchQueue.main.async {
+      plugin.eventSink?(["session": session, "type": Int(type), "data": text])
+    }
+  }
+  
+  // Copies and frees a string returned by the C API
+  private static func take(_ str: UnsafeMutablePointer<CChar>?) -> String {
+    guard let str = str else { return "" }
+    defer { cortex_string_free(str) }
+    return String(cString: str)
+  }
+  
+  // Runs `work` on the engine queue and answers on the main thread
+  private func background(_ result: @escaping FlutterResult, _ work: @escaping () -> Any?) {
+    queue.async {
+      let value = work()
+      DispatchQueue.main.async { result(value) }
+    }
+  }
+  
+  func handle(_ call: FlutterMethodCall, result: @escaping FlutterResult) {
+    let args = call.arguments as? [String: Any] ?? [:]
+    let modelPath = args["modelPath"] as? String
+    let prompt = args["prompt"] as? String
+    let temperature = Float(args["temperature"] as? Double ?? 0.7)
+    let topP = Float(args["topP"] as? Double ?? 0.9)
+    let topK = Int32(args["topK"] as? Int ?? 40)
+    let maxTokens = Int32(args["maxTokens"] as? Int ?? 2048)
+    let grammar = args["grammar"] as? String ?? ""
+    let jsonSchema = args["jsonSchema"] as? String ?? ""
+    
+    switch call.method {
+    case "loadModel":
+      guard let path = modelPath else {
+        result(FlutterError(code: "INVALID_ARGUMENT", message: "Model path is required", details: nil))
+        return
+      }
+      background(result) { cortex_load_model(path) }
+    
+    case "preflightModel":
+      guard let path = modelPath else {
+        result(FlutterError(code: "INVALID_ARGUMENT", message: "Model path is required", details: nil))
+        return
+      }
+      background(result) { InferenceEnginePlugin.take(cortex_preflight_model(path)) }
+    
+    case "getLoadError":
+      result(InferenceEnginePlugin.take(cortex_get_load_error()))
+    
+    case "startModelLoad":
+      guard let path = modelPath else {
+        result(FlutterError(code: "INVALID_ARGUMENT", message: "Model path is required", details: nil))
+        return
+      }
+      // Waits for a previous load's worker to wind down
+      background(result) { cortex_start_model_load(path) }
+    
+    case "cancelModelLoad":
+      cortex_cancel_model_load()
+      result(true)
+    
+    case "getLoadProgress":
+      result(InferenceEnginePlugin.take(cortex_get_load_progress()))
+    
+    case "unloadModel":
+      background(result) {
+        cortex_unload_model()
+        return true
+      }
+    
+    case "loadDraftModel":
+      guard let path = modelPath else {
+        result(FlutterError(code: "INVALID_ARGUMENT", message: "Model path is required", details: nil))
+        return
+      }
+      background(result) { cortex_load_draft_model(path) }
+    
+    case "unloadDraftModel":
+      background(result) {
+        cortex_unload_draft_model()
+        return true
+      }
+    
+    case "hasDraftModel":
+      result(cortex_has_draft_model())
+    
+    case "isModelLoaded":
+      result(cortex_is_model_loaded())
+    
+    case "getGpuInfo":
+      let path = modelPath ?? ""
+      background(result) { InferenceEnginePlugin.take(cortex_get_gpu_info(path)) }
+    
+    case "tuneGpuLayers":
+      guard let path = modelPath else {
+        result(FlutterError(code: "INVALID_ARGUMENT", message: "Model path is required", details: nil))
+        return
+      }
+      // One model load per split; takes a while
+      background(result) { InferenceEnginePlugin.take(cortex_tune_gpu_layers(path)) }
+    
+    case "getModelInfo":
+      result(InferenceEnginePlugin.take(cortex_get_model_info()))
+    
+    case "startChat":
+      // Structured messages; the chat template is applied natively. Returns
+      // the session handle at once; output follows as events.
+      guard let messages = args["messages"] as? [[String: String]], !messages.isEmpty else {
+        result(FlutterError(code: "INVALID_ARGUMENT", message: "Messages are required", details: nil))
+        return
+      }
+      let roles = messages.map { $0["role"] ?? "user" }
+      let contents = messages.map { $0["content"] ?? "" }
+      let speculative = args["speculative"] as? Bool ?? false
+      let stream = args["stream"] as? Bool ?? false
+      let userData = Unmanaged.passUnretained(self).toOpaque()
+      // Waits for a running session to end, and may reload a suspended model
+      background(result) {
+        InferenceEnginePlugin.withCStrings(roles) { rolePtrs in
+          InferenceEnginePlugin.withCStrings(contents) { contentPtrs in
+            cortex_start_chat_session(rolePtrs, contentPtrs, Int32(messages.count),
+                                      temperature, topP, topK, maxTokens, grammar, jsonSchema,
+                                      speculative, stream,
+                                      InferenceEnginePlugin.sessionCallback, userData)
+          }
+        }
+      }
+    
+    case "startCompletion":
+      // Raw prompt; incremental continues the cached sequence
+      guard let prompt = prompt else {
+        result(FlutterError(code: "INVALID_ARGUMENT", message: "Prompt is required", details: nil))
+        return
+      }
+      let incremental = args["incremental"] as? Bool ?? false
+      let speculative = args["speculative"] as? Bool ?? false
+      let stream = args["stream"] as? Bool ?? false
+      let userData = Unmanaged.passUnretained(self).toOpaque()
+      background(result) {
+        cortex_start_prompt_session(prompt, incremental, temperature, topP, topK, maxTokens,
+                                    grammar, jsonSchema, speculative, stream,
+                                    InferenceEnginePlugin.sessionCallback, userData)
+      }
+    
+    case "startBackground":
+      // Titles, summaries, suggestions: decoded next to the running session
+      // in the same batches. Messages or a raw prompt.
+      let messages = args["messages"] as? [[String: String]] ?? []
+      let backgroundPrompt = prompt ?? ""
+      guard !messages.isEmpty || !backgroundPrompt.isEmpty else {
+        result(FlutterError(code: "INVALID_ARGUMENT", message: "Messages or a prompt are required", details: nil))
+        return
+      }
+      let roles = messages.map { $0["role"] ?? "user" }
+      let contents = messages.map { $0["content"] ?? "" }
+      let backgroundTokens = Int32(args["maxTokens"] as? Int ?? 128)
+      let userData = Unmanaged.passUnretained(self).toOpaque()
+      background(result) {
+        InferenceEnginePlugin.withCStrings(roles) { rolePtrs in
+          InferenceEnginePlugin.withCStrings(contents) { contentPtrs in
+            cortex_start_background_session(rolePtrs, contentPtrs, Int32(messages.count), backgroundPrompt,
+                                            temperature, topP, topK, backgroundTokens, grammar, jsonSchema,
+                                            InferenceEnginePlugin.sessionCallback, userData)
+          }
+        }
+      }
+    
+    case "cancelSession":
+      let session = (args["session"] as? NSNumber)?.int64Value ?? 0
+      background(result) {
+        cortex_cancel_session(session)
+        return true
+      }
+    
+    case "clearCache":
+      cortex_clear_cache()
+      result(true)
+    
+    case "getCachedTokenCount":
+      result(Int(cortex_get_cached_token_count()))
+    
+    case "selectConversation":
+      let conversationId = (args["conversationId"] as? NSNumber)?.int64Value ?? 0
+      background(result) { Int(cortex_select_conversation(conversationId)) }
+    
+    case "forkConversation":
+      guard let srcId = (args["srcId"] as? NSNumber)?.int64Value,
+            let dstId = (args["dstId"] as? NSNumber)?.int64Value else {
+        result(FlutterError(code: "INVALID_ARGUMENT", message: "srcId and dstId are required", details: nil))
+        return
+      }
+      background(result) { cortex_fork_conversation(srcId, dstId) }
+    
+    case "releaseConversation":
+      let conversationId = (args["conversationId"] as? NSNumber)?.int64Value ?? 0
+      background(result) {
+        cortex_release_conversation(conversationId)
+        return true
+      }
+    
+    case "isGenerating":
+      result(cortex_is_generating())
+    
+    case "stopGeneration":
+      // Returns once the running session has sent its final event
+      background(result) {
+        cortex_stop_generation()
+        return true
+      }
+    
+    case "getStats":
+      result(InferenceEnginePlugin.take(cortex_get_stats()))
+    
+    case "resetStats":
+      cortex_reset_stats()
+      result(true)
+    
+    case "getMemoryInfo":
+      result(InferenceEnginePlugin.take(cortex_get_memory_info()))
+    
+    case "getMemoryUsage":
+      result(Int(cortex_get_memory_usage()))
+    
+    case "runBenchmark":
+      // Empty lists fall back to the native defaults
+      let promptLengths = (args["promptLengths"] as? [Int] ?? []).map { Int32($0) }
+      let decodeDepths = (args["decodeDepths"] as? [Int] ?? []).map { Int32($0) }
+      let decodeTokens = Int32(args["decodeTokens"] as? Int ?? 0)
+      let threadCounts = (args["threadCounts"] as? [Int] ?? []).map { Int32($0) }
+      let ubatchSizes = (args["ubatchSizes"] as? [Int] ?? []).map { Int32($0) }
+      let warmup = Int32(args["warmup"] as? Int ?? 1)
+      let repetitions = Int32(args["repetitions"] as? Int ?? 0)
+      background(result) {
+        InferenceEnginePlugin.take(cortex_run_benchmark(
+          promptLengths, Int32(promptLengths.count),
+          decodeDepths, Int32(decodeDepths.count),
+          decodeTokens,
+          threadCounts, Int32(threadCounts.count),
+          ubatchSizes, Int32(ubatchSizes.count),
+          warmup, repetitions))
+      }
+    
+    default:
+      result(FlutterMethodNotImplemented)
+    }
+  }
+  
+  // NUL-terminated copies of `strings`, valid for the duration of `body`
+  private static func withCStrings<T>(_ strings: [String],
+                                      _ body: (UnsafePointer<UnsafePointer<CChar>?>) -> T) -> T {
+    let copies = strings.map { strdup($0) }
+    defer { copies.forEach { free($0) } }
+    let pointers = copies.map { UnsafePointer<CChar>($0) }
+    return pointers.withUnsafeBufferPointer { body($0.baseAddress!) }
+  }
+}
@@ -1,64 +0,0 @@
-// Swift bridge for llama.cpp on iOS
-// This file provides Swift interface to llama.cpp functions
-
-import Foundation
-
-@_cdecl("llama_init")
-public func llamaInit() -> Int32 {
-    // TODO: Initialize llama.cpp if needed
-    return 0
-}
-
-@_cdecl("llama_load_model")
-public func llamaLoadModel(_ modelPath: UnsafePointer<CChar>) -> UnsafeMutableRawPointer? {
-    // TODO: Load model from file path
-    // let path = String(cString: modelPath)
-    // Call llama.cpp C API to load model
-    // Return model pointer
-    return nil // Placeholder
-}
-
-@_cdecl("llama_create_context")
-public func llamaCreateContext(_ modelPtr: UnsafeMutableRawPointer?, _ nCtx: Int32) -> UnsafeMutableRawPointer? {
-    // TODO: Create context from model
-    // Call llama.cpp C API to create context
-    // Return context pointer
-    return nil // Placeholder
-}
-
-@_cdecl("llama_tokenize")
-public func llamaTokenize(_ ctxPtr: UnsafeMutableRawPointer?, _ text: UnsafePointer<CChar>, _ tokens: UnsafeMutablePointer<Int32>, _ maxTokens: Int32) -> Int32 {
-    // TODO: Tokenize text
-    // Call llama.cpp C API to tokenize
-    // Return number of tokens
-    return 0 // Placeholder
-}
-
-@_cdecl("llama_decode")
-public func llamaDecode(_ ctxPtr: UnsafeMutableRawPointer?, _ token: Int32) -> Int32 {
-    // TODO: Decode token
-    // Call llama.cpp C API to decode
-    // Return result code
-    return 0 // Placeholder
-}
-
-@_cdecl("llama_sample")
-public func llamaSample(_ ctxPtr: UnsafeMutableRawPointer?, _ temperature: Double) -> Int32 {
-    // TODO: Sample next token
-    // Call llama.cpp C API to sample
-    // Return token ID
-    return 0 // Placeholder
-}
-
-@_cdecl("llama_free_model")
-public func llamaFreeModel(_ modelPtr: UnsafeMutableRawPointer?) {
-    // TODO: Free model
-    // Call llama.cpp C API to free model
-}
-
-@_cdecl("llama_free_context")
-public func llamaFreeContext(_ ctxPtr: UnsafeMutableRawPointer?) {
-    // TODO: Free context
-    // Call llama.cpp C API to free context
-}
-
@@ -1 +1,2 @@
 #import "GeneratedPluginRegistrant.h"
+#import "cortex_api.h"
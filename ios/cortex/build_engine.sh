@@ -0,0 +1,40 @@
+#!/bin/sh
+# Builds the native engine and llama.cpp into one static library,
+# build/<platform>/libcortex.a, which Cortex.xcconfig links into Runner.
+# Runs as the Runner target's "Build Cortex Engine" phase; outside Xcode
+# pass the platform: ./build_engine.sh iphoneos|iphonesimulator
+set -e
+
+HERE="$(cd "$(dirname "$0")" && pwd)"
+PLATFORM="${PLATFORM_NAME:-${1:-iphoneos}}"
+BUILD_TYPE=Release
+if [ "${CONFIGURATION}" = "Debug" ]; then
+    BUILD_TYPE=RelWithDebInfo  # An unoptimized engine is unusably slow even when debugging
+fi
+
+case "$PLATFORM" in
+    iphoneos) ARCHS_LIST="arm64" ;;
+    iphonesimulator) ARCHS_LIST="${ARCHS:-arm64}" ;;
+    *) echo "error: unsupported platform $PLATFORM" >&2; exit 1 ;;
+esac
+
+BUILD="$HERE/build/$PLATFORM"
+OUT="$BUILD/libcortex.a"
+
+if [ ! -d "$HERE/../../android/app/src/main/cpp/llama.cpp" ]; then
+    echo "error: llama.cpp missing; clone it into android/app/src/main/cpp/llama.cpp" >&2
+    exit 1
+fi
+
+cmake -S "$HERE" -B "$BUILD" \
+    -DCMAKE_SYSTEM_NAME=iOS \
+    -DCMAKE_OSX_SYSROOT="$PLATFORM" \
+    -DCMAKE_OSX_ARCHITECTURES="$(echo "$ARCHS_LIST" | tr ' ' ';')" \
+    -DCMAKE_OSX_DEPLOYMENT_TARGET="${IPHONEOS_DEPLOYMENT_TARGET:-13.0}" \
+    -DCMAKE_BUILD_TYPE="$BUILD_TYPE"
+cmake --build "$BUILD" --config "$BUILD_TYPE" -j "$(sysctl -n hw.ncpu)"
+
+# One archive so the app links a single -force_load (the FFI stream and the
+# C API are only reached through dlsym and would otherwise be dropped)
+rm -f "$OUT"
+libtool -static -o "$OUT" $(find "$BUILD" -name '*.a' ! -name libcortex.a)
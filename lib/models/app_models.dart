@@ -20,6 +20,7 @@ class Model {
   final ModelStatus status;
   final double downloadProgress;
   final String? downloadUrl;
+  final String? sha256;          // Expected hash of the download; null: the server's, if any
   final String? localPath;
 
   Model({
@@ -30,6 +31,7 @@ class Model {
     this.status = ModelStatus.notDownloaded,
     this.downloadProgress = 0.0,
     this.downloadUrl,
+    this.sha256,
     this.localPath,
   });
 
@@ -41,6 +43,7 @@ class Model {
     ModelStatus? status,
     double? downloadProgress,
     String? downloadUrl,
+    String? sha256,
     String? localPath,
   }) {
     return Model(
@@ -51,6 +54,7 @@ class Model {
       status: status ?? this.status,
       downloadProgress: downloadProgress ?? this.downloadProgress,
       downloadUrl: downloadUrl ?? this.downloadUrl,
+      sha256: sha256 ?? this.sha256,
       localPath: localPath ?? this.localPath,
     );
   }
@@ -62,6 +62,7 @@ class _ChatPageState extends State<ChatPage> {
                   icon: const Icon(Icons.clear_all),
                   tooltip: 'Clear chat',
                 ),
+              _buildConversationMenu(chatProvider),
             ],
           ),
           body: modelProvider.selectedModel == null
@@ -86,6 +87,55 @@ class _ChatPageState extends State<ChatPage> {
     );
   }
 
+  Widget _buildConversationMenu(ChatProvider chatProvider) {
+    // Positive values select a conversation, sentinels trigger actions
+    const newChat = -1;
+    const forkChat = -2;
+
+    return PopupMenuButton<int>(
+      icon: const Icon(Icons.forum_outlined),
+      tooltip: 'Conversations',
+      onSelected: (value) {
+        if (value == newChat) {
+          chatProvider.newConversation();
+        } else if (value == forkChat) {
+          chatProvider.forkConversation();
+        } else {
+          chatProvider.switchConversation(value);
+        }
+      },
+      itemBuilder: (context) => [
+        const PopupMenuItem(
+          value: newChat,
+          child: ListTile(
+            leading: Icon(Icons.add_comment_outlined),
+            title: Text('New chat'),
+          ),
+        ),
+        if (chatProvider.hasMessages)
+          const PopupMenuItem(
+            value: forkChat,
+            child: ListTile(
+              leading: Icon(Icons.call_split),
+              title: Text('Fork chat'),
+            ),
+          ),
+        if (chatProvider.conversationIds.length > 1) const PopupMenuDivider(),
+        if (chatProvider.conversationIds.length > 1)
+          for (final id in chatProvider.conversationIds)
+            PopupMenuItem(
+              value: id,
+              child: ListTile(
+                leading: Icon(id == chatProvider.currentConversationId
+                    ? Icons.chat_bubble
+                    : Icons.chat_bubble_outline),
+                title: Text('Chat ${id + 1}'),
+              ),
+            ),
+      ],
+    );
+  }
+
   Widget _buildChatInterface(BuildContext context, ChatProvider chatProvider) {
     _scrollToBottom();
 
@@ -102,6 +102,10 @@ class _ModelsPageState extends State<ModelsPage> {
             onTap: model.status == ModelStatus.downloaded 
                 ? () => _onModelTap(context, model, provider)
                 : null,
+            // Long press toggles the model as the speculative decoding draft
+            onLongPress: model.status == ModelStatus.downloaded
+                ? () => _toggleDraftModel(model, provider)
+                : null,
           ),
         );
       },
@@ -217,6 +221,30 @@ class _ModelsPageState extends State<ModelsPage> {
     }
   }
 
+  void _toggleDraftModel(Model model, ModelProvider provider) async {
+    final scaffold = ScaffoldMessenger.of(context);
+    final chat = context.read<ChatProvider>();
+
+    if (provider.draftModel?.id == model.id) {
+      await provider.unloadDraftModel();
+      chat.setSpeculativeDecoding(false);
+      scaffold.showSnackBar(
+        SnackBar(content: Text('${model.name} no longer used as draft')),
+      );
+      return;
+    }
+
+    final success = await provider.loadDraftModel(model.id);
+    chat.setSpeculativeDecoding(success);
+    scaffold.showSnackBar(
+      SnackBar(
+        content: Text(success
+            ? '${model.name} loaded as draft model'
+            : 'failed to load ${model.name} as draft'),
+      ),
+    );
+  }
+
   void _unloadModel(ModelProvider provider) async {
     await provider.unloadModel();
     
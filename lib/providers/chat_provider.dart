@@ -5,25 +5,19 @@ import '../services/inference_engine.dart';
 import 'model_provider.dart';
 import 'package:provider/provider.dart';
 
-/// Chat template formats for different model families
-enum ChatTemplate {
-  chatml,     // Qwen, many instruct models
-  llama,      // Llama 2/3, TinyLlama  
-  alpaca,     // Alpaca-style models
-  phi,        // Microsoft Phi models
-  gemma,      // Google Gemma
-  simple,     // Fallback simple format
-}
-
 class ChatProvider extends ChangeNotifier {
-  final List<ChatMessage> _messages = [];
+  // Conversations by id; each one maps to its own native KV cache slot
+  final Map<int, List<ChatMessage>> _conversations = {0: []};
+  int _conversationId = 0;
+  int _nextConversationId = 1;
   bool _isGenerating = false;
   bool _lastGenerationComplete = false;
   StreamSubscription<String>? _tokenSubscription;
   String? _currentModelId;
-  bool _isFirstMessage = true;  // Track if this is the first message (no cache)
+  bool _speculativeDecoding = false;  // Use the loaded draft model to propose tokens
   
-  // OPTIMIZATION Max messages to keep in context (aggressive trimming)
+  // OPTIMIZATION Max messages sent when the conversation has to be
+  // re-evaluated (aggressive trimming); a warm cache only needs the new turn
   static const int _maxContextMessages = 4;  // Keep last 4 messages (2 turns)
   
   // Suggested questions for new users
@@ -35,10 +29,21 @@ class ChatProvider extends ChangeNotifier {
     "Give me a fun fact",
   ];
 
+  List<ChatMessage> get _messages => _conversations[_conversationId]!;
+
   List<ChatMessage> get messages => List.unmodifiable(_messages);
+  List<int> get conversationIds => List.unmodifiable(_conversations.keys);
+  int get currentConversationId => _conversationId;
   bool get isGenerating => _isGenerating;
   bool get hasMessages => _messages.isNotEmpty;
   bool get lastGenerationComplete => _lastGenerationComplete;
+  bool get speculativeDecoding => _speculativeDecoding;
+  
+  /// Enable speculative decoding once a draft model is loaded
+  void setSpeculativeDecoding(bool enabled) {
+    _speculativeDecoding = enabled;
+    notifyListeners();
+  }
   
   /// Set the current model for template selection
   /// When model changes, we must reset the KV cache since it's model-specific
@@ -46,11 +51,12 @@ class ChatProvider extends ChangeNotifier {
     if (_currentModelId != modelId) {
       // Model changed - KV cache is invalid for new model
       _currentModelId = modelId;
-      _isFirstMessage = true;
       
-      // Clear the KV cache since it belongs to the old model
+      // Clear the KV cache since it belongs to the old model, and rebind
+      // the active conversation to a slot in the new context
       try {
         await InferenceEngine.clearCache();
+        await InferenceEngine.selectConversation(_conversationId);
       } catch (e) {
         print('Warning: Could not clear cache: $e');
       }
@@ -67,108 +73,95 @@ class ChatProvider extends ChangeNotifier {
   /// Clear cache when starting new conversation
   Future<void> _resetConversation() async {
     await InferenceEngine.clearCache();
-    _isFirstMessage = true;
   }
   
-  /// Detect chat template based on model ID
-  ChatTemplate _detectTemplate(String? modelId) {
-    if (modelId == null) return ChatTemplate.simple;
+  /// Start a new, empty conversation in its own KV slot
+  Future<int> newConversation() async {
+    final id = _nextConversationId++;
+    _conversations[id] = [];
+    await switchConversation(id);
+    return id;
+  }
+  
+  /// Switch chats. A conversation whose slot is still resident continues
+  /// incrementally instead of re-evaluating its prompt.
+  Future<void> switchConversation(int id) async {
+    if (!_conversations.containsKey(id)) return;
     
-    final id = modelId.toLowerCase();
+    await stopGeneration();
+    _conversationId = id;
+    _lastGenerationComplete = false;
     
-    if (id.contains('qwen')) return ChatTemplate.chatml;
-    if (id.contains('llama') || id.contains('tinyllama')) return ChatTemplate.llama;
-    if (id.contains('phi')) return ChatTemplate.phi;
-    if (id.contains('gemma')) return ChatTemplate.gemma;
-    if (id.contains('alpaca')) return ChatTemplate.alpaca;
-    if (id.contains('smol')) return ChatTemplate.chatml;  // SmolLM uses ChatML
-    if (id.contains('stable')) return ChatTemplate.chatml; // StableLM uses ChatML
+    try {
+      await InferenceEngine.selectConversation(id);
+    } catch (e) {
+      print('Warning: Could not select conversation: $e');
+    }
     
-    return ChatTemplate.simple;
+    notifyListeners();
   }
-
-  /// Format prompt with chat template for instruction-tuned models
-  /// OPTIMIZATION 2: Chunk the prompt - system context separate from user input
-  /// OPTIMIZATION 3: Trim context aggressively - only include recent messages
-  String _formatPrompt(String userMessage, {bool includeHistory = false}) {
-    final template = _detectTemplate(_currentModelId);
+  
+  /// Branch the current conversation. The shared history is copied inside
+  /// the KV cache rather than decoded again.
+  Future<int> forkConversation() async {
+    await stopGeneration();
     
-    // Build context from recent messages (OPTIMIZATION 3: aggressive trimming)
-    String contextPrefix = '';
-    if (includeHistory && _messages.length > 1) {
-      // Get last N messages for context (excluding the just-added user message)
-      final recentMessages = _messages
-          .take((_messages.length - 1).clamp(0, _maxContextMessages))
-          .toList();
-      
-      for (final msg in recentMessages) {
-        if (msg.isUser) {
-          contextPrefix += _formatUserMessage(msg.content, template);
-        } else if (msg.content.isNotEmpty && 
-                   !msg.content.startsWith('error') && 
-                   !msg.content.startsWith('failed') &&
-                   !msg.content.startsWith('model generated empty')) {
-          contextPrefix += _formatAssistantMessage(msg.content, template);
-        }
-      }
+    final srcId = _conversationId;
+    final id = _nextConversationId++;
+    _conversations[id] = List.of(_messages);
+    _conversationId = id;
+    _lastGenerationComplete = false;
+    
+    try {
+      await InferenceEngine.forkConversation(srcId, id);
+      await InferenceEngine.selectConversation(id);
+    } catch (e) {
+      print('Warning: Could not fork conversation: $e');
     }
     
-    // Format just the new user message
-    return contextPrefix + _formatUserMessage(userMessage, template) + _getAssistantPrefix(template);
+    notifyListeners();
+    return id;
   }
   
-  String _formatUserMessage(String content, ChatTemplate template) {
-    switch (template) {
-      case ChatTemplate.chatml:
-        return '<|im_start|>user\n$content<|im_end|>\n';
-      case ChatTemplate.llama:
-        return '[INST] $content [/INST]';
-      case ChatTemplate.phi:
-        return 'Instruct: $content\n';
-      case ChatTemplate.gemma:
-        return '<start_of_turn>user\n$content<end_of_turn>\n';
-      case ChatTemplate.alpaca:
-        return '### Instruction:\n$content\n\n';
-      case ChatTemplate.simple:
-      default:
-        return 'Q: $content\n';
+  /// Delete a conversation and free its KV slot
+  Future<void> deleteConversation(int id) async {
+    if (!_conversations.containsKey(id)) return;
+    
+    if (id == _conversationId) {
+      final others = _conversations.keys.where((k) => k != id);
+      if (others.isEmpty) {
+        await clearChat();
+        return;
+      }
+      await switchConversation(others.last);
     }
-  }
-  
-  String _formatAssistantMessage(String content, ChatTemplate template) {
-    switch (template) {
-      case ChatTemplate.chatml:
-        return '<|im_start|>assistant\n$content<|im_end|>\n';
-      case ChatTemplate.llama:
-        return '$content</s>';
-      case ChatTemplate.phi:
-        return 'Output: $content\n';
-      case ChatTemplate.gemma:
-        return '<start_of_turn>model\n$content<end_of_turn>\n';
-      case ChatTemplate.alpaca:
-        return '### Response:\n$content\n\n';
-      case ChatTemplate.simple:
-      default:
-        return 'A: $content\n';
+    
+    _conversations.remove(id);
+    try {
+      await InferenceEngine.releaseConversation(id);
+    } catch (e) {
+      print('Warning: Could not release conversation: $e');
     }
+    notifyListeners();
   }
   
-  String _getAssistantPrefix(ChatTemplate template) {
-    switch (template) {
-      case ChatTemplate.chatml:
-        return '<|im_start|>assistant\n';
-      case ChatTemplate.llama:
-        return '';  // No prefix needed for llama
-      case ChatTemplate.phi:
-        return 'Output:';
-      case ChatTemplate.gemma:
-        return '<start_of_turn>model\n';
-      case ChatTemplate.alpaca:
-        return '### Response:\n';
-      case ChatTemplate.simple:
-      default:
-        return 'A:';
+  /// Recent messages as chat turns for the native template
+  /// OPTIMIZATION 3: Trim context aggressively - only include recent messages
+  List<Map<String, String>> _chatTurns() {
+    final turns = <Map<String, String>>[];
+    for (final msg in _messages) {
+      if (msg.isUser) {
+        turns.add({'role': 'user', 'content': msg.content});
+      } else if (msg.content.isNotEmpty &&
+                 !msg.content.startsWith('error') &&
+                 !msg.content.startsWith('failed') &&
+                 !msg.content.startsWith('model generated empty')) {
+        turns.add({'role': 'assistant', 'content': msg.content});
+      }
     }
+    
+    final start = (turns.length - _maxContextMessages).clamp(0, turns.length);
+    return turns.sublist(start);
   }
 
   Future<void> sendMessage(String content) async {
@@ -231,30 +224,15 @@ class ChatProvider extends ChangeNotifier {
     }
 
     try {
-      // OPTIMIZATION 1 & 2: Use incremental inference for subsequent messages
-      // First message: full prompt with context (clears cache)
-      // Subsequent messages: only new tokens (reuses KV cache)
-      bool success;
-      final formattedPrompt = _formatPrompt(userMessage, includeHistory: false);
-      
-      if (_isFirstMessage) {
-        // First message: format with full context, use regular inference
-        success = await InferenceEngine.startInference(formattedPrompt);
-        if (success) _isFirstMessage = false;
-      } else {
-        // OPTIMIZATION 1: Reuse KV cache - only send new user message
-        // The model's previous response is already in the cache!
-        success = await InferenceEngine.startInferenceIncremental(formattedPrompt);
-        
-        // Fallback: if incremental fails (cache issue), try regular inference
-        if (!success) {
-          // print removed
-          success = await InferenceEngine.startInference(formattedPrompt);
-          _isFirstMessage = false;  // Reset for next time
-        }
-      }
+      // OPTIMIZATION 1 & 2: The native side renders the turns with the
+      // model's template; when this conversation's KV slot is warm it only
+      // evaluates the new turn, otherwise the trimmed history
+      final session = await InferenceEngine.startChat(
+        _chatTurns(),
+        speculative: _speculativeDecoding,
+      );
       
-      if (!success) {
+      if (session == null) {
         _updateAIMessage(aiMessageId, 'failed to start inference. please load a model first.');
         _isGenerating = false;
         _lastGenerationComplete = true;
@@ -262,55 +240,25 @@ class ChatProvider extends ChangeNotifier {
         return;
       }
 
-      // OPTIMIZATION 4: Stream tokens immediately
+      // OPTIMIZATION 4: Text is pushed as it is decoded, from the shared
+      // native buffer or the EventChannel; the stream closes on the
+      // session's final event
       StringBuffer responseBuffer = StringBuffer();
-      int emptyCount = 0;
       int tokenCount = 0;
       DateTime lastUpdate = DateTime.now();
       
-      // Use single token mode for first few tokens (immediate display)
-      // Then switch to batch mode for efficiency
-      _tokenSubscription = InferenceEngine.streamTokens().listen(
+      _tokenSubscription = session.text.listen(
         (token) {
-          if (token.isNotEmpty) {
-            // Filter out special tokens that shouldn't be displayed
-            String cleanToken = token
-                .replaceAll('<|im_end|>', '')
-                .replaceAll('<|im_start|>', '')
-                .replaceAll('<|endoftext|>', '');
-            
-            if (cleanToken.isNotEmpty) {
-              responseBuffer.write(cleanToken);
-              tokenCount++;
-              
-              // Throttle UI updates to prevent buffer overflow
-              // Update every 3 tokens or every 100ms, whichever comes first
-              final now = DateTime.now();
-              if (tokenCount % 3 == 0 || now.difference(lastUpdate).inMilliseconds > 100) {
-                _updateAIMessage(aiMessageId, responseBuffer.toString());
-                lastUpdate = now;
-              }
-              emptyCount = 0;
-            }
-          } else {
-            emptyCount++;
-            // If we get many empty tokens in a row, generation may have ended
-            if (emptyCount > 5) {
-              _tokenSubscription?.cancel();
-              _tokenSubscription = null;
-              // Ensure native side stops too
-              InferenceEngine.stopGeneration();
-              if (responseBuffer.isEmpty) {
-                _updateAIMessage(aiMessageId, 'model generated empty response. try rephrasing your question.');
-              } else {
-                // Final update with all remaining content
-                _updateAIMessage(aiMessageId, responseBuffer.toString());
-              }
-              _isGenerating = false;
-              _lastGenerationComplete = true;
-              notifyListeners();
-              return; // Exit early to avoid duplicate processing
-            }
+          // Template markers are already stripped by the native detokenizer
+          responseBuffer.write(token);
+          tokenCount++;
+          
+          // Throttle UI updates to prevent buffer overflow
+          // Update every 3 tokens or every 100ms, whichever comes first
+          final now = DateTime.now();
+          if (tokenCount % 3 == 0 || now.difference(lastUpdate).inMilliseconds > 100) {
+            _updateAIMessage(aiMessageId, responseBuffer.toString());
+            lastUpdate = now;
           }
         },
         onDone: () {
@@ -332,6 +280,7 @@ class ChatProvider extends ChangeNotifier {
           _lastGenerationComplete = true;
           notifyListeners();
         },
+        cancelOnError: true,
       );
 
     } catch (e) {
@@ -2,9 +2,10 @@ import 'package:flutter/material.dart';
 import 'package:path_provider/path_provider.dart';
 import 'dart:io';
 import 'dart:async';
-import 'package:http/http.dart' as http;
+import 'dart:convert';
 import '../models/app_models.dart';
 import '../services/inference_engine.dart';
+import '../services/model_download.dart';
 
 class ModelProvider extends ChangeNotifier {
   final List<Model> _models = [
@@ -70,7 +71,11 @@ class ModelProvider extends ChangeNotifier {
   ];
 
   Model? _selectedModel;
+  Model? _draftModel;
   String? _loadedModelPath;
+  String? _loadError;
+  String? _downloadError;
+  double? _loadProgress;  // Non-null while a load runs
   int _memoryUsage = 0;
   Timer? _memoryTimer;
 
@@ -78,8 +83,18 @@ class ModelProvider extends ChangeNotifier {
   Model? get selectedModel => _selectedModel;
   bool get hasSelectedModel => _selectedModel != null;
   bool get hasLoadedModel => _loadedModelPath != null;
+  Model? get draftModel => _draftModel;
+  bool get hasDraftModel => _draftModel != null;
   int get memoryUsageMB => (_memoryUsage / 1024 / 1024).round();
 
+  /// Reason the last load failed, e.g. the model not fitting in memory
+  String? get loadError => _loadError;
+  double? get loadProgress => _loadProgress;
+
+  /// Reason the last download failed, e.g. a hash mismatch or the model
+  /// being too large for this device
+  String? get downloadError => _downloadError;
+
   ModelProvider() {
     _startMemoryMonitoring();
   }
@@ -97,13 +112,15 @@ class ModelProvider extends ChangeNotifier {
     });
   }
 
-  /// Download a model from HuggingFace
+  /// Download a model from HuggingFace. Picks up an interrupted download
+  /// where it stopped, verifies the SHA-256, and gives up early when the
+  /// GGUF header shows the model cannot load on this device.
   Future<void> downloadModel(String modelId) async {
     final modelIndex = _models.indexWhere((m) => m.id == modelId);
     if (modelIndex == -1) return;
 
     final model = _models[modelIndex];
-    if (model.status == ModelStatus.downloaded) return;
+    if (model.status == ModelStatus.downloaded || model.status == ModelStatus.downloading) return;
 
     try {
       // Update status to downloading
@@ -111,6 +128,7 @@ class ModelProvider extends ChangeNotifier {
         status: ModelStatus.downloading,
         downloadProgress: 0.0,
       );
+      _downloadError = null;
       notifyListeners();
 
       // Get app documents directory for storing models
@@ -122,39 +140,39 @@ class ModelProvider extends ChangeNotifier {
 
       final modelFile = File('${modelsDir.path}/${model.id}.gguf');
       
-      // Download the model file from HuggingFace with progress tracking
       if (model.downloadUrl == null) {
         throw Exception('Download URL not available');
       }
       
       print('starting download: ${model.downloadUrl}');
       
-      final request = http.Request('GET', Uri.parse(model.downloadUrl!));
-      final response = await request.send();
-      
-      if (response.statusCode != 200) {
-        throw Exception('Failed to download model: ${response.statusCode} ${response.reasonPhrase}');
-      }
-
-      final contentLength = response.contentLength ?? 0;
-      print('model size: ${(contentLength / 1024 / 1024).toStringAsFixed(1)} MB');
-      
-      final sink = modelFile.openWrite();
-      int downloaded = 0;
-      
-      await response.stream.listen((chunk) {
-        sink.add(chunk);
-        downloaded += chunk.length;
-        
-        final progress = contentLength > 0 ? downloaded / contentLength : 0.0;
-        _models[modelIndex] = model.copyWith(
-          status: ModelStatus.downloading,
-          downloadProgress: progress,
+      var rejected = false;
+      try {
+        await ModelDownload.run(
+          url: model.downloadUrl!,
+          path: modelFile.path,
+          sha256: model.sha256,
+          checkHeader: (partPath) async {
+            final plan = await InferenceEngine.preflightModel(partPath);
+            if (plan['ok'] == false) {
+              rejected = true;
+              return 'model does not fit: ${plan['reason']}';
+            }
+            return null;
+          },
+          onProgress: (progress) {
+            _models[modelIndex] = model.copyWith(
+              status: ModelStatus.downloading,
+              downloadProgress: progress,
+            );
+            notifyListeners();
+          },
         );
-        notifyListeners();
-      }).asFuture();
-      
-      await sink.close();
+      } catch (e) {
+        // Nothing to resume for a model this device cannot load
+        if (rejected) ModelDownload.discard(modelFile.path);
+        rethrow;
+      }
       print('model downloaded: ${modelFile.path}');
       
       // Update status to downloaded
@@ -166,8 +184,9 @@ class ModelProvider extends ChangeNotifier {
 
     } catch (e) {
       print('download failed: $e');
+      _downloadError = e.toString().replaceFirst('Exception: ', '');
       
-      // Update status to error
+      // Update status to error; a retry resumes from the finished chunks
       _models[modelIndex] = model.copyWith(
         status: ModelStatus.error,
         downloadProgress: 0.0,
@@ -194,8 +213,26 @@ class ModelProvider extends ChangeNotifier {
       }
       
       print('loading model: ${model.localPath}');
+      _loadError = null;
+      _loadProgress = 0.0;
+      notifyListeners();
       
-      final success = await InferenceEngine.loadModel(model.localPath!);
+      // First load on a GPU build: pick the layer split once per model
+      final gpu = await InferenceEngine.getGpuInfo(modelPath: model.localPath!);
+      if (gpu['compiled'] == true && (gpu['devices'] as List?)?.isNotEmpty == true && gpu['tuned'] != true) {
+        final tune = await InferenceEngine.tuneGpuLayers(model.localPath!);
+        print('gpu tune ${model.id}: ${jsonEncode(tune)}');
+      }
+      
+      // The weights keep being read ahead after this returns
+      var state = 'failed';
+      await for (final progress in InferenceEngine.loadModelWithProgress(model.localPath!)) {
+        state = progress['state'] as String? ?? 'failed';
+        _loadProgress = (progress['progress'] as num?)?.toDouble() ?? 0.0;
+        notifyListeners();
+      }
+      _loadProgress = null;
+      final success = state == 'ready';
       
       if (success) {
         _selectedModel = model;
@@ -204,7 +241,9 @@ class ModelProvider extends ChangeNotifier {
         notifyListeners();
         return true;
       } else {
-        print('native engine failed to load: $modelId');
+        final reason = await InferenceEngine.getLoadError();
+        _loadError = reason.isNotEmpty ? reason : null;
+        print('native engine failed to load: $modelId ${reason.isNotEmpty ? '($reason)' : ''}');
         _selectedModel = null;
         _loadedModelPath = null;
         notifyListeners();
@@ -213,6 +252,7 @@ class ModelProvider extends ChangeNotifier {
       
     } catch (e) {
       print('exception loading model: $e');
+      _loadProgress = null;
       _selectedModel = null;
       _loadedModelPath = null;
       notifyListeners();
@@ -220,6 +260,63 @@ class ModelProvider extends ChangeNotifier {
     }
   }
 
+  /// Abort a load started by [loadModel]; it then returns false
+  Future<void> cancelLoad() async {
+    await InferenceEngine.cancelModelLoad();
+  }
+
+  /// Load a small downloaded model as the speculative decoding draft
+  /// (e.g. SmolLM 135M for a larger model from the same tokenizer family)
+  Future<bool> loadDraftModel(String modelId) async {
+    final model = _models.firstWhere((m) => m.id == modelId);
+
+    if (model.status != ModelStatus.downloaded || model.localPath == null) {
+      print('draft model not downloaded: $modelId');
+      return false;
+    }
+
+    try {
+      final success = await InferenceEngine.loadDraftModel(model.localPath!);
+      _draftModel = success ? model : null;
+      notifyListeners();
+      return success;
+    } catch (e) {
+      print('exception loading draft model: $e');
+      _draftModel = null;
+      notifyListeners();
+      return false;
+    }
+  }
+
+  /// Unload the speculative decoding draft model
+  Future<void> unloadDraftModel() async {
+    await InferenceEngine.unloadDraftModel();
+    _draftModel = null;
+    notifyListeners();
+  }
+
+  /// Benchmark a downloaded model before shipping it. Loads it if needed and
+  /// returns the native JSON results, tagged with the model id.
+  Future<Map<String, dynamic>> benchmarkModel(String modelId, {
+    List<int> threadCounts = const [],
+    List<int> ubatchSizes = const [],
+    int repetitions = 0,
+  }) async {
+    final model = _models.firstWhere((m) => m.id == modelId);
+    if (_loadedModelPath != model.localPath && !await loadModel(modelId)) {
+      return {'error': 'failed to load $modelId'};
+    }
+    
+    final results = await InferenceEngine.runBenchmark(
+      threadCounts: threadCounts,
+      ubatchSizes: ubatchSizes,
+      repetitions: repetitions,
+    );
+    results['model_id'] = modelId;
+    print('benchmark $modelId: ${jsonEncode(results)}');
+    return results;
+  }
+
   /// Unload the current model
   Future<void> unloadModel() async {
     await InferenceEngine.stopGeneration();
@@ -240,6 +337,9 @@ class ModelProvider extends ChangeNotifier {
     if (_selectedModel?.id == modelId) {
       await unloadModel();
     }
+    if (_draftModel?.id == modelId) {
+      await unloadDraftModel();
+    }
 
     // Delete the file
     if (model.localPath != null) {
@@ -248,6 +348,8 @@ class ModelProvider extends ChangeNotifier {
         await file.delete();
       }
     }
+    final appDir = await getApplicationDocumentsDirectory();
+    ModelDownload.discard('${appDir.path}/models/${model.id}.gguf');
 
     // Update status
     _models[modelIndex] = model.copyWith(
@@ -0,0 +1,95 @@
+import 'dart:async';
+import 'dart:convert';
+import 'dart:developer';
+
+/// Event types sent by the native generation thread (SessionEventKind in
+/// platform_channel.h)
+class SessionEventType {
+  static const int token = 0;
+  static const int done = 1;
+  static const int error = 2;
+}
+
+/// Raised on [GenerationSession.text] when native generation fails
+class GenerationException implements Exception {
+  GenerationException(this.message, this.stats);
+
+  final String message;
+  final Map<String, dynamic> stats;
+
+  @override
+  String toString() => message;
+}
+
+/// One generation on the native engine, started by
+/// [InferenceEngine.startChat], [InferenceEngine.startCompletion] or
+/// [InferenceEngine.startBackground].
+///
+/// Text is pushed as it is decoded. The native side ends every session
+/// with one final event: [text] then closes, or fails with a
+/// [GenerationException], and [result] completes with the final stats
+/// either way (the getStats fields, plus `finish_reason`: eos, length,
+/// stopped or error).
+class GenerationSession {
+  GenerationSession._(this.handle, this._controller, this._result, this._cancel);
+
+  final int handle;
+  final StreamController<String> _controller;
+  final Completer<Map<String, dynamic>> _result;
+  final Future<void> Function(int handle) _cancel;
+
+  Stream<String> get text => _controller.stream;
+  Future<Map<String, dynamic>> get result => _result.future;
+
+  /// Stops generation; [text] closes once the final event is in
+  Future<void> cancel() => _cancel(handle);
+}
+
+/// Assembles a [GenerationSession] from the native events as they arrive
+class GenerationSessionBuilder {
+  GenerationSessionBuilder(this._cancel);
+
+  final Future<void> Function(int handle) _cancel;
+  final _controller = StreamController<String>();
+  final _result = Completer<Map<String, dynamic>>();
+
+  bool get isFinished => _result.isCompleted;
+
+  void addText(String text) {
+    if (text.isEmpty || _result.isCompleted) return;
+    // Lines up with the native cortex:* sections in a Perfetto capture
+    // (profile builds; a no-op in release)
+    Timeline.instantSync('cortex:text');
+    _controller.add(text);
+  }
+
+  /// Final event: [type] is done or error, [data] the stats JSON
+  void finish(int type, String data) {
+    if (_result.isCompleted) return;
+
+    Map<String, dynamic> stats = {};
+    if (data.isNotEmpty) {
+      try {
+        stats = Map<String, dynamic>.from(const JsonDecoder().convert(data) as Map);
+      } catch (e) {
+        print('failed to parse session stats: $e');
+      }
+    }
+    _result.complete(stats);
+
+    if (type != SessionEventType.done) {
+      _controller.addError(
+        GenerationException(stats['error']?.toString() ?? 'generation failed', stats),
+      );
+    }
+    _controller.close();
+  }
+
+  GenerationSession build(int handle) {
+    // Dropping the subscription stops the native side too
+    _controller.onCancel = () {
+      if (!_result.isCompleted) _cancel(handle);
+    };
+    return GenerationSession._(handle, _controller, _result, _cancel);
+  }
+}
@@ -2,9 +2,19 @@ import 'package:flutter/services.dart';
 import 'dart:async';
 import 'dart:convert';
 
+import 'generation_session.dart';
+import 'native_stream.dart';
+
+export 'generation_session.dart';
+
 class InferenceEngine {
   static const MethodChannel _channel = MethodChannel('inference_engine');
 
+  // Session events from the native generation thread; one platform
+  // subscription, shared by every session on the channel
+  static final Stream<dynamic> _sessionEvents =
+      const EventChannel('inference_engine/tokens').receiveBroadcastStream();
+
   static Future<bool> loadModel(String modelPath) async {
     final result = await _channel.invokeMethod('loadModel', {
       'modelPath': modelPath,
@@ -13,38 +23,274 @@ class InferenceEngine {
     return result == true;
   }
 
+  /// Sizes a model from its GGUF header without loading it: weights, KV
+  /// bytes per token, the context and batch that would be used, or `ok:
+  /// false` with the reason it does not fit.
+  static Future<Map<String, dynamic>> preflightModel(String modelPath) async {
+    final result = await _channel.invokeMethod('preflightModel', {
+      'modelPath': modelPath,
+    });
+    if (result is String && result.isNotEmpty) {
+      try {
+        return Map<String, dynamic>.from(
+          const JsonDecoder().convert(result) as Map,
+        );
+      } catch (e) {
+        print('failed to parse preflight: $e');
+      }
+    }
+    return {};
+  }
+
+  /// Why the last [loadModel] returned false, empty otherwise
+  static Future<String> getLoadError() async {
+    final result = await _channel.invokeMethod('getLoadError');
+    return result is String ? result : '';
+  }
+
+  /// Starts loading in the background; false if a load is already running.
+  /// Poll [getLoadProgress], or use [loadModelWithProgress].
+  static Future<bool> startModelLoad(String modelPath) async {
+    final result = await _channel.invokeMethod('startModelLoad', {
+      'modelPath': modelPath,
+    });
+    return result == true;
+  }
+
+  /// Aborts a background load, or the weight prefetch after it
+  static Future<void> cancelModelLoad() async {
+    await _channel.invokeMethod('cancelModelLoad');
+  }
+
+  /// Background load state: `state` (idle, loading, ready, failed,
+  /// cancelled), `progress` and `prefetched` in [0, 1], `prefetching`,
+  /// `elapsed_ms` and `error`.
+  static Future<Map<String, dynamic>> getLoadProgress() async {
+    final result = await _channel.invokeMethod('getLoadProgress');
+    if (result is String && result.isNotEmpty) {
+      try {
+        return Map<String, dynamic>.from(
+          const JsonDecoder().convert(result) as Map,
+        );
+      } catch (e) {
+        print('failed to parse load progress: $e');
+      }
+    }
+    return {};
+  }
+
+  /// Loads in the background and emits [getLoadProgress] until the load
+  /// finishes; the last event's `state` is the outcome.
+  static Stream<Map<String, dynamic>> loadModelWithProgress(
+    String modelPath, {
+    Duration interval = const Duration(milliseconds: 100),
+  }) async* {
+    if (!await startModelLoad(modelPath)) {
+      yield {'state': 'failed', 'error': 'a load is already running'};
+      return;
+    }
+    while (true) {
+      final progress = await getLoadProgress();
+      yield progress;
+      if (progress['state'] != 'loading') break;
+      await Future.delayed(interval);
+    }
+  }
+
   static Future<void> unloadModel() async {
     await _channel.invokeMethod('unloadModel');
     print('model unloaded');
   }
 
-  static Future<bool> startInference(String prompt) async {
-    final result = await _channel.invokeMethod('startInference', {
-      'prompt': prompt,
+  static Future<bool> loadDraftModel(String modelPath) async {
+    final result = await _channel.invokeMethod('loadDraftModel', {
+      'modelPath': modelPath,
     });
-    print('starting inference: ${prompt.length} chars');
+    print('draft model loaded: $modelPath');
     return result == true;
   }
 
-  static Future<bool> startInferenceIncremental(String prompt) async {
-    final result = await _channel.invokeMethod('startInferenceIncremental', {
+  static Future<void> unloadDraftModel() async {
+    await _channel.invokeMethod('unloadDraftModel');
+  }
+
+  static Future<bool> hasDraftModel() async {
+    final result = await _channel.invokeMethod('hasDraftModel');
+    return result == true;
+  }
+
+  /// Backend state: the `cpu_variant` of ggml's CPU kernels picked for
+  /// this core and its `cpu_features`; for GPU offload `compiled`,
+  /// `backend`, `devices`, and for [modelPath] whether it is `tuned` and
+  /// its `gpu_layers` and `ubatch`
+  static Future<Map<String, dynamic>> getGpuInfo({String modelPath = ''}) async {
+    final result = await _channel.invokeMethod('getGpuInfo', {
+      'modelPath': modelPath,
+    });
+    if (result is String && result.isNotEmpty) {
+      try {
+        return Map<String, dynamic>.from(
+          const JsonDecoder().convert(result) as Map,
+        );
+      } catch (e) {
+        print('failed to parse gpu info: $e');
+      }
+    }
+    return {};
+  }
+
+  /// Measures prefill and decode speed for a few GPU layer splits and
+  /// caches the best one for later loads. Unloads the current model and
+  /// takes one model load per split.
+  static Future<Map<String, dynamic>> tuneGpuLayers(String modelPath) async {
+    final result = await _channel.invokeMethod('tuneGpuLayers', {
+      'modelPath': modelPath,
+    });
+    if (result is String && result.isNotEmpty) {
+      try {
+        return Map<String, dynamic>.from(
+          const JsonDecoder().convert(result) as Map,
+        );
+      } catch (e) {
+        print('failed to parse gpu tune: $e');
+      }
+    }
+    return {};
+  }
+
+  /// Start a reply to [messages] (maps with 'role' and 'content'). The
+  /// native engine renders them with the model's chat template and only
+  /// evaluates the new turn when the conversation is already cached. Ends
+  /// the running session first; null when no model is loaded.
+  ///
+  /// [grammar] (GBNF with a `root` rule) or [jsonSchema] restrict the
+  /// output to text they accept; the schema wins when both are given.
+  /// Null as well when the grammar does not compile.
+  static Future<GenerationSession?> startChat(
+    List<Map<String, String>> messages, {
+    bool speculative = false,
+    String? grammar,
+    Map<String, dynamic>? jsonSchema,
+  }) {
+    print('chat session: ${messages.length} messages');
+    return _startSession('startChat', {
+      'messages': messages,
+      'speculative': speculative,
+      ..._constraint(grammar, jsonSchema),
+    });
+  }
+
+  /// Generate from a raw [prompt]; [incremental] continues the cached
+  /// sequence instead of starting over
+  static Future<GenerationSession?> startCompletion(
+    String prompt, {
+    bool incremental = false,
+    bool speculative = false,
+    String? grammar,
+    Map<String, dynamic>? jsonSchema,
+  }) {
+    print('completion session: ${prompt.length} chars');
+    return _startSession('startCompletion', {
       'prompt': prompt,
+      'incremental': incremental,
+      'speculative': speculative,
+      ..._constraint(grammar, jsonSchema),
     });
-    print('incremental inference: ${prompt.length} chars');
-    return result == true;
   }
 
-  static Future<bool> startInferenceTurbo(String prompt) async {
-    final result = await _channel.invokeMethod('startInferenceTurbo', {
+  /// Short side work (titles, summaries, suggestions) from [messages] or a
+  /// raw [prompt]. Runs next to the chat instead of ending it: its tokens
+  /// are decoded in the same native batches. Null when the background
+  /// sequences are all busy or no model is loaded.
+  static Future<GenerationSession?> startBackground({
+    List<Map<String, String>> messages = const [],
+    String prompt = '',
+    int maxTokens = 128,
+    String? grammar,
+    Map<String, dynamic>? jsonSchema,
+  }) {
+    return _startSession('startBackground', {
+      'messages': messages,
       'prompt': prompt,
+      'maxTokens': maxTokens,
+      ..._constraint(grammar, jsonSchema),
+    }, background: true);
+  }
+
+  // Compiled natively and cached by their text, so the same schema keeps
+  // encoding to the same string
+  static Map<String, String> _constraint(String? grammar, Map<String, dynamic>? jsonSchema) {
+    return {
+      if (grammar != null && grammar.isNotEmpty) 'grammar': grammar,
+      if (jsonSchema != null) 'jsonSchema': jsonEncode(jsonSchema),
+    };
+  }
+
+  static Future<GenerationSession?> _startSession(
+    String method,
+    Map<String, dynamic> arguments, {
+    bool background = false,
+  }) async {
+    final builder = GenerationSessionBuilder(cancelSession);
+
+    // Text comes through the shared native ring when it is available,
+    // otherwise as EventChannel events; the final event either way. The
+    // ring carries one session, so background sessions always use events.
+    final useRing = !background && NativeTokenStream.open(
+      onText: builder.addText,
+      onEnd: (type, data) {
+        if (type >= 0) builder.finish(type, data);
+      },
+    );
+
+    // Events can beat the handle back; keep them until it is known
+    int? handle;
+    final early = <Map>[];
+    StreamSubscription<dynamic>? subscription;
+
+    void dispatch(Map event) {
+      if (event['session'] != handle) return;
+      final type = event['type'] as int? ?? SessionEventType.error;
+      final data = event['data']?.toString() ?? '';
+      if (type == SessionEventType.token) {
+        builder.addText(data);
+      } else {
+        subscription?.cancel();
+        builder.finish(type, data);
+      }
+    }
+
+    if (!useRing) {
+      subscription = _sessionEvents.listen((event) {
+        if (event is! Map) return;
+        if (handle == null) {
+          early.add(event);
+        } else {
+          dispatch(event);
+        }
+      });
+    }
+
+    final result = await _channel.invokeMethod(method, {
+      ...arguments,
+      'stream': useRing,
     });
-    print('optimized inference: ${prompt.length} chars');
-    return result == true;
+    handle = (result as num?)?.toInt() ?? -1;
+
+    if (handle < 0) {
+      await subscription?.cancel();
+      if (useRing) NativeTokenStream.close();
+      return null;
+    }
+    early.forEach(dispatch);
+    return builder.build(handle);
   }
 
-  static Future<String> getBufferedTokens() async {
-    final result = await _channel.invokeMethod('getBufferedTokens');
-    return result?.toString() ?? '';
+  /// End a session; returns once its final event was sent. 0 ends
+  /// whichever session is running. Background sessions are only asked to
+  /// stop; their final event follows.
+  static Future<void> cancelSession(int handle) async {
+    await _channel.invokeMethod('cancelSession', {'session': handle});
   }
 
   static Future<void> clearCache() async {
@@ -56,33 +302,37 @@ class InferenceEngine {
     return result ?? 0;
   }
 
-  static Future<String> getNextToken() async {
-    final result = await _channel.invokeMethod('getNextToken');
-    return result?.toString() ?? '';
+  /// Make a conversation's KV slot active; returns its cached token count
+  /// (0 when it has to be prompted from scratch, -1 on error)
+  static Future<int> selectConversation(int conversationId) async {
+    final result = await _channel.invokeMethod('selectConversation', {
+      'conversationId': conversationId,
+    });
+    return result ?? -1;
   }
 
-  static Future<List<String>> getNextTokens({int count = 4}) async {
-    final result = await _channel.invokeMethod('getNextTokens', {
-      'count': count,
+  /// Continue [dstId] from [srcId]'s cached tokens without re-decoding them
+  static Future<bool> forkConversation(int srcId, int dstId) async {
+    final result = await _channel.invokeMethod('forkConversation', {
+      'srcId': srcId,
+      'dstId': dstId,
     });
-    if (result is List) {
-      return result.map((e) => e?.toString() ?? '').toList();
-    }
-    return [];
+    return result == true;
   }
 
-  static Future<String> getNextTokensBatch({int count = 8}) async {
-    final result = await _channel.invokeMethod('getNextTokensBatch', {
-      'count': count,
+  static Future<void> releaseConversation(int conversationId) async {
+    await _channel.invokeMethod('releaseConversation', {
+      'conversationId': conversationId,
     });
-    return result?.toString() ?? '';
   }
 
+  /// Whether a session is queued or running
   static Future<bool> isGenerating() async {
     final result = await _channel.invokeMethod('isGenerating');
     return result == true;
   }
 
+  /// Ends the running session, see [cancelSession]
   static Future<void> stopGeneration() async {
     await _channel.invokeMethod('stopGeneration');
   }
@@ -92,6 +342,10 @@ class InferenceEngine {
     return result?.toInt() ?? 0;
   }
 
+  /// Totals of the last generation, plus `latency`: native per-stage
+  /// histograms since [resetStats] (queue, prefill, decode, sample,
+  /// detokenize, deliver, jni, first_token, token_gap), each with count,
+  /// p50_ms, p90_ms, p99_ms, mean_ms and max_ms.
   static Future<Map<String, dynamic>> getStats() async {
     final result = await _channel.invokeMethod('getStats');
     if (result is String && result.isNotEmpty) {
@@ -120,59 +374,42 @@ class InferenceEngine {
     return {};
   }
 
-  static Future<void> resetStats() async {
-    await _channel.invokeMethod('resetStats');
-  }
-
-  static Stream<String> streamTokens() async* {
-    try {
-      bool isActive = await isGenerating();
-      int tokenCount = 0;
-      
-      while (isActive) {
-        if (tokenCount < 3) {
-          final token = await getNextToken();
-          if (token.isNotEmpty) {
-            yield token;
-            tokenCount++;
-          }
-        } else {
-          final tokens = await getNextTokens(count: 4);
-          if (tokens.isNotEmpty) {
-            for (final token in tokens) {
-              if (token.isNotEmpty) {
-                yield token;
-                tokenCount++;
-              }
-            }
-          }
-        }
-        isActive = await isGenerating();
+  /// Benchmark the loaded model: prefill and time-to-first-token per prompt
+  /// length, decode speed per cache depth, for every thread count x ubatch
+  /// size. Each measurement reports median/p90/min/max over [repetitions];
+  /// thermal and CPU clock state are captured before and after. Empty lists
+  /// use the native defaults.
+  static Future<Map<String, dynamic>> runBenchmark({
+    List<int> promptLengths = const [],
+    List<int> decodeDepths = const [],
+    int decodeTokens = 0,
+    List<int> threadCounts = const [],
+    List<int> ubatchSizes = const [],
+    int warmup = 1,
+    int repetitions = 0,
+  }) async {
+    final result = await _channel.invokeMethod('runBenchmark', {
+      'promptLengths': promptLengths,
+      'decodeDepths': decodeDepths,
+      'decodeTokens': decodeTokens,
+      'threadCounts': threadCounts,
+      'ubatchSizes': ubatchSizes,
+      'warmup': warmup,
+      'repetitions': repetitions,
+    });
+    if (result is String && result.isNotEmpty) {
+      try {
+        return Map<String, dynamic>.from(
+          const JsonDecoder().convert(result) as Map,
+        );
+      } catch (e) {
+        print('failed to parse benchmark: $e');
       }
-    } catch (e) {
-      print('stream error: $e');
     }
+    return {};
   }
 
-  static Stream<String> streamTokensThreaded() async* {
-    try {
-      bool isActive = await isGenerating();
-      
-      while (isActive) {
-        await Future.delayed(const Duration(milliseconds: 25));
-        final tokens = await getBufferedTokens();
-        if (tokens.isNotEmpty) {
-          yield tokens;
-        }
-        isActive = await isGenerating();
-      }
-      
-      final remaining = await getBufferedTokens();
-      if (remaining.isNotEmpty) {
-        yield remaining;
-      }
-    } catch (e) {
-      print('stream error: $e');
-    }
+  static Future<void> resetStats() async {
+    await _channel.invokeMethod('resetStats');
   }
 }
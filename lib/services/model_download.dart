@@ -0,0 +1,298 @@
+import 'dart:async';
+import 'dart:ffi';
+import 'dart:io';
+import 'dart:typed_data';
+
+import 'package:ffi/ffi.dart';
+import 'package:http/http.dart' as http;
+
+typedef _OpenNative = Pointer<Void> Function(Pointer<Utf8>, Int64, Int64, Pointer<Utf8>);
+typedef _OpenDart = Pointer<Void> Function(Pointer<Utf8>, int, int, Pointer<Utf8>);
+typedef _WriteNative = Bool Function(Pointer<Void>, Int64, Pointer<Uint8>, Int64);
+typedef _WriteDart = bool Function(Pointer<Void>, int, Pointer<Uint8>, int);
+
+/// Size and identity of a remote file, from a HEAD and a one-byte range probe
+class _RemoteFile {
+  final int size;
+  final bool ranges;        // Server honours Range requests
+  final String etag;
+  final String? sha256;     // Hugging Face's LFS hash, when the server gives one
+
+  _RemoteFile(this.size, this.ranges, this.etag, this.sha256);
+}
+
+/// Model downloads through the native download pipeline
+/// (android/app/src/main/cpp/model_download.h) via dart:ffi.
+///
+/// The file is fetched as [chunkBytes] ranges over [connections] parallel
+/// requests and written straight into a preallocated `<path>.part`. Native
+/// keeps track of finished chunks, so calling [run] again after a failure
+/// or an app restart fetches only what is missing, and hashes the file
+/// while it arrives. Once the GGUF header is in, [run] asks `checkHeader`
+/// whether the model can load at all before fetching the weights.
+class ModelDownload {
+  static const int chunkBytes = 8 * 1024 * 1024;
+  static const int connections = 4;
+  static const int _attempts = 3;   // Per chunk, before the download fails
+
+  static DynamicLibrary? _lib;
+  static late final _OpenDart _open;
+  static late final void Function(Pointer<Void>) _close;
+  static late final void Function(Pointer<Utf8>) _discard;
+  static late final Pointer<Utf8> Function(Pointer<Void>) _error;
+  static late final Pointer<Utf8> Function(Pointer<Void>) _partPath;
+  static late final int Function(Pointer<Void>) _nextChunk;
+  static late final int Function(Pointer<Void>, int) _chunkOffset;
+  static late final int Function(Pointer<Void>, int) _chunkSize;
+  static late final _WriteDart _write;
+  static late final void Function(Pointer<Void>, int) _completeChunk;
+  static late final void Function(Pointer<Void>, int) _releaseChunk;
+  static late final int Function(Pointer<Void>) _doneBytes;
+  static late final int Function(Pointer<Void>) _hashedBytes;
+  static late final int Function(Pointer<Void>) _headerBytes;
+  static late final bool Function(Pointer<Void>, Pointer<Utf8>) _commit;
+  static late final Pointer<Utf8> Function(Pointer<Void>) _digest;
+
+  /// Whether the native library exposes the download pipeline
+  static bool get isAvailable => _load();
+
+  static bool _load() {
+    if (_lib != null) return true;
+    if (!Platform.isAndroid && !Platform.isIOS) return false;
+
+    try {
+      // iOS links the engine statically into the app binary
+      final lib = Platform.isIOS
+          ? DynamicLibrary.process()
+          : DynamicLibrary.open('libllama_jni.so');
+      _open = lib.lookupFunction<_OpenNative, _OpenDart>('cortex_download_open');
+      _close = lib.lookupFunction<Void Function(Pointer<Void>), void Function(Pointer<Void>)>(
+          'cortex_download_close');
+      _discard = lib.lookupFunction<Void Function(Pointer<Utf8>), void Function(Pointer<Utf8>)>(
+          'cortex_download_discard');
+      _error = lib.lookupFunction<Pointer<Utf8> Function(Pointer<Void>), Pointer<Utf8> Function(Pointer<Void>)>(
+          'cortex_download_error');
+      _partPath = lib.lookupFunction<Pointer<Utf8> Function(Pointer<Void>), Pointer<Utf8> Function(Pointer<Void>)>(
+          'cortex_download_part_path');
+      _nextChunk = lib.lookupFunction<Int32 Function(Pointer<Void>), int Function(Pointer<Void>)>(
+          'cortex_download_next_chunk');
+      _chunkOffset = lib.lookupFunction<Int64 Function(Pointer<Void>, Int32), int Function(Pointer<Void>, int)>(
+          'cortex_download_chunk_offset', isLeaf: true);
+      _chunkSize = lib.lookupFunction<Int64 Function(Pointer<Void>, Int32), int Function(Pointer<Void>, int)>(
+          'cortex_download_chunk_size', isLeaf: true);
+      // Leaf, so the response bytes can be passed in place
+      _write = lib.lookupFunction<_WriteNative, _WriteDart>('cortex_download_write', isLeaf: true);
+      _completeChunk = lib.lookupFunction<Void Function(Pointer<Void>, Int32), void Function(Pointer<Void>, int)>(
+          'cortex_download_complete_chunk');
+      _releaseChunk = lib.lookupFunction<Void Function(Pointer<Void>, Int32), void Function(Pointer<Void>, int)>(
+          'cortex_download_release_chunk');
+      _doneBytes = lib.lookupFunction<Int64 Function(Pointer<Void>), int Function(Pointer<Void>)>(
+          'cortex_download_done_bytes');
+      _hashedBytes = lib.lookupFunction<Int64 Function(Pointer<Void>), int Function(Pointer<Void>)>(
+          'cortex_download_hashed_bytes');
+      _headerBytes = lib.lookupFunction<Int64 Function(Pointer<Void>), int Function(Pointer<Void>)>(
+          'cortex_download_header_bytes');
+      _commit = lib.lookupFunction<Bool Function(Pointer<Void>, Pointer<Utf8>), bool Function(Pointer<Void>, Pointer<Utf8>)>(
+          'cortex_download_commit');
+      _digest = lib.lookupFunction<Pointer<Utf8> Function(Pointer<Void>), Pointer<Utf8> Function(Pointer<Void>)>(
+          'cortex_download_digest');
+      _lib = lib;
+      return true;
+    } catch (e) {
+      print('native download unavailable: $e');
+      return false;
+    }
+  }
+
+  /// Download [url] to [path], resuming an earlier attempt when the remote
+  /// file is unchanged. [sha256] pins the expected hash; without it the
+  /// server's LFS hash is used when it has one. [checkHeader] gets the
+  /// part file once its GGUF header is in and returns why the model cannot
+  /// be used, or null to go on. [onProgress] gets the fraction fetched.
+  /// Throws with the reason when the download fails or is turned down.
+  static Future<void> run({
+    required String url,
+    required String path,
+    String? sha256,
+    Future<String?> Function(String partPath)? checkHeader,
+    void Function(double progress)? onProgress,
+  }) async {
+    if (!_load()) {
+      throw Exception('native download unavailable');
+    }
+
+    final client = http.Client();
+    Pointer<Void> download = nullptr;
+    try {
+      final uri = Uri.parse(url);
+      final remote = await _probe(client, uri);
+      final expected = sha256 ?? remote.sha256 ?? '';
+      print('download ${remote.size} bytes, ranges ${remote.ranges}, sha256 ${expected.isEmpty ? 'unknown' : expected}');
+
+      // Without range support there is one chunk and one request
+      final chunk = remote.ranges ? chunkBytes : remote.size;
+      download = _withStrings(path, '$url ${remote.etag}', (p, source) => _open(p, remote.size, chunk, source));
+      _throwOnError(download);
+
+      var failure = '';
+      var headerChecked = false;
+      var streaming = 0;    // Bytes of chunks still being fetched
+      void report() {
+        onProgress?.call((_doneBytes(download) + streaming) / remote.size);
+      }
+
+      // Runs next to the fetches: rejects the model as soon as the
+      // header says it cannot load, and catches native write errors
+      Future<void> watch(Future<void> fetches) async {
+        var fetching = true;
+        unawaited(fetches.whenComplete(() => fetching = false));
+        while (fetching && failure.isEmpty) {
+          await Future.delayed(const Duration(milliseconds: 200));
+          report();
+          final error = _error(download).toDartString();
+          if (error.isNotEmpty) {
+            failure = error;
+          } else if (!headerChecked && _headerBytes(download) > 0) {
+            headerChecked = true;
+            final reason = await checkHeader?.call(_partPath(download).toDartString());
+            if (reason != null && failure.isEmpty) failure = reason;
+          }
+        }
+      }
+
+      Future<void> worker() async {
+        while (failure.isEmpty) {
+          final index = _nextChunk(download);
+          if (index < 0) return;
+          for (var attempt = 1;; attempt++) {
+            var received = 0;
+            try {
+              await _fetchChunk(client, uri, download, index, remote.ranges, () => failure.isNotEmpty, (n) {
+                received += n;
+                streaming += n;
+              });
+              streaming -= received;
+              _completeChunk(download, index);
+              break;
+            } catch (e) {
+              streaming -= received;
+              if (failure.isNotEmpty || attempt >= _attempts) {
+                _releaseChunk(download, index);
+                if (failure.isEmpty) failure = 'chunk $index failed: $e';
+                return;
+              }
+              print('chunk $index attempt $attempt failed: $e');
+              await Future.delayed(Duration(seconds: attempt));
+            }
+          }
+        }
+      }
+
+      final fetches = Future.wait(List.generate(remote.ranges ? connections : 1, (_) => worker()));
+      await Future.wait([fetches, watch(fetches)]);
+      if (failure.isEmpty) failure = _error(download).toDartString();
+      if (failure.isNotEmpty) {
+        throw Exception(failure);
+      }
+      report();
+
+      // The hash trails the writes by a chunk or so
+      while (_hashedBytes(download) < remote.size) {
+        final error = _error(download).toDartString();
+        if (error.isNotEmpty) throw Exception(error);
+        await Future.delayed(const Duration(milliseconds: 50));
+      }
+      if (!headerChecked) {
+        final reason = await checkHeader?.call(_partPath(download).toDartString());
+        if (reason != null) throw Exception(reason);
+      }
+
+      final ok = _withStrings(expected, '', (hash, _) => _commit(download, hash));
+      if (!ok) {
+        throw Exception(_error(download).toDartString());
+      }
+      print('download verified: sha256 ${_digest(download).toDartString()}');
+    } finally {
+      if (download != nullptr) _close(download);
+      client.close();
+    }
+  }
+
+  /// Delete the part file and bookkeeping of an unfinished download
+  static void discard(String path) {
+    if (!_load()) return;
+    _withStrings(path, '', (p, _) => _discard(p));
+  }
+
+  static Future<_RemoteFile> _probe(http.Client client, Uri uri) async {
+    // Hugging Face answers the resolve URL itself with the LFS size and
+    // hash, then redirects to the CDN; don't follow so they are visible
+    final head = http.Request('HEAD', uri)..followRedirects = false;
+    final headResponse = await client.send(head);
+    await headResponse.stream.drain<void>();
+    final linked = headResponse.headers['x-linked-etag']?.replaceAll('"', '');
+    final sha256 = linked != null && RegExp(r'^[0-9a-fA-F]{64}$').hasMatch(linked) ? linked : null;
+
+    final probe = http.Request('GET', uri)..headers['Range'] = 'bytes=0-0';
+    final response = await client.send(probe);
+    await response.stream.drain<void>();
+    final etag = linked ?? response.headers['etag'] ?? '';
+
+    if (response.statusCode == 206) {
+      final total = response.headers['content-range']?.split('/').last;
+      final size = int.tryParse(total ?? '');
+      if (size != null && size > 0) return _RemoteFile(size, true, etag, sha256);
+    }
+    if (response.statusCode == 200 && (response.contentLength ?? 0) > 0) {
+      return _RemoteFile(response.contentLength!, false, etag, sha256);
+    }
+    throw Exception('failed to download model: ${response.statusCode} ${response.reasonPhrase}');
+  }
+
+  static Future<void> _fetchChunk(http.Client client, Uri uri, Pointer<Void> download, int index,
+      bool ranges, bool Function() cancelled, void Function(int bytes) onBytes) async {
+    final start = _chunkOffset(download, index);
+    final size = _chunkSize(download, index);
+    final request = http.Request('GET', uri);
+    if (ranges) request.headers['Range'] = 'bytes=$start-${start + size - 1}';
+
+    final response = await client.send(request);
+    if (response.statusCode != (ranges ? 206 : 200)) {
+      await response.stream.drain<void>();
+      throw Exception('${response.statusCode} ${response.reasonPhrase}');
+    }
+
+    var offset = start;
+    await for (final data in response.stream) {
+      if (cancelled()) throw Exception('cancelled');
+      final bytes = data is Uint8List ? data : Uint8List.fromList(data);
+      if (offset + bytes.length > start + size) {
+        throw Exception('server sent more than the requested range');
+      }
+      if (!_write(download, offset, bytes.address, bytes.length)) {
+        throw Exception(_error(download).toDartString());
+      }
+      offset += bytes.length;
+      onBytes(bytes.length);
+    }
+    if (offset != start + size) {
+      throw Exception('connection closed after ${offset - start} of $size bytes');
+    }
+  }
+
+  static void _throwOnError(Pointer<Void> download) {
+    final error = _error(download).toDartString();
+    if (error.isNotEmpty) throw Exception(error);
+  }
+
+  static T _withStrings<T>(String a, String b, T Function(Pointer<Utf8>, Pointer<Utf8>) body) {
+    final first = a.toNativeUtf8();
+    final second = b.toNativeUtf8();
+    try {
+      return body(first, second);
+    } finally {
+      malloc.free(first);
+      malloc.free(second);
+    }
+  }
+}
@@ -0,0 +1,136 @@
+import 'dart:convert';
+import 'dart:ffi';
+import 'dart:io';
+import 'dart:typed_data';
+
+import 'package:ffi/ffi.dart';
+
+typedef _NotifyNative = Void Function(Int64);
+typedef _OpenNative = Bool Function(Uint32, Pointer<NativeFunction<_NotifyNative>>);
+typedef _OpenDart = bool Function(int, Pointer<NativeFunction<_NotifyNative>>);
+
+/// Session text read straight out of the native ring buffer via dart:ffi.
+///
+/// Replaces the EventChannel for a session's text: native writes UTF-8
+/// bytes into shared memory and posts one wakeup per burst, Dart decodes
+/// them in place. No JNI strings or main-thread hops. The final event
+/// arrives with the last wakeup.
+class NativeTokenStream {
+  static const int _capacity = 64 * 1024;
+
+  static DynamicLibrary? _lib;
+  static late final _OpenDart _open;
+  static late final void Function() _close;
+  static late final void Function() _release;
+  static late final Pointer<Uint8> Function() _data;
+  static late final int Function() _writePos;
+  static late final void Function(int) _setReadPos;
+  static late final int Function() _arm;
+  static late final int Function() _resultType;
+  static late final Pointer<Utf8> Function() _result;
+
+  /// Whether the native library exposes the FFI stream
+  static bool get isAvailable => _load();
+
+  static bool _load() {
+    if (_lib != null) return true;
+    if (!Platform.isAndroid && !Platform.isIOS) return false;
+
+    try {
+      // iOS links the engine statically into the app binary
+      final lib = Platform.isIOS
+          ? DynamicLibrary.process()
+          : DynamicLibrary.open('libllama_jni.so');
+      _open = lib.lookupFunction<_OpenNative, _OpenDart>('cortex_stream_open');
+      _close = lib.lookupFunction<Void Function(), void Function()>('cortex_stream_close');
+      _release = lib.lookupFunction<Void Function(), void Function()>('cortex_stream_release');
+      _data = lib.lookupFunction<Pointer<Uint8> Function(), Pointer<Uint8> Function()>(
+          'cortex_stream_data', isLeaf: true);
+      _writePos = lib.lookupFunction<Int64 Function(), int Function()>(
+          'cortex_stream_write_pos', isLeaf: true);
+      _setReadPos = lib.lookupFunction<Void Function(Int64), void Function(int)>(
+          'cortex_stream_set_read_pos', isLeaf: true);
+      _arm = lib.lookupFunction<Int64 Function(), int Function()>(
+          'cortex_stream_arm', isLeaf: true);
+      _resultType = lib.lookupFunction<Int32 Function(), int Function()>(
+          'cortex_stream_result_type', isLeaf: true);
+      _result = lib.lookupFunction<Pointer<Utf8> Function(), Pointer<Utf8> Function()>(
+          'cortex_stream_result', isLeaf: true);
+      _lib = lib;
+      return true;
+    } catch (e) {
+      print('native stream unavailable: $e');
+      return false;
+    }
+  }
+
+  /// Open the ring for the session about to be started with `stream:
+  /// true`. [onText] gets decoded text; [onEnd] gets the final event type
+  /// and stats JSON once the session has ended (-1 if none ran; an error
+  /// when this side read too slowly and text was dropped). False if the
+  /// ring is unavailable or the previous session has not ended yet.
+  static bool open({
+    required void Function(String text) onText,
+    required void Function(int type, String data) onEnd,
+  }) {
+    if (!_load()) return false;
+
+    final pending = StringBuffer();
+    // Chunked decoding keeps multi-byte characters split across writes intact
+    final decoder = const Utf8Decoder(allowMalformed: true)
+        .startChunkedConversion(StringConversionSink.fromStringSink(pending));
+
+    late final NativeCallable<_NotifyNative> callable;
+    late final Uint8List ring;
+    int readPos = 0;
+
+    void drain(int writePos) {
+      while (readPos < writePos) {
+        final offset = readPos % _capacity;
+        final end = (offset + (writePos - readPos)).clamp(0, _capacity);
+        decoder.addSlice(ring, offset, end, false);
+        readPos += end - offset;
+      }
+      _setReadPos(readPos);
+
+      if (pending.isNotEmpty) onText(pending.toString());
+      pending.clear();
+    }
+
+    callable = NativeCallable<_NotifyNative>.listener((int writePos) {
+      if (writePos < 0) {
+        // Session ended: read the tail and the result, then hand the ring
+        // back so the next open can reuse it
+        drain(_writePos());
+        decoder.close();
+        if (pending.isNotEmpty) onText(pending.toString());
+        final type = _resultType();
+        final data = _result().toDartString();
+        _release();
+        callable.close();
+        onEnd(type, data);
+        return;
+      }
+
+      drain(writePos);
+      // Re-arm, then catch anything written while we were decoding
+      int latest = _arm();
+      while (latest > readPos) {
+        drain(latest);
+        latest = _arm();
+      }
+    });
+
+    if (!_open(_capacity, callable.nativeFunction)) {
+      callable.close();
+      return false;
+    }
+    ring = _data().asTypedList(_capacity);
+    return true;
+  }
+
+  /// Stop reading; the final event still arrives through onEnd
+  static void close() {
+    if (_load()) _close();
+  }
+}